@@ -0,0 +1,50 @@
+// CPU cost of the attitude filter: process CPU time with the acquisition
+// running alone, then with the filter fed every sample, at 1kHz on the
+// simulated bus.
+//
+//     node bench/attitude.js [seconds]
+var RPiGY86 = require('../index.js').RPiGY86;
+
+var seconds = parseFloat(process.argv[2]) || 5;
+var gy86 = new RPiGY86({ bus: 'sim' });
+
+function measure(name, start, stop, next) {
+    start();
+    // let the acquisition settle first
+    setTimeout(function () {
+        var cpu = process.cpuUsage();
+        var wall = process.hrtime();
+        setTimeout(function () {
+            cpu = process.cpuUsage(cpu);
+            wall = process.hrtime(wall);
+            var percent = (cpu.user + cpu.system) / 1e4 / (wall[0] + wall[1] / 1e9);
+            console.log(name + ': ' + percent.toFixed(2) + '% of one core');
+            stop();
+            next(percent);
+        }, seconds * 1000);
+    }, 500);
+}
+
+var stream;
+measure('acquisition only        ', function () {
+    stream = gy86.stream({ rate: 1000, sensors: ['accel', 'gyro', 'mag'], batch: 100 });
+    stream.on('data', function () {});
+}, function () {
+    stream.destroy();
+}, function (base) {
+    ['madgwick', 'mahony'].forEach(function (filter, i) {
+        setTimeout(function () {
+            measure('acquisition + ' + filter + (filter === 'mahony' ? '  ' : ''), function () {
+                stream = gy86.stream({ rate: 1000, sensors: ['accel', 'gyro', 'mag'], batch: 100 });
+                stream.on('data', function () {});
+                gy86.startAttitude({ filter: filter, rate: 1000 });
+            }, function () {
+                gy86.stopAttitude();
+                stream.destroy();
+            }, function (percent) {
+                console.log('    filter: ' + (percent - base).toFixed(2) + '% of one core, attitude ' +
+                        JSON.stringify(gy86.getAttitude()));
+            });
+        }, i * (seconds * 1000 + 1000));
+    });
+});
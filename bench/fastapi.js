@@ -0,0 +1,36 @@
+// Compares the fast API entry points of the hot getters with the same reads
+// forced through the regular callbacks. Runs against the simulated bus so
+// the binding overhead is not hidden behind I2C transfers.
+//
+//     node bench/fastapi.js [iterations]
+var RPiGY86 = require('../index.js').RPiGY86;
+
+var iterations = parseInt(process.argv[2], 10) || 200000;
+var gy86 = new RPiGY86({ bus: 'sim' });
+
+function run(name, fn) {
+    // let the call site get optimized before timing it
+    for (var i = 0; i < 10000; i++) {
+        fn();
+    }
+    var start = process.hrtime();
+    for (var i = 0; i < iterations; i++) {
+        fn();
+    }
+    var elapsed = process.hrtime(start);
+    var ns = (elapsed[0] * 1e9 + elapsed[1]) / iterations;
+    console.log(name + ': ' + ns.toFixed(0) + ' ns/call');
+}
+
+var frame = new Float32Array(9);
+var int16 = new Int16Array(9);
+
+// an offset argument or an Int16Array always takes the regular callback
+run('getMotion6(Float32Array)    fast', function () { gy86.getMotion6(frame); });
+run('getMotion6(Float32Array, 0) slow', function () { gy86.getMotion6(frame, 0); });
+run('getMotion6(Int16Array)      slow', function () { gy86.getMotion6(int16); });
+run('getMotion9(Float32Array)    fast', function () { gy86.getMotion9(frame); });
+run('getMotion9(Float32Array, 0) slow', function () { gy86.getMotion9(frame, 0); });
+run('readLatest(Float32Array)    fast', function () { gy86.readLatest(frame); });
+run('readLatest(Float32Array, 0) slow', function () { gy86.readLatest(frame, 0); });
+run('getHeading()                fast', function () { gy86.getHeading(); });
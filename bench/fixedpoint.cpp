@@ -0,0 +1,276 @@
+// Float against Q8.24 fixed point attitude updates, and float against
+// Q16.16 unit conversion: cost per update and how far the results drift
+// apart. Both instantiations of the AHRSCore.h templates run on the same
+// synthetic minute of 1kHz motion (the board swaying in roll, pitch and yaw
+// with sensor noise), so the numbers compare arithmetic only, no bus.
+//
+//     build/Release/fixedpoint [seconds]
+//
+// Cycles come from the perf cycle counter when the kernel allows it
+// (perf_event_paranoid), otherwise only CPU time is printed.
+
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "AHRSCore.h"
+#include "Acquisition.h"
+#include "Units.h"
+
+#define RATE 1000
+#define DEG_TO_RAD ((float)M_PI / 180.0f)
+#define RAD_TO_DEG (180.0f / (float)M_PI)
+
+typedef Fixed<24> q24_t;
+
+struct Input {
+    float gyro[3];  // rad/s
+    float accel[3]; // g
+    float mag[3];   // uT
+    float truth[3]; // roll, pitch, yaw in rad
+};
+
+static int sCycles = -1;
+
+static void openCycles() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    sCycles = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t readCycles() {
+    uint64_t value = 0;
+    if (sCycles < 0 || read(sCycles, &value, sizeof(value)) != sizeof(value)) {
+        return 0;
+    }
+    return value;
+}
+
+static uint64_t cpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static float noise(float sigma) {
+    // sum of uniforms, close enough to gaussian here
+    float sum = 0;
+    for (int i = 0; i < 4; i++) {
+        sum += rand() / (float)RAND_MAX - 0.5f;
+    }
+    return sum * sigma * 1.732f;
+}
+
+/** Earth vector e seen in the sensor frame, R^T e with R = Rz Ry Rx.
+ */
+static void toSensor(const float* euler, const float* e, float* out) {
+    float cr = cosf(euler[0]), sr = sinf(euler[0]);
+    float cp = cosf(euler[1]), sp = sinf(euler[1]);
+    float cy = cosf(euler[2]), sy = sinf(euler[2]);
+    float r[9] = { cy * cp, cy * sp * sr - sy * cr, cy * sp * cr + sy * sr,
+                   sy * cp, sy * sp * sr + cy * cr, sy * sp * cr - cy * sr,
+                   -sp, cp * sr, cp * cr };
+    for (int i = 0; i < 3; i++) {
+        out[i] = r[i] * e[0] + r[3 + i] * e[1] + r[6 + i] * e[2];
+    }
+}
+
+/** Sway in all three angles; body rates from the Euler angle rates.
+ */
+static void makeInput(std::vector<Input>* inputs, uint32_t count) {
+    const float gravity[3] = { 0, 0, 1 };
+    // 48uT at 60 degrees inclination
+    const float field[3] = { 24.0f, 0, -41.6f };
+    float dt = 1.0f / RATE;
+    inputs->resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        Input& in = (*inputs)[i];
+        float t = i * dt;
+        float euler[3] = { 30 * DEG_TO_RAD * sinf(0.7f * t), 15 * DEG_TO_RAD * sinf(0.45f * t + 1),
+                           90 * DEG_TO_RAD * sinf(0.1f * t) };
+        float rates[3] = { 30 * DEG_TO_RAD * 0.7f * cosf(0.7f * t),
+                           15 * DEG_TO_RAD * 0.45f * cosf(0.45f * t + 1),
+                           90 * DEG_TO_RAD * 0.1f * cosf(0.1f * t) };
+        float cr = cosf(euler[0]), sr = sinf(euler[0]);
+        float cp = cosf(euler[1]), sp = sinf(euler[1]);
+        in.gyro[0] = rates[0] - sp * rates[2] + noise(0.002f);
+        in.gyro[1] = cr * rates[1] + sr * cp * rates[2] + noise(0.002f);
+        in.gyro[2] = -sr * rates[1] + cr * cp * rates[2] + noise(0.002f);
+        toSensor(euler, gravity, in.accel);
+        toSensor(euler, field, in.mag);
+        for (int k = 0; k < 3; k++) {
+            in.accel[k] += noise(0.005f);
+            in.mag[k] += noise(0.3f);
+            in.truth[k] = euler[k];
+        }
+    }
+}
+
+/** Angle between two attitudes, degrees; from the relative rotation
+ * conj(a) * b in double, which stays exact for tiny angles where acos of
+ * the dot product does not, and ignores the norms.
+ */
+static float angleBetween(const float* a, const float* b) {
+    double w = (double)a[0] * b[0] + (double)a[1] * b[1] + (double)a[2] * b[2] + (double)a[3] * b[3];
+    double x = (double)a[0] * b[1] - (double)a[1] * b[0] - (double)a[2] * b[3] + (double)a[3] * b[2];
+    double y = (double)a[0] * b[2] + (double)a[1] * b[3] - (double)a[2] * b[0] - (double)a[3] * b[1];
+    double z = (double)a[0] * b[3] - (double)a[1] * b[2] + (double)a[2] * b[1] - (double)a[3] * b[0];
+    return 2 * atan2(sqrt(x * x + y * y + z * z), fabs(w)) * RAD_TO_DEG;
+}
+
+static void truthQuaternion(const float* euler, float* q) {
+    float cr = cosf(euler[0] * 0.5f), sr = sinf(euler[0] * 0.5f);
+    float cp = cosf(euler[1] * 0.5f), sp = sinf(euler[1] * 0.5f);
+    float cy = cosf(euler[2] * 0.5f), sy = sinf(euler[2] * 0.5f);
+    q[0] = cy * cp * cr + sy * sp * sr;
+    q[1] = cy * cp * sr - sy * sp * cr;
+    q[2] = cy * sp * cr + sy * cp * sr;
+    q[3] = sy * cp * cr - cy * sp * sr;
+}
+
+/** One pass of a filter over all inputs, the way AHRS::update() feeds it:
+ * float inputs converted to T on every update.
+ * @param trace Receives the attitude after every update
+ */
+template<typename T>
+static void run(bool mahony, const std::vector<Input>& inputs, float* trace,
+        uint64_t* ns, uint64_t* cycles) {
+    T q[4] = { T(1), T(0), T(0), T(0) };
+    T integral[3] = { T(0), T(0), T(0) };
+    T dt = T(1.0f / RATE);
+    T beta = T(0.1f), kp = T(0.5f), ki = T(0.0f);
+    uint64_t ns0 = cpuNs(), cycles0 = readCycles();
+    for (size_t i = 0; i < inputs.size(); i++) {
+        const Input& in = inputs[i];
+        T gyro[3] = { T(in.gyro[0]), T(in.gyro[1]), T(in.gyro[2]) };
+        T accel[3], mag[3];
+        toDirection(in.accel, accel);
+        toDirection(in.mag, mag);
+        if (mahony) {
+            mahonyUpdate<T>(q, integral, gyro[0], gyro[1], gyro[2], accel, mag, kp, ki, dt);
+        } else {
+            madgwickUpdate<T>(q, gyro[0], gyro[1], gyro[2], accel, mag, beta, dt);
+        }
+        for (int k = 0; k < 4; k++) {
+            trace[i * 4 + k] = toFloat(q[k]);
+        }
+    }
+    *cycles = readCycles() - cycles0;
+    *ns = cpuNs() - ns0;
+}
+
+static void report(const char* name, uint64_t ns, uint64_t cycles, size_t count) {
+    printf("  %-8s %7.1f ns", name, (double)ns / count);
+    if (cycles) {
+        printf(" %7.1f cycles", (double)cycles / count);
+    }
+    printf(" per update\n");
+}
+
+static void compareFilter(bool mahony, const std::vector<Input>& inputs) {
+    size_t count = inputs.size();
+    std::vector<float> floatTrace(count * 4), fixedTrace(count * 4);
+    uint64_t floatNs, floatCycles, fixedNs, fixedCycles;
+    // warm up caches and the branch predictor once
+    run<float>(mahony, inputs, &floatTrace[0], &floatNs, &floatCycles);
+    run<float>(mahony, inputs, &floatTrace[0], &floatNs, &floatCycles);
+    run<q24_t>(mahony, inputs, &fixedTrace[0], &fixedNs, &fixedCycles);
+
+    printf("%s\n", mahony ? "mahony" : "madgwick");
+    report("float", floatNs, floatCycles, count);
+    report("Q8.24", fixedNs, fixedCycles, count);
+    if (floatCycles && fixedCycles) {
+        printf("  saved    %7.1f cycles per update (%.0f%%)\n",
+                ((double)floatCycles - fixedCycles) / count,
+                100.0 * ((double)floatCycles - fixedCycles) / floatCycles);
+    } else {
+        printf("  saved    %7.1f ns per update (%.0f%%)\n", ((double)floatNs - fixedNs) / count,
+                100.0 * ((double)floatNs - fixedNs) / floatNs);
+    }
+
+    // skip the first two seconds of settling from level and north
+    double sumApart = 0, sumFloat = 0, sumFixed = 0;
+    float maxApart = 0;
+    size_t n = 0;
+    for (size_t i = 2 * RATE; i < count; i++, n++) {
+        float truth[4];
+        truthQuaternion(inputs[i].truth, truth);
+        float apart = angleBetween(&floatTrace[i * 4], &fixedTrace[i * 4]);
+        float floatError = angleBetween(&floatTrace[i * 4], truth);
+        float fixedError = angleBetween(&fixedTrace[i * 4], truth);
+        maxApart = apart > maxApart ? apart : maxApart;
+        sumApart += apart * apart;
+        sumFloat += floatError * floatError;
+        sumFixed += fixedError * fixedError;
+    }
+    printf("  float vs Q8.24: rms %.4f max %.4f deg; error to truth rms float %.3f, Q8.24 %.3f deg\n",
+            sqrt(sumApart / n), maxApart, sqrt(sumFloat / n), sqrt(sumFixed / n));
+}
+
+/** Gyro and accel batches through UnitScales, float against Q16.16.
+ */
+static void compareUnits(uint32_t count) {
+    std::vector<Sample> samples(count);
+    for (uint32_t i = 0; i < count; i++) {
+        for (int k = 0; k < 3; k++) {
+            samples[i].accel[k] = (int16_t)(rand() % 65536 - 32768);
+            samples[i].gyro[k] = (int16_t)(rand() % 65536 - 32768);
+        }
+    }
+    std::vector<float> floats(count * 3);
+    std::vector<q16_t> fixeds(count * 3);
+    printf("unit conversion, accel and gyro\n");
+    for (uint8_t range = 0; range < 4; range++) {
+        UnitScales units;
+        units.setAccelRange(range);
+        units.setGyroRange(range);
+
+        uint64_t ns0 = cpuNs(), cycles0 = readCycles();
+        units.accel(&samples[0], count, &floats[0]);
+        units.gyro(&samples[0], count, &floats[0]);
+        uint64_t floatCycles = readCycles() - cycles0, floatNs = cpuNs() - ns0;
+        ns0 = cpuNs();
+        cycles0 = readCycles();
+        units.accel(&samples[0], count, &fixeds[0]);
+        units.gyro(&samples[0], count, &fixeds[0]);
+        uint64_t fixedCycles = readCycles() - cycles0, fixedNs = cpuNs() - ns0;
+
+        // gyro is what is left in both buffers
+        float worst = 0;
+        for (uint32_t i = 0; i < count * 3; i++) {
+            float error = fabsf(fixeds[i].toFloat() - floats[i]) / (fabsf(floats[i]) + 1e-3f);
+            worst = error > worst ? error : worst;
+        }
+        printf("  range %d: float %.2f, Q16.16 %.2f %s per sample; gyro relative error max %.5f\n",
+                range, (double)(floatCycles ? floatCycles : floatNs) / count,
+                (double)(fixedCycles ? fixedCycles : fixedNs) / count, floatCycles ? "cycles" : "ns",
+                worst);
+    }
+}
+
+int main(int argc, char** argv) {
+    float seconds = argc > 1 ? atof(argv[1]) : 60;
+    std::vector<Input> inputs;
+    srand(1);
+    makeInput(&inputs, (uint32_t)(seconds * RATE));
+    openCycles();
+    if (sCycles < 0) {
+        printf("no cycle counter (perf_event_paranoid?), CPU time only\n");
+    }
+    compareFilter(false, inputs);
+    compareFilter(true, inputs);
+    compareUnits(100000);
+    return 0;
+}
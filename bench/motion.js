@@ -0,0 +1,33 @@
+// Compares the allocating getMotion6()/getMotion9() calls with the typed
+// array overloads that write into a caller supplied buffer.
+//
+//     node --expose-gc bench/motion.js [iterations]
+var RPiGY86 = require('../index.js').RPiGY86;
+
+var iterations = parseInt(process.argv[2], 10) || 10000;
+var gy86 = new RPiGY86();
+
+function run(name, fn) {
+    if (global.gc) {
+        global.gc();
+    }
+    var heapBefore = process.memoryUsage().heapUsed;
+    var start = process.hrtime();
+    for (var i = 0; i < iterations; i++) {
+        fn();
+    }
+    var elapsed = process.hrtime(start);
+    var heapAfter = process.memoryUsage().heapUsed;
+    var us = (elapsed[0] * 1e6 + elapsed[1] / 1e3) / iterations;
+    console.log(name + ': ' + us.toFixed(2) + ' us/call, heap +' +
+                ((heapAfter - heapBefore) / 1024).toFixed(0) + ' KiB');
+}
+
+var int16 = new Int16Array(9);
+var float32 = new Float32Array(9);
+
+run('getMotion6()             ', function () { gy86.getMotion6(); });
+run('getMotion6(Int16Array)   ', function () { gy86.getMotion6(int16); });
+run('getMotion9()             ', function () { gy86.getMotion9(); });
+run('getMotion9(Int16Array)   ', function () { gy86.getMotion9(int16); });
+run('getMotion9(Float32Array) ', function () { gy86.getMotion9(float32); });
@@ -0,0 +1,43 @@
+// Fusion throughput on recorded data: replays a log made with
+// .startRecording() as fast as possible through the attitude filter or the
+// EKF and reports samples per second and the final estimate.
+//
+//     node bench/replay.js log [madgwick|mahony|ekf]
+var RPiGY86 = require('../index.js').RPiGY86;
+
+var path = process.argv[2];
+var filter = process.argv[3] || 'madgwick';
+if (!path) {
+    console.log('usage: node bench/replay.js log [madgwick|mahony|ekf]');
+    process.exit(1);
+}
+
+var gy86 = new RPiGY86({ replay: path, speed: 0 });
+var cpu = process.cpuUsage();
+var wall = process.hrtime();
+if (filter === 'ekf') {
+    gy86.startEKF({ rate: 1000 });
+} else {
+    gy86.startAttitude({ filter: filter, rate: 1000 });
+}
+
+var timer = setInterval(function () {
+    var replay = gy86.getReplay();
+    if (!replay.finished) {
+        return;
+    }
+    clearInterval(timer);
+    cpu = process.cpuUsage(cpu);
+    wall = process.hrtime(wall);
+    var seconds = wall[0] + wall[1] / 1e9;
+    console.log(replay.records + ' samples in ' + seconds.toFixed(3) + ' s: ' +
+            (replay.records / seconds).toFixed(0) + ' samples/s, ' +
+            ((cpu.user + cpu.system) / 1e4 / seconds).toFixed(1) + '% of one core');
+    if (filter === 'ekf') {
+        console.log('EKF: ' + Array.prototype.slice.call(gy86.getEKF(), 0, 10).join(', '));
+        gy86.stopEKF();
+    } else {
+        console.log('attitude: ' + JSON.stringify(gy86.getAttitude()));
+        gy86.stopAttitude();
+    }
+}, 10);
@@ -1,6 +1,16 @@
 {
+  'variables': {
+    # node-gyp rebuild -- -Dfixed_point=1: Q8.24 attitude filter for boards
+    # without a fast FPU (Pi Zero, Pi 1)
+    'fixed_point%': 0
+  },
   'conditions': [
     ['OS=="linux"', {
+      'target_defaults': {
+        'conditions': [
+          ['fixed_point==1', { 'defines': ['GY86_FIXED_POINT'] }]
+        ]
+      },
       'targets': [
 
         {
@@ -17,11 +27,78 @@
           'type': 'static_library',
           'sources': [
             './src/I2Cdev/I2Cdev.cpp',
+            './src/I2Cdev/I2CTransport.cpp',
+            './src/SimTransport/SimTransport.cpp',
             './src/MPU6050/MPU6050.cpp',
             './src/HMC5883L/HMC5883L.cpp',
             './src/MS5611/MS5611.cpp',
+            './src/MagCalibration/MagCalibration.cpp',
+            './src/Heading/Heading.cpp',
+            './src/MagneticModel/MagneticModel.cpp',
+            './src/Acquisition/Acquisition.cpp',
+            './src/MPU6050Calibration/MPU6050Calibration.cpp',
+            './src/Units/Units.cpp',
+            './src/AHRS/AHRS.cpp',
+            './src/EKF/EKF.cpp',
+            './src/SampleLog/SampleLog.cpp',
+            './src/PackedLog/PackedLog.cpp',
+            './src/FlightRecorder/FlightRecorder.cpp',
+            './src/ReplayTransport/ReplayTransport.cpp',
+            './src/TriggeredCapture/TriggeredCapture.cpp',
+            './src/Decimator/Decimator.cpp',
+            './src/BiquadBank/BiquadBank.cpp',
+            './src/Spectrum/Spectrum.cpp',
           ],
           'include_dirs': ['./include'],
+          # let gcc vectorize the batch loops; none of the math relies on errno
+          # or floating point traps
+          'cflags': ['-O2', '-Wall', '-ftree-vectorize', '-fno-math-errno', '-fno-trapping-math']
+        },
+
+        {
+          # float against fixed point filter and unit conversion cost,
+          # build/Release/fixedpoint
+          'target_name': 'fixedpoint',
+          'type': 'executable',
+          'sources': ['./bench/fixedpoint.cpp'],
+          'dependencies': ['rpi_libgy86'],
+          'include_dirs': ['./include'],
+          'cflags': ['-O2', '-Wall']
+        },
+
+        {
+          # flight recorder ring to CSV or a replayable log,
+          # build/Release/blackbox
+          'target_name': 'blackbox',
+          'type': 'executable',
+          'sources': ['./tools/blackbox.cpp'],
+          'dependencies': ['rpi_libgy86'],
+          'include_dirs': ['./include'],
+          'cflags': ['-O2', '-Wall']
+        },
+
+        {
+          # behavior tests, npm test or build/Release/gy86test
+          'target_name': 'gy86test',
+          'type': 'executable',
+          'sources': [
+            './test/main.cpp',
+            './test/replay.cpp',
+            './test/magcalibration.cpp',
+            './test/heading.cpp',
+            './test/magneticmodel.cpp',
+            './test/calibration.cpp',
+            './test/units.cpp',
+            './test/fixedpoint.cpp',
+            './test/packedlog.cpp',
+            './test/flightrecorder.cpp',
+            './test/capture.cpp',
+            './test/decimator.cpp',
+            './test/biquadbank.cpp',
+            './test/spectrum.cpp'
+          ],
+          'dependencies': ['rpi_libgy86'],
+          'include_dirs': ['./include'],
           'cflags': ['-O2', '-Wall']
         },
 
@@ -0,0 +1,62 @@
+// Attitude and heading reference
+//
+// Fuses gyro, accelerometer and, when available, magnetometer samples into
+// an orientation quaternion with either Madgwick's gradient descent filter
+// or Mahony's nonlinear complementary filter (where the magnetometer only
+// corrects yaw). Both run once per IMU sample, in single precision only,
+// with a bit-trick inverse square root for every normalization, so a 1kHz
+// update stays cheap on the Pi's VFP. Built with GY86_FIXED_POINT the same
+// updates run in Q8.24 fixed point instead (see AHRSCore.h); the interface
+// stays float either way.
+//
+// The quaternion rotates the sensor frame into the earth frame, where Z
+// points up along gravity and X towards magnetic north. Accelerometer and
+// magnetometer axes are assumed to be aligned, as they are on the GY-86.
+
+#ifndef _AHRS_H_
+#define _AHRS_H_
+
+#include <stdint.h>
+
+#include "AHRSCore.h"
+
+#define AHRS_DEFAULT_BETA   0.1f
+#define AHRS_DEFAULT_KP     0.5f
+#define AHRS_DEFAULT_KI     0.0f
+
+enum AHRSFilter {
+    AHRS_MADGWICK,
+    AHRS_MAHONY
+};
+
+class AHRS {
+    public:
+        AHRS();
+
+        void setFilter(AHRSFilter filter);
+        AHRSFilter getFilter() const;
+        void setBeta(float beta);
+        float getBeta() const;
+        void setGains(float kp, float ki);
+        float getKp() const;
+        float getKi() const;
+        void reset();
+
+        void update(const float* gyro, const float* accel, const float* mag, float dt);
+        void getQuaternion(float* q) const;
+        void getEuler(float* euler) const;
+
+        static void eulerFromQuaternion(const float* q, float* euler);
+        static float invSqrt(float x);
+
+    private:
+        ahrs_scalar_t mQ[4];        // w, x, y, z
+        ahrs_scalar_t mIntegral[3]; // Mahony integral feedback, rad/s
+        AHRSFilter mFilter;
+        float mBeta;
+        float mKp;
+        float mKi;
+        float mSettle;      // seconds of high gain left after reset()
+};
+
+#endif /* _AHRS_H_ */
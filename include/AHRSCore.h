@@ -0,0 +1,243 @@
+// Attitude filter arithmetic
+//
+// The Madgwick and Mahony updates behind AHRS, written once as templates
+// over the scalar type. AHRS instantiates them with ahrs_scalar_t: float,
+// or Fixed<24> (Q8.24) when built with GY86_FIXED_POINT for boards without
+// a fast FPU. Q8.24 rather than Q1.15 because one gyro LSB integrated over
+// a 1kHz step is below 2^-15, and the gradient terms need a few integer
+// bits. bench/fixedpoint.cpp runs both instantiations on the same input.
+
+#ifndef _AHRS_CORE_H_
+#define _AHRS_CORE_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Fixed.h"
+#include "Heading.h"
+
+#ifdef GY86_FIXED_POINT
+typedef Fixed<24> ahrs_scalar_t;
+#else
+typedef float ahrs_scalar_t;
+#endif
+
+/** 1 / sqrt(x) for x > 0, relative error below 7e-4.
+ * The magic constant and the single Newton step are tuned together (Jan
+ * Kadlec's variant of the well known trick); it needs neither VSQRT nor
+ * VDIV, which are slow and not pipelined on the Pi's cores.
+ */
+inline float invSqrt(float x) {
+    uint32_t i;
+    float y;
+    memcpy(&i, &x, sizeof(i));
+    i = 0x5F1F1412 - (i >> 1);
+    memcpy(&y, &i, sizeof(y));
+    return y * (1.69000231f - 0.714158168f * x * y * y);
+}
+
+/** Scale a vector to unit length.
+ * @return false for the zero vector, which is left alone
+ */
+inline bool normalize(float* v, int n) {
+    float sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += v[i] * v[i];
+    }
+    if (sum <= 0) {
+        return false;
+    }
+    float norm = invSqrt(sum);
+    for (int i = 0; i < n; i++) {
+        v[i] *= norm;
+    }
+    return true;
+}
+
+inline float toFloat(float value) {
+    return value;
+}
+
+template<int F>
+inline float toFloat(Fixed<F> value) {
+    return value.toFloat();
+}
+
+/** Convert a vector whose length does not matter, only its direction:
+ * floats pass through, fixed point gets the vector scaled by a power of two
+ * so its largest component lies in [0.5, 1), whatever the input unit.
+ */
+inline void toDirection(const float* in, float* out) {
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2];
+}
+
+template<int F>
+void toDirection(const float* in, Fixed<F>* out) {
+    float largest = fmaxf(fabsf(in[0]), fmaxf(fabsf(in[1]), fabsf(in[2])));
+    if (largest == 0) {
+        out[0] = out[1] = out[2] = Fixed<F>();
+        return;
+    }
+    // largest = mantissa * 2^exponent with the mantissa in [0.5, 1); scale
+    // by 2^-exponent, built straight from the exponent bits
+    uint32_t bits;
+    memcpy(&bits, &largest, sizeof(bits));
+    int exponent = (int)((bits >> 23) & 0xFF) - 126;
+    bits = (uint32_t)(127 - exponent) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    for (int i = 0; i < 3; i++) {
+        out[i] = Fixed<F>(in[i] * scale);
+    }
+}
+
+/** Madgwick: gyro integration followed by one normalized gradient descent
+ * step on the difference between measured and predicted gravity (and
+ * field).
+ * @param q w, x, y, z, updated in place
+ * @param accel NULL to integrate the gyro only
+ * @param mag NULL for an accel and gyro only update
+ */
+template<typename T>
+void madgwickUpdate(T* q, T gx, T gy, T gz, const T* accel, const T* mag, T beta, T dt) {
+    const T half = T(0.5f);
+    T q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+
+    // rate of change from the gyro, q * (0, g) / 2
+    T qDot0 = half * (-q1 * gx - q2 * gy - q3 * gz);
+    T qDot1 = half * (q0 * gx + q2 * gz - q3 * gy);
+    T qDot2 = half * (q0 * gy - q1 * gz + q3 * gx);
+    T qDot3 = half * (q0 * gz + q1 * gy - q2 * gx);
+
+    if (accel) {
+        T norm = invSqrt(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+        T ax = accel[0] * norm, ay = accel[1] * norm, az = accel[2] * norm;
+
+        // gravity predicted in the sensor frame minus the measurement
+        T fx = 2 * (q1 * q3 - q0 * q2) - ax;
+        T fy = 2 * (q0 * q1 + q2 * q3) - ay;
+        T fz = T(1) - 2 * (q1 * q1 + q2 * q2) - az;
+        // gradient, J(q)^T f
+        T s0 = -2 * q2 * fx + 2 * q1 * fy;
+        T s1 = 2 * q3 * fx + 2 * q0 * fy - 4 * q1 * fz;
+        T s2 = -2 * q0 * fx + 2 * q3 * fy - 4 * q2 * fz;
+        T s3 = 2 * q1 * fx + 2 * q2 * fy;
+
+        if (mag) {
+            norm = invSqrt(mag[0] * mag[0] + mag[1] * mag[1] + mag[2] * mag[2]);
+            T mx = mag[0] * norm, my = mag[1] * norm, mz = mag[2] * norm;
+
+            // field in the earth frame, its horizontal part turned onto X
+            T hx = (T(1) - 2 * (q2 * q2 + q3 * q3)) * mx + 2 * (q1 * q2 - q0 * q3) * my
+                    + 2 * (q1 * q3 + q0 * q2) * mz;
+            T hy = 2 * (q1 * q2 + q0 * q3) * mx + (T(1) - 2 * (q1 * q1 + q3 * q3)) * my
+                    + 2 * (q2 * q3 - q0 * q1) * mz;
+            T bz = 2 * (q1 * q3 - q0 * q2) * mx + 2 * (q2 * q3 + q0 * q1) * my
+                    + (T(1) - 2 * (q1 * q1 + q2 * q2)) * mz;
+            T h2 = hx * hx + hy * hy;
+            T bx = h2 > T(0) ? h2 * invSqrt(h2) : T(0);
+
+            T bx2 = 2 * bx, bz2 = 2 * bz, bx4 = 4 * bx, bz4 = 4 * bz;
+            T gx_ = bx * (T(1) - 2 * (q2 * q2 + q3 * q3)) + bz2 * (q1 * q3 - q0 * q2) - mx;
+            T gy_ = bx2 * (q1 * q2 - q0 * q3) + bz2 * (q0 * q1 + q2 * q3) - my;
+            T gz_ = bx2 * (q0 * q2 + q1 * q3) + bz * (T(1) - 2 * (q1 * q1 + q2 * q2)) - mz;
+            s0 += -bz2 * q2 * gx_ + (-bx2 * q3 + bz2 * q1) * gy_ + bx2 * q2 * gz_;
+            s1 += bz2 * q3 * gx_ + (bx2 * q2 + bz2 * q0) * gy_ + (bx2 * q3 - bz4 * q1) * gz_;
+            s2 += (-bx4 * q2 - bz2 * q0) * gx_ + (bx2 * q1 + bz2 * q3) * gy_ + (bx2 * q0 - bz4 * q2) * gz_;
+            s3 += (-bx4 * q3 + bz2 * q1) * gx_ + (-bx2 * q0 + bz2 * q2) * gy_ + bx2 * q1 * gz_;
+        }
+
+        T step[4] = { s0, s1, s2, s3 };
+        if (normalize(step, 4)) {
+            qDot0 -= beta * step[0];
+            qDot1 -= beta * step[1];
+            qDot2 -= beta * step[2];
+            qDot3 -= beta * step[3];
+        }
+    }
+
+    q0 += qDot0 * dt;
+    q1 += qDot1 * dt;
+    q2 += qDot2 * dt;
+    q3 += qDot3 * dt;
+    T norm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    q[0] = q0 * norm;
+    q[1] = q1 * norm;
+    q[2] = q2 * norm;
+    q[3] = q3 * norm;
+}
+
+/** Mahony: gyro rate corrected by the cross product of measured and
+ * predicted gravity plus the heading error of the field (proportional and
+ * integral feedback), then integrated.
+ * @param q w, x, y, z, updated in place
+ * @param integral Integral feedback X/Y/Z in rad/s, updated in place
+ * @param accel NULL to integrate the gyro only
+ * @param mag NULL for an accel and gyro only update
+ */
+template<typename T>
+void mahonyUpdate(T* q, T* integral, T gx, T gy, T gz, const T* accel, const T* mag,
+        T kp, T ki, T dt) {
+    T q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+
+    if (accel) {
+        T norm = invSqrt(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+        T ax = accel[0] * norm, ay = accel[1] * norm, az = accel[2] * norm;
+
+        // predicted gravity direction
+        T vx = 2 * (q1 * q3 - q0 * q2);
+        T vy = 2 * (q0 * q1 + q2 * q3);
+        T vz = T(1) - 2 * (q1 * q1 + q2 * q2);
+        T ex = ay * vz - az * vy;
+        T ey = az * vx - ax * vz;
+        T ez = ax * vy - ay * vx;
+
+        if (mag) {
+            // heading error of the field in the earth frame, fed back about
+            // the predicted vertical only: the magnetometer then cannot
+            // disturb roll and pitch, and a yaw error near 180 degrees is
+            // corrected as fast as a small one
+            T mx = mag[0], my = mag[1], mz = mag[2];
+            T hx = (T(1) - 2 * (q2 * q2 + q3 * q3)) * mx + 2 * (q1 * q2 - q0 * q3) * my
+                    + 2 * (q1 * q3 + q0 * q2) * mz;
+            T hy = 2 * (q1 * q2 + q0 * q3) * mx + (T(1) - 2 * (q1 * q1 + q3 * q3)) * my
+                    + 2 * (q2 * q3 - q0 * q1) * mz;
+            T yaw = fastAtan2(hy, hx);
+            ex -= yaw * vx;
+            ey -= yaw * vy;
+            ez -= yaw * vz;
+        }
+
+        if (ki > T(0)) {
+            integral[0] += ki * ex * dt;
+            integral[1] += ki * ey * dt;
+            integral[2] += ki * ez * dt;
+            gx += integral[0];
+            gy += integral[1];
+            gz += integral[2];
+        }
+        gx += kp * ex;
+        gy += kp * ey;
+        gz += kp * ez;
+    }
+
+    T h = T(0.5f) * dt;
+    T dq0 = (-q1 * gx - q2 * gy - q3 * gz) * h;
+    T dq1 = (q0 * gx + q2 * gz - q3 * gy) * h;
+    T dq2 = (q0 * gy - q1 * gz + q3 * gx) * h;
+    T dq3 = (q0 * gz + q1 * gy - q2 * gx) * h;
+    q0 += dq0;
+    q1 += dq1;
+    q2 += dq2;
+    q3 += dq3;
+    T norm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    q[0] = q0 * norm;
+    q[1] = q1 * norm;
+    q[2] = q2 * norm;
+    q[3] = q3 * norm;
+}
+
+#endif /* _AHRS_CORE_H_ */
@@ -0,0 +1,260 @@
+// Background sample acquisition
+//
+// Acquisition runs a thread that drains the MPU6050 FIFO at the chip's own
+// sample clock, so samples are evenly spaced and never read twice, and
+// attaches the most recent HMC5883L and MS5611 readings to them. Samples go
+// into a SampleRing, a fixed-size broadcast ring: the writer never blocks and
+// never allocates, and each reader keeps its own position and learns how many
+// samples it missed when it falls a whole ring behind.
+
+#ifndef _ACQUISITION_H_
+#define _ACQUISITION_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class MPU6050;
+class HMC5883L;
+class MS5611;
+
+#define SENSOR_ACCEL    0x01
+#define SENSOR_GYRO     0x02
+#define SENSOR_TEMP     0x04
+#define SENSOR_MAG      0x08
+#define SENSOR_BARO     0x10
+#define SENSOR_ALL      0x1F
+
+// Sample.flags
+#define SAMPLE_MAG      0x01 // mag was read with this sample
+#define SAMPLE_BARO     0x02 // pressure or baroTemperature was read with this sample
+#define SAMPLE_GAP      0x04 // the FIFO overflowed, samples before this one were lost
+#define SAMPLE_FREEFALL 0x08 // the MPU6050 free-fall detector fired since the previous poll
+#define SAMPLE_MOTION   0x10 // the MPU6050 motion detector fired since the previous poll
+#define SAMPLE_ZERO_MOTION 0x20 // zero motion began or ended since the previous poll
+#define SAMPLE_LOW_POWER 0x40 // taken in low-power cycle mode: accel only, at the wake frequency
+// with SAMPLE_MOTION or SAMPLE_ZERO_MOTION, bits 8-15 hold MOT_DETECT_STATUS:
+// the axes and directions of the motion, and in bit 8 whether zero motion
+// is now detected
+#define SAMPLE_MOTION_STATUS_SHIFT 8
+#define SAMPLE_MOTION_STATUS(flags) (((flags) >> SAMPLE_MOTION_STATUS_SHIFT) & 0xff)
+
+#define ACQUISITION_MAX_RATE 1000
+#define SAMPLE_RING_DEFAULT_CAPACITY 4096
+
+/**
+ * One acquisition record, 40 bytes. mag, pressure and baroTemperature
+ * repeat the most recent reading until the next one arrives.
+ */
+struct Sample {
+    uint64_t timestamp;       // CLOCK_MONOTONIC, ns
+    int16_t accel[3];
+    int16_t temperature;      // MPU6050 raw
+    int16_t gyro[3];
+    int16_t mag[3];           // HMC5883L raw, before calibration
+    uint32_t pressure;        // MS5611 raw D1
+    uint32_t baroTemperature; // MS5611 raw D2
+    uint32_t flags;
+};
+
+/**
+ * Header in front of the records. The fields are 32 bit so that the whole
+ * ring can also be mapped by JavaScript as an Int32Array.
+ */
+struct SampleRingHeader {
+    uint32_t head;       // samples written so far, wraps around; the
+                         // futex word for Atomics.wait()
+    uint32_t capacity;   // records, a power of two
+    uint32_t recordSize; // sizeof(Sample)
+    uint32_t rate;       // samples per second
+};
+
+class SampleRing {
+    public:
+        SampleRing(uint32_t capacity = SAMPLE_RING_DEFAULT_CAPACITY);
+        SampleRing(void* memory, uint32_t capacity);
+        ~SampleRing();
+
+        static uint32_t bytesFor(uint32_t capacity);
+
+        void write(const Sample* samples, uint32_t count);
+        uint32_t read(uint32_t* tail, Sample* out, uint32_t max, uint32_t* lost) const;
+        uint32_t getHead() const;
+        uint32_t getCapacity() const;
+        void setRate(uint32_t rate);
+        uint32_t getRate() const;
+        void* getMemory() const;
+        std::shared_ptr<void> share() const;
+
+    private:
+        void init(uint32_t capacity);
+
+        std::shared_ptr<uint64_t> mStorage; // empty for caller supplied memory
+        SampleRingHeader* mHeader;
+        Sample* mRecords;
+};
+
+/**
+ * One consumer of a SampleRing at its own rate. The ring is decimated to
+ * the requested rate by timestamp. A reader that falls behind either loses
+ * the samples the writer overwrites, or, with decimate set, starts skipping
+ * every other sample once half a ring is pending so that it catches up before
+ * anything is overwritten.
+ */
+class SampleReader {
+    public:
+        SampleReader(const SampleRing* ring, uint32_t rate, bool decimate);
+
+        uint32_t read(Sample* out, uint32_t max);
+        uint32_t pending() const;
+        uint32_t ready() const;
+        uint32_t getRate() const;
+        uint64_t getDropped() const;
+        uint64_t getDecimated() const;
+
+    private:
+        bool accept(const Sample& sample);
+
+        const SampleRing* mRing;
+        uint32_t mTail;
+        uint32_t mRate;
+        bool mDecimate;
+        uint64_t mPeriod;
+        uint64_t mNextDue;
+        uint64_t mDropped;
+        uint64_t mDecimated;
+        uint32_t mSkip;
+        uint32_t mCarryFlags; // flags of samples dropped by rate decimation
+        std::vector<Sample> mScratch;
+};
+
+class AcquisitionListener {
+    public:
+        virtual ~AcquisitionListener() {}
+        /** Called on the acquisition thread after samples were written.
+         * @param samples The samples of this poll, oldest first
+         * @param count At least 1
+         */
+        virtual void onSamples(const Sample* samples, uint32_t count) = 0;
+        /** Called on the acquisition thread when the low-power policy puts
+         * the MPU6050 to sleep or wakes it up.
+         * @param timestamp ns, the clock of Sample.timestamp
+         */
+        virtual void onPowerMode(uint64_t timestamp, bool lowPower) {}
+};
+
+/**
+ * Time base of the acquisition thread, CLOCK_MONOTONIC unless replaced; a
+ * replay substitutes the log's time so that it can run faster than real
+ * time.
+ */
+class AcquisitionClock {
+    public:
+        virtual ~AcquisitionClock() {}
+        /** ns, the clock of Sample.timestamp */
+        virtual uint64_t now() = 0;
+        virtual void sleepUntil(uint64_t t) = 0;
+};
+
+/**
+ * MPU6050 free-fall, motion and zero-motion detector settings, in register
+ * units; a threshold of 0 leaves that detector and its interrupt off.
+ */
+struct MotionDetection {
+    uint8_t freefallThreshold;   // 2 mg, all axes below it
+    uint8_t freefallDuration;    // ms
+    uint8_t motionThreshold;     // 2 mg, any high-passed axis above it
+    uint8_t motionDuration;      // ms
+    uint8_t zeroMotionThreshold; // 2 mg, all high-passed axes below it
+    uint8_t zeroMotionDuration;  // 64 ms
+};
+
+/**
+ * Adaptive sampling. Once the board is still, by the zero-motion detector
+ * (if programmed) or by the variance of the acceleration over a window of
+ * samples, the MPU6050 drops to low-power cycle mode: gyros in standby,
+ * temperature sensor off, FIFO off, one accelerometer sample per wake
+ * period. A motion interrupt against the resting acceleration brings back
+ * full rate.
+ */
+struct LowPowerPolicy {
+    bool enabled;
+    uint8_t wakeFrequency;  // MPU6050_WAKE_FREQ_*
+    uint8_t wakeThreshold;  // 2 mg, motion that ends low power
+    uint32_t stillSamples;  // variance window, 0 for the zero-motion detector only
+    uint32_t stillVariance; // accel counts squared, every axis below it over the window
+};
+
+class Acquisition {
+    public:
+        Acquisition(std::mutex* busLock, MPU6050* mpu6050, HMC5883L* hmc5883l, MS5611* ms5611);
+        ~Acquisition();
+
+        bool start(uint32_t rate, uint32_t sensors);
+        void stop();
+        bool isRunning() const;
+        uint32_t getRate() const;
+        uint32_t getSensors() const;
+        SampleRing* getRing();
+        void setListener(AcquisitionListener* listener);
+        void setClock(AcquisitionClock* clock);
+        void setMotionDetection(const MotionDetection& detection);
+        void setLowPowerPolicy(const LowPowerPolicy& policy);
+        bool isLowPower() const;
+        uint64_t getOverflows() const;
+
+    private:
+        void run();
+        void configure();
+        void restore();
+        void configureDetection();
+        uint32_t poll(Sample* batch, uint32_t max);
+        uint32_t pollLowPower(Sample* batch);
+        bool isStill(const Sample* samples, uint32_t count, const LowPowerPolicy& policy);
+        void enterLowPower(uint64_t now);
+        void leaveLowPower(uint64_t now);
+        uint64_t pollInterval() const;
+
+        std::mutex* mBusLock;
+        MPU6050* mMPU6050;
+        HMC5883L* mHMC5883L;
+        MS5611* mMS5611;
+        SampleRing mRing;
+        std::thread mThread;
+        std::atomic<bool> mRunning;
+        AcquisitionListener* mListener;
+        AcquisitionClock* mClock;
+        uint32_t mRate;
+        uint32_t mSensors;
+        uint64_t mOverflows;
+        MotionDetection mDetection;
+        LowPowerPolicy mPolicy; // written under the bus lock
+        std::atomic<bool> mLowPower;
+
+        // device settings to restore on stop
+        uint8_t mSavedRate;
+        uint8_t mSavedDLPF;
+        uint8_t mSavedMagRate;
+        uint8_t mSavedClock;    // clock source while awake
+
+        // state carried between polls
+        int16_t mMag[3];
+        uint32_t mPressure;
+        uint32_t mBaroTemperature;
+        uint64_t mLastTimestamp;
+        uint64_t mNextMag;
+        uint64_t mBaroReady;
+        bool mBaroPressure; // conversion in flight is D1
+        bool mGap;
+        uint32_t mEvents;   // detector flags not attached to a sample yet
+        int16_t mTemperature;
+        uint64_t mNextWake; // low power: when the next cycle sample is due
+        int64_t mStillSum[3];
+        int64_t mStillSquares[3];
+        uint32_t mStillCount;
+};
+
+#endif /* _ACQUISITION_H_ */
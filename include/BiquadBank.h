@@ -0,0 +1,94 @@
+// Biquad filter bank
+//
+// A cascade of second order sections on the accelerometer and gyro axes,
+// for vibration the MPU6050 low-pass (DLPF) cannot take out without adding
+// lag to everything: a narrow notch at a motor or propeller frequency, or a
+// low-pass tuned to the loop. Each section is a notch or a low-pass from
+// the Audio EQ Cookbook, designed for the acquisition rate, and applies to
+// the accel axes, the gyro axes or both; axes it does not apply to pass
+// through.
+//
+// The six axes are one frame of floats padded to BIQUAD_STRIDE, with one
+// coefficient per axis, so each section is a handful of loops over
+// contiguous axes that gcc vectorizes, like the decimator.
+//
+// Sections can be changed at any time from any thread. The acquisition
+// thread picks the change up with the next batch and moves the
+// coefficients there over BIQUAD_RAMP_SAMPLES samples instead of switching
+// at once. The sections are direct form I, whose state is only past inputs
+// and outputs and stays valid under any coefficients, so a notch that
+// follows the motor speed does not click; sections added or removed fade
+// in from, or out to, a pass-through.
+
+#ifndef _BIQUAD_BANK_H_
+#define _BIQUAD_BANK_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+#include "Acquisition.h"
+
+#define BIQUAD_CHANNELS 6 // accel x, y, z, gyro x, y, z
+#define BIQUAD_STRIDE 8
+#define BIQUAD_MAX_SECTIONS 8
+#define BIQUAD_RAMP_SAMPLES 32
+
+// BiquadSpec.type
+#define BIQUAD_NOTCH   1
+#define BIQUAD_LOWPASS 2
+
+// BiquadSpec.sensors, as SENSOR_*
+#define BIQUAD_SENSORS (SENSOR_ACCEL | SENSOR_GYRO)
+
+#define BIQUAD_DEFAULT_NOTCH_Q 3.0f
+#define BIQUAD_DEFAULT_LOWPASS_Q 0.70710678f // Butterworth
+
+struct BiquadSpec {
+    uint32_t type;      // BIQUAD_NOTCH or BIQUAD_LOWPASS
+    uint32_t sensors;   // SENSOR_ACCEL and/or SENSOR_GYRO
+    float frequency;    // Hz, centre of a notch or cutoff of a low-pass
+    float q;
+};
+
+class BiquadBank {
+    public:
+        BiquadBank();
+
+        bool setSections(const BiquadSpec* specs, uint32_t count);
+        uint32_t getSections() const;
+        bool isActive() const;
+        void filter(Sample* samples, uint32_t count, uint32_t rate);
+        void reset();
+
+    private:
+        // coefficient rows
+        enum { COEF_B0, COEF_B1, COEF_B2, COEF_A1, COEF_A2, COEF_COUNT };
+        // state rows
+        enum { STATE_X1, STATE_X2, STATE_Y1, STATE_Y2, STATE_COUNT };
+
+        void design(uint32_t rate);
+        static bool designSection(const BiquadSpec& spec, uint32_t rate, float* coefficients);
+
+        // set from any thread, guarded by mLock
+        mutable std::mutex mLock;
+        BiquadSpec mPending[BIQUAD_MAX_SECTIONS];
+        uint32_t mPendingCount;
+        std::atomic<bool> mChanged;
+        std::atomic<bool> mReset;
+
+        // acquisition thread
+        BiquadSpec mSpecs[BIQUAD_MAX_SECTIONS];
+        uint32_t mCount;
+        uint32_t mRate;     // of the current design, 0 before the first
+        uint32_t mRunning;  // sections filtered, mCount or more while
+                            // removed ones fade out
+        uint32_t mSeed;     // sections from here on start from the next input
+        uint32_t mRamp;     // samples left to reach mTarget
+        float mCurrent[BIQUAD_MAX_SECTIONS][COEF_COUNT][BIQUAD_STRIDE];
+        float mTarget[BIQUAD_MAX_SECTIONS][COEF_COUNT][BIQUAD_STRIDE];
+        float mStep[BIQUAD_MAX_SECTIONS][COEF_COUNT][BIQUAD_STRIDE];
+        float mState[BIQUAD_MAX_SECTIONS][STATE_COUNT][BIQUAD_STRIDE];
+};
+
+#endif /* _BIQUAD_BANK_H_ */
@@ -0,0 +1,79 @@
+// Decimation filters
+//
+// Brings acquisition samples down to a consumer's lower rate without
+// aliasing, instead of picking every nth sample. The factor is split into
+// a cascade of decimating FIR stages, each a Kaiser-windowed sinc low-pass
+// just long enough to suppress what would fold into the output passband
+// (DECIMATOR_PASSBAND of the output rate). A stage only computes its output
+// once per factor input samples, which is the saving of a polyphase
+// decimator. Large even factors can start with a CIC stage instead
+// (integrators and combs, no multiplies), followed by a FIR stage that
+// decimates by 2 and compensates the CIC passband droop.
+//
+// The nine motion channels (accel, gyro, mag) are filtered together as one
+// frame of floats padded to DECIMATOR_STRIDE, so each tap is a loop over
+// contiguous channels that gcc turns into three vector operations.
+// Temperature, pressure and the timestamp are those of the input sample at
+// the centre of the filters' delay, so timestamps stay aligned with the
+// filtered data; the flags of every input are carried to the next output.
+
+#ifndef _DECIMATOR_H_
+#define _DECIMATOR_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "Acquisition.h"
+
+#define DECIMATOR_CHANNELS 9
+#define DECIMATOR_STRIDE 12
+// fraction of the output rate passed unattenuated; what lies between it and
+// the output Nyquist frequency may alias, but only above the passband
+#define DECIMATOR_PASSBAND 0.25
+#define DECIMATOR_MAX_TAPS 255
+#define DECIMATOR_CIC_ORDER 3
+// keeps the CIC integrators within 32 bits: 16 + 3 * log2(32) < 32
+#define DECIMATOR_CIC_MAX_FACTOR 32
+
+class Decimator {
+    public:
+        Decimator();
+
+        bool configure(uint32_t factor, bool cic);
+        void reset();
+        uint32_t write(const Sample* samples, uint32_t count, Sample* out);
+
+        uint32_t getFactor() const;
+        uint32_t getStages() const;
+        uint32_t getTaps() const;
+        uint32_t getDelay() const;
+
+    private:
+        struct Stage {
+            uint32_t factor;
+            bool cic;
+            std::vector<float> taps;
+            std::vector<float> line;       // FIR: the delay line twice, oldest
+                                           // first from position
+            std::vector<uint32_t> sums;    // CIC: integrators, then combs
+            std::vector<Sample> history;   // inputs for the timestamp and the
+                                           // slow channels
+            uint32_t length;               // taps, or CIC history
+            uint32_t position;
+            uint32_t phase;                // inputs since the last output
+            uint32_t centre;               // delay in inputs
+            float scale;                   // CIC gain
+            bool primed;
+        };
+
+        static void design(Stage* stage, uint32_t factor, double passband, double stopband,
+                uint32_t cicFactor);
+        bool fir(Stage* stage, const float* frame, const Sample& sample, float* out, Sample* outSample);
+        bool cic(Stage* stage, const float* frame, const Sample& sample, float* out, Sample* outSample);
+
+        std::vector<Stage> mStages;
+        uint32_t mFactor;
+        uint32_t mFlags; // of the inputs since the last output
+};
+
+#endif /* _DECIMATOR_H_ */
@@ -0,0 +1,102 @@
+// Extended Kalman filter for attitude, gyro bias and altitude
+//
+// A multiplicative (error state) EKF: the attitude is kept as a quaternion
+// and the filter estimates a small rotation error in the earth frame next to
+// the gyro bias and a vertical channel of altitude, vertical speed and
+// vertical accelerometer bias. Each sensor is folded in by its own update
+// whenever it has a new reading: the gyro propagates the state, the
+// accelerometer corrects roll and pitch and drives the vertical channel, the
+// magnetometer corrects yaw and the barometer corrects altitude. All matrices
+// are fixed-size members, so an update never allocates.
+//
+// Frames and units follow AHRS: the quaternion rotates the sensor frame into
+// an earth frame with Z up and X towards magnetic north; gyro in rad/s,
+// accelerometer in g, altitude in m.
+
+#ifndef _EKF_H_
+#define _EKF_H_
+
+#include <stdint.h>
+
+#include "Matrix.h"
+
+// error state: rotation x/y/z, gyro bias x/y/z, altitude, vertical speed,
+// vertical accelerometer bias
+#define EKF_STATES 9
+#define EKF_THETA 0
+#define EKF_GYRO_BIAS 3
+#define EKF_ALTITUDE 6
+#define EKF_VELOCITY 7
+#define EKF_ACCEL_BIAS 8
+
+// exportState(): quaternion w/x/y/z, gyro bias x/y/z (rad/s), altitude (m),
+// vertical speed (m/s), vertical accel bias (m/s^2), then the error state
+// covariance, row major
+#define EKF_EXPORT_HEADER 10
+#define EKF_EXPORT_SIZE (EKF_EXPORT_HEADER + EKF_STATES * EKF_STATES)
+
+/**
+ * Noise settings; densities are per square root of a second.
+ */
+struct EKFNoise {
+    float gyro;         // rad/s/sqrt(Hz)
+    float gyroBias;     // rad/s^2/sqrt(Hz), bias random walk
+    float accel;        // g, per reading, gravity direction
+    float verticalAccel; // m/s^2/sqrt(Hz)
+    float accelBias;    // m/s^3/sqrt(Hz), vertical bias random walk
+    float mag;          // rad, per heading reading
+    float baro;         // m, per altitude reading
+
+    EKFNoise()
+        : gyro(0.002f), gyroBias(0.0001f), accel(0.05f), verticalAccel(0.1f),
+          accelBias(0.005f), mag(0.05f), baro(0.5f) {}
+};
+
+class EKF {
+    public:
+        typedef Matrix<EKF_STATES, EKF_STATES> Covariance;
+
+        EKF();
+
+        void setNoise(const EKFNoise& noise);
+        const EKFNoise& getNoise() const;
+        void reset();
+
+        void updateGyro(const float* gyro, float dt);
+        void updateAccel(const float* accel);
+        void updateMag(const float* mag);
+        void updateBaro(float altitude);
+
+        void getQuaternion(float* q) const;
+        void getGyroBias(float* bias) const;
+        float getAltitude() const;
+        float getVerticalSpeed() const;
+        const Covariance& getCovariance() const;
+        void exportState(float* out) const;
+
+    private:
+        template<int M>
+        bool correct(const Matrix<M, EKF_STATES>& h, const Matrix<M, 1>& residual,
+                const Matrix<M, M>& noise);
+        void inject(const Matrix<EKF_STATES, 1>& dx);
+        void rotation(float* r) const;
+        void alignTilt(const float* accel);
+
+        float mQ[4];
+        float mGyroBias[3];
+        float mAltitude;
+        float mVelocity;
+        float mAccelBias;
+        Covariance mP;
+        EKFNoise mNoise;
+
+        // vertical acceleration of the last accelerometer reading, m/s^2,
+        // gravity removed; integrated by the next gyro updates
+        float mVerticalAccel;
+        // the first reading of each kind sets its states directly
+        bool mTiltAligned;
+        bool mYawAligned;
+        bool mAltitudeAligned;
+};
+
+#endif /* _EKF_H_ */
@@ -0,0 +1,197 @@
+// Fixed point numbers
+//
+// Fixed<F> is a signed 32 bit Q(31-F).F number: Fixed<16> is Q16.16. It has
+// the operators the filter templates use, so the same source compiles for
+// float and for fixed point. Products and quotients go through 64 bits (one
+// SMULL on ARM); nothing saturates, so callers keep values inside the range
+// of the format they pick. ARMv6 boards (Pi Zero and Pi 1) have a VFP whose
+// divide and square root take tens of cycles and stall the pipeline; the
+// integer versions here avoid both.
+
+#ifndef _FIXED_H_
+#define _FIXED_H_
+
+#include <stdint.h>
+
+template<int F>
+class Fixed {
+    public:
+        Fixed() : mRaw(0) {}
+        Fixed(int value) : mRaw((int32_t)((uint32_t)value << F)) {}
+        Fixed(float value) : mRaw((int32_t)(value * (float)(1 << F) + (value < 0 ? -0.5f : 0.5f))) {}
+
+        static Fixed fromRaw(int32_t raw) {
+            Fixed out;
+            out.mRaw = raw;
+            return out;
+        }
+
+        int32_t raw() const {
+            return mRaw;
+        }
+
+        float toFloat() const {
+            return mRaw * (1.0f / (1 << F));
+        }
+
+        Fixed operator-() const {
+            return fromRaw(-mRaw);
+        }
+
+        Fixed operator+(Fixed other) const {
+            return fromRaw(mRaw + other.mRaw);
+        }
+
+        Fixed operator-(Fixed other) const {
+            return fromRaw(mRaw - other.mRaw);
+        }
+
+        /** Rounds to nearest; truncating would bias every integration
+         * step the same way.
+         */
+        Fixed operator*(Fixed other) const {
+            return fromRaw((int32_t)(((int64_t)mRaw * other.mRaw + (1 << (F - 1))) >> F));
+        }
+
+        Fixed operator/(Fixed other) const {
+            return fromRaw((int32_t)(((int64_t)mRaw << F) / other.mRaw));
+        }
+
+        /** Integer factors skip the shift; int16_t raw counts times a
+         * Fixed scale is one 32 bit multiply.
+         */
+        Fixed operator*(int factor) const {
+            return fromRaw(mRaw * factor);
+        }
+
+        friend Fixed operator*(int factor, Fixed value) {
+            return fromRaw(factor * value.mRaw);
+        }
+
+        Fixed& operator+=(Fixed other) {
+            mRaw += other.mRaw;
+            return *this;
+        }
+
+        Fixed& operator-=(Fixed other) {
+            mRaw -= other.mRaw;
+            return *this;
+        }
+
+        Fixed& operator*=(Fixed other) {
+            return *this = *this * other;
+        }
+
+        bool operator<(Fixed other) const { return mRaw < other.mRaw; }
+        bool operator>(Fixed other) const { return mRaw > other.mRaw; }
+        bool operator<=(Fixed other) const { return mRaw <= other.mRaw; }
+        bool operator>=(Fixed other) const { return mRaw >= other.mRaw; }
+        bool operator==(Fixed other) const { return mRaw == other.mRaw; }
+        bool operator!=(Fixed other) const { return mRaw != other.mRaw; }
+
+    private:
+        int32_t mRaw;
+};
+
+// Q16.16, physical units converted from raw counts
+typedef Fixed<16> q16_t;
+
+template<int F>
+inline Fixed<F> fabs(Fixed<F> value) {
+    return value < Fixed<F>() ? -value : value;
+}
+
+/** 1 / sqrt(x) for x > 0, relative error below 1e-6; the largest value of
+ * the format when the result does not fit.
+ * x is normalized to m * 4^k with m in [1, 4) by counting leading zeros,
+ * 1 / sqrt(m) starts from a linear fit and takes three Newton steps in Q2.30,
+ * and the result is shifted back by k.
+ */
+template<int F>
+Fixed<F> invSqrt(Fixed<F> x) {
+    const int32_t largest = 0x7FFFFFFF;
+    if (x.raw() <= 0) {
+        return Fixed<F>::fromRaw(largest);
+    }
+    uint32_t value = (uint32_t)x.raw();
+    int shift = __builtin_clz(value) & ~1;
+    // m in Q2.30; x = m * 2^(30 - F - shift)
+    int64_t m = (int64_t)(value << shift);
+    const int64_t one = (int64_t)1 << 30;
+    // 1.066 - 0.152 * m
+    int64_t y = 1144597610LL - ((163208757LL * m) >> 30);
+    for (int i = 0; i < 3; i++) {
+        int64_t y2 = (y * y) >> 30;
+        y = (y * (3 * one - ((m * y2) >> 30))) >> 31;
+    }
+    // 1 / sqrt(x) = y * 2^((shift + F - 30) / 2); with an odd F the
+    // exponent is odd and the half bit becomes a factor of sqrt(2)
+    int exponent = shift + F - 30;
+    if (exponent & 1) {
+        // sqrt(2)
+        y = (y * 1518500250LL) >> 30;
+        exponent -= 1;
+    }
+    int out = 30 - F - exponent / 2;
+    if (out >= 0) {
+        return Fixed<F>::fromRaw((int32_t)(y >> out));
+    }
+    if (out <= -31 || (y >> (31 + out)) != 0) {
+        return Fixed<F>::fromRaw(largest);
+    }
+    return Fixed<F>::fromRaw((int32_t)(y << -out));
+}
+
+/** Scale a vector to unit length.
+ * The vector is first shifted so that its largest component lies in
+ * [0.25, 0.5); the sum of squares then neither overflows nor loses its low
+ * bits, however long or short the vector was.
+ * @return false for the zero vector, which is left alone
+ */
+template<int F>
+bool normalize(Fixed<F>* v, int n) {
+    int32_t largest = 0;
+    for (int i = 0; i < n; i++) {
+        int32_t a = v[i].raw() < 0 ? -v[i].raw() : v[i].raw();
+        largest = a > largest ? a : largest;
+    }
+    if (largest == 0) {
+        return false;
+    }
+    int shift = __builtin_clz((uint32_t)largest) - (33 - F);
+    Fixed<F> sum;
+    for (int i = 0; i < n; i++) {
+        int32_t raw = v[i].raw();
+        v[i] = Fixed<F>::fromRaw(shift >= 0 ? (int32_t)((uint32_t)raw << shift) : raw >> -shift);
+        sum += v[i] * v[i];
+    }
+    Fixed<F> norm = invSqrt(sum);
+    for (int i = 0; i < n; i++) {
+        v[i] *= norm;
+    }
+    return true;
+}
+
+/** atan2 in radians, the fixed point overload of fastAtan2() in Heading.h
+ * with the same polynomial.
+ */
+template<int F>
+Fixed<F> fastAtan2(Fixed<F> y, Fixed<F> x) {
+    typedef Fixed<F> T;
+    T ax = fabs(x);
+    T ay = fabs(y);
+    T mn = ax < ay ? ax : ay;
+    T mx = ax < ay ? ay : ax;
+    if (mx == T()) {
+        return T();
+    }
+    T z = mn / mx;
+    T z2 = z * z;
+    T r = z * (T(0.9998660f) + z2 * (T(-0.3302995f) + z2 * (T(0.1801410f)
+            + z2 * (T(-0.0851330f) + z2 * T(0.0208351f)))));
+    r = ay > ax ? T(1.57079633f) - r : r;
+    r = x < T() ? T(3.14159265f) - r : r;
+    return y < T() ? -r : r;
+}
+
+#endif /* _FIXED_H_ */
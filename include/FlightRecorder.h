@@ -0,0 +1,74 @@
+// Flight recorder
+//
+// A fixed-size ring of the most recent samples in a memory-mapped file, for
+// the seconds before a crash. The acquisition thread writes every sample
+// straight into the mapping, no system call per sample; the kernel owns the
+// dirty pages, so they survive the process dying, and writeback of the
+// slots written in the last second is started once a second so that most of
+// them survive a power cut too.
+//
+// Each slot carries its sequence number before and after the sample. A
+// slot is valid when both match and the sequence belongs to that slot
+// (sequence % capacity); a write torn by a crash, or pages of a slot that
+// reached the disk at different times, leave them different. recover()
+// walks back from the newest valid slot for the requested number of
+// seconds; tools/blackbox.cpp is the command line decoder built on it.
+//
+// Opening a recorder moves a previous ring at the same path to path.prev
+// instead of overwriting it, so restarting after a crash keeps the crash.
+
+#ifndef _FLIGHT_RECORDER_H_
+#define _FLIGHT_RECORDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Acquisition.h"
+#include "SampleLog.h"
+
+#define FLIGHT_RECORDER_MAGIC "GY86BOX"
+#define FLIGHT_RECORDER_DEFAULT_SECONDS 60
+#define FLIGHT_RECORDER_PREVIOUS_SUFFIX ".prev"
+
+/**
+ * One ring slot, 56 bytes; 0 in sequence marks a slot never written.
+ */
+struct FlightRecord {
+    uint64_t sequence; // stored first
+    Sample sample;
+    uint64_t commit;   // stored last, equal to sequence once complete
+};
+
+class FlightRecorder : public SampleRecorder {
+    public:
+        FlightRecorder();
+        ~FlightRecorder();
+
+        bool open(const char* path, const SampleLogHeader& header, uint32_t capacity);
+        bool write(const Sample* samples, uint32_t count);
+        void flush();
+        void close();
+
+        uint64_t getCount() const;
+        uint32_t getSegments() const;
+        int getError() const;
+
+        static bool recover(const char* path, double seconds, SampleLogHeader* header,
+                std::vector<Sample>* samples, int* error);
+
+    private:
+        int mFd;
+        uint8_t* mMap;
+        size_t mMapSize;
+        SampleLogHeader* mHeader;
+        FlightRecord* mSlots;
+        uint32_t mCapacity;
+        uint64_t mSequence;       // of the last slot written
+        uint64_t mFlushed;        // sequence covered by the last flush
+        uint64_t mFlushTimestamp; // Sample.timestamp of the last flush
+        int mError;
+};
+
+#endif /* _FLIGHT_RECORDER_H_ */
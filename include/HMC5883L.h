@@ -104,6 +104,7 @@ class HMC5883L {
     public:
         HMC5883L();
         HMC5883L(uint8_t address);
+        HMC5883L(const char* dev, uint8_t address);
         ~HMC5883L();
         
         void initialize();
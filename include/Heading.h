@@ -0,0 +1,18 @@
+// Compass heading helpers
+//
+// Headings are in degrees, 0 to 360, measured the same way as the level
+// atan2(my, mx) heading that RPIGY86 has always returned. Declination is left
+// to the caller. Accelerometer and magnetometer axes are assumed to be
+// aligned, as they are on the GY-86 board.
+
+#ifndef _HEADING_H_
+#define _HEADING_H_
+
+#include <stdint.h>
+
+float fastAtan2(float y, float x);
+float levelHeading(float mx, float my);
+float tiltCompensatedHeading(const float* accel, const float* mag);
+void tiltCompensatedHeadings(const int16_t* accel, const float* mag, uint32_t count, float* heading);
+
+#endif /* _HEADING_H_ */
@@ -0,0 +1,41 @@
+// I2Cdev transport interface
+//
+// I2Cdev normally talks to a Linux i2c-dev character device. A transport can
+// be registered under a bus name instead; every I2Cdev opened with that name
+// then routes its register reads and writes through it. This is how the
+// drivers run against a simulated or replayed GY-86 without any hardware.
+
+#ifndef _I2CTRANSPORT_H_
+#define _I2CTRANSPORT_H_
+
+#include <stdint.h>
+
+// built-in bus name that maps to the shared SimTransport
+#define I2C_SIM_BUS "sim"
+
+class I2CTransport {
+    public:
+        virtual ~I2CTransport() {}
+
+        /** Read length bytes starting at regAddr.
+         * @return number of bytes read, -1 on error
+         */
+        virtual int8_t readBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data) = 0;
+        /** Write length bytes starting at regAddr.
+         */
+        virtual bool writeBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data) = 0;
+        /** Write a single command byte without a register address (SMBus send byte).
+         */
+        virtual bool writeCommand(uint8_t devAddr, uint8_t command) = 0;
+        /** SMBus I2C block read; the same as readBytes() unless overridden.
+         */
+        virtual int8_t readBlock(uint8_t devAddr, uint8_t command, uint8_t length, uint8_t *data) {
+            return readBytes(devAddr, command, length, data);
+        }
+
+        static bool registerBus(const char* name, I2CTransport* transport);
+        static void unregisterBus(const char* name);
+        static I2CTransport* find(const char* name);
+};
+
+#endif /* _I2CTRANSPORT_H_ */
@@ -35,6 +35,8 @@ THE SOFTWARE.
 #define FALSE	(0==1)
 #endif
 
+class I2CTransport;
+
 class I2Cdev {
     public:
         I2Cdev(const char* dev);
@@ -62,6 +64,7 @@ class I2Cdev {
         static uint16_t readTimeout;
 private:
 	int mFD;
+	I2CTransport* mTransport;
 };
 
 #endif /* _I2CDEV_H_ */
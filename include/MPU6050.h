@@ -389,6 +389,7 @@ class MPU6050 {
     public:
         MPU6050();
         MPU6050(uint8_t address);
+        MPU6050(const char* dev, uint8_t address);
         ~MPU6050();
 
         void initialize();
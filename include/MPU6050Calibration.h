@@ -0,0 +1,101 @@
+// MPU6050 offset calibration
+//
+// With the board resting level, samples accel and gyro at 1kHz through the
+// FIFO, keeps a running mean and variance per axis (Welford's method) and
+// moves the chip's offset registers against the remaining bias with a
+// proportional controller. It stops when every axis is inside its dead zone,
+// or when the iteration or time budget runs out, whichever comes first.
+
+#ifndef _MPU6050CALIBRATION_H_
+#define _MPU6050CALIBRATION_H_
+
+#include <stdint.h>
+#include <mutex>
+
+class MPU6050;
+
+#define CALIBRATION_DEFAULT_SAMPLES     250
+#define CALIBRATION_DEFAULT_ITERATIONS  20
+#define CALIBRATION_DEFAULT_BUDGET_MS   10000
+
+/**
+ * Running mean and variance, numerically stable for long runs.
+ */
+struct RunningStats {
+    uint32_t count;
+    double mean;
+    double m2;
+
+    RunningStats() { reset(); }
+
+    void reset() {
+        count = 0;
+        mean = 0;
+        m2 = 0;
+    }
+
+    void add(double x) {
+        count++;
+        double delta = x - mean;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+    }
+
+    double variance() const {
+        return count > 1 ? m2 / (count - 1) : 0;
+    }
+};
+
+/**
+ * State after one iteration. Axes are accel x, y, z and gyro x, y, z; the
+ * accel z error is relative to 1g.
+ */
+struct CalibrationProgress {
+    uint32_t iteration;
+    uint32_t samples;       // per axis, this iteration
+    float error[6];         // mean error, LSB
+    float stddev[6];        // sample standard deviation, LSB
+    int16_t offsets[6];     // offset registers for the next iteration
+    uint32_t ready;         // axes inside their dead zone
+    bool done;
+    bool converged;
+};
+
+class CalibrationListener {
+    public:
+        virtual ~CalibrationListener() {}
+        /** Called on the calibrating thread after every iteration.
+         */
+        virtual void onProgress(const CalibrationProgress& progress) = 0;
+};
+
+class MPU6050Calibration {
+    public:
+        MPU6050Calibration(MPU6050* mpu6050, std::mutex* busLock);
+
+        void setSamples(uint32_t samples);
+        void setMaxIterations(uint32_t iterations);
+        void setTimeBudget(uint32_t milliseconds);
+
+        bool run(int16_t* offsets, CalibrationListener* listener);
+
+    private:
+        void configure();
+        void restore();
+        void readOffsets(int16_t* offsets);
+        void writeOffsets(const int16_t* offsets);
+        bool collect(RunningStats* stats, uint64_t deadline);
+
+        MPU6050* mMPU6050;
+        std::mutex* mBusLock;
+        uint32_t mSamples;
+        uint32_t mMaxIterations;
+        uint32_t mTimeBudget;
+
+        // device settings to restore when done
+        uint8_t mSavedRate;
+        uint8_t mSavedDLPF;
+        bool mSavedFIFO;
+};
+
+#endif /* _MPU6050CALIBRATION_H_ */
@@ -23,6 +23,7 @@ class MS5611 {
 public:
     MS5611();
     MS5611(uint8_t add);
+    MS5611(const char* dev, uint8_t add);
     ~MS5611();
 
     bool begin(ms5611_osr_t osr = MS5611_HIGH_RES);
@@ -30,10 +31,15 @@ public:
     uint32_t readRawPressure(void);
     double readTemperature(bool compensation = false);
     int32_t readPressure(bool compensation = false);
-    double getAltitude(double pressure, double seaLevelPressure = 101325);
+    void startConversion(uint8_t command);
+    uint32_t readConversion(void);
+    double calculateTemperature(uint32_t D2, bool compensation = false) const;
+    int32_t calculatePressure(uint32_t D1, uint32_t D2, bool compensation = false) const;
+    double getAltitude(double pressure, double seaLevelPressure = 101325) const;
     double getSeaLevel(double pressure, double altitude);
     void setOversampling(ms5611_osr_t osr);
     ms5611_osr_t getOversampling(void);
+    void getCoefficients(uint16_t* coefficients);
 
 private:
     uint16_t read16(uint8_t devAddr, uint8_t cmd);
@@ -43,8 +49,6 @@ private:
     uint16_t fc[6];
     uint8_t ct;
     uint8_t uosr;
-    int32_t TEMP2;
-    int64_t OFF2, SENS2;
 
     void reset(void);
     void readPROM(void);
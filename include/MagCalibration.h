@@ -0,0 +1,83 @@
+// HMC5883L hard/soft-iron calibration
+//
+// MagCalibration streams raw magnetometer samples into an incremental
+// least-squares ellipsoid fit. Only the 9x9 normal equations are kept, so
+// memory and per-sample cost stay constant no matter how long the board is
+// rotated. solve() turns the fitted ellipsoid into a MagCorrection: an offset
+// (hard iron) and a symmetric 3x3 matrix (soft iron) that maps the ellipsoid
+// back onto a sphere.
+//
+// selfTest() drives the HMC5883L internal bias coil to measure the per-axis
+// gain mismatch, which is folded into the correction as a scale vector. The
+// scale changes the units of the fit, so a fit is redone after it.
+
+#ifndef _MAGCALIBRATION_H_
+#define _MAGCALIBRATION_H_
+
+#include <mutex>
+#include <stdint.h>
+
+#define MAG_CALIBRATION_MIN_SAMPLES 50
+
+// checkSelfTest() results
+#define MAG_SELF_TEST_PASSED    0
+#define MAG_SELF_TEST_SATURATED 1 // an axis overflowed, try a lower gain
+#define MAG_SELF_TEST_FAILED    2 // outside the datasheet limits
+
+class HMC5883L;
+
+/** Correction applied to every raw magnetometer reading:
+ *     corrected = matrix * (scale .* raw - offset)
+ * The matrix is row-major. A reset correction is the identity transform.
+ */
+struct MagCorrection {
+    float scale[3];
+    float offset[3];
+    float matrix[9];
+
+    MagCorrection() { reset(); }
+
+    void reset() {
+        for (int i = 0; i < 3; i++) {
+            scale[i] = 1.0f;
+            offset[i] = 0;
+        }
+        for (int i = 0; i < 9; i++) {
+            matrix[i] = (i % 4 == 0) ? 1.0f : 0.0f;
+        }
+    }
+
+    void apply(int16_t x, int16_t y, int16_t z, float* out) const {
+        float dx = x * scale[0] - offset[0];
+        float dy = y * scale[1] - offset[1];
+        float dz = z * scale[2] - offset[2];
+        out[0] = matrix[0] * dx + matrix[1] * dy + matrix[2] * dz;
+        out[1] = matrix[3] * dx + matrix[4] * dy + matrix[5] * dz;
+        out[2] = matrix[6] * dx + matrix[7] * dy + matrix[8] * dz;
+    }
+};
+
+class MagCalibration {
+    public:
+        MagCalibration();
+
+        void reset();
+        void addSample(int16_t x, int16_t y, int16_t z);
+        void addSample(float x, float y, float z);
+        uint32_t getSampleCount() const;
+        bool solve(MagCorrection* correction) const;
+
+        static bool selfTest(HMC5883L* hmc5883l, std::mutex* busLock, float* scale);
+        static int checkSelfTest(uint8_t gain, const int16_t* pos, const int16_t* neg, float* scale);
+
+    private:
+        // normal equations of the 9 parameter ellipsoid fit, upper triangle used
+        double mDTD[9][9];
+        double mDT1[9];
+        // samples are divided by this before they are accumulated to keep the
+        // 4th order sums well conditioned
+        double mScale;
+        uint32_t mCount;
+};
+
+#endif /* _MAGCALIBRATION_H_ */
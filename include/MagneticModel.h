@@ -0,0 +1,62 @@
+// World Magnetic Model evaluator and declination cache
+//
+// MagneticModel evaluates the degree 12 spherical-harmonic World Magnetic
+// Model with the coefficients compiled in. That is ~90 terms and a few
+// hundred floating point operations per point, too much to do per sample, so
+// DeclinationGrid evaluates it once on a small grid around a set-once
+// location and bilinearly interpolates declination and inclination from
+// there. A vehicle that leaves the grid triggers a one-off re-centre.
+//
+// A model is only valid for WMM_LIFESPAN years from its epoch; dates outside
+// that are refused rather than extrapolated.
+
+#ifndef _MAGNETICMODEL_H_
+#define _MAGNETICMODEL_H_
+
+#include <stdint.h>
+
+#define WMM_MAX_DEGREE 12
+#define WMM_LIFESPAN 5.0
+
+// grid nodes per side, odd so the origin sits on a node
+#define DECLINATION_GRID_SIZE 9
+#define DECLINATION_GRID_SPACING 0.25
+
+struct MagneticField {
+    double x;           // north component, nT
+    double y;           // east component, nT
+    double z;           // down component, nT
+    double declination; // degrees, east positive
+    double inclination; // degrees, down positive
+};
+
+class MagneticModel {
+    public:
+        static double getEpoch();
+        static double currentDecimalYear();
+        static bool isValidDate(double decimalYear);
+        static bool evaluate(double latitude, double longitude, double altitude,
+                double decimalYear, MagneticField* field);
+};
+
+class DeclinationGrid {
+    public:
+        DeclinationGrid();
+
+        bool setOrigin(double latitude, double longitude, double altitude, double decimalYear);
+        bool isValid() const;
+        void lookup(double latitude, double longitude, float* declination, float* inclination);
+
+    private:
+        void build(double latitude, double longitude);
+
+        float mDeclination[DECLINATION_GRID_SIZE][DECLINATION_GRID_SIZE];
+        float mInclination[DECLINATION_GRID_SIZE][DECLINATION_GRID_SIZE];
+        double mLatitude0;  // latitude of node [0][*]
+        double mLongitude0; // longitude of node [*][0]
+        double mAltitude;
+        double mYear;
+        bool mValid;
+};
+
+#endif /* _MAGNETICMODEL_H_ */
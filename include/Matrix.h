@@ -0,0 +1,143 @@
+// Fixed-size matrices
+//
+// Dimensions are template parameters, so every matrix lives inside its owner
+// or on the stack, nothing is ever allocated, and the loops have constant
+// trip counts the compiler can unroll. Only what the filters need is here.
+
+#ifndef _MATRIX_H_
+#define _MATRIX_H_
+
+#include <math.h>
+#include <string.h>
+
+template<int R, int C>
+struct Matrix {
+    float m[R][C];
+
+    static Matrix zero() {
+        Matrix out;
+        memset(out.m, 0, sizeof(out.m));
+        return out;
+    }
+
+    static Matrix identity() {
+        Matrix out = zero();
+        for (int i = 0; i < R && i < C; i++) {
+            out.m[i][i] = 1;
+        }
+        return out;
+    }
+
+    float& operator()(int r, int c) {
+        return m[r][c];
+    }
+
+    float operator()(int r, int c) const {
+        return m[r][c];
+    }
+
+    Matrix operator+(const Matrix& other) const {
+        Matrix out;
+        for (int r = 0; r < R; r++) {
+            for (int c = 0; c < C; c++) {
+                out.m[r][c] = m[r][c] + other.m[r][c];
+            }
+        }
+        return out;
+    }
+
+    Matrix operator-(const Matrix& other) const {
+        Matrix out;
+        for (int r = 0; r < R; r++) {
+            for (int c = 0; c < C; c++) {
+                out.m[r][c] = m[r][c] - other.m[r][c];
+            }
+        }
+        return out;
+    }
+
+    template<int K>
+    Matrix<R, K> operator*(const Matrix<C, K>& other) const {
+        Matrix<R, K> out = Matrix<R, K>::zero();
+        for (int r = 0; r < R; r++) {
+            for (int i = 0; i < C; i++) {
+                float a = m[r][i];
+                for (int c = 0; c < K; c++) {
+                    out.m[r][c] += a * other.m[i][c];
+                }
+            }
+        }
+        return out;
+    }
+
+    Matrix<C, R> transposed() const {
+        Matrix<C, R> out;
+        for (int r = 0; r < R; r++) {
+            for (int c = 0; c < C; c++) {
+                out.m[c][r] = m[r][c];
+            }
+        }
+        return out;
+    }
+
+    /** Average with the transpose, against rounding drift in covariances.
+     */
+    void symmetrize() {
+        for (int r = 0; r < R; r++) {
+            for (int c = r + 1; c < C; c++) {
+                float v = 0.5f * (m[r][c] + m[c][r]);
+                m[r][c] = v;
+                m[c][r] = v;
+            }
+        }
+    }
+};
+
+/** Gauss-Jordan inverse with partial pivoting, for the small innovation
+ * covariances of the filters.
+ * @return false if the matrix is singular
+ */
+template<int N>
+bool invert(const Matrix<N, N>& in, Matrix<N, N>* out) {
+    Matrix<N, N> a = in;
+    *out = Matrix<N, N>::identity();
+    for (int col = 0; col < N; col++) {
+        int pivot = col;
+        for (int r = col + 1; r < N; r++) {
+            if (fabsf(a.m[r][col]) > fabsf(a.m[pivot][col])) {
+                pivot = r;
+            }
+        }
+        if (a.m[pivot][col] == 0) {
+            return false;
+        }
+        if (pivot != col) {
+            for (int c = 0; c < N; c++) {
+                float t = a.m[col][c];
+                a.m[col][c] = a.m[pivot][c];
+                a.m[pivot][c] = t;
+                t = out->m[col][c];
+                out->m[col][c] = out->m[pivot][c];
+                out->m[pivot][c] = t;
+            }
+        }
+        float scale = 1 / a.m[col][col];
+        for (int c = 0; c < N; c++) {
+            a.m[col][c] *= scale;
+            out->m[col][c] *= scale;
+        }
+        for (int r = 0; r < N; r++) {
+            if (r == col || a.m[r][col] == 0) {
+                continue;
+            }
+            float f = a.m[r][col];
+            for (int c = 0; c < N; c++) {
+                a.m[r][c] -= f * a.m[col][c];
+                out->m[r][c] -= f * out->m[col][c];
+            }
+        }
+    }
+    return true;
+}
+
+#endif /* _MATRIX_H_ */
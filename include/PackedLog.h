@@ -0,0 +1,151 @@
+// Compressed sample log
+//
+// Same recording as SampleLog, a fraction of the size. Samples are buffered
+// into blocks of PACKED_LOG_BLOCK_SAMPLES and each block is stored column by
+// column: the timestamps as the change in the sample interval, every other
+// field as the change from the previous sample, both zig-zag coded. Columns
+// that mostly do not change (mag, baro, flags, often temperature) use
+// zero-run coding, a zero delta followed by the length of the run. The
+// others take the smaller of varints and fixed-width bit packing, the
+// latter of the deltas or, for vibration, of their change. Blocks decode on
+// their own, so a reader can start at any of them.
+//
+// File layout: the SampleLogHeader page with PACKED_LOG_MAGIC and capacity
+// in samples per segment, then PackedBlockHeader + payload per block, and on
+// close the block index (PackedIndexEntry per block) and a PackedLogTrailer.
+// A file cut short by a crash has no index; its blocks are found by walking
+// the block headers, up to the last complete one. The writer makes one
+// write() per block (about a second at 1 kHz) and none per sample.
+
+#ifndef _PACKED_LOG_H_
+#define _PACKED_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Acquisition.h"
+#include "SampleLog.h"
+
+#define PACKED_LOG_MAGIC "GY86PAK"
+#define PACKED_LOG_BLOCK_MAGIC 0x4B425947 // "GYBK"
+#define PACKED_LOG_INDEX_MAGIC 0x58495947 // "GYIX"
+#define PACKED_LOG_BLOCK_SAMPLES 1024
+
+// timestamp, accel X/Y/Z, temperature, gyro X/Y/Z, mag X/Y/Z, pressure,
+// baroTemperature, flags
+#define PACKED_LOG_COLUMNS 14
+
+struct PackedBlockHeader {
+    uint32_t magic;          // PACKED_LOG_BLOCK_MAGIC
+    uint32_t count;          // samples
+    uint32_t size;           // payload bytes following this header
+    uint32_t reserved;
+    uint64_t firstIndex;     // index of the first sample in the recording
+    uint64_t firstTimestamp; // Sample.timestamp of the first sample
+};
+
+struct PackedIndexEntry {
+    uint64_t offset;         // of the PackedBlockHeader in the file
+    uint64_t firstIndex;
+    uint64_t firstTimestamp;
+};
+
+struct PackedLogTrailer {
+    uint64_t indexOffset;
+    uint32_t blocks;
+    uint32_t magic;          // PACKED_LOG_INDEX_MAGIC
+};
+
+/**
+ * Encode count (at most PACKED_LOG_BLOCK_SAMPLES) samples into out, which
+ * must hold packedBlockBound() bytes.
+ * @return payload size
+ */
+size_t packBlock(const Sample* samples, uint32_t count, uint64_t firstTimestamp, uint8_t* out);
+/**
+ * Decode a payload of size bytes back into count samples.
+ * @return false if the payload is malformed
+ */
+bool unpackBlock(const uint8_t* in, size_t size, uint32_t count, uint64_t firstTimestamp, Sample* out);
+size_t packedBlockBound(uint32_t count);
+
+class PackedLog : public SampleRecorder {
+    public:
+        PackedLog();
+        ~PackedLog();
+
+        bool open(const char* path, const SampleLogHeader& header, uint32_t segmentRecords);
+        bool write(const Sample* samples, uint32_t count);
+        void close();
+
+        uint64_t getCount() const;
+        uint64_t getBytes() const;
+        uint32_t getSegments() const;
+        int getError() const;
+
+    private:
+        bool openSegment();
+        void closeSegment();
+        bool writeBlock();
+        bool writeAll(const void* data, size_t size);
+
+        std::string mPath;
+        SampleLogHeader mTemplate;
+        uint32_t mCapacity;
+
+        int mFd;
+        uint64_t mOffset;       // file size so far
+        uint32_t mSegment;
+        uint32_t mCount;        // samples in the current segment
+        uint64_t mTotal;
+        uint64_t mBytes;        // over all segments
+        int mError;
+
+        std::vector<Sample> mBlock;
+        uint32_t mBlockCount;
+        std::vector<uint8_t> mPacked;
+        std::vector<PackedIndexEntry> mIndex;
+};
+
+/**
+ * Read side of a compressed recording, for SampleLogReader: the block index
+ * of every segment, and the most recently used block decoded.
+ */
+class PackedLogReader {
+    public:
+        PackedLogReader();
+        ~PackedLogReader();
+
+        bool open(const char* path);
+        void close();
+
+        const SampleLogHeader& getHeader() const;
+        uint64_t getCount() const;
+        const Sample* at(uint64_t index);
+        uint64_t find(uint64_t timestamp);
+        int getError() const;
+
+    private:
+        struct Block {
+            const uint8_t* payload;
+            uint32_t size;
+            uint32_t count;
+            uint64_t firstIndex;
+            uint64_t firstTimestamp;
+        };
+
+        bool openSegment(const std::string& file, bool first);
+        size_t blockOf(uint64_t index) const;
+
+        std::vector<std::pair<void*, size_t> > mMaps;
+        std::vector<Block> mBlocks;
+        SampleLogHeader mHeader;
+        uint64_t mCount;
+        size_t mDecodedBlock;   // index into mBlocks, mBlocks.size() if none
+        std::vector<Sample> mDecoded;
+        int mError;
+};
+
+#endif /* _PACKED_LOG_H_ */
@@ -0,0 +1,79 @@
+// Replayed GY-86 bus
+//
+// Serves the registers of the three chips from a SampleLog recording, so the
+// unchanged drivers, Acquisition, calibration and fusion code run on
+// recorded field data. The MPU6050 FIFO fills with the recorded frames as
+// the replay clock passes their timestamps, decimated to the sample rate
+// the driver programs; the data registers, the HMC5883L and MS5611
+// conversions return the record current at that time and the MS5611 PROM
+// and the full scale ranges are the recorded ones, whatever the driver
+// writes. Detector events recorded in Sample.flags raise their interrupts
+// again if the driver enabled them.
+//
+// The transport is also the AcquisitionClock of the acquisition reading
+// it. The replay clock stands at the start of the recording until the
+// FIFO is first enabled and then runs at speed times real time, or, with
+// speed 0, jumps to whatever time the acquisition sleeps until: the log is
+// then replayed as fast as the code consuming it can go.
+
+#ifndef _REPLAYTRANSPORT_H_
+#define _REPLAYTRANSPORT_H_
+
+#include <stdint.h>
+#include <mutex>
+
+#include "Acquisition.h"
+#include "I2CTransport.h"
+#include "SampleLog.h"
+
+#define REPLAY_FIFO_SIZE 1024
+
+class ReplayTransport : public I2CTransport, public AcquisitionClock {
+    public:
+        ReplayTransport();
+
+        bool open(const char* path, double speed);
+        const SampleLogHeader& getHeader() const;
+        int getError() const;
+        uint64_t getCount() const;
+        uint64_t getPosition();
+        bool isFinished();
+
+        int8_t readBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data);
+        bool writeBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data);
+        bool writeCommand(uint8_t devAddr, uint8_t command);
+
+        uint64_t now();
+        void sleepUntil(uint64_t t);
+
+    private:
+        uint64_t clock();
+        void advance(uint64_t t);
+        void pushFrame(const Sample& sample);
+        void replayDetection(const Sample& sample);
+        uint8_t readMPU(uint8_t regAddr);
+        void writeMPU(uint8_t regAddr, uint8_t value);
+        uint8_t readMag(uint8_t regAddr);
+
+        std::mutex mLock;
+        SampleLogReader mLog;
+        double mSpeed;        // 0: as fast as possible
+        bool mStarted;
+        uint64_t mOrigin;     // log time when the clock started
+        uint64_t mWallOrigin; // CLOCK_MONOTONIC at the same moment
+        uint64_t mVirtual;    // log time, speed 0 only
+
+        uint64_t mNext;       // next record to pass
+        uint64_t mNextDue;    // earliest timestamp of the next FIFO frame
+        Sample mCurrent;      // latest record passed
+
+        uint8_t mRegs[128];
+        uint8_t mFifo[REPLAY_FIFO_SIZE];
+        uint16_t mFifoHead;
+        uint16_t mFifoCount;
+        uint8_t mMagRegs[13];
+        int16_t mMagLatched[3];
+        uint8_t mBaroCommand; // conversion in flight, 0 if none
+};
+
+#endif /* _REPLAYTRANSPORT_H_ */
@@ -0,0 +1,160 @@
+// Binary sample log
+//
+// Records acquisition Samples, unchanged and 40 bytes each, into segment
+// files that are preallocated and memory mapped, so logging a sample is a
+// memcpy into the page cache. Each segment starts with a SampleLogHeader
+// page describing everything needed to turn the raw counts into units
+// later: rate, ranges, scales, the MS5611 PROM and the magnetometer
+// correction.
+//
+// Dirty pages of a shared mapping belong to the kernel, so a crashing
+// process loses nothing it already copied. Once a second the header count
+// is updated and writeback of the new pages is started without waiting
+// for it (sync_file_range), which bounds what a power cut can take. A
+// reader trusts header.count and may take the records after it up to the
+// first one with a zero timestamp; the file is zero filled beyond that.
+// SampleLogReader does exactly that, for ReplayTransport and other tools.
+
+#ifndef _SAMPLE_LOG_H_
+#define _SAMPLE_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Acquisition.h"
+
+#define SAMPLE_LOG_MAGIC "GY86LOG"
+#define SAMPLE_LOG_VERSION 1
+// records start one page into the file
+#define SAMPLE_LOG_HEADER_SIZE 4096
+#define SAMPLE_LOG_DEFAULT_SEGMENT_SECONDS 600
+
+/**
+ * Destination of a recording: SampleLog, or PackedLog for the compressed
+ * format. write() is called on the acquisition thread.
+ */
+class SampleRecorder {
+    public:
+        virtual ~SampleRecorder() {}
+        virtual bool write(const Sample* samples, uint32_t count) = 0;
+        virtual void close() = 0;
+        virtual uint64_t getCount() const = 0;
+        virtual uint32_t getSegments() const = 0;
+        virtual int getError() const = 0;
+};
+
+/**
+ * Segment header. Fixed width, little endian fields only, so the layout is
+ * the file format.
+ */
+struct SampleLogHeader {
+    char magic[8];              // SAMPLE_LOG_MAGIC
+    uint32_t version;           // SAMPLE_LOG_VERSION
+    uint32_t headerSize;        // byte offset of the first record
+    uint32_t recordSize;        // sizeof(Sample)
+    uint32_t capacity;          // records this segment has room for
+    uint32_t count;             // records written as of the last flush
+    uint32_t segment;           // 0 for the first file of a recording
+    uint32_t rate;              // samples per second when recording started
+    uint32_t sensors;           // SENSOR_* mask of the recorded fields
+    uint64_t startMonotonic;    // CLOCK_MONOTONIC ns, the clock of Sample.timestamp
+    uint64_t startRealtime;     // CLOCK_REALTIME ns at the same moment
+    uint8_t accelRange;         // MPU6050 AFS_SEL
+    uint8_t gyroRange;          // MPU6050 FS_SEL
+    uint8_t magGain;            // HMC5883L gain setting
+    uint8_t baroOversampling;   // ms5611_osr_t
+    float accelScale;           // g per LSB
+    float gyroScale;            // deg/s per LSB
+    float magScale;             // uT per LSB, after magCorrection
+    uint16_t baroCoefficients[6]; // MS5611 PROM C1-C6
+    int16_t accelOffset[3];     // MPU6050 offset registers, already applied
+    int16_t gyroOffset[3];      //   to the recorded counts
+    float magCorrectionScale[3];  // MagCorrection: matrix * (raw * scale - offset)
+    float magCorrectionOffset[3];
+    float magCorrectionMatrix[9];
+    uint8_t mpuAddress;
+    uint8_t reserved[3];
+};
+
+class SampleLog : public SampleRecorder {
+    public:
+        SampleLog();
+        ~SampleLog();
+
+        bool open(const char* path, const SampleLogHeader& header, uint32_t segmentRecords);
+        bool write(const Sample* samples, uint32_t count);
+        void flush();
+        void close();
+
+        bool isOpen() const;
+        uint64_t getCount() const;
+        uint32_t getSegments() const;
+        int getError() const;
+
+        static std::string segmentPath(const std::string& path, uint32_t segment);
+
+    private:
+        bool openSegment();
+        void closeSegment();
+
+        std::string mPath;
+        SampleLogHeader mTemplate;
+        uint32_t mCapacity;
+
+        int mFd;
+        uint8_t* mMap;
+        size_t mMapSize;
+        SampleLogHeader* mHeader;
+        Sample* mRecords;
+        uint32_t mSegment;
+        uint32_t mCount;          // records in the current segment
+        uint32_t mFlushed;        // of which covered by the last flush
+        uint64_t mFlushTimestamp; // Sample.timestamp of the last flush
+        uint64_t mTotal;
+        int mError;               // errno of the first failure, 0 if none
+};
+
+class PackedLogReader;
+
+/**
+ * Read side of a recording: maps every segment of it read-only and serves
+ * the records by index across segment boundaries. Compressed recordings
+ * (PackedLog) are detected and decoded block by block.
+ */
+class SampleLogReader {
+    public:
+        SampleLogReader();
+        ~SampleLogReader();
+
+        bool open(const char* path);
+        void close();
+
+        const SampleLogHeader& getHeader() const;
+        uint64_t getCount() const;
+        const Sample* at(uint64_t index);
+        uint64_t find(uint64_t timestamp);
+        bool isPacked() const;
+        int getError() const;
+
+    private:
+        struct Segment {
+            void* map;
+            size_t size;
+            const Sample* records;
+            uint64_t first; // index of records[0] in the recording
+            uint32_t count;
+        };
+
+        bool openSegment(const std::string& file, bool first);
+
+        std::vector<Segment> mSegments;
+        PackedLogReader* mPacked;
+        SampleLogHeader mHeader;
+        uint64_t mCount;
+        size_t mCurrent; // segment of the last at(), reads are mostly sequential
+        int mError;
+};
+
+#endif /* _SAMPLE_LOG_H_ */
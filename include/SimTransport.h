@@ -0,0 +1,76 @@
+// Simulated GY-86 bus
+//
+// Register level model of the three chips on the GY-86 board, good enough to
+// exercise the drivers and the binding without hardware: benchmarks, CI and
+// development on a desktop. Selected with the I2C_SIM_BUS bus name.
+//
+//  - MPU6050 at 0x68 and 0x69: a board slowly rocking around X with a fixed
+//    sensor bias, offset registers, full scale ranges, sample rate divider,
+//    the FIFO, the free-fall, motion and zero-motion detectors, and
+//    low-power cycle mode with gyro standby
+//  - HMC5883L at 0x1E: the earth field rotated with the board plus a hard-iron
+//    offset, gain, self-test bias and overflow
+//  - MS5611 at 0x77: the datasheet PROM and conversion example values
+//
+// Signals are a function of the monotonic clock, so two reads at the same
+// time see the same board.
+
+#ifndef _SIMTRANSPORT_H_
+#define _SIMTRANSPORT_H_
+
+#include <stdint.h>
+#include <mutex>
+
+#include "I2CTransport.h"
+
+#define SIM_MPU_COUNT 2
+#define SIM_FIFO_SIZE 1024
+
+class SimTransport : public I2CTransport {
+    public:
+        SimTransport();
+
+        static SimTransport* shared();
+
+        int8_t readBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data);
+        bool writeBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data);
+        bool writeCommand(uint8_t devAddr, uint8_t command);
+
+    private:
+        struct MPU {
+            uint8_t regs[128];
+            uint8_t fifo[SIM_FIFO_SIZE];
+            uint16_t fifoHead;  // next byte to read
+            uint16_t fifoCount;
+            uint64_t lastSample; // sample index last pushed into the FIFO
+            bool cycle;          // lastSample counts low-power wakeups
+            bool primed;         // detector state below is valid
+            double lowPass[3];   // g, the part the motion high-pass removes
+            double motionTime;   // ms the motion condition has held
+            double freefallTime; // ms the free-fall condition has held
+            double stillTime;    // ms the zero-motion condition has held
+            bool still;          // zero motion detected
+        };
+
+        void resetMPU(MPU* mpu);
+        void sampleMPU(const MPU* mpu, double t, int16_t* out);
+        void updateFIFO(MPU* mpu, double t);
+        void detectMotion(MPU* mpu, const int16_t* v, double period);
+        uint8_t readMPU(MPU* mpu, uint8_t regAddr, double t);
+        void writeMPU(MPU* mpu, uint8_t regAddr, uint8_t value);
+
+        void sampleMag(double t, int16_t* out);
+        uint8_t readMag(uint8_t regAddr, double t);
+
+        double now();
+
+        std::mutex mLock;
+        double mStart;
+        MPU mMPU[SIM_MPU_COUNT];
+        uint8_t mMagRegs[13];
+        int16_t mMagLatched[3];
+        uint32_t mBaroValue;
+        uint32_t mNoise;
+};
+
+#endif /* _SIMTRANSPORT_H_ */
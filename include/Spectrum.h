@@ -0,0 +1,98 @@
+// Vibration spectrum
+//
+// Spectra of the accelerometer and gyro axes computed next to the
+// acquisition, so a vibration survey does not have to ship every raw
+// sample to JS. Every hop samples the last size samples of each axis, less
+// their mean, go through a Hann window and a radix-2 FFT; overlapping
+// frames are averaged as power (Welch's method) until the publishing
+// interval has passed, and then turned into one SpectrumResult: the
+// amplitude spectrum, the strongest peaks of each axis at interpolated
+// frequencies, and the RMS within a set of frequency bands.
+//
+// The six axes are one frame of floats padded to SPECTRUM_STRIDE, so each
+// butterfly is a loop over contiguous axes that gcc vectorizes, like the
+// decimator and the biquad bank. Bit reversal and twiddle factors are
+// tables computed once for the size.
+//
+// Everything works in raw counts; the caller applies the unit scales. The
+// acquisition thread writes samples, another thread takes the results; at
+// most SPECTRUM_MAX_PENDING wait to be taken, later ones are counted as
+// missed.
+
+#ifndef _SPECTRUM_H_
+#define _SPECTRUM_H_
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "Acquisition.h"
+
+#define SPECTRUM_CHANNELS 6 // accel x, y, z, gyro x, y, z
+#define SPECTRUM_STRIDE 8
+#define SPECTRUM_MIN_SIZE 16
+#define SPECTRUM_MAX_SIZE 4096
+#define SPECTRUM_MAX_PEAKS 8
+#define SPECTRUM_MAX_BANDS 16
+#define SPECTRUM_MAX_PENDING 4
+
+struct SpectrumSettings {
+    uint32_t size;          // FFT length, a power of 2
+    uint32_t hop;           // samples between frames, size for no overlap
+    uint64_t interval;      // ns of sample time between results
+    uint32_t peaks;         // per axis
+    std::vector<float> bands; // Hz, low and high edge of each band
+};
+
+struct SpectrumResult {
+    uint64_t timestamp;     // Sample.timestamp of the newest sample
+    uint32_t rate;          // Hz the samples were taken at
+    uint32_t frames;        // FFTs averaged
+    uint32_t bins;          // size / 2 + 1, 0 Hz to rate / 2
+    std::vector<float> amplitude; // bins per axis, peak amplitude of a sine
+    std::vector<float> peaks;     // peaks per axis, frequency and amplitude,
+                                  // strongest first, 0 where there are fewer
+    std::vector<float> bands;     // RMS of each band per axis
+};
+
+class SpectrumAnalyzer {
+    public:
+        SpectrumAnalyzer(const SpectrumSettings& settings);
+
+        void write(const Sample* samples, uint32_t count, uint32_t rate);
+        bool take(SpectrumResult* result);
+
+        uint64_t getMissed() const;
+
+    private:
+        void restart();
+        void transform();
+        void publish();
+
+        SpectrumSettings mSettings;
+        std::vector<float> mWindow;
+        float mWindowSum;          // amplitude gain of the window
+        float mWindowPower;        // sum of the squared window
+        std::vector<uint32_t> mReverse;
+        std::vector<float> mCos;   // size / 2 twiddle factors
+        std::vector<float> mSin;
+
+        // acquisition thread
+        std::vector<float> mInput; // size frames, oldest first
+        uint32_t mFill;
+        std::vector<float> mRe;    // size frames each
+        std::vector<float> mIm;
+        std::vector<float> mPower; // bins frames, summed over mFrames
+        uint32_t mFrames;
+        uint32_t mRate;            // of the samples in mInput, 0 before any
+        uint64_t mTimestamp;       // of the newest sample
+        uint64_t mStart;           // of the first sample since the last result
+
+        // guarded by mLock
+        mutable std::mutex mLock;
+        std::deque<SpectrumResult> mDone;
+        uint64_t mMissed;
+};
+
+#endif /* _SPECTRUM_H_ */
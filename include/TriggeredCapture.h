@@ -0,0 +1,95 @@
+// Triggered capture
+//
+// Keeps only the samples around an event instead of everything. The
+// acquisition thread feeds every sample into a rolling pre-trigger ring in
+// memory; when a trigger fires, the ring (the seconds before the event), the
+// trigger sample and the samples that follow it up to the post-trigger
+// length become one CaptureEvent, which another thread takes and persists.
+//
+// Triggers are the MPU6050 free-fall and motion interrupts, as reported by
+// Acquisition in Sample.flags (up to a poll interval after the fact, which
+// the pre-trigger window covers), and software thresholds on the magnitude
+// of the acceleration: above a shock level, or below a free-fall level for
+// a number of consecutive samples. A trigger while the post-trigger window
+// is still being filled belongs to the event in progress.
+//
+// Nothing is allocated per sample. The buffer of an event is reserved when
+// it triggers and handed over whole; at most CAPTURE_MAX_PENDING events wait
+// to be taken, later ones are counted as missed.
+
+#ifndef _TRIGGERED_CAPTURE_H_
+#define _TRIGGERED_CAPTURE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "Acquisition.h"
+
+// CaptureSettings.triggers and CaptureEvent.reason
+#define CAPTURE_SHOCK        0x01 // software, |accel| above shockThreshold
+#define CAPTURE_FREEFALL     0x02 // software, |accel| below freefallThreshold
+#define CAPTURE_HW_FREEFALL  0x04 // SAMPLE_FREEFALL
+#define CAPTURE_HW_MOTION    0x08 // SAMPLE_MOTION
+#define CAPTURE_MANUAL       0x10 // trigger()
+
+#define CAPTURE_MAX_PENDING 8
+
+struct CaptureSettings {
+    uint32_t preSamples;        // kept before the trigger sample
+    uint32_t postSamples;       // collected after it
+    uint32_t triggers;          // CAPTURE_* sources that fire
+    uint32_t shockThreshold;    // accel counts
+    uint32_t freefallThreshold; // accel counts
+    uint32_t freefallSamples;   // consecutive samples below freefallThreshold
+};
+
+struct CaptureEvent {
+    uint64_t sequence;          // 1 for the first event of a capture
+    uint32_t reason;            // CAPTURE_* that fired, or'ed while filling
+    uint32_t trigger;           // index of the trigger sample in samples
+    uint64_t timestamp;         // Sample.timestamp of the trigger sample
+    std::vector<Sample> samples;
+};
+
+class TriggeredCapture {
+    public:
+        TriggeredCapture(const CaptureSettings& settings);
+
+        void write(const Sample* samples, uint32_t count);
+        void trigger();
+        bool take(CaptureEvent* event);
+
+        bool isCapturing() const;
+        uint64_t getEvents() const;
+        uint64_t getMissed() const;
+
+    private:
+        uint32_t check(const Sample& sample);
+        void begin(const Sample& sample, uint32_t reason);
+
+        CaptureSettings mSettings;
+        uint64_t mShock;            // shockThreshold squared
+        uint64_t mFreefall;         // freefallThreshold squared
+
+        // acquisition thread
+        std::vector<Sample> mRing;  // preSamples, oldest at mRingHead once full
+        uint32_t mRingHead;
+        uint32_t mRingCount;
+        uint32_t mBelow;            // consecutive samples under the free-fall level
+        CaptureEvent mCurrent;
+        bool mCapturing;
+        uint32_t mRemaining;        // post-trigger samples still to collect
+        uint64_t mSequence;
+        std::atomic<bool> mManual;  // set by trigger(), any thread
+
+        // guarded by mLock
+        mutable std::mutex mLock;
+        std::deque<CaptureEvent> mDone;
+        uint64_t mEvents;
+        uint64_t mMissed;
+};
+
+#endif /* _TRIGGERED_CAPTURE_H_ */
@@ -0,0 +1,55 @@
+// Physical units
+//
+// Scale factors from raw counts to g, deg/s, uT, deg C and hPa, and batch
+// conversions of acquisition Samples into float arrays in those units. The
+// scales follow the range and gain settings the caller shadows here when it
+// writes them to the chips, so converting never touches the bus. Batches
+// are gathered out of the Sample records a block at a time and then scaled
+// in contiguous loops that gcc vectorizes. Accel and gyro batches also come
+// in Q16.16 fixed point, one integer multiply per value.
+
+#ifndef _UNITS_H_
+#define _UNITS_H_
+
+#include <stdint.h>
+
+#include "Fixed.h"
+
+struct Sample;
+struct MagCorrection;
+
+class UnitScales {
+    public:
+        UnitScales();
+
+        void setAccelRange(uint8_t range);
+        void setGyroRange(uint8_t range);
+        void setMagGain(uint8_t gain);
+        uint8_t getAccelRange() const;
+        uint8_t getGyroRange() const;
+        uint8_t getMagGain() const;
+
+        float getAccelScale() const;
+        float getGyroScale() const;
+        float getMagScale() const;
+
+        void toUnits(float* frame, uint32_t axes) const;
+        void accel(const Sample* samples, uint32_t count, float* out) const;
+        void gyro(const Sample* samples, uint32_t count, float* out) const;
+        void accel(const Sample* samples, uint32_t count, q16_t* out) const;
+        void gyro(const Sample* samples, uint32_t count, q16_t* out) const;
+        void mag(const Sample* samples, uint32_t count, const MagCorrection& correction, float* out) const;
+        static void temperature(const Sample* samples, uint32_t count, float* out);
+
+        static float temperature(int16_t raw);
+
+    private:
+        uint8_t mAccelRange;
+        uint8_t mGyroRange;
+        uint8_t mMagGain;
+        float mAccelScale;  // g per LSB
+        float mGyroScale;   // deg/s per LSB
+        float mMagScale;    // uT per LSB
+};
+
+#endif /* _UNITS_H_ */
@@ -1,4 +1,369 @@
-exports.RPiGY86 = require('./lib/binding/rpi_gy86').RPiGY86;
+var EventEmitter = require('events').EventEmitter;
+var Readable = require('stream').Readable;
+var util = require('util');
+var RPiGY86 = require('./lib/binding/rpi_gy86').RPiGY86;
+
+var SENSOR = {
+    ACCEL       : 0x01,
+    GYRO        : 0x02,
+    TEMPERATURE : 0x04,
+    MAG         : 0x08,
+    BARO        : 0x10,
+    ALL         : 0x1F
+};
+
+// getMotion6([buffer[, offset]]), getMotion9([buffer[, offset]]) and
+// readLatest(buffer[, offset]) return the buffer they filled, or a new array
+// without one. The native calls return nothing for a buffer, so that V8 can
+// call them through the fast API; each arity gets its own call site.
+['getMotion6', 'getMotion9', 'readLatest'].forEach(function (name) {
+    var native = '_' + name;
+    RPiGY86.prototype[name] = function (buffer, offset) {
+        switch (arguments.length) {
+        case 0:
+            return this[native]();
+        case 1:
+            this[native](buffer);
+            return buffer;
+        default:
+            this[native].apply(this, arguments);
+            return buffer;
+        }
+    };
+});
+
+// asynchronous variants: bus I/O runs on the libuv threadpool and calls made
+// while the same read is in flight share its result. Without a callback a
+// Promise is returned.
+['getMotion6', 'getMotion9', 'getHeadingXYZ', 'getHeading',
+ 'getTiltCompensatedHeading'].forEach(function (name) {
+    RPiGY86.prototype[name + 'Async'] = function (callback) {
+        var self = this;
+        if (typeof callback === 'function') {
+            return self['_' + name + 'Async'](callback);
+        }
+        return new Promise(function (resolve, reject) {
+            self['_' + name + 'Async'](function (err, result) {
+                if (err) {
+                    reject(err);
+                } else {
+                    resolve(result);
+                }
+            });
+        });
+    };
+});
+
+// options: maxIterations (default 20), timeout (ms, default 10000),
+// samples (per iteration, default 250), onProgress(progress) called after
+// every iteration. Without a callback a Promise is returned.
+RPiGY86.prototype.calibrateMPU6050Async = function (options, callback) {
+    var self = this;
+    if (typeof options === 'function') {
+        callback = options;
+        options = undefined;
+    }
+    var onProgress = options && options.onProgress;
+    if (typeof callback === 'function') {
+        return self._calibrateMPU6050Async(options, onProgress, callback);
+    }
+    return new Promise(function (resolve, reject) {
+        self._calibrateMPU6050Async(options, onProgress, function (err, offsets) {
+            if (err) {
+                reject(err);
+            } else {
+                resolve(offsets);
+            }
+        });
+    });
+};
+
+// reads count magnetometer samples into the calibration started with
+// .startMagCalibration() and gives the total collected so far. Without a
+// callback a Promise is returned.
+RPiGY86.prototype.sampleMagCalibrationAsync = function (count, callback) {
+    var self = this;
+    if (typeof callback === 'function') {
+        return self._sampleMagCalibrationAsync(count, callback);
+    }
+    return new Promise(function (resolve, reject) {
+        self._sampleMagCalibrationAsync(count, function (err, total) {
+            if (err) {
+                reject(err);
+            } else {
+                resolve(total);
+            }
+        });
+    });
+};
+
+// sensors: a SENSOR mask or an array of names, e.g. ['accel', 'gyro']
+function sensorMask(sensors) {
+    if (sensors === undefined) {
+        return SENSOR.ACCEL | SENSOR.GYRO;
+    }
+    if (typeof sensors === 'number') {
+        return sensors & SENSOR.ALL;
+    }
+    return sensors.reduce(function (mask, name) {
+        var bit = SENSOR[String(name).toUpperCase()];
+        if (bit === undefined) {
+            throw new TypeError('unknown sensor: ' + name);
+        }
+        return mask | bit;
+    }, 0);
+}
+
+// .stream() filter option: anti-alias filtering and decimation from
+// inputRate to rate, through FIR stages or a CIC stage and its compensator
+var FILTER = { none: 0, fir: 1, cic: 2 };
+
+// Readable over the native acquisition ring. Every chunk is one batch of
+// samples. A consumer that does not keep up never makes the stream buffer
+// more than highWaterMark: the ring keeps running and the consumer either
+// loses the samples that are overwritten ('drop') or gets every other sample
+// while it is more than half a ring behind ('decimate'). Both are counted in
+// .dropped and .decimated.
+function SampleStream(gy86, options) {
+    var binary = !!options.binary;
+    var readableOptions = { objectMode: !binary };
+    if (options.highWaterMark !== undefined) {
+        readableOptions.highWaterMark = options.highWaterMark;
+    }
+    Readable.call(this, readableOptions);
+
+    var units = options.units || gy86.getUnits();
+    if (units !== 'raw' && units !== 'si') {
+        throw new TypeError('unknown units: ' + units);
+    }
+    var filter = FILTER[options.filter || 'none'];
+    if (filter === undefined) {
+        throw new TypeError('unknown filter: ' + options.filter);
+    }
+    var self = this;
+    this._gy86 = gy86;
+    this._binary = binary;
+    this._wanted = false;
+    this._id = gy86._streamOpen(options.rate || 100, sensorMask(options.sensors),
+            options.batch || 10, options.overflow === 'decimate', units === 'si',
+            filter, options.inputRate || 1000, function () { self._pump(); });
+}
+util.inherits(SampleStream, Readable);
+
+SampleStream.prototype._read = function () {
+    this._wanted = true;
+    this._pump();
+};
+
+SampleStream.prototype._pump = function () {
+    while (this._wanted && this._id !== null) {
+        var batch = this._gy86._streamRead(this._id, this._binary);
+        if (batch === null) {
+            return; // called again once a batch is ready
+        }
+        this._wanted = this.push(batch);
+    }
+};
+
+SampleStream.prototype._destroy = function (err, callback) {
+    this._close();
+    callback(err);
+};
+
+SampleStream.prototype._close = function () {
+    if (this._id !== null) {
+        this._stats = this._gy86._streamStats(this._id);
+        this._gy86._streamClose(this._id);
+        this._id = null;
+    }
+};
+
+SampleStream.prototype._stat = function (index) {
+    var stats = this._id !== null ? this._gy86._streamStats(this._id) : this._stats;
+    return stats ? stats[index] : 0;
+};
+
+Object.defineProperties(SampleStream.prototype, {
+    // samples overwritten before this stream read them
+    dropped   : { get: function () { return this._stat(0); } },
+    // samples skipped to catch up, 'decimate' overflow only
+    decimated : { get: function () { return this._stat(1); } },
+    // hardware FIFO overflows of the acquisition, shared by all streams
+    overflows : { get: function () { return this._stat(2); } },
+    // Hz of the samples delivered
+    rate      : { get: function () { return this._stat(3); } }
+});
+
+// options: rate (Hz, default 100), sensors (default accel and gyro),
+// batch (samples per chunk, default 10), binary (chunks are Buffers of raw
+// 40 byte records), overflow ('drop' or 'decimate'), units ('raw' or 'si',
+// default getUnits()), filter ('none', 'fir' or 'cic') with inputRate (Hz,
+// default 1000), highWaterMark
+RPiGY86.prototype.stream = function (options) {
+    return new SampleStream(this, options || {});
+};
+
+// Share the acquisition ring with worker_threads: returns a
+// SharedArrayBuffer to pass to workers, which read it with ring.js. Starts
+// the acquisition (or raises its rate) until releaseSharedRing(). Workers
+// blocked in Atomics.wait() are woken from this thread's event loop.
+RPiGY86.prototype.sharedRing = function (options) {
+    options = options || {};
+    if (!this._sharedRing) {
+        this._sharedRing = this._ringBuffer();
+    }
+    var header = new Int32Array(this._sharedRing, 0, 4);
+    this._ringStart(options.rate || 100, sensorMask(options.sensors), function () {
+        Atomics.notify(header, 0);
+    });
+    return this._sharedRing;
+};
+
+RPiGY86.prototype.releaseSharedRing = function () {
+    this._ringStop();
+};
+
+var BIQUAD = { notch: 1, lowpass: 2 };
+
+// filters: [{ type ('notch' or 'lowpass'), frequency (Hz), q, sensors
+// (default accel and gyro) }], run on the acquisition thread in front of the
+// attitude filter, the EKF and readLatest(); a new list replaces the old
+// one without a jump in the output
+RPiGY86.prototype.setFilters = function (filters) {
+    this._setFilters((filters || []).map(function (filter) {
+        var type = BIQUAD[filter.type];
+        if (type === undefined) {
+            throw new TypeError('unknown filter type: ' + filter.type);
+        }
+        return { type: type, sensors: sensorMask(filter.sensors), frequency: filter.frequency, q: filter.q };
+    }));
+};
+
+// Sample.flags as passed to the ._motionStart() callback
+var SAMPLE = {
+    MAG         : 0x01,
+    BARO        : 0x02,
+    GAP         : 0x04,
+    FREEFALL    : 0x08,
+    MOTION      : 0x10,
+    ZERO_MOTION : 0x20,
+    LOW_POWER   : 0x40
+};
+
+// ._motionStart() callback flags of a low-power policy transition
+var POWER_MODE = 0x10000;
+
+// MOT_DETECT_STATUS, bits 8-15 of the flags: negative/positive bit per axis
+function motionAxis(status, negative) {
+    return status & (1 << negative) ? -1 : status & (1 << (negative - 1)) ? 1 : 0;
+}
+
+function MotionEvents(gy86, options) {
+    EventEmitter.call(this);
+    var self = this;
+    this._gy86 = gy86;
+    gy86._motionStart(options, function (timestamp, flags) {
+        var status = (flags >> 8) & 0xff;
+        if (flags & POWER_MODE) {
+            self.emit(flags & SAMPLE.LOW_POWER ? 'lowPower' : 'fullRate', { timestamp: timestamp });
+            return;
+        }
+        if (flags & SAMPLE.FREEFALL) {
+            self.emit('freefall', { timestamp: timestamp });
+        }
+        if (flags & SAMPLE.MOTION) {
+            self.emit('motion', { timestamp: timestamp, x: motionAxis(status, 7),
+                    y: motionAxis(status, 5), z: motionAxis(status, 3) });
+        }
+        if (flags & SAMPLE.ZERO_MOTION) {
+            self.emit(status & 1 ? 'zeroMotion' : 'zeroMotionEnd', { timestamp: timestamp });
+        }
+    });
+}
+util.inherits(MotionEvents, EventEmitter);
+
+MotionEvents.prototype.close = function () {
+    if (this._gy86) {
+        this._gy86._motionStop();
+        this._gy86 = null;
+    }
+};
+
+// options: motion, freefall, zeroMotion (thresholds in mg), motionTime,
+// freefallTime, zeroMotionTime (ms), rate (Hz, default 50). Without any
+// threshold, motion 40, freefall 300 and zeroMotion 8 are detected.
+// lowPower: { wakeRate (Hz), wake (mg), stillTime (ms), stillNoise (mg) }
+// sleeps the MPU6050 while the board is still.
+RPiGY86.prototype.motionEvents = function (options) {
+    var settings = {};
+    Object.keys(options || {}).forEach(function (key) {
+        settings[key] = options[key];
+    });
+    if (settings.motion === undefined && settings.freefall === undefined &&
+            settings.zeroMotion === undefined) {
+        settings.motion = 40;
+        settings.freefall = 300;
+        settings.zeroMotion = 8;
+    }
+    return new MotionEvents(this, settings);
+};
+
+// one Float32Array row per axis, accel x, y, z then gyro x, y, z
+function spectrumAxes(values, offset) {
+    var row = values.length / 6;
+    return [0, 1, 2].map(function (axis) {
+        return values.subarray((offset + axis) * row, (offset + axis + 1) * row);
+    });
+}
+
+function spectrumPeaks(row) {
+    var peaks = [];
+    for (var i = 0; i < row.length; i += 2) {
+        if (row[i + 1] > 0) {
+            peaks.push({ frequency: row[i], amplitude: row[i + 1] });
+        }
+    }
+    return peaks;
+}
+
+function spectrumSensor(result, offset) {
+    return {
+        amplitude: spectrumAxes(result.amplitude, offset),
+        peaks: spectrumAxes(result.peaks, offset).map(spectrumPeaks),
+        bands: spectrumAxes(result.bands, offset)
+    };
+}
+
+function VibrationSpectrum(gy86, options) {
+    EventEmitter.call(this);
+    var self = this;
+    this._gy86 = gy86;
+    gy86._spectrumStart(options, function (result) {
+        self.emit('spectrum', { timestamp: result.timestamp, rate: result.rate, frames: result.frames,
+                resolution: result.resolution, accel: spectrumSensor(result, 0),
+                gyro: spectrumSensor(result, 3) });
+    });
+}
+util.inherits(VibrationSpectrum, EventEmitter);
+
+VibrationSpectrum.prototype.close = function () {
+    if (this._gy86) {
+        this._gy86._spectrumStop();
+        this._gy86 = null;
+    }
+};
+
+// options: rate (Hz, default 1000), size (samples per FFT, default 256),
+// overlap (default 0.5), interval (ms between 'spectrum' events, default
+// 1000), peaks (per axis, default 3), bands ([[low, high], ...] in Hz)
+RPiGY86.prototype.spectrum = function (options) {
+    return new VibrationSpectrum(this, options || {});
+};
+
+exports.RPiGY86 = RPiGY86;
+exports.SENSOR = SENSOR;
+exports.SAMPLE = SAMPLE;
+exports.SampleRingReader = require('./ring.js').SampleRingReader;
 exports.HMC5883L = { 
     GAIN_1370 : 0,  // 0.73 mG/LSb
     GAIN_1090 : 1,  // 0.92 mG/LSb
@@ -0,0 +1,135 @@
+// Reader for the sample ring shared by RPiGY86.prototype.sharedRing().
+//
+// Does not load the native binding, so it can be required from a
+// worker_thread. Layout of the SharedArrayBuffer (little endian):
+//   header, 4 x int32 : head (samples written, wraps), capacity (a power of
+//                       two), record size (40), rate (Hz)
+//   capacity records  : u64 timestamp (ns), int16 accel[3], int16
+//                       temperature, int16 gyro[3], int16 mag[3], u32 D1,
+//                       u32 D2, u32 flags
+// Only the acquisition thread writes; every reader keeps its own tail, so
+// any number of threads can read the same ring without copying it around.
+
+var HEADER_INTS = 4;
+var HEADER_BYTES = HEADER_INTS * 4;
+
+function SampleRingReader(buffer) {
+    this.header = new Int32Array(buffer, 0, HEADER_INTS);
+    this.capacity = this.header[1];
+    var recordSize = this.header[2];
+    if (recordSize !== 40) {
+        throw new Error('unsupported sample record size ' + recordSize);
+    }
+    this._u32 = new Uint32Array(buffer, HEADER_BYTES);
+    this._i16 = new Int16Array(buffer, HEADER_BYTES);
+    this.tail = Atomics.load(this.header, 0) >>> 0;
+    this.dropped = 0;
+}
+
+// preallocated destination for read(); raw values as in the records
+SampleRingReader.prototype.createBatch = function (size) {
+    return {
+        count       : 0,
+        timestamp   : new Float64Array(size),      // ms
+        accel       : new Int16Array(3 * size),
+        temperature : new Int16Array(size),
+        gyro        : new Int16Array(3 * size),
+        mag         : new Int16Array(3 * size),
+        pressure    : new Uint32Array(size),       // MS5611 D1
+        baroTemperature : new Uint32Array(size),   // MS5611 D2
+        flags       : new Uint32Array(size)
+    };
+};
+
+SampleRingReader.prototype.rate = function () {
+    return Atomics.load(this.header, 3);
+};
+
+SampleRingReader.prototype.available = function () {
+    return Math.min((Atomics.load(this.header, 0) - this.tail) >>> 0, this.capacity - 1);
+};
+
+// Block until a sample is available or timeout ms passed. The owner of the
+// RPiGY86 object wakes waiters from its event loop, so pass a timeout if
+// that thread may be busy. Not allowed on the main thread.
+SampleRingReader.prototype.wait = function (timeout) {
+    if (this.available() > 0) {
+        return true;
+    }
+    Atomics.wait(this.header, 0, this.tail | 0, timeout);
+    return this.available() > 0;
+};
+
+// Copy up to batch.timestamp.length new samples into batch. A reader more
+// than a ring behind skips to the oldest intact sample and counts the rest
+// in .dropped.
+// returns batch.count
+SampleRingReader.prototype.read = function (batch) {
+    var capacity = this.capacity;
+    var mask = capacity - 1;
+    var head = Atomics.load(this.header, 0) >>> 0;
+    var start = this.tail;
+    // the slot of the oldest sample may be being rewritten
+    var behind = (head - start) >>> 0;
+    if (behind > capacity - 1) {
+        this.dropped += behind - (capacity - 1);
+        start = (head - (capacity - 1)) >>> 0;
+        behind = capacity - 1;
+    }
+    var count = Math.min(behind, batch.timestamp.length);
+    for (var i = 0; i < count; i++) {
+        this._copy(((start + i) & mask) >>> 0, batch, i);
+    }
+
+    // drop whatever the writer overwrote while we were copying
+    var now = Atomics.load(this.header, 0) >>> 0;
+    var torn = ((now - start) >>> 0) - (capacity - 1);
+    if (torn > 0) {
+        this.dropped += torn;
+        if (torn >= count) {
+            this.tail = (start + torn) >>> 0;
+            batch.count = 0;
+            return 0;
+        }
+        shift(batch, torn, count);
+        count -= torn;
+        start = (start + torn) >>> 0;
+    }
+    this.tail = (start + count) >>> 0;
+    batch.count = count;
+    return count;
+};
+
+SampleRingReader.prototype._copy = function (slot, batch, i) {
+    var u32 = this._u32;
+    var i16 = this._i16;
+    var w = slot * 10; // record offset in 32 bit words
+    var h = slot * 20; // record offset in 16 bit words
+    batch.timestamp[i] = (u32[w] + u32[w + 1] * 4294967296) / 1e6;
+    batch.accel[3 * i] = i16[h + 4];
+    batch.accel[3 * i + 1] = i16[h + 5];
+    batch.accel[3 * i + 2] = i16[h + 6];
+    batch.temperature[i] = i16[h + 7];
+    batch.gyro[3 * i] = i16[h + 8];
+    batch.gyro[3 * i + 1] = i16[h + 9];
+    batch.gyro[3 * i + 2] = i16[h + 10];
+    batch.mag[3 * i] = i16[h + 11];
+    batch.mag[3 * i + 1] = i16[h + 12];
+    batch.mag[3 * i + 2] = i16[h + 13];
+    batch.pressure[i] = u32[w + 7];
+    batch.baroTemperature[i] = u32[w + 8];
+    batch.flags[i] = u32[w + 9];
+};
+
+function shift(batch, from, count) {
+    batch.timestamp.copyWithin(0, from, count);
+    batch.accel.copyWithin(0, 3 * from, 3 * count);
+    batch.temperature.copyWithin(0, from, count);
+    batch.gyro.copyWithin(0, 3 * from, 3 * count);
+    batch.mag.copyWithin(0, 3 * from, 3 * count);
+    batch.pressure.copyWithin(0, from, count);
+    batch.baroTemperature.copyWithin(0, from, count);
+    batch.flags.copyWithin(0, from, count);
+}
+
+exports.SampleRingReader = SampleRingReader;
@@ -0,0 +1,147 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "AHRS.h"
+
+#define RAD_TO_DEG (180.0f / (float)M_PI)
+
+// after reset() the filter starts from level and north; a high gain for the
+// first second pulls it onto the measured attitude instead of drifting
+// there at the normal gain
+#define AHRS_SETTLE_TIME    1.0f
+#define AHRS_SETTLE_BETA    2.5f
+#define AHRS_SETTLE_KP      10.0f
+// cap on the settling correction per update, as a fraction of the error
+#define AHRS_SETTLE_STEP    0.2f
+
+AHRS::AHRS()
+    : mFilter(AHRS_MADGWICK), mBeta(AHRS_DEFAULT_BETA), mKp(AHRS_DEFAULT_KP), mKi(AHRS_DEFAULT_KI) {
+    reset();
+}
+
+/** Switching keeps the current attitude.
+ */
+void AHRS::setFilter(AHRSFilter filter) {
+    mFilter = filter;
+    mIntegral[0] = mIntegral[1] = mIntegral[2] = 0;
+}
+
+AHRSFilter AHRS::getFilter() const {
+    return mFilter;
+}
+
+/** Madgwick gain, rad/s; larger follows the accelerometer and magnetometer
+ * faster but passes more of their noise.
+ */
+void AHRS::setBeta(float beta) {
+    mBeta = beta > 0 ? beta : 0;
+}
+
+float AHRS::getBeta() const {
+    return mBeta;
+}
+
+/** Mahony proportional and integral gains. A nonzero ki also learns the
+ * gyro bias.
+ */
+void AHRS::setGains(float kp, float ki) {
+    mKp = kp > 0 ? kp : 0;
+    mKi = ki > 0 ? ki : 0;
+    mIntegral[0] = mIntegral[1] = mIntegral[2] = 0;
+}
+
+float AHRS::getKp() const {
+    return mKp;
+}
+
+float AHRS::getKi() const {
+    return mKi;
+}
+
+void AHRS::reset() {
+    mQ[0] = 1;
+    mQ[1] = mQ[2] = mQ[3] = 0;
+    mIntegral[0] = mIntegral[1] = mIntegral[2] = 0;
+    mSettle = AHRS_SETTLE_TIME;
+}
+
+/** 1 / sqrt(x) for x > 0, see invSqrt() in AHRSCore.h.
+ */
+float AHRS::invSqrt(float x) {
+    return ::invSqrt(x);
+}
+
+/** Advance the filter by one sample.
+ * @param gyro Angular rate X/Y/Z in rad/s
+ * @param accel Accelerometer X/Y/Z, any unit; all zero skips the correction
+ * @param mag Corrected magnetometer X/Y/Z, any unit; NULL or all zero for
+ * an accel and gyro only update, which leaves yaw to the gyro
+ * @param dt Seconds since the previous sample
+ */
+void AHRS::update(const float* gyro, const float* accel, const float* mag, float dt) {
+    if (mag && mag[0] == 0 && mag[1] == 0 && mag[2] == 0) {
+        mag = NULL;
+    }
+    if (accel[0] == 0 && accel[1] == 0 && accel[2] == 0) {
+        accel = NULL;
+        mag = NULL;
+    }
+    bool settling = mSettle > 0;
+    if (settling) {
+        mSettle -= dt;
+    }
+    ahrs_scalar_t g[3] = { ahrs_scalar_t(gyro[0]), ahrs_scalar_t(gyro[1]), ahrs_scalar_t(gyro[2]) };
+    ahrs_scalar_t a[3], m[3];
+    if (accel) {
+        toDirection(accel, a);
+    }
+    if (mag) {
+        toDirection(mag, m);
+    }
+    if (mFilter == AHRS_MAHONY) {
+        float kp = mKp;
+        if (settling && dt > 0) {
+            kp = fminf(fmaxf(kp, AHRS_SETTLE_KP), AHRS_SETTLE_STEP / dt);
+        }
+        mahonyUpdate<ahrs_scalar_t>(mQ, mIntegral, g[0], g[1], g[2], accel ? a : NULL, mag ? m : NULL,
+                kp, mKi, dt);
+    } else {
+        float beta = mBeta;
+        if (settling && dt > 0) {
+            beta = fminf(fmaxf(beta, AHRS_SETTLE_BETA), AHRS_SETTLE_STEP / dt);
+        }
+        madgwickUpdate<ahrs_scalar_t>(mQ, g[0], g[1], g[2], accel ? a : NULL, mag ? m : NULL, beta, dt);
+    }
+}
+
+/** @param q Receives w, x, y, z
+ */
+void AHRS::getQuaternion(float* q) const {
+    for (int i = 0; i < 4; i++) {
+        q[i] = toFloat(mQ[i]);
+    }
+}
+
+/** @param euler Receives roll, pitch and yaw in degrees, see
+ * eulerFromQuaternion()
+ */
+void AHRS::getEuler(float* euler) const {
+    float q[4];
+    getQuaternion(q);
+    eulerFromQuaternion(q, euler);
+}
+
+/** Roll about X, pitch about Y and yaw about Z, applied in Z-Y-X order.
+ * Yaw grows counterclockwise seen from above, from magnetic north.
+ * @param q w, x, y, z
+ * @param euler Receives roll, pitch and yaw in degrees, -180 to 180
+ * (pitch -90 to 90)
+ */
+void AHRS::eulerFromQuaternion(const float* q, float* euler) {
+    float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    float sinp = 2 * (q0 * q2 - q1 * q3);
+    sinp = sinp > 1 ? 1 : (sinp < -1 ? -1 : sinp);
+    euler[0] = atan2f(2 * (q0 * q1 + q2 * q3), 1 - 2 * (q1 * q1 + q2 * q2)) * RAD_TO_DEG;
+    euler[1] = asinf(sinp) * RAD_TO_DEG;
+    euler[2] = atan2f(2 * (q0 * q3 + q1 * q2), 1 - 2 * (q2 * q2 + q3 * q3)) * RAD_TO_DEG;
+}
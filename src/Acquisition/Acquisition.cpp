@@ -0,0 +1,792 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "Acquisition.h"
+#include "MPU6050.h"
+#include "HMC5883L.h"
+#include "MS5611.h"
+
+#define NS_PER_SEC 1000000000ULL
+#define NS_PER_MS 1000000ULL
+
+// FIFO frame: accel X/Y/Z, temperature, gyro X/Y/Z, big endian
+#define FIFO_FRAME 14
+#define FIFO_SIZE 1024
+// frames per bus read, keeps each transfer under 256 bytes
+#define FIFO_CHUNK 18
+#define MAX_BATCH (FIFO_SIZE / FIFO_FRAME + 1)
+
+// HMC5883L at 75Hz, MS5611 OSR 4096 takes up to 9.04ms per conversion
+#define MAG_INTERVAL (NS_PER_SEC / 75)
+#define BARO_INTERVAL (10 * NS_PER_MS)
+
+// low power: cycle sample period of each MPU6050_WAKE_FREQ_*, and the
+// longest sleep between two looks at the motion interrupt
+static const uint64_t sWakePeriods[4] = { 800 * NS_PER_MS, 400 * NS_PER_MS, 200 * NS_PER_MS, 100 * NS_PER_MS };
+#define LOW_POWER_POLL (100 * NS_PER_MS)
+
+static uint64_t monotonicNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void sleepUntil(uint64_t t) {
+    struct timespec ts;
+    ts.tv_sec = t / NS_PER_SEC;
+    ts.tv_nsec = t % NS_PER_SEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+class MonotonicClock : public AcquisitionClock {
+    public:
+        uint64_t now() {
+            return monotonicNow();
+        }
+
+        void sleepUntil(uint64_t t) {
+            ::sleepUntil(t);
+        }
+};
+
+static MonotonicClock sMonotonicClock;
+
+static uint32_t roundUpPow2(uint32_t v) {
+    uint32_t p = 2;
+    while (p < v) {
+        p <<= 1;
+    }
+    return p;
+}
+
+SampleRing::SampleRing(uint32_t capacity) {
+    capacity = roundUpPow2(capacity);
+    // uint64_t keeps the records 8 byte aligned
+    mStorage.reset(new uint64_t[(bytesFor(capacity) + 7) / 8], std::default_delete<uint64_t[]>());
+    mHeader = (SampleRingHeader*)mStorage.get();
+    init(capacity);
+}
+
+/** Ring in caller supplied memory of at least bytesFor(capacity) bytes,
+ * 8 byte aligned. The memory is not owned.
+ * @param capacity Records, must be a power of two
+ */
+SampleRing::SampleRing(void* memory, uint32_t capacity) {
+    mHeader = (SampleRingHeader*)memory;
+    init(capacity);
+}
+
+SampleRing::~SampleRing() {
+}
+
+void SampleRing::init(uint32_t capacity) {
+    mRecords = (Sample*)(mHeader + 1);
+    mHeader->head = 0;
+    mHeader->capacity = capacity;
+    mHeader->recordSize = sizeof(Sample);
+    mHeader->rate = 0;
+}
+
+/*static*/
+uint32_t SampleRing::bytesFor(uint32_t capacity) {
+    return sizeof(SampleRingHeader) + capacity * sizeof(Sample);
+}
+
+/** Append samples. Single writer only.
+ * head is published after every record, and before the next record
+ * overwrites the oldest slot, so a reader can tell which records it copied
+ * may have been torn.
+ */
+void SampleRing::write(const Sample* samples, uint32_t count) {
+    uint32_t head = mHeader->head;
+    uint32_t mask = mHeader->capacity - 1;
+    for (uint32_t i = 0; i < count; i++) {
+        mRecords[head & mask] = samples[i];
+        head++;
+        __atomic_store_n(&mHeader->head, head, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+}
+
+/** Copy up to max records starting at *tail and advance *tail.
+ * A reader more than a ring behind is moved forward to the oldest record
+ * still intact and the skipped records are reported in *lost.
+ * @return number of records copied
+ */
+uint32_t SampleRing::read(uint32_t* tail, Sample* out, uint32_t max, uint32_t* lost) const {
+    uint32_t capacity = mHeader->capacity;
+    uint32_t mask = capacity - 1;
+    uint32_t head = __atomic_load_n(&mHeader->head, __ATOMIC_ACQUIRE);
+    uint32_t start = *tail;
+    *lost = 0;
+    // the slot of the oldest record may be being rewritten right now
+    if (head - start > capacity - 1) {
+        *lost = head - start - (capacity - 1);
+        start = head - (capacity - 1);
+    }
+    uint32_t count = head - start < max ? head - start : max;
+    for (uint32_t i = 0; i < count; i++) {
+        out[i] = mRecords[(start + i) & mask];
+    }
+
+    // drop whatever the writer reached while we were copying
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint32_t now = __atomic_load_n(&mHeader->head, __ATOMIC_RELAXED);
+    if (now - start > capacity - 1) {
+        uint32_t torn = now - start - (capacity - 1);
+        *lost += torn;
+        if (torn >= count) {
+            *tail = start + torn;
+            return 0;
+        }
+        memmove(out, out + torn, (count - torn) * sizeof(Sample));
+        count -= torn;
+        start += torn;
+    }
+    *tail = start + count;
+    return count;
+}
+
+uint32_t SampleRing::getHead() const {
+    return __atomic_load_n(&mHeader->head, __ATOMIC_ACQUIRE);
+}
+
+uint32_t SampleRing::getCapacity() const {
+    return mHeader->capacity;
+}
+
+void SampleRing::setRate(uint32_t rate) {
+    __atomic_store_n(&mHeader->rate, rate, __ATOMIC_RELAXED);
+}
+
+uint32_t SampleRing::getRate() const {
+    return __atomic_load_n(&mHeader->rate, __ATOMIC_RELAXED);
+}
+
+void* SampleRing::getMemory() const {
+    return mHeader;
+}
+
+/** Reference to the ring memory that keeps it alive after the ring is
+ * destroyed, for handing it to a SharedArrayBuffer. It owns nothing if the
+ * memory was supplied by the caller.
+ */
+std::shared_ptr<void> SampleRing::share() const {
+    return std::shared_ptr<void>(mStorage, mHeader);
+}
+
+/** Start reading at the current head of the ring.
+ * @param rate Samples per second to deliver; higher than the ring rate
+ *        delivers every sample
+ * @param decimate Skip samples instead of losing them when falling behind
+ */
+SampleReader::SampleReader(const SampleRing* ring, uint32_t rate, bool decimate)
+    : mRing(ring), mTail(ring->getHead()), mRate(rate), mDecimate(decimate),
+      mPeriod(rate ? NS_PER_SEC / rate : 0), mNextDue(0), mDropped(0),
+      mDecimated(0), mSkip(0), mCarryFlags(0) {
+}
+
+bool SampleReader::accept(const Sample& sample) {
+    // half a source period of slack absorbs timestamp jitter
+    uint32_t sourceRate = mRing->getRate();
+    uint64_t slack = sourceRate ? NS_PER_SEC / sourceRate / 2 : 0;
+    if (sample.timestamp + slack < mNextDue) {
+        mCarryFlags |= sample.flags;
+        return false;
+    }
+    mNextDue = sample.timestamp > mNextDue + mPeriod ? sample.timestamp + mPeriod : mNextDue + mPeriod;
+    return true;
+}
+
+/** Read up to max samples at the reader's rate, or fewer once the ring is
+ * drained.
+ * @return number of samples written to out
+ */
+uint32_t SampleReader::read(Sample* out, uint32_t max) {
+    bool behind = mDecimate && pending() > mRing->getCapacity() / 2;
+    if (mScratch.size() < max) {
+        mScratch.resize(max);
+    }
+    uint32_t count = 0;
+    while (count < max) {
+        uint32_t lost;
+        uint32_t n = mRing->read(&mTail, mScratch.data(), max - count, &lost);
+        mDropped += lost;
+        if (n == 0) {
+            break;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            const Sample& sample = mScratch[i];
+            if (!accept(sample)) {
+                continue;
+            }
+            if (behind && (mSkip++ & 1)) {
+                mCarryFlags |= sample.flags;
+                mDecimated++;
+                continue;
+            }
+            out[count] = sample;
+            out[count].flags |= mCarryFlags;
+            mCarryFlags = 0;
+            count++;
+        }
+    }
+    return count;
+}
+
+/** Samples in the ring not read yet, before rate decimation.
+ */
+uint32_t SampleReader::pending() const {
+    uint32_t available = mRing->getHead() - mTail;
+    return available < mRing->getCapacity() ? available : mRing->getCapacity();
+}
+
+/** Samples a read() would return now, estimated from pending() and the
+ * ratio of the reader and ring rates.
+ */
+uint32_t SampleReader::ready() const {
+    uint32_t sourceRate = mRing->getRate();
+    uint32_t available = pending();
+    if (sourceRate == 0 || mRate >= sourceRate) {
+        return available;
+    }
+    return (uint32_t)((uint64_t)available * mRate / sourceRate);
+}
+
+uint32_t SampleReader::getRate() const {
+    return mRate;
+}
+
+uint64_t SampleReader::getDropped() const {
+    return mDropped;
+}
+
+uint64_t SampleReader::getDecimated() const {
+    return mDecimated;
+}
+
+/** The devices are not owned. busLock is held around every bus transaction
+ * of the acquisition thread.
+ */
+Acquisition::Acquisition(std::mutex* busLock, MPU6050* mpu6050, HMC5883L* hmc5883l, MS5611* ms5611)
+    : mBusLock(busLock), mMPU6050(mpu6050), mHMC5883L(hmc5883l), mMS5611(ms5611),
+      mRunning(false), mListener(NULL), mClock(&sMonotonicClock), mRate(0), mSensors(0), mOverflows(0),
+      mLowPower(false), mSavedRate(0), mSavedDLPF(0), mSavedMagRate(0), mSavedClock(MPU6050_CLOCK_PLL_XGYRO),
+      mPressure(0), mBaroTemperature(0), mLastTimestamp(0), mNextMag(0), mBaroReady(0), mBaroPressure(true), mGap(false), mEvents(0),
+      mTemperature(0), mNextWake(0), mStillCount(0) {
+    memset(mMag, 0, sizeof(mMag));
+    memset(&mDetection, 0, sizeof(mDetection));
+    memset(&mPolicy, 0, sizeof(mPolicy));
+    memset(mStillSum, 0, sizeof(mStillSum));
+    memset(mStillSquares, 0, sizeof(mStillSquares));
+}
+
+Acquisition::~Acquisition() {
+    stop();
+}
+
+/** Start sampling, or widen what is already running.
+ * A running acquisition that is at least as fast and already reads the
+ * requested sensors is left alone; otherwise it is restarted at the higher
+ * rate with the union of the sensors. The ring carries on across restarts.
+ * @param rate Samples per second, rounded up to 1000 / n
+ * @param sensors SENSOR_* mask; accel, gyro and temperature are always read
+ * @return false if the MPU6050 could not be configured
+ */
+bool Acquisition::start(uint32_t rate, uint32_t sensors) {
+    if (rate > ACQUISITION_MAX_RATE) {
+        rate = ACQUISITION_MAX_RATE;
+    }
+    if (rate < 4) {
+        rate = 4;
+    }
+    if (mRunning) {
+        if (rate <= mRate && (sensors & ~mSensors) == 0) {
+            return true;
+        }
+        if (rate < mRate) {
+            rate = mRate;
+        }
+        sensors |= mSensors;
+        stop();
+    }
+
+    uint32_t divider = ACQUISITION_MAX_RATE / rate;
+    mRate = ACQUISITION_MAX_RATE / divider;
+    mSensors = sensors;
+    mRing.setRate(mRate);
+    {
+        std::lock_guard<std::mutex> lock(*mBusLock);
+        configure();
+    }
+    mRunning = true;
+    mThread = std::thread(&Acquisition::run, this);
+    return true;
+}
+
+void Acquisition::stop() {
+    if (!mRunning) {
+        return;
+    }
+    mRunning = false;
+    mThread.join();
+    std::lock_guard<std::mutex> lock(*mBusLock);
+    restore();
+}
+
+bool Acquisition::isRunning() const {
+    return mRunning;
+}
+
+uint32_t Acquisition::getRate() const {
+    return mRate;
+}
+
+uint32_t Acquisition::getSensors() const {
+    return mSensors;
+}
+
+SampleRing* Acquisition::getRing() {
+    return &mRing;
+}
+
+/** Set before start(); the listener is called on the acquisition thread.
+ */
+void Acquisition::setListener(AcquisitionListener* listener) {
+    mListener = listener;
+}
+
+/** Set before start(); NULL restores CLOCK_MONOTONIC. The clock is not
+ * owned.
+ */
+void Acquisition::setClock(AcquisitionClock* clock) {
+    mClock = clock ? clock : &sMonotonicClock;
+}
+
+/** Program the free-fall, motion and zero-motion detectors. Their
+ * interrupt status is cleared by the status read of every poll, so it is
+ * reported through the samples instead: SAMPLE_FREEFALL, SAMPLE_MOTION and
+ * SAMPLE_ZERO_MOTION with the motion status on the newest sample of the poll
+ * that saw it, up to one poll interval late. Takes effect at once
+ * if running; kept across restarts, stop() turns the interrupts off.
+ */
+void Acquisition::setMotionDetection(const MotionDetection& detection) {
+    mDetection = detection;
+    if (mRunning) {
+        std::lock_guard<std::mutex> lock(*mBusLock);
+        configureDetection();
+    }
+}
+
+/** Enable or disable adaptive sampling. Transitions happen on the
+ * acquisition thread and are reported through
+ * AcquisitionListener::onPowerMode(); disabling it wakes the MPU6050 at the
+ * next poll. Samples taken in low power carry SAMPLE_LOW_POWER and hold no
+ * gyro data.
+ */
+void Acquisition::setLowPowerPolicy(const LowPowerPolicy& policy) {
+    std::lock_guard<std::mutex> lock(*mBusLock);
+    mPolicy = policy;
+}
+
+bool Acquisition::isLowPower() const {
+    return mLowPower;
+}
+
+uint64_t Acquisition::getOverflows() const {
+    return mOverflows;
+}
+
+/** Program sample rate, low pass filter and FIFO. Called with the bus lock held.
+ */
+void Acquisition::configure() {
+    static const uint8_t bandwidths[] = { 188, 98, 42, 20, 10, 5 };
+    static const uint8_t modes[] = { MPU6050_DLPF_BW_188, MPU6050_DLPF_BW_98, MPU6050_DLPF_BW_42,
+                                     MPU6050_DLPF_BW_20, MPU6050_DLPF_BW_10, MPU6050_DLPF_BW_5 };
+    mSavedRate = mMPU6050->getRate();
+    mSavedDLPF = mMPU6050->getDLPFMode();
+
+    // widest filter that is still below Nyquist; any DLPF setting also puts
+    // the gyro on the 1kHz clock the divider is based on
+    uint8_t mode = MPU6050_DLPF_BW_5;
+    for (unsigned i = 0; i < sizeof(bandwidths); i++) {
+        if (bandwidths[i] * 2 < mRate) {
+            mode = modes[i];
+            break;
+        }
+    }
+    mMPU6050->setDLPFMode(mode);
+    mMPU6050->setRate(ACQUISITION_MAX_RATE / mRate - 1);
+    mMPU6050->setAccelFIFOEnabled(true);
+    mMPU6050->setTempFIFOEnabled(true);
+    mMPU6050->setXGyroFIFOEnabled(true);
+    mMPU6050->setYGyroFIFOEnabled(true);
+    mMPU6050->setZGyroFIFOEnabled(true);
+    mMPU6050->resetFIFO();
+    configureDetection();
+    mMPU6050->getIntStatus();
+    mMPU6050->setFIFOEnabled(true);
+
+    uint64_t now = mClock->now();
+    if (mSensors & SENSOR_MAG) {
+        mSavedMagRate = mHMC5883L->getDataRate();
+        mHMC5883L->setDataRate(HMC5883L_RATE_75);
+        mNextMag = now;
+    }
+    if (mSensors & SENSOR_BARO) {
+        mBaroPressure = true;
+        mMS5611->startConversion(MS5611_CMD_CONV_D1 + MS5611_ULTRA_HIGH_RES);
+        mBaroReady = now + BARO_INTERVAL;
+    }
+    mGap = false;
+    mEvents = 0;
+    mStillCount = 0;
+}
+
+/** Detector thresholds, durations and interrupt enables from mDetection.
+ * Called with the bus lock held.
+ */
+void Acquisition::configureDetection() {
+    bool freefall = mDetection.freefallThreshold != 0;
+    bool motion = mDetection.motionThreshold != 0;
+    bool zeroMotion = mDetection.zeroMotionThreshold != 0;
+    if (freefall) {
+        mMPU6050->setFreefallDetectionThreshold(mDetection.freefallThreshold);
+        mMPU6050->setFreefallDetectionDuration(mDetection.freefallDuration);
+    }
+    if (motion || zeroMotion) {
+        // both are judged on the high-passed accelerometer; the filter
+        // does not touch the data registers or the FIFO
+        mMPU6050->setDHPFMode(MPU6050_DHPF_5);
+    }
+    if (motion) {
+        mMPU6050->setMotionDetectionThreshold(mDetection.motionThreshold);
+        mMPU6050->setMotionDetectionDuration(mDetection.motionDuration);
+    }
+    if (zeroMotion) {
+        mMPU6050->setZeroMotionDetectionThreshold(mDetection.zeroMotionThreshold);
+        mMPU6050->setZeroMotionDetectionDuration(mDetection.zeroMotionDuration);
+    }
+    mMPU6050->setIntFreefallEnabled(freefall);
+    mMPU6050->setIntMotionEnabled(motion);
+    mMPU6050->setIntZeroMotionEnabled(zeroMotion);
+}
+
+/** Undo configure(). Called with the bus lock held.
+ */
+void Acquisition::restore() {
+    mMPU6050->setIntFreefallEnabled(false);
+    mMPU6050->setIntMotionEnabled(false);
+    mMPU6050->setIntZeroMotionEnabled(false);
+    mMPU6050->setFIFOEnabled(false);
+    mMPU6050->setAccelFIFOEnabled(false);
+    mMPU6050->setTempFIFOEnabled(false);
+    mMPU6050->setXGyroFIFOEnabled(false);
+    mMPU6050->setYGyroFIFOEnabled(false);
+    mMPU6050->setZGyroFIFOEnabled(false);
+    mMPU6050->resetFIFO();
+    mMPU6050->setRate(mSavedRate);
+    mMPU6050->setDLPFMode(mSavedDLPF);
+    if (mSensors & SENSOR_MAG) {
+        mHMC5883L->setDataRate(mSavedMagRate);
+    }
+}
+
+/** Time between two polls: about four samples per wakeup, within 2-20ms,
+ * or in low power the wake period, at most LOW_POWER_POLL.
+ */
+uint64_t Acquisition::pollInterval() const {
+    if (mLowPower) {
+        uint64_t period = sWakePeriods[mPolicy.wakeFrequency & 3];
+        return period < LOW_POWER_POLL ? period : LOW_POWER_POLL;
+    }
+    uint64_t interval = 4 * NS_PER_SEC / mRate;
+    if (interval < 2 * NS_PER_MS) {
+        interval = 2 * NS_PER_MS;
+    } else if (interval > 20 * NS_PER_MS) {
+        interval = 20 * NS_PER_MS;
+    }
+    return interval;
+}
+
+void Acquisition::run() {
+    Sample batch[MAX_BATCH];
+    bool lowPower = mLowPower;
+    uint64_t interval = pollInterval();
+    uint64_t next = mClock->now() + interval;
+    while (mRunning) {
+        mClock->sleepUntil(next);
+        next += interval;
+        uint64_t now = mClock->now();
+        if (now > next) {
+            // overslept, do not try to catch up with a burst of wakeups
+            next = now + interval;
+        }
+        uint32_t n = mLowPower ? pollLowPower(batch) : poll(batch, MAX_BATCH);
+        if (n > 0) {
+            mRing.write(batch, n);
+            if (mListener) {
+                mListener->onSamples(batch, n);
+            }
+        }
+        if (mLowPower != lowPower) {
+            // switched modes: poll at the new pace from now on; after a
+            // wakeup the first full rate sample is a sample period away
+            lowPower = mLowPower;
+            interval = pollInterval();
+            next = mClock->now() + interval;
+            if (mListener) {
+                mListener->onPowerMode(mClock->now(), lowPower);
+            }
+        }
+    }
+    if (mLowPower) {
+        {
+            std::lock_guard<std::mutex> lock(*mBusLock);
+            leaveLowPower(mClock->now());
+        }
+        if (mListener) {
+            mListener->onPowerMode(mClock->now(), false);
+        }
+    }
+}
+
+/** Drain the FIFO and service the magnetometer and barometer.
+ * @return number of samples written to batch
+ */
+uint32_t Acquisition::poll(Sample* batch, uint32_t max) {
+    uint8_t data[FIFO_CHUNK * FIFO_FRAME];
+    uint32_t flags = 0;
+    uint32_t count;
+    uint64_t now;
+    LowPowerPolicy policy;
+    {
+        std::lock_guard<std::mutex> lock(*mBusLock);
+        policy = mPolicy;
+        uint8_t status = mMPU6050->getIntStatus();
+        uint16_t fifoCount = mMPU6050->getFIFOCount();
+        if ((status & (1 << MPU6050_INTERRUPT_FIFO_OFLOW_BIT)) || fifoCount > FIFO_SIZE - FIFO_FRAME) {
+            // frames are no longer aligned once the FIFO has wrapped
+            mMPU6050->resetFIFO();
+            mOverflows++;
+            mGap = true;
+            fifoCount = 0;
+        }
+        if (status & (1 << MPU6050_INTERRUPT_FF_BIT)) {
+            mEvents |= SAMPLE_FREEFALL;
+        }
+        if (status & (1 << MPU6050_INTERRUPT_MOT_BIT)) {
+            mEvents |= SAMPLE_MOTION;
+        }
+        if (status & (1 << MPU6050_INTERRUPT_ZMOT_BIT)) {
+            mEvents |= SAMPLE_ZERO_MOTION;
+        }
+        if (status & ((1 << MPU6050_INTERRUPT_MOT_BIT) | (1 << MPU6050_INTERRUPT_ZMOT_BIT))) {
+            // which axes moved, and which way zero motion went; only read
+            // when there is something to read
+            mEvents = (mEvents & ~(0xff << SAMPLE_MOTION_STATUS_SHIFT))
+                    | (uint32_t)mMPU6050->getMotionStatus() << SAMPLE_MOTION_STATUS_SHIFT;
+        }
+        count = fifoCount / FIFO_FRAME;
+        if (count > max) {
+            count = max;
+        }
+        now = mClock->now();
+        for (uint32_t done = 0; done < count; done += FIFO_CHUNK) {
+            uint32_t n = count - done < FIFO_CHUNK ? count - done : FIFO_CHUNK;
+            mMPU6050->getFIFOBytes(data, n * FIFO_FRAME);
+            for (uint32_t i = 0; i < n; i++) {
+                const uint8_t* frame = data + i * FIFO_FRAME;
+                Sample* s = &batch[done + i];
+                for (int axis = 0; axis < 3; axis++) {
+                    s->accel[axis] = (int16_t)((frame[axis * 2] << 8) | frame[axis * 2 + 1]);
+                    s->gyro[axis] = (int16_t)((frame[8 + axis * 2] << 8) | frame[8 + axis * 2 + 1]);
+                }
+                s->temperature = (int16_t)((frame[6] << 8) | frame[7]);
+            }
+        }
+
+        if ((mSensors & SENSOR_MAG) && now >= mNextMag) {
+            mHMC5883L->getHeading(&mMag[0], &mMag[1], &mMag[2]);
+            mNextMag += MAG_INTERVAL;
+            if (mNextMag < now) {
+                mNextMag = now + MAG_INTERVAL;
+            }
+            flags |= SAMPLE_MAG;
+        }
+        if ((mSensors & SENSOR_BARO) && now >= mBaroReady) {
+            uint32_t value = mMS5611->readConversion();
+            if (mBaroPressure) {
+                mPressure = value;
+            } else {
+                mBaroTemperature = value;
+            }
+            mBaroPressure = !mBaroPressure;
+            mMS5611->startConversion(mBaroPressure ? MS5611_CMD_CONV_D1 + MS5611_ULTRA_HIGH_RES
+                                                   : MS5611_CMD_CONV_D2 + MS5611_ULTRA_HIGH_RES);
+            mBaroReady = now + BARO_INTERVAL;
+            flags |= SAMPLE_BARO;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    // the last frame in the FIFO is the newest, earlier ones are a sample
+    // period apart
+    uint64_t period = NS_PER_SEC / mRate;
+    for (uint32_t i = 0; i < count; i++) {
+        Sample* s = &batch[i];
+        uint64_t t = now - (count - 1 - i) * period;
+        s->timestamp = t > mLastTimestamp ? t : mLastTimestamp + 1;
+        mLastTimestamp = s->timestamp;
+        memcpy(s->mag, mMag, sizeof(mMag));
+        s->pressure = mPressure;
+        s->baroTemperature = mBaroTemperature;
+        s->flags = 0;
+    }
+    if (mGap) {
+        batch[0].flags |= SAMPLE_GAP;
+        mGap = false;
+    }
+    batch[count - 1].flags |= flags | mEvents;
+    mTemperature = batch[count - 1].temperature;
+    // zero motion that just began, as the detector reported it
+    bool still = (mEvents & SAMPLE_ZERO_MOTION)
+            && (SAMPLE_MOTION_STATUS(mEvents) & (1 << MPU6050_MOTION_MOT_ZRMOT_BIT));
+    mEvents = 0;
+    if (policy.enabled && (isStill(batch, count, policy) || still)) {
+        std::lock_guard<std::mutex> lock(*mBusLock);
+        if (mPolicy.enabled) {
+            enterLowPower(batch[count - 1].timestamp);
+        }
+    }
+    return count;
+}
+
+/** Software still detector: the variance of every accel axis over a
+ * window of stillSamples below stillVariance. The window
+ * restarts after each verdict.
+ */
+bool Acquisition::isStill(const Sample* samples, uint32_t count, const LowPowerPolicy& policy) {
+    uint32_t window = policy.stillSamples;
+    if (window == 0) {
+        return false;
+    }
+    bool still = false;
+    for (uint32_t i = 0; i < count; i++) {
+        if (mStillCount == 0) {
+            memset(mStillSum, 0, sizeof(mStillSum));
+            memset(mStillSquares, 0, sizeof(mStillSquares));
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            int64_t a = samples[i].accel[axis];
+            mStillSum[axis] += a;
+            mStillSquares[axis] += a * a;
+        }
+        if (++mStillCount == window) {
+            // n^2 variance = n sum(a^2) - sum(a)^2
+            int64_t n = window;
+            int64_t limit = (int64_t)policy.stillVariance * n * n;
+            still = true;
+            for (int axis = 0; axis < 3; axis++) {
+                still = still && n * mStillSquares[axis] - mStillSum[axis] * mStillSum[axis] < limit;
+            }
+            mStillCount = 0;
+        }
+    }
+    return still;
+}
+
+/** Accelerometer-only cycle mode with wake on motion. The high-pass filter
+ * is frozen on the resting acceleration, so the motion interrupt fires on
+ * any departure from it; zero motion, which does not run in cycle mode, is
+ * off until leaveLowPower(). Called with the bus lock held.
+ */
+void Acquisition::enterLowPower(uint64_t now) {
+    mMPU6050->setFIFOEnabled(false);
+    mMPU6050->resetFIFO();
+    // the PLL runs off gyro X, which goes to standby
+    mSavedClock = mMPU6050->getClockSource();
+    mMPU6050->setClockSource(MPU6050_CLOCK_INTERNAL);
+    mMPU6050->setStandbyXGyroEnabled(true);
+    mMPU6050->setStandbyYGyroEnabled(true);
+    mMPU6050->setStandbyZGyroEnabled(true);
+    mMPU6050->setTempSensorEnabled(false);
+    mMPU6050->setMotionDetectionThreshold(mPolicy.wakeThreshold ? mPolicy.wakeThreshold : 1);
+    mMPU6050->setMotionDetectionDuration(1);
+    mMPU6050->setIntMotionEnabled(true);
+    mMPU6050->setIntZeroMotionEnabled(false);
+    mMPU6050->setDHPFMode(MPU6050_DHPF_HOLD);
+    mMPU6050->getIntStatus();
+    mMPU6050->setWakeFrequency(mPolicy.wakeFrequency);
+    mMPU6050->setWakeCycleEnabled(true);
+    mNextWake = now;
+    mLowPower = true;
+}
+
+/** Back to full rate: undo enterLowPower() and restart the FIFO, with the
+ * detectors as programmed. Called with the bus lock held.
+ */
+void Acquisition::leaveLowPower(uint64_t now) {
+    mMPU6050->setWakeCycleEnabled(false);
+    mMPU6050->setStandbyXGyroEnabled(false);
+    mMPU6050->setStandbyYGyroEnabled(false);
+    mMPU6050->setStandbyZGyroEnabled(false);
+    mMPU6050->setTempSensorEnabled(true);
+    mMPU6050->setClockSource(mSavedClock);
+    mMPU6050->setDHPFMode(MPU6050_DHPF_RESET);
+    configureDetection();
+    mMPU6050->resetFIFO();
+    mMPU6050->setFIFOEnabled(true);
+    mLastTimestamp = now > mLastTimestamp ? now : mLastTimestamp;
+    mStillCount = 0;
+    mLowPower = false;
+}
+
+/** Low power: look at the interrupt status, wake up on motion, and read a
+ * sample from the data registers once per wake period.
+ * @return number of samples written to batch, 0 or 1
+ */
+uint32_t Acquisition::pollLowPower(Sample* batch) {
+    std::lock_guard<std::mutex> lock(*mBusLock);
+    uint64_t now = mClock->now();
+    if (!mPolicy.enabled) {
+        leaveLowPower(now);
+        return 0;
+    }
+    uint8_t status = mMPU6050->getIntStatus();
+    if (status & (1 << MPU6050_INTERRUPT_FF_BIT)) {
+        mEvents |= SAMPLE_FREEFALL;
+    }
+    if (status & (1 << MPU6050_INTERRUPT_MOT_BIT)) {
+        // reported with the first full rate sample
+        mEvents = (mEvents & ~(0xff << SAMPLE_MOTION_STATUS_SHIFT)) | SAMPLE_MOTION
+                | (uint32_t)mMPU6050->getMotionStatus() << SAMPLE_MOTION_STATUS_SHIFT;
+        leaveLowPower(now);
+        return 0;
+    }
+    if (now < mNextWake) {
+        return 0;
+    }
+    Sample* s = &batch[0];
+    mMPU6050->getAcceleration(&s->accel[0], &s->accel[1], &s->accel[2]);
+    memset(s->gyro, 0, sizeof(s->gyro));
+    s->temperature = mTemperature;
+    s->timestamp = now > mLastTimestamp ? now : mLastTimestamp + 1;
+    mLastTimestamp = s->timestamp;
+    memcpy(s->mag, mMag, sizeof(mMag));
+    s->pressure = mPressure;
+    s->baroTemperature = mBaroTemperature;
+    s->flags = SAMPLE_LOW_POWER | mEvents;
+    mEvents = 0;
+    uint64_t period = sWakePeriods[mPolicy.wakeFrequency & 3];
+    mNextWake += period;
+    if (mNextWake < now) {
+        mNextWake = now + period;
+    }
+    return 1;
+}
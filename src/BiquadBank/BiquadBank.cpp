@@ -0,0 +1,220 @@
+#include <math.h>
+#include <string.h>
+
+#include "BiquadBank.h"
+
+static inline int16_t round16(float v) {
+    if (v > 32767) return 32767;
+    if (v < -32768) return -32768;
+    return (int16_t)lrintf(v);
+}
+
+BiquadBank::BiquadBank()
+    : mPendingCount(0), mChanged(false), mReset(false), mCount(0), mRate(0), mRunning(0), mSeed(0),
+      mRamp(0) {
+    memset(mCurrent, 0, sizeof(mCurrent));
+    for (uint32_t s = 0; s < BIQUAD_MAX_SECTIONS; s++) {
+        for (uint32_t c = 0; c < BIQUAD_STRIDE; c++) {
+            mCurrent[s][COEF_B0][c] = 1;
+        }
+    }
+    memcpy(mTarget, mCurrent, sizeof(mTarget));
+    memset(mStep, 0, sizeof(mStep));
+    memset(mState, 0, sizeof(mState));
+}
+
+/** Replace the sections; the acquisition thread moves to them with its
+ * next batch. An empty list fades out all filtering.
+ * @return false, changing nothing, for more than BIQUAD_MAX_SECTIONS or a
+ * spec without a known type, a positive frequency and a positive q
+ */
+bool BiquadBank::setSections(const BiquadSpec* specs, uint32_t count) {
+    if (count > BIQUAD_MAX_SECTIONS) {
+        return false;
+    }
+    for (uint32_t s = 0; s < count; s++) {
+        if ((specs[s].type != BIQUAD_NOTCH && specs[s].type != BIQUAD_LOWPASS)
+                || !(specs[s].frequency > 0) || !(specs[s].q > 0)) {
+            return false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mLock);
+    memcpy(mPending, specs, count * sizeof(BiquadSpec));
+    mPendingCount = count;
+    mChanged = true;
+    return true;
+}
+
+/** Sections last set, whether or not the acquisition thread has picked
+ * them up yet.
+ */
+uint32_t BiquadBank::getSections() const {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mPendingCount;
+}
+
+/** There are sections to run, or a change to pick up; acquisition thread
+ * only, so that a bank without sections costs nothing.
+ */
+bool BiquadBank::isActive() const {
+    return mRunning > 0 || mChanged || mReset;
+}
+
+/** Start every section over from the next input, e.g. when samples resume
+ * after a pause; any thread.
+ */
+void BiquadBank::reset() {
+    mReset = true;
+}
+
+/** Notch or low-pass coefficients b0, b1, b2, a1, a2, normalized to a0.
+ * @return false if the frequency is not below the Nyquist frequency of
+ * rate; the section then passes its input through
+ */
+/*static*/
+bool BiquadBank::designSection(const BiquadSpec& spec, uint32_t rate, float* coefficients) {
+    if (rate == 0 || spec.frequency >= rate / 2.0f) {
+        return false;
+    }
+    double w0 = 2 * M_PI * spec.frequency / rate;
+    double cosw0 = cos(w0);
+    double alpha = sin(w0) / (2 * spec.q);
+    double a0 = 1 + alpha;
+    if (spec.type == BIQUAD_NOTCH) {
+        coefficients[COEF_B0] = 1 / a0;
+        coefficients[COEF_B1] = -2 * cosw0 / a0;
+        coefficients[COEF_B2] = 1 / a0;
+    } else {
+        coefficients[COEF_B0] = (1 - cosw0) / 2 / a0;
+        coefficients[COEF_B1] = (1 - cosw0) / a0;
+        coefficients[COEF_B2] = (1 - cosw0) / 2 / a0;
+    }
+    coefficients[COEF_A1] = -2 * cosw0 / a0;
+    coefficients[COEF_A2] = (1 - alpha) / a0;
+    return true;
+}
+
+/** Coefficients of mSpecs at rate into mTarget, and start the ramp towards
+ * them; the first design is taken at once.
+ */
+void BiquadBank::design(uint32_t rate) {
+    memset(mTarget, 0, sizeof(mTarget));
+    for (uint32_t s = 0; s < BIQUAD_MAX_SECTIONS; s++) {
+        for (uint32_t c = 0; c < BIQUAD_STRIDE; c++) {
+            mTarget[s][COEF_B0][c] = 1;
+        }
+        float coefficients[COEF_COUNT];
+        if (s >= mCount || !designSection(mSpecs[s], rate, coefficients)) {
+            continue;
+        }
+        for (uint32_t c = 0; c < BIQUAD_CHANNELS; c++) {
+            if (mSpecs[s].sensors & (c < 3 ? SENSOR_ACCEL : SENSOR_GYRO)) {
+                for (uint32_t k = 0; k < COEF_COUNT; k++) {
+                    mTarget[s][k][c] = coefficients[k];
+                }
+            }
+        }
+    }
+
+    // sections that were not running are pass-throughs with stale state
+    if (mCount > mRunning) {
+        if (mSeed > mRunning) {
+            mSeed = mRunning;
+        }
+        mRunning = mCount;
+    }
+    if (mRate == 0) {
+        memcpy(mCurrent, mTarget, sizeof(mCurrent));
+        mRamp = 0;
+        mRunning = mCount;
+    } else {
+        float* current = &mCurrent[0][0][0];
+        float* target = &mTarget[0][0][0];
+        float* step = &mStep[0][0][0];
+        for (uint32_t n = 0; n < BIQUAD_MAX_SECTIONS * COEF_COUNT * BIQUAD_STRIDE; n++) {
+            step[n] = (target[n] - current[n]) / BIQUAD_RAMP_SAMPLES;
+        }
+        mRamp = BIQUAD_RAMP_SAMPLES;
+    }
+    mRate = rate;
+}
+
+/** Filter the accel and gyro axes of samples in place; called on the
+ * acquisition thread.
+ * @param rate Hz the samples were taken at, the sections are redesigned
+ * when it changes
+ */
+void BiquadBank::filter(Sample* samples, uint32_t count, uint32_t rate) {
+    if (mReset.exchange(false)) {
+        mSeed = 0;
+    }
+    if (mChanged.exchange(false)) {
+        std::lock_guard<std::mutex> lock(mLock);
+        memcpy(mSpecs, mPending, mPendingCount * sizeof(BiquadSpec));
+        mCount = mPendingCount;
+        design(rate);
+    } else if (rate != mRate && mRunning > 0) {
+        design(rate);
+    }
+    if (mRunning == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        Sample& sample = samples[i];
+        if (sample.flags & SAMPLE_LOW_POWER) {
+            // accel only, at the wake frequency: nothing the sections are
+            // designed for; start over once the full rate is back
+            mSeed = 0;
+            continue;
+        }
+        if (sample.flags & SAMPLE_GAP) {
+            mSeed = 0;
+        }
+        float frame[BIQUAD_STRIDE];
+        for (int axis = 0; axis < 3; axis++) {
+            frame[axis] = sample.accel[axis];
+            frame[axis + 3] = sample.gyro[axis];
+        }
+        frame[6] = frame[7] = 0;
+
+        for (uint32_t s = 0; s < mRunning; s++) {
+            const float (*k)[BIQUAD_STRIDE] = mCurrent[s];
+            float (*z)[BIQUAD_STRIDE] = mState[s];
+            if (s >= mSeed) {
+                // as if the input had always been this value
+                for (uint32_t c = 0; c < BIQUAD_STRIDE; c++) {
+                    z[STATE_X1][c] = z[STATE_X2][c] = z[STATE_Y1][c] = z[STATE_Y2][c] = frame[c];
+                }
+            }
+            for (uint32_t c = 0; c < BIQUAD_STRIDE; c++) {
+                float y = k[COEF_B0][c] * frame[c] + k[COEF_B1][c] * z[STATE_X1][c] + k[COEF_B2][c] * z[STATE_X2][c]
+                        - k[COEF_A1][c] * z[STATE_Y1][c] - k[COEF_A2][c] * z[STATE_Y2][c];
+                z[STATE_X2][c] = z[STATE_X1][c];
+                z[STATE_X1][c] = frame[c];
+                z[STATE_Y2][c] = z[STATE_Y1][c];
+                z[STATE_Y1][c] = y;
+                frame[c] = y;
+            }
+        }
+        mSeed = BIQUAD_MAX_SECTIONS;
+
+        for (int axis = 0; axis < 3; axis++) {
+            sample.accel[axis] = round16(frame[axis]);
+            sample.gyro[axis] = round16(frame[axis + 3]);
+        }
+
+        if (mRamp > 0) {
+            if (--mRamp == 0) {
+                memcpy(mCurrent, mTarget, sizeof(mCurrent));
+                mRunning = mCount;
+            } else {
+                float* current = &mCurrent[0][0][0];
+                const float* step = &mStep[0][0][0];
+                for (uint32_t n = 0; n < mRunning * COEF_COUNT * BIQUAD_STRIDE; n++) {
+                    current[n] += step[n];
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,351 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Decimator.h"
+
+// stopband attenuation of the FIR stages, dB, and the matching Kaiser
+// window parameter
+#define DECIMATOR_ATTENUATION 60.0
+#define DECIMATOR_KAISER_BETA (0.1102 * (DECIMATOR_ATTENUATION - 8.7))
+// integration steps for the CIC compensator response
+#define DECIMATOR_DESIGN_STEPS 1024
+
+/** Zeroth order modified Bessel function, for the Kaiser window.
+ */
+static double besselI0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static inline int16_t round16(float v) {
+    if (v > 32767) return 32767;
+    if (v < -32768) return -32768;
+    return (int16_t)lrintf(v);
+}
+
+Decimator::Decimator() : mFactor(1), mFlags(0) {
+}
+
+/** Plan the stages for a factor. Factors of 5, 4, 3 and 2 are taken
+ * largest first, so the long filters run at the lowest rates; what does not
+ * split that way is one stage. With cic, an even factor of at least 4
+ * starts with a CIC stage of up to DECIMATOR_CIC_MAX_FACTOR and its
+ * compensator.
+ * @param factor Input samples per output sample, 1 passes samples through
+ * @return false if factor is 0
+ */
+bool Decimator::configure(uint32_t factor, bool cic) {
+    mStages.clear();
+    mFactor = factor;
+    mFlags = 0;
+    if (factor == 0) {
+        mFactor = 1;
+        return false;
+    }
+
+    std::vector<uint32_t> factors;
+    uint32_t rest = factor;
+    uint32_t cicFactor = 0;
+    if (cic && factor >= 4 && factor % 2 == 0) {
+        for (uint32_t r = factor / 2; r >= 2; r--) {
+            if ((factor / 2) % r == 0 && r <= DECIMATOR_CIC_MAX_FACTOR) {
+                cicFactor = r;
+                break;
+            }
+        }
+        if (cicFactor) {
+            factors.push_back(cicFactor);
+            factors.push_back(2);
+            rest = factor / cicFactor / 2;
+        }
+    }
+    static const uint32_t splits[] = { 5, 4, 3, 2 };
+    while (rest > 1) {
+        uint32_t m = rest;
+        for (unsigned i = 0; i < sizeof(splits) / sizeof(splits[0]); i++) {
+            if (rest % splits[i] == 0) {
+                m = splits[i];
+                break;
+            }
+        }
+        factors.push_back(m);
+        rest /= m;
+    }
+
+    // rates in units of the output rate
+    double rate = factor;
+    for (size_t i = 0; i < factors.size(); i++) {
+        Stage stage;
+        uint32_t m = factors[i];
+        double out = rate / m;
+        stage.factor = m;
+        stage.cic = cicFactor && i == 0;
+        stage.position = 0;
+        stage.phase = 0;
+        stage.scale = 1;
+        stage.primed = false;
+        if (stage.cic) {
+            stage.length = DECIMATOR_CIC_ORDER * m;
+            stage.centre = DECIMATOR_CIC_ORDER * (m - 1) / 2;
+            stage.sums.assign(2 * DECIMATOR_CIC_ORDER * DECIMATOR_STRIDE, 0);
+            stage.scale = (float)(1.0 / pow((double)m, DECIMATOR_CIC_ORDER));
+        } else {
+            // only what would fold into the passband has to go
+            double stopband = out - DECIMATOR_PASSBAND;
+            design(&stage, m, DECIMATOR_PASSBAND / rate, stopband / rate,
+                    cicFactor && i == 1 ? cicFactor : 0);
+            stage.line.assign(2 * stage.length * DECIMATOR_STRIDE, 0);
+        }
+        stage.history.resize(stage.length);
+        mStages.push_back(stage);
+        rate = out;
+    }
+    return true;
+}
+
+/** Windowed low-pass taps, odd length from the Kaiser estimate for the
+ * transition band, cut off in its middle. With cicFactor the passband
+ * follows the inverse of the CIC response instead of 1, from the frequency
+ * response integrated numerically.
+ * @param passband Edge in cycles per input sample
+ * @param stopband Edge in cycles per input sample
+ */
+/*static*/
+void Decimator::design(Stage* stage, uint32_t factor, double passband, double stopband, uint32_t cicFactor) {
+    double width = stopband - passband;
+    uint32_t taps = (uint32_t)ceil((DECIMATOR_ATTENUATION - 7.95) / (14.36 * width)) + 1;
+    taps |= 1;
+    if (taps > DECIMATOR_MAX_TAPS) {
+        taps = DECIMATOR_MAX_TAPS;
+    }
+    if (taps < factor) {
+        taps = factor | 1;
+    }
+    stage->length = taps;
+    stage->centre = (taps - 1) / 2;
+    stage->taps.resize(taps);
+
+    double middle = (taps - 1) / 2.0;
+    double cutoff = (passband + stopband) / 2;
+    double norm = besselI0(DECIMATOR_KAISER_BETA);
+    double sum = 0;
+    for (uint32_t n = 0; n < taps; n++) {
+        double t = n - middle;
+        double r = middle > 0 ? t / middle : 0;
+        double window = besselI0(DECIMATOR_KAISER_BETA * sqrt(1 - r * r)) / norm;
+        double h = 0;
+        if (!cicFactor) {
+            h = t == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * t) / (M_PI * t);
+        } else {
+            double step = cutoff / DECIMATOR_DESIGN_STEPS;
+            for (int k = 0; k < DECIMATOR_DESIGN_STEPS; k++) {
+                double nu = (k + 0.5) * step;
+                double droop = fabs(sin(M_PI * nu) / (cicFactor * sin(M_PI * nu / cicFactor)));
+                h += 2 * cos(2 * M_PI * nu * t) / pow(droop, DECIMATOR_CIC_ORDER) * step;
+            }
+        }
+        stage->taps[n] = (float)(h * window);
+        sum += h * window;
+    }
+    // unity gain at DC
+    for (uint32_t n = 0; n < taps; n++) {
+        stage->taps[n] = (float)(stage->taps[n] / sum);
+    }
+}
+
+/** Forget the filter state; the next sample primes the delay lines as if
+ * it had been there forever, so there is no start-up transient.
+ */
+void Decimator::reset() {
+    for (size_t i = 0; i < mStages.size(); i++) {
+        mStages[i].primed = false;
+        mStages[i].phase = 0;
+        mStages[i].position = 0;
+    }
+    mFlags = 0;
+}
+
+/** Push one frame into a FIR stage.
+ * @return true with out and outSample filled once per factor inputs
+ */
+bool Decimator::fir(Stage* stage, const float* frame, const Sample& sample, float* out, Sample* outSample) {
+    uint32_t length = stage->length;
+    float* line = stage->line.data();
+    if (!stage->primed) {
+        for (uint32_t i = 0; i < 2 * length; i++) {
+            memcpy(&line[i * DECIMATOR_STRIDE], frame, DECIMATOR_STRIDE * sizeof(float));
+        }
+        for (uint32_t i = 0; i < length; i++) {
+            stage->history[i] = sample;
+        }
+        stage->primed = true;
+    }
+    memcpy(&line[stage->position * DECIMATOR_STRIDE], frame, DECIMATOR_STRIDE * sizeof(float));
+    memcpy(&line[(stage->position + length) * DECIMATOR_STRIDE], frame, DECIMATOR_STRIDE * sizeof(float));
+    stage->history[stage->position] = sample;
+    stage->position = stage->position + 1 == length ? 0 : stage->position + 1;
+    if (++stage->phase < stage->factor) {
+        return false;
+    }
+    stage->phase = 0;
+
+    // the newest length frames are contiguous from position on
+    const float* x = &line[stage->position * DECIMATOR_STRIDE];
+    const float* taps = stage->taps.data();
+    float acc[DECIMATOR_STRIDE];
+    memset(acc, 0, sizeof(acc));
+    for (uint32_t k = 0; k < length; k++) {
+        float h = taps[k];
+        const float* v = x + k * DECIMATOR_STRIDE;
+        for (int c = 0; c < DECIMATOR_STRIDE; c++) {
+            acc[c] += h * v[c];
+        }
+    }
+    memcpy(out, acc, sizeof(acc));
+    *outSample = stage->history[(stage->position + length - 1 - stage->centre) % length];
+    return true;
+}
+
+/** Push one frame into a CIC stage: DECIMATOR_CIC_ORDER integrators at the
+ * input rate, as many combs at the output rate, in wrapping 32 bit
+ * arithmetic on the raw counts.
+ */
+bool Decimator::cic(Stage* stage, const float* frame, const Sample& sample, float* out, Sample* outSample) {
+    uint32_t* integrators = stage->sums.data();
+    uint32_t* combs = integrators + DECIMATOR_CIC_ORDER * DECIMATOR_STRIDE;
+    if (!stage->primed) {
+        // settle on the first sample, the last of these pushes is this one
+        stage->primed = true;
+        for (uint32_t i = 0; i < stage->length; i++) {
+            stage->history[i] = sample;
+        }
+        for (uint32_t i = 1; i < stage->length; i++) {
+            cic(stage, frame, sample, out, outSample);
+        }
+    }
+    uint32_t x[DECIMATOR_STRIDE];
+    for (int c = 0; c < DECIMATOR_STRIDE; c++) {
+        x[c] = (uint32_t)(int32_t)lrintf(frame[c]);
+    }
+    for (int c = 0; c < DECIMATOR_STRIDE; c++) {
+        integrators[c] += x[c];
+    }
+    for (int k = 1; k < DECIMATOR_CIC_ORDER; k++) {
+        uint32_t* current = integrators + k * DECIMATOR_STRIDE;
+        const uint32_t* previous = current - DECIMATOR_STRIDE;
+        for (int c = 0; c < DECIMATOR_STRIDE; c++) {
+            current[c] += previous[c];
+        }
+    }
+    stage->history[stage->position] = sample;
+    stage->position = stage->position + 1 == stage->length ? 0 : stage->position + 1;
+    if (++stage->phase < stage->factor) {
+        return false;
+    }
+    stage->phase = 0;
+
+    uint32_t v[DECIMATOR_STRIDE];
+    memcpy(v, integrators + (DECIMATOR_CIC_ORDER - 1) * DECIMATOR_STRIDE, sizeof(v));
+    for (int k = 0; k < DECIMATOR_CIC_ORDER; k++) {
+        uint32_t* comb = combs + k * DECIMATOR_STRIDE;
+        for (int c = 0; c < DECIMATOR_STRIDE; c++) {
+            uint32_t difference = v[c] - comb[c];
+            comb[c] = v[c];
+            v[c] = difference;
+        }
+    }
+    for (int c = 0; c < DECIMATOR_STRIDE; c++) {
+        out[c] = (float)(int32_t)v[c] * stage->scale;
+    }
+    uint32_t newest = stage->position + stage->length - 1;
+    *outSample = stage->history[(newest - stage->centre) % stage->length];
+    if (DECIMATOR_CIC_ORDER * (stage->factor - 1) % 2) {
+        // the delay is centre and a half
+        const Sample& older = stage->history[(newest - stage->centre - 1) % stage->length];
+        outSample->timestamp -= (outSample->timestamp - older.timestamp) / 2;
+    }
+    return true;
+}
+
+/** Filter and decimate a batch.
+ * @param out Room for count / getFactor() + 1 samples
+ * @return number of samples written to out
+ */
+uint32_t Decimator::write(const Sample* samples, uint32_t count, Sample* out) {
+    uint32_t n = 0;
+    float a[DECIMATOR_STRIDE], b[DECIMATOR_STRIDE];
+    for (uint32_t i = 0; i < count; i++) {
+        const Sample& sample = samples[i];
+        mFlags |= sample.flags;
+        float* frame = a;
+        for (int axis = 0; axis < 3; axis++) {
+            frame[axis] = sample.accel[axis];
+            frame[axis + 3] = sample.gyro[axis];
+            frame[axis + 6] = sample.mag[axis];
+        }
+        for (int c = DECIMATOR_CHANNELS; c < DECIMATOR_STRIDE; c++) {
+            frame[c] = 0;
+        }
+        Sample current = sample;
+        bool done = true;
+        for (size_t s = 0; s < mStages.size() && done; s++) {
+            Stage* stage = &mStages[s];
+            float* next = frame == a ? b : a;
+            done = stage->cic ? cic(stage, frame, current, next, &current)
+                              : fir(stage, frame, current, next, &current);
+            frame = next;
+        }
+        if (!done) {
+            continue;
+        }
+        Sample* o = &out[n++];
+        *o = current;
+        for (int axis = 0; axis < 3; axis++) {
+            o->accel[axis] = round16(frame[axis]);
+            o->gyro[axis] = round16(frame[axis + 3]);
+            o->mag[axis] = round16(frame[axis + 6]);
+        }
+        o->flags = mFlags;
+        mFlags = 0;
+    }
+    return n;
+}
+
+uint32_t Decimator::getFactor() const {
+    return mFactor;
+}
+
+uint32_t Decimator::getStages() const {
+    return (uint32_t)mStages.size();
+}
+
+/** Multiplies per channel and output sample, over all FIR stages.
+ */
+uint32_t Decimator::getTaps() const {
+    uint32_t taps = 0;
+    uint32_t factor = 1;
+    for (size_t i = 0; i < mStages.size(); i++) {
+        factor *= mStages[i].factor;
+        if (!mStages[i].cic) {
+            taps += mStages[i].length * (mFactor / factor);
+        }
+    }
+    return taps;
+}
+
+/** Group delay in input samples; the timestamps already account for it.
+ */
+uint32_t Decimator::getDelay() const {
+    uint32_t delay = 0;
+    uint32_t factor = 1;
+    for (size_t i = 0; i < mStages.size(); i++) {
+        delay += mStages[i].centre * factor;
+        factor *= mStages[i].factor;
+    }
+    return delay;
+}
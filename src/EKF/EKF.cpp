@@ -0,0 +1,329 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "EKF.h"
+
+#define GRAVITY 9.80665f
+
+// accelerometer readings further than this from 1g are not used for tilt;
+// closer ones count with their deviation added to the noise
+#define EKF_ACCEL_GATE      0.3f
+// below this horizontal field, as a fraction of the total, heading is
+// undefined and the magnetometer is skipped
+#define EKF_MAG_MIN_HORIZONTAL 0.1f
+
+// initial standard deviations
+#define EKF_INITIAL_TILT        0.1f   // rad
+#define EKF_INITIAL_YAW         3.0f   // rad, unknown until the first mag
+#define EKF_INITIAL_GYRO_BIAS   0.02f  // rad/s
+#define EKF_INITIAL_VELOCITY    1.0f   // m/s
+#define EKF_INITIAL_ACCEL_BIAS  0.3f   // m/s^2
+
+EKF::EKF() {
+    reset();
+}
+
+void EKF::setNoise(const EKFNoise& noise) {
+    mNoise = noise;
+}
+
+const EKFNoise& EKF::getNoise() const {
+    return mNoise;
+}
+
+/** Level, north, zero bias and altitude; the first readings after a reset
+ * align the attitude and altitude before any filtering happens.
+ */
+void EKF::reset() {
+    mQ[0] = 1;
+    mQ[1] = mQ[2] = mQ[3] = 0;
+    memset(mGyroBias, 0, sizeof(mGyroBias));
+    mAltitude = 0;
+    mVelocity = 0;
+    mAccelBias = 0;
+    mVerticalAccel = 0;
+    mTiltAligned = false;
+    mYawAligned = false;
+    mAltitudeAligned = false;
+
+    mP = Covariance::zero();
+    mP(0, 0) = mP(1, 1) = EKF_INITIAL_TILT * EKF_INITIAL_TILT;
+    mP(2, 2) = EKF_INITIAL_YAW * EKF_INITIAL_YAW;
+    for (int i = EKF_GYRO_BIAS; i < EKF_GYRO_BIAS + 3; i++) {
+        mP(i, i) = EKF_INITIAL_GYRO_BIAS * EKF_INITIAL_GYRO_BIAS;
+    }
+    mP(EKF_ALTITUDE, EKF_ALTITUDE) = mNoise.baro * mNoise.baro;
+    mP(EKF_VELOCITY, EKF_VELOCITY) = EKF_INITIAL_VELOCITY * EKF_INITIAL_VELOCITY;
+    mP(EKF_ACCEL_BIAS, EKF_ACCEL_BIAS) = EKF_INITIAL_ACCEL_BIAS * EKF_INITIAL_ACCEL_BIAS;
+}
+
+/** Sensor to earth rotation matrix of the current quaternion, row major.
+ */
+void EKF::rotation(float* r) const {
+    float w = mQ[0], x = mQ[1], y = mQ[2], z = mQ[3];
+    r[0] = 1 - 2 * (y * y + z * z);
+    r[1] = 2 * (x * y - w * z);
+    r[2] = 2 * (x * z + w * y);
+    r[3] = 2 * (x * y + w * z);
+    r[4] = 1 - 2 * (x * x + z * z);
+    r[5] = 2 * (y * z - w * x);
+    r[6] = 2 * (x * z - w * y);
+    r[7] = 2 * (y * z + w * x);
+    r[8] = 1 - 2 * (x * x + y * y);
+}
+
+static void normalize(float* q) {
+    float norm = 1 / sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    for (int i = 0; i < 4; i++) {
+        q[i] *= norm;
+    }
+}
+
+/** out = a * b, Hamilton product.
+ */
+static void multiply(const float* a, const float* b, float* out) {
+    out[0] = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+    out[1] = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+    out[2] = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+    out[3] = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+}
+
+/** Propagate with one gyro reading. The attitude turns by the bias
+ * corrected rate, the vertical channel integrates the acceleration of the
+ * last accelerometer reading, and the covariance grows by the process
+ * noise.
+ * @param gyro rad/s, sensor frame
+ * @param dt seconds since the previous gyro reading
+ */
+void EKF::updateGyro(const float* gyro, float dt) {
+    float r[9];
+    rotation(r);
+
+    float half = 0.5f * dt;
+    float dq[4] = { 1, (gyro[0] - mGyroBias[0]) * half, (gyro[1] - mGyroBias[1]) * half,
+                    (gyro[2] - mGyroBias[2]) * half };
+    float q[4];
+    multiply(mQ, dq, q);
+    normalize(q);
+    memcpy(mQ, q, sizeof(mQ));
+
+    // error transition: the rotation error picks up the bias error turned
+    // into the earth frame, the vertical channel is a double integrator
+    Covariance phi = Covariance::identity();
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 3; col++) {
+            phi(EKF_THETA + row, EKF_GYRO_BIAS + col) = -r[row * 3 + col] * dt;
+        }
+    }
+    if (mAltitudeAligned) {
+        float a = mVerticalAccel - mAccelBias;
+        mAltitude += mVelocity * dt + 0.5f * a * dt * dt;
+        mVelocity += a * dt;
+        phi(EKF_ALTITUDE, EKF_VELOCITY) = dt;
+        phi(EKF_ALTITUDE, EKF_ACCEL_BIAS) = -0.5f * dt * dt;
+        phi(EKF_VELOCITY, EKF_ACCEL_BIAS) = -dt;
+    }
+    mP = phi * mP * phi.transposed();
+
+    float gyroNoise = mNoise.gyro * mNoise.gyro * dt;
+    float biasNoise = mNoise.gyroBias * mNoise.gyroBias * dt;
+    for (int i = 0; i < 3; i++) {
+        mP(EKF_THETA + i, EKF_THETA + i) += gyroNoise;
+        mP(EKF_GYRO_BIAS + i, EKF_GYRO_BIAS + i) += biasNoise;
+    }
+    if (mAltitudeAligned) {
+        mP(EKF_VELOCITY, EKF_VELOCITY) += mNoise.verticalAccel * mNoise.verticalAccel * dt;
+        mP(EKF_ACCEL_BIAS, EKF_ACCEL_BIAS) += mNoise.accelBias * mNoise.accelBias * dt;
+    }
+}
+
+/** Roll and pitch straight from the gravity vector, keeping yaw.
+ */
+void EKF::alignTilt(const float* accel) {
+    float roll = atan2f(accel[1], accel[2]);
+    float pitch = atan2f(-accel[0], sqrtf(accel[1] * accel[1] + accel[2] * accel[2]));
+    float yaw = atan2f(2 * (mQ[0] * mQ[3] + mQ[1] * mQ[2]), 1 - 2 * (mQ[2] * mQ[2] + mQ[3] * mQ[3]));
+    float cr = cosf(roll * 0.5f), sr = sinf(roll * 0.5f);
+    float cp = cosf(pitch * 0.5f), sp = sinf(pitch * 0.5f);
+    float cy = cosf(yaw * 0.5f), sy = sinf(yaw * 0.5f);
+    mQ[0] = cy * cp * cr + sy * sp * sr;
+    mQ[1] = cy * cp * sr - sy * sp * cr;
+    mQ[2] = cy * sp * cr + sy * cp * sr;
+    mQ[3] = sy * cp * cr - cy * sp * sr;
+    mTiltAligned = true;
+}
+
+/** Correct roll and pitch from the direction of gravity, and keep the
+ * vertical acceleration for the altitude channel.
+ * @param accel g, sensor frame
+ */
+void EKF::updateAccel(const float* accel) {
+    float norm = sqrtf(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+    if (norm == 0) {
+        return;
+    }
+    if (!mTiltAligned) {
+        alignTilt(accel);
+        return;
+    }
+    float r[9];
+    rotation(r);
+    float earth[3];
+    for (int i = 0; i < 3; i++) {
+        earth[i] = r[i * 3] * accel[0] + r[i * 3 + 1] * accel[1] + r[i * 3 + 2] * accel[2];
+    }
+    mVerticalAccel = (earth[2] - 1) * GRAVITY;
+
+    float deviation = fabsf(norm - 1);
+    if (deviation > EKF_ACCEL_GATE) {
+        return;
+    }
+    // the measured up direction is (-theta_y, theta_x, 1) for a small
+    // rotation error theta
+    Matrix<2, EKF_STATES> h = Matrix<2, EKF_STATES>::zero();
+    h(0, EKF_THETA + 1) = -1;
+    h(1, EKF_THETA + 0) = 1;
+    Matrix<2, 1> residual;
+    residual(0, 0) = earth[0] / norm;
+    residual(1, 0) = earth[1] / norm;
+    float sigma = mNoise.accel + deviation;
+    Matrix<2, 2> noise = Matrix<2, 2>::identity();
+    noise(0, 0) = noise(1, 1) = sigma * sigma;
+    correct(h, residual, noise);
+}
+
+/** Correct yaw from the horizontal part of the field; the vertical part
+ * (inclination) is ignored, so soft iron or a wrong tilt cannot pull on
+ * roll and pitch.
+ * @param mag any unit, sensor frame, after hard and soft iron correction
+ */
+void EKF::updateMag(const float* mag) {
+    float r[9];
+    rotation(r);
+    float hx = r[0] * mag[0] + r[1] * mag[1] + r[2] * mag[2];
+    float hy = r[3] * mag[0] + r[4] * mag[1] + r[5] * mag[2];
+    float hz = r[6] * mag[0] + r[7] * mag[1] + r[8] * mag[2];
+    float horizontal = hx * hx + hy * hy;
+    if (horizontal <= EKF_MAG_MIN_HORIZONTAL * EKF_MAG_MIN_HORIZONTAL * (horizontal + hz * hz)) {
+        return;
+    }
+    // the field points north, so its heading in the estimated earth frame
+    // is the yaw error with the sign flipped
+    float yawError = -atan2f(hy, hx);
+    if (!mYawAligned) {
+        Matrix<EKF_STATES, 1> dx = Matrix<EKF_STATES, 1>::zero();
+        dx(EKF_THETA + 2, 0) = yawError;
+        inject(dx);
+        mP(EKF_THETA + 2, EKF_THETA + 2) = mNoise.mag * mNoise.mag;
+        mYawAligned = true;
+        return;
+    }
+    Matrix<1, EKF_STATES> h = Matrix<1, EKF_STATES>::zero();
+    h(0, EKF_THETA + 2) = 1;
+    Matrix<1, 1> residual;
+    residual(0, 0) = yawError;
+    Matrix<1, 1> noise;
+    noise(0, 0) = mNoise.mag * mNoise.mag;
+    correct(h, residual, noise);
+}
+
+/** Correct the altitude.
+ * @param altitude m, from the barometer
+ */
+void EKF::updateBaro(float altitude) {
+    if (!mAltitudeAligned) {
+        mAltitude = altitude;
+        mVelocity = 0;
+        mAltitudeAligned = true;
+        return;
+    }
+    Matrix<1, EKF_STATES> h = Matrix<1, EKF_STATES>::zero();
+    h(0, EKF_ALTITUDE) = 1;
+    Matrix<1, 1> residual;
+    residual(0, 0) = altitude - mAltitude;
+    Matrix<1, 1> noise;
+    noise(0, 0) = mNoise.baro * mNoise.baro;
+    correct(h, residual, noise);
+}
+
+/** Standard EKF measurement update on the error state, then fold the
+ * error into the nominal state.
+ * @return false if the innovation covariance is singular
+ */
+template<int M>
+bool EKF::correct(const Matrix<M, EKF_STATES>& h, const Matrix<M, 1>& residual,
+        const Matrix<M, M>& noise) {
+    Matrix<EKF_STATES, M> pht = mP * h.transposed();
+    Matrix<M, M> s = h * pht + noise;
+    Matrix<M, M> sInverse;
+    if (!invert(s, &sInverse)) {
+        return false;
+    }
+    Matrix<EKF_STATES, M> gain = pht * sInverse;
+    mP = mP - gain * (h * mP);
+    mP.symmetrize();
+    inject(gain * residual);
+    return true;
+}
+
+/** Apply an error state estimate: the rotation error turns the quaternion
+ * in the earth frame, the other states add.
+ */
+void EKF::inject(const Matrix<EKF_STATES, 1>& dx) {
+    float tx = dx(EKF_THETA, 0), ty = dx(EKF_THETA + 1, 0), tz = dx(EKF_THETA + 2, 0);
+    float angle = sqrtf(tx * tx + ty * ty + tz * tz);
+    if (angle > 0) {
+        float scale = sinf(angle * 0.5f) / angle;
+        float dq[4] = { cosf(angle * 0.5f), tx * scale, ty * scale, tz * scale };
+        float q[4];
+        multiply(dq, mQ, q);
+        normalize(q);
+        memcpy(mQ, q, sizeof(mQ));
+    }
+    for (int i = 0; i < 3; i++) {
+        mGyroBias[i] += dx(EKF_GYRO_BIAS + i, 0);
+    }
+    if (mAltitudeAligned) {
+        mAltitude += dx(EKF_ALTITUDE, 0);
+        mVelocity += dx(EKF_VELOCITY, 0);
+        mAccelBias += dx(EKF_ACCEL_BIAS, 0);
+    }
+}
+
+/** @param q receives w, x, y, z; rotates the sensor frame into the earth
+ * frame
+ */
+void EKF::getQuaternion(float* q) const {
+    memcpy(q, mQ, sizeof(mQ));
+}
+
+/** @param bias receives x, y, z in rad/s
+ */
+void EKF::getGyroBias(float* bias) const {
+    memcpy(bias, mGyroBias, sizeof(mGyroBias));
+}
+
+float EKF::getAltitude() const {
+    return mAltitude;
+}
+
+float EKF::getVerticalSpeed() const {
+    return mVelocity;
+}
+
+const EKF::Covariance& EKF::getCovariance() const {
+    return mP;
+}
+
+/** @param out receives EKF_EXPORT_SIZE floats, laid out as described at
+ * EKF_EXPORT_HEADER
+ */
+void EKF::exportState(float* out) const {
+    memcpy(out, mQ, sizeof(mQ));
+    memcpy(out + 4, mGyroBias, sizeof(mGyroBias));
+    out[7] = mAltitude;
+    out[8] = mVelocity;
+    out[9] = mAccelBias;
+    memcpy(out + EKF_EXPORT_HEADER, mP.m, sizeof(mP.m));
+}
@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FlightRecorder.h"
+
+#define NS_PER_SEC 1000000000ULL
+// how often the header is brought up to date and writeback started
+#define FLIGHT_RECORDER_FLUSH_NS NS_PER_SEC
+
+static_assert(sizeof(FlightRecord) == 56, "the slot layout is the file format");
+
+FlightRecorder::FlightRecorder()
+    : mFd(-1), mMap(NULL), mMapSize(0), mHeader(NULL), mSlots(NULL), mCapacity(0), mSequence(0),
+      mFlushed(0), mFlushTimestamp(0), mError(0) {
+}
+
+FlightRecorder::~FlightRecorder() {
+    close();
+}
+
+/** Create the ring file, preallocated and zero filled, after moving an
+ * existing one to path.prev.
+ * @param header Settings and calibration; the bookkeeping fields are
+ * filled in here
+ * @param capacity Slots, the number of most recent samples kept
+ * @return false on failure, see getError()
+ */
+bool FlightRecorder::open(const char* path, const SampleLogHeader& header, uint32_t capacity) {
+    close();
+    mError = 0;
+    std::string previous = std::string(path) + FLIGHT_RECORDER_PREVIOUS_SUFFIX;
+    if (rename(path, previous.c_str()) != 0 && errno != ENOENT) {
+        mError = errno;
+        return false;
+    }
+    mFd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mFd < 0) {
+        mError = errno;
+        return false;
+    }
+    mCapacity = capacity > 0 ? capacity : 1;
+    mMapSize = SAMPLE_LOG_HEADER_SIZE + (size_t)mCapacity * sizeof(FlightRecord);
+    // every page is rewritten over and over; allocate the blocks once now
+    if (posix_fallocate(mFd, 0, mMapSize) != 0 && ftruncate(mFd, mMapSize) != 0) {
+        mError = errno;
+        ::close(mFd);
+        mFd = -1;
+        return false;
+    }
+    void* map = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (map == MAP_FAILED) {
+        mError = errno;
+        ::close(mFd);
+        mFd = -1;
+        return false;
+    }
+    mMap = static_cast<uint8_t*>(map);
+    mHeader = reinterpret_cast<SampleLogHeader*>(mMap);
+    mSlots = reinterpret_cast<FlightRecord*>(mMap + SAMPLE_LOG_HEADER_SIZE);
+    *mHeader = header;
+    memcpy(mHeader->magic, FLIGHT_RECORDER_MAGIC, sizeof(mHeader->magic));
+    mHeader->version = SAMPLE_LOG_VERSION;
+    mHeader->headerSize = SAMPLE_LOG_HEADER_SIZE;
+    mHeader->recordSize = sizeof(FlightRecord);
+    mHeader->capacity = mCapacity;
+    mHeader->count = 0;
+    mHeader->segment = 0;
+    sync_file_range(mFd, 0, SAMPLE_LOG_HEADER_SIZE, SYNC_FILE_RANGE_WRITE);
+    mSequence = 0;
+    mFlushed = 0;
+    mFlushTimestamp = 0;
+    return true;
+}
+
+/** Store samples in the ring; called on the acquisition thread. Plain
+ * memory writes, plus a flush about once a second of sample time.
+ */
+bool FlightRecorder::write(const Sample* samples, uint32_t count) {
+    if (!mMap) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t sequence = ++mSequence;
+        FlightRecord* slot = &mSlots[sequence % mCapacity];
+        // sequence, sample, commit in this order, also as seen by the
+        // page cache should the process die half way
+        __atomic_store_n(&slot->sequence, sequence, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(&slot->sample, &samples[i], sizeof(Sample));
+        __atomic_store_n(&slot->commit, sequence, __ATOMIC_RELEASE);
+    }
+    if (count > 0 && samples[count - 1].timestamp >= mFlushTimestamp + FLIGHT_RECORDER_FLUSH_NS) {
+        flush();
+        mFlushTimestamp = samples[count - 1].timestamp;
+    }
+    return true;
+}
+
+/** Record the newest sequence in the header and start writeback of the
+ * slots written since the last flush, without waiting for the device.
+ */
+void FlightRecorder::flush() {
+    if (!mMap || mSequence == mFlushed) {
+        return;
+    }
+    __atomic_store_n(&mHeader->count, (uint32_t)(mSequence < mCapacity ? mSequence : mCapacity),
+            __ATOMIC_RELEASE);
+    sync_file_range(mFd, 0, SAMPLE_LOG_HEADER_SIZE, SYNC_FILE_RANGE_WRITE);
+    uint64_t written = mSequence - mFlushed;
+    size_t from = SAMPLE_LOG_HEADER_SIZE + (size_t)((mFlushed + 1) % mCapacity) * sizeof(FlightRecord);
+    size_t to = SAMPLE_LOG_HEADER_SIZE + (size_t)(mSequence % mCapacity + 1) * sizeof(FlightRecord);
+    if (written >= mCapacity) {
+        sync_file_range(mFd, SAMPLE_LOG_HEADER_SIZE, 0, SYNC_FILE_RANGE_WRITE);
+    } else if (from < to) {
+        sync_file_range(mFd, from, to - from, SYNC_FILE_RANGE_WRITE);
+    } else {
+        // wrapped around the end of the ring
+        sync_file_range(mFd, from, mMapSize - from, SYNC_FILE_RANGE_WRITE);
+        sync_file_range(mFd, SAMPLE_LOG_HEADER_SIZE, to - SAMPLE_LOG_HEADER_SIZE, SYNC_FILE_RANGE_WRITE);
+    }
+    mFlushed = mSequence;
+}
+
+void FlightRecorder::close() {
+    if (!mMap) {
+        return;
+    }
+    flush();
+    munmap(mMap, mMapSize);
+    ::close(mFd);
+    mMap = NULL;
+    mHeader = NULL;
+    mSlots = NULL;
+    mFd = -1;
+}
+
+/** Samples written since open(), including those overwritten since.
+ */
+uint64_t FlightRecorder::getCount() const {
+    return mSequence;
+}
+
+uint32_t FlightRecorder::getSegments() const {
+    return mMap || mSequence > 0 ? 1 : 0;
+}
+
+int FlightRecorder::getError() const {
+    return mError;
+}
+
+/** Extract the newest samples of a ring file, also one whose writer
+ * crashed: starting at the newest valid slot, older slots are taken while
+ * their sequence numbers run on without a gap and they lie within seconds
+ * of the newest sample.
+ * @param seconds 0 for everything still in the ring
+ * @param samples Filled oldest first
+ * @param error errno on failure, EINVAL if path is not a flight recorder
+ * @return false if the file cannot be read
+ */
+/*static*/
+bool FlightRecorder::recover(const char* path, double seconds, SampleLogHeader* header,
+        std::vector<Sample>* samples, int* error) {
+    samples->clear();
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = errno;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SAMPLE_LOG_HEADER_SIZE) {
+        *error = EINVAL;
+        ::close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        *error = errno;
+        return false;
+    }
+    const SampleLogHeader* fileHeader = static_cast<const SampleLogHeader*>(map);
+    if (memcmp(fileHeader->magic, FLIGHT_RECORDER_MAGIC, sizeof(fileHeader->magic)) != 0
+            || fileHeader->version != SAMPLE_LOG_VERSION || fileHeader->recordSize != sizeof(FlightRecord)
+            || fileHeader->headerSize < sizeof(SampleLogHeader) || fileHeader->capacity == 0
+            || fileHeader->headerSize + (uint64_t)fileHeader->capacity * sizeof(FlightRecord) > size) {
+        *error = EINVAL;
+        munmap(map, size);
+        return false;
+    }
+    *header = *fileHeader;
+    uint32_t capacity = fileHeader->capacity;
+    const FlightRecord* slots = reinterpret_cast<const FlightRecord*>(
+            static_cast<const uint8_t*>(map) + fileHeader->headerSize);
+
+    // newest complete slot
+    uint64_t newest = 0;
+    for (uint32_t i = 0; i < capacity; i++) {
+        const FlightRecord& slot = slots[i];
+        if (slot.sequence != 0 && slot.sequence == slot.commit && slot.sequence % capacity == i
+                && slot.sequence > newest) {
+            newest = slot.sequence;
+        }
+    }
+    if (newest > 0) {
+        uint64_t end = slots[newest % capacity].sample.timestamp;
+        uint64_t span = seconds > 0 ? (uint64_t)(seconds * NS_PER_SEC) : UINT64_MAX;
+        uint64_t first = newest;
+        for (uint64_t sequence = newest - 1; sequence > 0 && newest - sequence < capacity; sequence--) {
+            const FlightRecord& slot = slots[sequence % capacity];
+            if (slot.sequence != sequence || slot.commit != sequence || end - slot.sample.timestamp > span) {
+                break;
+            }
+            first = sequence;
+        }
+        samples->reserve(newest - first + 1);
+        for (uint64_t sequence = first; sequence <= newest; sequence++) {
+            samples->push_back(slots[sequence % capacity].sample);
+        }
+    }
+    munmap(map, size);
+    return true;
+}
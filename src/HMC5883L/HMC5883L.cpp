@@ -61,6 +61,17 @@ HMC5883L::HMC5883L(uint8_t address) {
     mode = HMC5883L_MODE_CONTINUOUS;
 }
 
+/** Specific bus and address constructor.
+ * @param dev i2c-dev device path or registered bus name
+ * @param address I2C address
+ * @see HMC5883L_DEFAULT_ADDRESS
+ */
+HMC5883L::HMC5883L(const char* dev, uint8_t address) {
+    i2cdev = new I2Cdev(dev);
+    devAddr = address;
+    mode = HMC5883L_MODE_CONTINUOUS;
+}
+
 HMC5883L::~HMC5883L() {
     delete i2cdev;
 }
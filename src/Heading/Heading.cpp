@@ -0,0 +1,100 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "Heading.h"
+
+#define RAD_TO_DEG (180.0f / (float)M_PI)
+#define HEADING_BLOCK 64
+
+/** Branch free atan2 approximation, max error about 1e-5 rad.
+ * Written with selects only so that the batch loop below can be vectorized.
+ */
+static inline float atan2Approx(float y, float x) {
+    float ax = fabsf(x);
+    float ay = fabsf(y);
+    float mn = ax < ay ? ax : ay;
+    float mx = ax < ay ? ay : ax;
+    float z = mn / (mx + 1e-30f);
+    float z2 = z * z;
+    float r = z * (0.9998660f + z2 * (-0.3302995f + z2 * (0.1801410f
+            + z2 * (-0.0851330f + z2 * 0.0208351f))));
+    r = ay > ax ? (float)M_PI_2 - r : r;
+    r = x < 0 ? (float)M_PI - r : r;
+    return y < 0 ? -r : r;
+}
+
+/** Convert an angle in radians to a 0-360 degree heading.
+ */
+static inline float toHeading(float rad) {
+    float heading = rad * RAD_TO_DEG;
+    return heading < 0 ? heading + 360 : heading;
+}
+
+float fastAtan2(float y, float x) {
+    return atan2Approx(y, x);
+}
+
+/** Heading of a level board.
+ * @param mx Corrected magnetometer X
+ * @param my Corrected magnetometer Y
+ */
+float levelHeading(float mx, float my) {
+    return toHeading(atan2f(my, mx));
+}
+
+/** Heading with the magnetometer vector derotated by roll and pitch.
+ * Roll and pitch are derived from the gravity vector, so the result is only
+ * valid while the board is not accelerating hard.
+ * @param accel Accelerometer X/Y/Z, any unit
+ * @param mag Corrected magnetometer X/Y/Z, any unit
+ */
+float tiltCompensatedHeading(const float* accel, const float* mag) {
+    float roll = atan2f(accel[1], accel[2]);
+    float sr = sinf(roll), cr = cosf(roll);
+    float pitch = atan2f(-accel[0], accel[1] * sr + accel[2] * cr);
+    float sp = sinf(pitch), cp = cosf(pitch);
+
+    float xh = mag[0] * cp + mag[1] * sp * sr + mag[2] * sp * cr;
+    float yh = mag[1] * cr - mag[2] * sr;
+    return toHeading(atan2f(yh, xh));
+}
+
+/** Heading for a block of samples with float accelerometer input.
+ * Roll and pitch sines/cosines are taken straight from the normalized gravity
+ * vector instead of going through atan2/sin/cos, and the final angle uses the
+ * polynomial atan2, so the loop has no calls or branches and vectorizes.
+ */
+static void headingBlock(const float* accel, const float* mag, uint32_t count, float* heading) {
+    for (uint32_t i = 0; i < count; i++) {
+        float ax = accel[i * 3], ay = accel[i * 3 + 1], az = accel[i * 3 + 2];
+        float mx = mag[i * 3], my = mag[i * 3 + 1], mz = mag[i * 3 + 2];
+
+        float yz = sqrtf(ay * ay + az * az) + 1e-30f;
+        float norm = sqrtf(ax * ax + ay * ay + az * az) + 1e-30f;
+        float sr = ay / yz, cr = az / yz;
+        float sp = -ax / norm, cp = yz / norm;
+
+        float xh = mx * cp + my * sp * sr + mz * sp * cr;
+        float yh = my * cr - mz * sr;
+        heading[i] = toHeading(atan2Approx(yh, xh));
+    }
+}
+
+/** Batch version of tiltCompensatedHeading().
+ * Raw accelerometer counts are widened to float a block at a time so that the
+ * heading loop itself only sees float data.
+ * @param accel Interleaved raw accelerometer X/Y/Z, 3 * count values
+ * @param mag Interleaved corrected magnetometer X/Y/Z, 3 * count values
+ * @param count Number of samples
+ * @param heading Receives count headings in degrees
+ */
+void tiltCompensatedHeadings(const int16_t* accel, const float* mag, uint32_t count, float* heading) {
+    float block[HEADING_BLOCK * 3];
+    for (uint32_t start = 0; start < count; start += HEADING_BLOCK) {
+        uint32_t n = count - start < HEADING_BLOCK ? count - start : HEADING_BLOCK;
+        for (uint32_t i = 0; i < n * 3; i++) {
+            block[i] = accel[start * 3 + i];
+        }
+        headingBlock(block, mag + start * 3, n, heading + start);
+    }
+}
@@ -0,0 +1,75 @@
+#include <string.h>
+#include <stdint.h>
+#include <mutex>
+
+#include "I2CTransport.h"
+#include "SimTransport.h"
+
+#define MAX_BUSES 8
+#define MAX_BUS_NAME 32
+
+struct BusEntry {
+    char name[MAX_BUS_NAME];
+    I2CTransport* transport;
+};
+
+static BusEntry sBuses[MAX_BUSES];
+static std::mutex sBusesLock;
+
+/** Route every I2Cdev opened with the given name through a transport.
+ * The transport is not owned and must outlive the devices using it.
+ * @return false if the name is too long or the table is full
+ */
+/*static*/
+bool I2CTransport::registerBus(const char* name, I2CTransport* transport) {
+    if (strlen(name) >= MAX_BUS_NAME) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(sBusesLock);
+    BusEntry* slot = NULL;
+    for (int i = 0; i < MAX_BUSES; i++) {
+        if (sBuses[i].transport && strcmp(sBuses[i].name, name) == 0) {
+            slot = &sBuses[i];
+            break;
+        }
+        if (!slot && !sBuses[i].transport) {
+            slot = &sBuses[i];
+        }
+    }
+    if (!slot) {
+        return false;
+    }
+    strcpy(slot->name, name);
+    slot->transport = transport;
+    return true;
+}
+
+/*static*/
+void I2CTransport::unregisterBus(const char* name) {
+    std::lock_guard<std::mutex> lock(sBusesLock);
+    for (int i = 0; i < MAX_BUSES; i++) {
+        if (sBuses[i].transport && strcmp(sBuses[i].name, name) == 0) {
+            sBuses[i].transport = NULL;
+        }
+    }
+}
+
+/** Look up the transport for a bus name.
+ * @return the registered transport, the shared SimTransport for I2C_SIM_BUS,
+ *         or NULL for a real i2c-dev device
+ */
+/*static*/
+I2CTransport* I2CTransport::find(const char* name) {
+    {
+        std::lock_guard<std::mutex> lock(sBusesLock);
+        for (int i = 0; i < MAX_BUSES; i++) {
+            if (sBuses[i].transport && strcmp(sBuses[i].name, name) == 0) {
+                return sBuses[i].transport;
+            }
+        }
+    }
+    if (strcmp(name, I2C_SIM_BUS) == 0) {
+        return SimTransport::shared();
+    }
+    return NULL;
+}
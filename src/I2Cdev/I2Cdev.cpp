@@ -39,14 +39,17 @@ THE SOFTWARE.
 #include <sys/stat.h>
 #include <linux/i2c-dev.h>
 #include "I2Cdev.h"
+#include "I2CTransport.h"
 
 #define DEFAULT_DEV "/dev/i2c-1"
 
 
 /** Default constructor.
+ * @param dev i2c-dev device path, or the name of a registered I2CTransport
  */
 I2Cdev::I2Cdev(const char* dev) {
-    mFD = open(dev, O_RDWR);
+    mTransport = I2CTransport::find(dev);
+    mFD = mTransport ? -1 : open(dev, O_RDWR);
 }
 
 I2Cdev::~I2Cdev() {
@@ -169,6 +172,10 @@ int8_t I2Cdev::readWord(uint8_t devAddr, uint8_t regAddr, uint16_t *data, uint16
 int8_t I2Cdev::readBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout) {
     int8_t count = 0;
 
+    if (mTransport) {
+        return mTransport->readBytes(devAddr, regAddr, length, data);
+    }
+
     int fd = mFD;
     if (fd < 0) {
         fprintf(stderr, "Failed to open device: %s\n", strerror(errno));
@@ -334,6 +341,9 @@ bool I2Cdev::writeBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_
         fprintf(stderr, "Byte write count (%d) > 127\n", length);
         return(FALSE);
     }
+    if (mTransport) {
+        return mTransport->writeBytes(devAddr, regAddr, length, data);
+    }
 
     if (fd < 0) {
         fprintf(stderr, "Failed to open device: %s\n", strerror(errno));
@@ -377,6 +387,13 @@ bool I2Cdev::writeWords(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint16
         fprintf(stderr, "Word write count (%d) > 63\n", length);
         return(FALSE);
     }
+    if (mTransport) {
+        for (i = 0; i < length; i++) {
+            buf[i*2] = data[i] >> 8;
+            buf[i*2+1] = data[i];
+        }
+        return mTransport->writeBytes(devAddr, regAddr, length*2, buf);
+    }
 
     if (fd < 0) {
         fprintf(stderr, "Failed to open device: %s\n", strerror(errno));
@@ -405,6 +422,10 @@ bool I2Cdev::writeWords(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint16
 bool I2Cdev::writeByte(uint8_t devAddr, uint8_t data) {
     int fd = mFD;
 
+    if (mTransport) {
+        return mTransport->writeCommand(devAddr, data);
+    }
+
     if (fd < 0) {
         fprintf(stderr, "Failed to open device: %s\n", strerror(errno));
         return(FALSE);
@@ -424,6 +445,10 @@ bool I2Cdev::writeByte(uint8_t devAddr, uint8_t data) {
 int8_t I2Cdev::readBlock(uint8_t devAddr, uint8_t command, uint8_t length, uint8_t *outdata, uint16_t timeout){
     union i2c_smbus_data data;
 
+    if (mTransport) {
+        return mTransport->readBlock(devAddr, command, length, outdata);
+    }
+
     int fd = mFD;
     if (fd < 0) {
         fprintf(stderr, "Failed to open device: %s\n", strerror(errno));
@@ -31,6 +31,17 @@ MPU6050::MPU6050(uint8_t address) {
     devAddr = address;
 }
 
+/** Specific bus and address constructor.
+ * @param dev i2c-dev device path or registered bus name
+ * @param address I2C address
+ * @see MPU6050_ADDRESS_AD0_LOW
+ * @see MPU6050_ADDRESS_AD0_HIGH
+ */
+MPU6050::MPU6050(const char* dev, uint8_t address) {
+    i2cdev = new I2Cdev(dev);
+    devAddr = address;
+}
+
 /** Power on and prepare for general usage.
  * This will activate the device and take it out of sleep mode (which must be done
  * after start-up). This function also sets both the accelerometer and the gyroscope
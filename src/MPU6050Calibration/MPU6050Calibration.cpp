@@ -0,0 +1,243 @@
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "MPU6050Calibration.h"
+#include "MPU6050.h"
+
+#define NS_PER_MS 1000000ULL
+
+// FIFO frame: accel X/Y/Z, gyro X/Y/Z, big endian
+#define FIFO_FRAME 12
+#define FIFO_CHUNK 21
+#define FIFO_SIZE 1024
+// samples dropped after every offset change while the filter settles
+#define SETTLE_SAMPLES 20
+// the FIFO holds 85 frames, drain it well before that
+#define POLL_INTERVAL (20 * NS_PER_MS)
+
+// dead zones at the most sensitive ranges, in LSB
+#define ACCEL_DEADZONE 8
+#define GYRO_DEADZONE 1
+// controller gain; the offset registers are linear, so close to 1
+#define GAIN 0.9
+
+static uint64_t monotonicNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleepFor(uint64_t ns) {
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+    }
+}
+
+/** The devices are not owned. busLock is held around each group of bus
+ * transactions, other reads can run in between.
+ */
+MPU6050Calibration::MPU6050Calibration(MPU6050* mpu6050, std::mutex* busLock)
+    : mMPU6050(mpu6050), mBusLock(busLock), mSamples(CALIBRATION_DEFAULT_SAMPLES),
+      mMaxIterations(CALIBRATION_DEFAULT_ITERATIONS), mTimeBudget(CALIBRATION_DEFAULT_BUDGET_MS),
+      mSavedRate(0), mSavedDLPF(0), mSavedFIFO(false) {
+}
+
+/** Samples averaged per iteration, at 1kHz.
+ */
+void MPU6050Calibration::setSamples(uint32_t samples) {
+    mSamples = samples > 10 ? samples : 10;
+}
+
+void MPU6050Calibration::setMaxIterations(uint32_t iterations) {
+    mMaxIterations = iterations > 0 ? iterations : 1;
+}
+
+/** Wall clock limit for run(), including the last iteration.
+ */
+void MPU6050Calibration::setTimeBudget(uint32_t milliseconds) {
+    mTimeBudget = milliseconds;
+}
+
+/** Calibrate, starting from the offsets currently in the chip.
+ * If the budget runs out first, the chip keeps the latest offsets.
+ * @param offsets Receives accel x, y, z and gyro x, y, z offsets
+ * @param listener Progress after every iteration, may be NULL
+ * @return true if every axis ended up inside its dead zone
+ */
+bool MPU6050Calibration::run(int16_t* offsets, CalibrationListener* listener) {
+    uint64_t deadline = monotonicNow() + mTimeBudget * NS_PER_MS;
+    int32_t target[6] = { 0, 0, 0, 0, 0, 0 };
+    // LSB moved by one step of each offset register; the accel registers
+    // count 1/2048g and the gyro registers 1/32.8 deg/s, whatever the range
+    float step[6];
+    float deadzone[6];
+    {
+        std::lock_guard<std::mutex> lock(*mBusLock);
+        uint8_t accelRange = mMPU6050->getFullScaleAccelRange();
+        uint8_t gyroRange = mMPU6050->getFullScaleGyroRange();
+        target[2] = 16384 >> accelRange;
+        for (int axis = 0; axis < 3; axis++) {
+            step[axis] = 8.0f / (1 << accelRange);
+            step[axis + 3] = 4.0f / (1 << gyroRange);
+            // below half a step the registers cannot get any closer
+            deadzone[axis] = fmaxf(ACCEL_DEADZONE >> accelRange, step[axis] / 2);
+            deadzone[axis + 3] = fmaxf(GYRO_DEADZONE, step[axis + 3] / 2);
+        }
+        readOffsets(offsets);
+        configure();
+    }
+
+    CalibrationProgress progress;
+    memset(&progress, 0, sizeof(progress));
+    RunningStats stats[6];
+    for (uint32_t iteration = 1; iteration <= mMaxIterations; iteration++) {
+        if (!collect(stats, deadline)) {
+            break;
+        }
+        progress.iteration = iteration;
+        progress.samples = stats[0].count;
+        progress.ready = 0;
+        for (int axis = 0; axis < 6; axis++) {
+            double error = stats[axis].mean - target[axis];
+            double stddev = sqrt(stats[axis].variance());
+            progress.error[axis] = error;
+            progress.stddev[axis] = stddev;
+            // do not chase noise: three standard errors of the mean count as zero
+            double zone = fmax(deadzone[axis], 3 * stddev / sqrt((double)stats[axis].count));
+            if (fabs(error) <= zone) {
+                progress.ready++;
+                continue;
+            }
+            long correction = lrint(GAIN * error / step[axis]);
+            if (correction == 0) {
+                correction = error > 0 ? 1 : -1;
+            }
+            long offset = offsets[axis] - correction;
+            offsets[axis] = offset > INT16_MAX ? INT16_MAX : (offset < INT16_MIN ? INT16_MIN : offset);
+        }
+        progress.converged = progress.ready == 6;
+        progress.done = progress.converged || iteration == mMaxIterations || monotonicNow() >= deadline;
+        memcpy(progress.offsets, offsets, sizeof(progress.offsets));
+        if (!progress.converged) {
+            std::lock_guard<std::mutex> lock(*mBusLock);
+            writeOffsets(offsets);
+        }
+        if (listener) {
+            listener->onProgress(progress);
+        }
+        if (progress.done) {
+            break;
+        }
+    }
+    if (!progress.done) {
+        // the deadline passed while sampling
+        progress.done = true;
+        memcpy(progress.offsets, offsets, sizeof(progress.offsets));
+        if (listener) {
+            listener->onProgress(progress);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(*mBusLock);
+    restore();
+    return progress.converged;
+}
+
+/** Called with the bus lock held.
+ */
+void MPU6050Calibration::configure() {
+    mSavedRate = mMPU6050->getRate();
+    mSavedDLPF = mMPU6050->getDLPFMode();
+    mSavedFIFO = mMPU6050->getFIFOEnabled();
+    // 1kHz with a 188Hz low pass
+    mMPU6050->setDLPFMode(MPU6050_DLPF_BW_188);
+    mMPU6050->setRate(0);
+    mMPU6050->setAccelFIFOEnabled(true);
+    mMPU6050->setTempFIFOEnabled(false);
+    mMPU6050->setXGyroFIFOEnabled(true);
+    mMPU6050->setYGyroFIFOEnabled(true);
+    mMPU6050->setZGyroFIFOEnabled(true);
+    mMPU6050->setFIFOEnabled(true);
+}
+
+/** Called with the bus lock held.
+ */
+void MPU6050Calibration::restore() {
+    mMPU6050->setFIFOEnabled(false);
+    mMPU6050->setAccelFIFOEnabled(false);
+    mMPU6050->setXGyroFIFOEnabled(false);
+    mMPU6050->setYGyroFIFOEnabled(false);
+    mMPU6050->setZGyroFIFOEnabled(false);
+    mMPU6050->resetFIFO();
+    mMPU6050->setRate(mSavedRate);
+    mMPU6050->setDLPFMode(mSavedDLPF);
+    mMPU6050->setFIFOEnabled(mSavedFIFO);
+}
+
+void MPU6050Calibration::readOffsets(int16_t* offsets) {
+    offsets[0] = mMPU6050->getXAccelOffset();
+    offsets[1] = mMPU6050->getYAccelOffset();
+    offsets[2] = mMPU6050->getZAccelOffset();
+    offsets[3] = mMPU6050->getXGyroOffset();
+    offsets[4] = mMPU6050->getYGyroOffset();
+    offsets[5] = mMPU6050->getZGyroOffset();
+}
+
+void MPU6050Calibration::writeOffsets(const int16_t* offsets) {
+    mMPU6050->setXAccelOffset(offsets[0]);
+    mMPU6050->setYAccelOffset(offsets[1]);
+    mMPU6050->setZAccelOffset(offsets[2]);
+    mMPU6050->setXGyroOffset(offsets[3]);
+    mMPU6050->setYGyroOffset(offsets[4]);
+    mMPU6050->setZGyroOffset(offsets[5]);
+}
+
+/** Gather mSamples samples per axis with the current offsets.
+ * @return false if the deadline passed first
+ */
+bool MPU6050Calibration::collect(RunningStats* stats, uint64_t deadline) {
+    uint8_t data[FIFO_CHUNK * FIFO_FRAME];
+    for (int axis = 0; axis < 6; axis++) {
+        stats[axis].reset();
+    }
+    {
+        std::lock_guard<std::mutex> lock(*mBusLock);
+        mMPU6050->resetFIFO();
+    }
+    uint32_t skip = SETTLE_SAMPLES;
+    while (stats[0].count < mSamples) {
+        if (monotonicNow() >= deadline) {
+            return false;
+        }
+        sleepFor(POLL_INTERVAL);
+        std::lock_guard<std::mutex> lock(*mBusLock);
+        uint16_t count = mMPU6050->getFIFOCount();
+        if (count > FIFO_SIZE - FIFO_FRAME) {
+            // overflowed, frames are no longer aligned
+            mMPU6050->resetFIFO();
+            continue;
+        }
+        uint32_t frames = count / FIFO_FRAME;
+        while (frames > 0) {
+            uint32_t n = frames < FIFO_CHUNK ? frames : FIFO_CHUNK;
+            mMPU6050->getFIFOBytes(data, n * FIFO_FRAME);
+            frames -= n;
+            for (uint32_t i = 0; i < n; i++) {
+                if (skip > 0) {
+                    skip--;
+                    continue;
+                }
+                const uint8_t* frame = data + i * FIFO_FRAME;
+                for (int axis = 0; axis < 6; axis++) {
+                    stats[axis].add((int16_t)((frame[axis * 2] << 8) | frame[axis * 2 + 1]));
+                }
+            }
+        }
+    }
+    return true;
+}
@@ -10,17 +10,23 @@
 
 #define DEFAULT_DEV "/dev/i2c-1"
 
-MS5611::MS5611() : ct(0), uosr(0), TEMP2(0), OFF2(0), SENS2(0)
+MS5611::MS5611() : ct(0), uosr(0)
 {
     i2cdev = new I2Cdev(DEFAULT_DEV);
     devAddr = MS5611_ADDRESS;
 }
 MS5611::MS5611(uint8_t add)
- : ct(0), uosr(0), TEMP2(0), OFF2(0), SENS2(0)
+ : ct(0), uosr(0)
 {
     i2cdev = new I2Cdev(DEFAULT_DEV);
     devAddr = add;
 }
+MS5611::MS5611(const char* dev, uint8_t add)
+ : ct(0), uosr(0)
+{
+    i2cdev = new I2Cdev(dev);
+    devAddr = add;
+}
 
 MS5611::~MS5611()
 {
@@ -62,6 +68,13 @@ ms5611_osr_t MS5611::getOversampling(void) {
     return (ms5611_osr_t) uosr;
 }
 
+// Factory calibration C1-C6 as read from the PROM, 6 values
+void MS5611::getCoefficients(uint16_t* coefficients) {
+    for (int i = 0; i < 6; i++) {
+        coefficients[i] = fc[i];
+    }
+}
+
 void MS5611::reset(void) {
     i2cdev->writeByte(devAddr, MS5611_CMD_RESET);
     usleep(50000);
@@ -103,10 +116,27 @@ uint32_t MS5611::readRawPressure(void) {
     return read24(devAddr, MS5611_CMD_ADC_READ);
 }
 
+// Start a D1 or D2 conversion without waiting for it, for callers that
+// schedule the ~9ms conversion time themselves
+void MS5611::startConversion(uint8_t command) {
+    i2cdev->writeByte(devAddr, command);
+}
+
+// Result of the last conversion started with startConversion()
+uint32_t MS5611::readConversion(void) {
+    return read24(devAddr, MS5611_CMD_ADC_READ);
+}
+
 int32_t MS5611::readPressure(bool compensation) {
     uint32_t D1 = readRawPressure();
 
     uint32_t D2 = readRawTemperature();
+    return calculatePressure(D1, D2, compensation);
+}
+
+// Pressure in Pa from raw D1/D2 values, no bus access and no state, so
+// any thread may call it
+int32_t MS5611::calculatePressure(uint32_t D1, uint32_t D2, bool compensation) const {
     int32_t dT = D2 - (uint32_t) fc[4] * 256;
 
     int64_t OFF = (int64_t) fc[1] * 65536 + (int64_t) fc[3] * dT / 128;
@@ -115,8 +145,8 @@ int32_t MS5611::readPressure(bool compensation) {
     if (compensation) {
         int32_t TEMP = 2000 + ((int64_t) dT * fc[5]) / 8388608;
 
-        OFF2 = 0;
-        SENS2 = 0;
+        int64_t OFF2 = 0;
+        int64_t SENS2 = 0;
 
         if (TEMP < 2000) {
             OFF2 = 5 * ((TEMP - 2000) * (TEMP - 2000)) / 2;
@@ -139,11 +169,16 @@ int32_t MS5611::readPressure(bool compensation) {
 
 double MS5611::readTemperature(bool compensation) {
     uint32_t D2 = readRawTemperature();
+    return calculateTemperature(D2, compensation);
+}
+
+// Temperature in C from a raw D2 value, no bus access and no state
+double MS5611::calculateTemperature(uint32_t D2, bool compensation) const {
     int32_t dT = D2 - (uint32_t) fc[4] * 256;
 
     int32_t TEMP = 2000 + ((int64_t) dT * fc[5]) / 8388608;
 
-    TEMP2 = 0;
+    int32_t TEMP2 = 0;
 
     if (compensation) {
         if (TEMP < 2000) {
@@ -157,7 +192,7 @@ double MS5611::readTemperature(bool compensation) {
 }
 
 // Calculate altitude from Pressure & Sea level pressure
-double MS5611::getAltitude(double pressure, double seaLevelPressure) {
+double MS5611::getAltitude(double pressure, double seaLevelPressure) const {
     return (44330.0f
             * (1.0f
                     - pow((double) pressure / (double) seaLevelPressure,
@@ -0,0 +1,364 @@
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "HMC5883L.h"
+#include "MagCalibration.h"
+
+#define FIT_PARAMS 9
+
+// value reported by the HMC5883L when an axis overflows
+#define HMC5883L_SATURATED -4096
+
+// LSB/Gauss for each HMC5883L_GAIN_* setting
+static const float sGainLSBPerGauss[] = { 1370, 1090, 820, 660, 440, 390, 330, 230 };
+
+// field induced by the self-test bias current, in Gauss (datasheet, X/Y/Z)
+static const float sSelfTestField[] = { 1.16f, 1.16f, 1.08f };
+
+/** Solve a * x = b in place with Gaussian elimination and partial pivoting.
+ * @return false if the system is singular
+ */
+static bool solveLinear(double a[FIT_PARAMS][FIT_PARAMS], double b[FIT_PARAMS], double x[FIT_PARAMS]) {
+    for (int col = 0; col < FIT_PARAMS; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < FIT_PARAMS; row++) {
+            if (fabs(a[row][col]) > fabs(a[pivot][col])) {
+                pivot = row;
+            }
+        }
+        if (fabs(a[pivot][col]) < 1e-12) {
+            return false;
+        }
+        if (pivot != col) {
+            for (int k = 0; k < FIT_PARAMS; k++) {
+                double t = a[col][k]; a[col][k] = a[pivot][k]; a[pivot][k] = t;
+            }
+            double t = b[col]; b[col] = b[pivot]; b[pivot] = t;
+        }
+        for (int row = col + 1; row < FIT_PARAMS; row++) {
+            double f = a[row][col] / a[col][col];
+            for (int k = col; k < FIT_PARAMS; k++) {
+                a[row][k] -= f * a[col][k];
+            }
+            b[row] -= f * b[col];
+        }
+    }
+    for (int row = FIT_PARAMS - 1; row >= 0; row--) {
+        double s = b[row];
+        for (int k = row + 1; k < FIT_PARAMS; k++) {
+            s -= a[row][k] * x[k];
+        }
+        x[row] = s / a[row][row];
+    }
+    return true;
+}
+
+/** Eigen decomposition of a symmetric 3x3 matrix with cyclic Jacobi rotations.
+ * @param m Symmetric matrix, destroyed on return
+ * @param values Eigenvalues
+ * @param vectors Eigenvectors, stored as columns
+ */
+static void jacobiEigen3(double m[3][3], double values[3], double vectors[3][3]) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            vectors[i][j] = (i == j) ? 1.0 : 0.0;
+        }
+    }
+    for (int sweep = 0; sweep < 50; sweep++) {
+        double off = fabs(m[0][1]) + fabs(m[0][2]) + fabs(m[1][2]);
+        if (off < 1e-15) {
+            break;
+        }
+        for (int p = 0; p < 2; p++) {
+            for (int q = p + 1; q < 3; q++) {
+                if (fabs(m[p][q]) < 1e-300) {
+                    continue;
+                }
+                double theta = (m[q][q] - m[p][p]) / (2 * m[p][q]);
+                double t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1));
+                double c = 1 / sqrt(t * t + 1);
+                double s = t * c;
+                for (int k = 0; k < 3; k++) {
+                    double mkp = m[k][p], mkq = m[k][q];
+                    m[k][p] = c * mkp - s * mkq;
+                    m[k][q] = s * mkp + c * mkq;
+                }
+                for (int k = 0; k < 3; k++) {
+                    double mpk = m[p][k], mqk = m[q][k];
+                    m[p][k] = c * mpk - s * mqk;
+                    m[q][k] = s * mpk + c * mqk;
+                }
+                for (int k = 0; k < 3; k++) {
+                    double vkp = vectors[k][p], vkq = vectors[k][q];
+                    vectors[k][p] = c * vkp - s * vkq;
+                    vectors[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        values[i] = m[i][i];
+    }
+}
+
+MagCalibration::MagCalibration() {
+    reset();
+}
+
+/** Drop all accumulated samples.
+ */
+void MagCalibration::reset() {
+    memset(mDTD, 0, sizeof(mDTD));
+    memset(mDT1, 0, sizeof(mDT1));
+    mScale = 0;
+    mCount = 0;
+}
+
+/** Accumulate one raw reading into the ellipsoid fit.
+ * Saturated readings (-4096 on any axis) are ignored.
+ * @param x Raw X axis reading
+ * @param y Raw Y axis reading
+ * @param z Raw Z axis reading
+ */
+void MagCalibration::addSample(int16_t x, int16_t y, int16_t z) {
+    if (x == HMC5883L_SATURATED || y == HMC5883L_SATURATED || z == HMC5883L_SATURATED) {
+        return;
+    }
+    addSample((float)x, (float)y, (float)z);
+}
+
+/** Accumulate one already scaled reading into the ellipsoid fit.
+ * @see MagCorrection::scale
+ */
+void MagCalibration::addSample(float x, float y, float z) {
+    if (mScale == 0) {
+        mScale = sqrt((double)x * x + (double)y * y + (double)z * z);
+        if (mScale < 1) {
+            mScale = 0;
+            return;
+        }
+    }
+    double fx = x / mScale, fy = y / mScale, fz = z / mScale;
+    double d[FIT_PARAMS] = {
+        fx * fx, fy * fy, fz * fz,
+        2 * fx * fy, 2 * fx * fz, 2 * fy * fz,
+        2 * fx, 2 * fy, 2 * fz
+    };
+    for (int i = 0; i < FIT_PARAMS; i++) {
+        for (int j = i; j < FIT_PARAMS; j++) {
+            mDTD[i][j] += d[i] * d[j];
+        }
+        mDT1[i] += d[i];
+    }
+    mCount++;
+}
+
+uint32_t MagCalibration::getSampleCount() const {
+    return mCount;
+}
+
+/** Fit an ellipsoid to the accumulated samples.
+ * The resulting soft-iron matrix keeps the volume of the fitted ellipsoid, so
+ * corrected readings stay in (roughly) the same LSB units as the raw ones.
+ * @param correction Receives offset and soft-iron matrix on success
+ * @return false if there are too few samples or they do not describe an
+ *         ellipsoid (e.g. the board was only rotated around one axis)
+ */
+bool MagCalibration::solve(MagCorrection* correction) const {
+    if (mCount < MAG_CALIBRATION_MIN_SAMPLES) {
+        return false;
+    }
+
+    double a[FIT_PARAMS][FIT_PARAMS];
+    double b[FIT_PARAMS];
+    double p[FIT_PARAMS];
+    for (int i = 0; i < FIT_PARAMS; i++) {
+        for (int j = 0; j < FIT_PARAMS; j++) {
+            a[i][j] = (j >= i) ? mDTD[i][j] : mDTD[j][i];
+        }
+        b[i] = mDT1[i];
+    }
+    if (!solveLinear(a, b, p)) {
+        return false;
+    }
+
+    // x' M x + 2 v' x = 1
+    double m[3][3] = {
+        { p[0], p[3], p[4] },
+        { p[3], p[1], p[5] },
+        { p[4], p[5], p[2] }
+    };
+    double v[3] = { p[6], p[7], p[8] };
+
+    double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+               - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+               + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    if (fabs(det) < 1e-300) {
+        return false;
+    }
+    double inv[3][3] = {
+        { (m[1][1] * m[2][2] - m[1][2] * m[2][1]) / det,
+          (m[0][2] * m[2][1] - m[0][1] * m[2][2]) / det,
+          (m[0][1] * m[1][2] - m[0][2] * m[1][1]) / det },
+        { (m[1][2] * m[2][0] - m[1][0] * m[2][2]) / det,
+          (m[0][0] * m[2][2] - m[0][2] * m[2][0]) / det,
+          (m[0][2] * m[1][0] - m[0][0] * m[1][2]) / det },
+        { (m[1][0] * m[2][1] - m[1][1] * m[2][0]) / det,
+          (m[0][1] * m[2][0] - m[0][0] * m[2][1]) / det,
+          (m[0][0] * m[1][1] - m[0][1] * m[1][0]) / det }
+    };
+
+    // center = -M^-1 v, then (x - c)' M (x - c) = 1 + c' M c
+    double c[3];
+    for (int i = 0; i < 3; i++) {
+        c[i] = -(inv[i][0] * v[0] + inv[i][1] * v[1] + inv[i][2] * v[2]);
+    }
+    double k = 1;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            k += c[i] * m[i][j] * c[j];
+        }
+    }
+    if (k <= 0) {
+        return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            m[i][j] /= k;
+        }
+    }
+
+    double values[3];
+    double vectors[3][3];
+    jacobiEigen3(m, values, vectors);
+    if (values[0] <= 0 || values[1] <= 0 || values[2] <= 0) {
+        return false;
+    }
+
+    // sqrt(M) maps the ellipsoid onto the unit sphere; scale it back to the
+    // radius of the sphere with the same volume as the ellipsoid
+    double radius = pow(values[0] * values[1] * values[2], -1.0 / 6.0);
+    double root[3];
+    for (int i = 0; i < 3; i++) {
+        root[i] = sqrt(values[i]) * radius;
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            double s = 0;
+            for (int e = 0; e < 3; e++) {
+                s += vectors[i][e] * root[e] * vectors[j][e];
+            }
+            correction->matrix[i * 3 + j] = (float)s;
+        }
+        correction->offset[i] = (float)(c[i] * mScale);
+    }
+    return true;
+}
+
+/** Take one single-mode measurement with the given bias applied.
+ * The first measurement after a gain change still uses the previous gain, so
+ * callers discard one reading after setGain().
+ * @return false on timeout
+ */
+static bool measureBiased(HMC5883L* hmc5883l, std::mutex* busLock, uint8_t bias, int16_t* m) {
+    {
+        std::lock_guard<std::mutex> lock(*busLock);
+        hmc5883l->setMeasurementBias(bias);
+        hmc5883l->setMode(HMC5883L_MODE_SINGLE);
+    }
+    for (int wait = 0;; wait++) {
+        {
+            std::lock_guard<std::mutex> lock(*busLock);
+            if (hmc5883l->getReadyStatus()) {
+                hmc5883l->getHeading(&m[0], &m[1], &m[2]);
+                return true;
+            }
+        }
+        if (wait > 100) {
+            return false;
+        }
+        usleep(1000);
+    }
+}
+
+static bool isSaturated(const int16_t* m) {
+    return m[0] == HMC5883L_SATURATED || m[1] == HMC5883L_SATURATED || m[2] == HMC5883L_SATURATED;
+}
+
+/** Judge one pair of self-test measurements.
+ * Half the difference of the positive and negative bias readings is the
+ * induced field with the ambient field cancelled out; comparing it with the
+ * nominal bias field gives the gain error of each axis.
+ * @param gain HMC5883L_GAIN_* the measurements were taken at
+ * @param pos Reading with positive bias
+ * @param neg Reading with negative bias
+ * @param scale Receives the X/Y/Z scale factors when the test passed
+ * @return MAG_SELF_TEST_PASSED, MAG_SELF_TEST_SATURATED if an axis overflowed
+ *         or MAG_SELF_TEST_FAILED if an axis is outside the limits
+ */
+int MagCalibration::checkSelfTest(uint8_t gain, const int16_t* pos, const int16_t* neg, float* scale) {
+    if (isSaturated(pos) || isSaturated(neg)) {
+        return MAG_SELF_TEST_SATURATED;
+    }
+    float factors[3];
+    for (int i = 0; i < 3; i++) {
+        float expected = sSelfTestField[i] * sGainLSBPerGauss[gain];
+        float measured = (pos[i] - neg[i]) * 0.5f;
+        // datasheet self-test limits are roughly 0.5x to 1.3x nominal
+        if (measured < expected * 0.5f || measured > expected * 1.5f) {
+            return MAG_SELF_TEST_FAILED;
+        }
+        factors[i] = expected / measured;
+    }
+    memcpy(scale, factors, sizeof(factors));
+    return MAG_SELF_TEST_PASSED;
+}
+
+/** Derive per-axis scale factors from the HMC5883L self-test bias coil.
+ * A positive and a negative bias measurement are taken at the configured
+ * gain; only if an axis saturates is the gain stepped down and the test
+ * repeated. Mode, gain, data rate and averaging are always restored. The bus
+ * lock is taken for each step, not for the whole test.
+ * @param hmc5883l Device to test
+ * @param busLock Lock of the bus the device is on
+ * @param scale Receives the X/Y/Z scale factors on success
+ * @return false if the readings are outside the limits, every gain
+ *         saturated or the device did not answer
+ */
+bool MagCalibration::selfTest(HMC5883L* hmc5883l, std::mutex* busLock, float* scale) {
+    uint8_t averaging, rate, mode, gain;
+    {
+        std::lock_guard<std::mutex> lock(*busLock);
+        averaging = hmc5883l->getSampleAveraging();
+        rate = hmc5883l->getDataRate();
+        mode = hmc5883l->getMode();
+        gain = hmc5883l->getGain();
+        hmc5883l->setSampleAveraging(HMC5883L_AVERAGING_8);
+    }
+    int result = MAG_SELF_TEST_SATURATED;
+    int16_t pos[3], neg[3], normal[3];
+    for (uint8_t g = gain; g <= HMC5883L_GAIN_220 && result == MAG_SELF_TEST_SATURATED; g++) {
+        {
+            std::lock_guard<std::mutex> lock(*busLock);
+            hmc5883l->setGain(g);
+        }
+        // the first reading after a gain change is discarded
+        if (!measureBiased(hmc5883l, busLock, HMC5883L_BIAS_NORMAL, normal)
+                || !measureBiased(hmc5883l, busLock, HMC5883L_BIAS_POSITIVE, pos)
+                || !measureBiased(hmc5883l, busLock, HMC5883L_BIAS_NEGATIVE, neg)) {
+            result = MAG_SELF_TEST_FAILED;
+            break;
+        }
+        result = checkSelfTest(g, pos, neg, scale);
+    }
+
+    std::lock_guard<std::mutex> lock(*busLock);
+    hmc5883l->setMeasurementBias(HMC5883L_BIAS_NORMAL);
+    hmc5883l->setSampleAveraging(averaging);
+    hmc5883l->setDataRate(rate);
+    hmc5883l->setGain(gain);
+    hmc5883l->setMode(mode);
+    return result == MAG_SELF_TEST_PASSED;
+}
@@ -0,0 +1,324 @@
+#include <math.h>
+#include <time.h>
+#include <stdint.h>
+
+#include "MagneticModel.h"
+
+#define DEG_TO_RAD (M_PI / 180.0)
+#define RAD_TO_DEG (180.0 / M_PI)
+
+// WGS84 ellipsoid and the geomagnetic reference radius, km
+#define WGS84_A 6378.137
+#define WGS84_B 6356.7523142
+#define WMM_RE  6371.2
+
+#define WMM_EPOCH 2025.0
+
+struct WMMCoefficient {
+    uint8_t n, m;
+    float g, h;       // nT
+    float gdot, hdot; // nT/year
+};
+
+// WMM2025, NOAA NCEI / BGS
+static const WMMCoefficient sWMM[] = {
+    {  1,  0, -29351.8f,      0.0f,  12.0f,   0.0f },
+    {  1,  1,  -1410.8f,   4545.4f,   9.7f, -21.5f },
+    {  2,  0,  -2556.6f,      0.0f, -11.6f,   0.0f },
+    {  2,  1,   2951.1f,  -3133.6f,  -5.2f, -27.7f },
+    {  2,  2,   1649.3f,   -815.1f,  -8.0f, -12.1f },
+    {  3,  0,   1361.0f,      0.0f,  -1.3f,   0.0f },
+    {  3,  1,  -2404.1f,    -56.6f,  -4.2f,   4.0f },
+    {  3,  2,   1243.8f,    237.5f,   0.4f,  -0.3f },
+    {  3,  3,    453.6f,   -549.5f, -15.6f,  -4.1f },
+    {  4,  0,    895.0f,      0.0f,  -1.6f,   0.0f },
+    {  4,  1,    799.5f,    278.6f,  -2.4f,  -1.1f },
+    {  4,  2,     55.7f,   -133.9f,  -6.0f,   4.1f },
+    {  4,  3,   -281.1f,    212.0f,   5.6f,   1.6f },
+    {  4,  4,     12.1f,   -375.6f,  -7.0f,  -4.4f },
+    {  5,  0,   -233.2f,      0.0f,   0.6f,   0.0f },
+    {  5,  1,    368.9f,     45.4f,   1.4f,  -0.5f },
+    {  5,  2,    187.2f,    220.2f,   0.0f,   2.2f },
+    {  5,  3,   -138.7f,   -122.9f,   0.6f,   0.4f },
+    {  5,  4,   -142.0f,     43.0f,   2.2f,   1.7f },
+    {  5,  5,     20.9f,    106.1f,   0.9f,   1.9f },
+    {  6,  0,     64.4f,      0.0f,  -0.2f,   0.0f },
+    {  6,  1,     63.8f,    -18.4f,  -0.4f,   0.3f },
+    {  6,  2,     76.9f,     16.8f,   0.9f,  -1.6f },
+    {  6,  3,   -115.7f,     48.8f,   1.2f,  -0.4f },
+    {  6,  4,    -40.9f,    -59.8f,  -0.9f,   0.9f },
+    {  6,  5,     14.9f,     10.9f,   0.3f,   0.7f },
+    {  6,  6,    -60.7f,     72.7f,   0.9f,   0.9f },
+    {  7,  0,     79.5f,      0.0f,  -0.0f,   0.0f },
+    {  7,  1,    -77.0f,    -48.9f,  -0.1f,   0.6f },
+    {  7,  2,     -8.8f,    -14.4f,  -0.1f,   0.5f },
+    {  7,  3,     59.3f,     -1.0f,   0.5f,  -0.8f },
+    {  7,  4,     15.8f,     23.4f,  -0.1f,   0.0f },
+    {  7,  5,      2.5f,     -7.4f,  -0.8f,  -1.0f },
+    {  7,  6,    -11.1f,    -25.1f,  -0.8f,   0.6f },
+    {  7,  7,     14.2f,     -2.3f,   0.8f,  -0.2f },
+    {  8,  0,     23.2f,      0.0f,  -0.1f,   0.0f },
+    {  8,  1,     10.8f,      7.1f,   0.2f,  -0.2f },
+    {  8,  2,    -17.5f,    -12.6f,   0.0f,   0.5f },
+    {  8,  3,      2.0f,     11.4f,   0.5f,  -0.4f },
+    {  8,  4,    -21.7f,     -9.7f,  -0.1f,   0.4f },
+    {  8,  5,     16.9f,     12.7f,   0.3f,  -0.5f },
+    {  8,  6,     15.0f,      0.7f,   0.2f,  -0.6f },
+    {  8,  7,    -16.8f,     -5.2f,  -0.0f,   0.3f },
+    {  8,  8,      0.9f,      3.9f,   0.2f,   0.2f },
+    {  9,  0,      4.6f,      0.0f,  -0.0f,   0.0f },
+    {  9,  1,      7.8f,    -24.8f,  -0.1f,  -0.3f },
+    {  9,  2,      3.0f,     12.2f,   0.1f,   0.3f },
+    {  9,  3,     -0.2f,      8.3f,   0.3f,  -0.3f },
+    {  9,  4,     -2.5f,     -3.3f,  -0.3f,   0.3f },
+    {  9,  5,    -13.1f,     -5.2f,   0.0f,   0.2f },
+    {  9,  6,      2.4f,      7.2f,   0.3f,  -0.1f },
+    {  9,  7,      8.6f,     -0.6f,  -0.1f,  -0.2f },
+    {  9,  8,     -8.7f,      0.8f,   0.1f,   0.4f },
+    {  9,  9,    -12.9f,     10.0f,  -0.1f,   0.1f },
+    { 10,  0,     -1.3f,      0.0f,   0.1f,   0.0f },
+    { 10,  1,     -6.4f,      3.3f,   0.0f,   0.0f },
+    { 10,  2,      0.2f,      0.0f,   0.1f,  -0.0f },
+    { 10,  3,      2.0f,      2.4f,   0.1f,  -0.2f },
+    { 10,  4,     -1.0f,      5.3f,  -0.0f,   0.1f },
+    { 10,  5,     -0.6f,     -9.1f,  -0.3f,  -0.1f },
+    { 10,  6,     -0.9f,      0.4f,   0.0f,   0.1f },
+    { 10,  7,      1.5f,     -4.2f,  -0.1f,   0.0f },
+    { 10,  8,      0.9f,     -3.8f,  -0.1f,  -0.1f },
+    { 10,  9,     -2.7f,      0.9f,  -0.0f,   0.2f },
+    { 10, 10,     -3.9f,     -9.1f,  -0.0f,  -0.0f },
+    { 11,  0,      2.9f,      0.0f,   0.0f,   0.0f },
+    { 11,  1,     -1.5f,      0.0f,  -0.0f,  -0.0f },
+    { 11,  2,     -2.5f,      2.9f,   0.0f,   0.1f },
+    { 11,  3,      2.4f,     -0.6f,   0.0f,  -0.0f },
+    { 11,  4,     -0.6f,      0.2f,   0.0f,   0.1f },
+    { 11,  5,     -0.1f,      0.5f,  -0.1f,  -0.0f },
+    { 11,  6,     -0.6f,     -0.3f,   0.0f,  -0.0f },
+    { 11,  7,     -0.1f,     -1.2f,  -0.0f,   0.1f },
+    { 11,  8,      1.1f,     -1.7f,  -0.1f,  -0.0f },
+    { 11,  9,     -1.0f,     -2.9f,  -0.1f,   0.0f },
+    { 11, 10,     -0.2f,     -1.8f,  -0.1f,   0.0f },
+    { 11, 11,      2.6f,     -2.3f,  -0.1f,   0.0f },
+    { 12,  0,     -2.0f,      0.0f,   0.0f,   0.0f },
+    { 12,  1,     -0.2f,     -1.3f,   0.0f,  -0.0f },
+    { 12,  2,      0.3f,      0.7f,  -0.0f,   0.0f },
+    { 12,  3,      1.2f,      1.0f,  -0.0f,  -0.1f },
+    { 12,  4,     -1.3f,     -1.4f,  -0.0f,   0.1f },
+    { 12,  5,      0.6f,     -0.0f,  -0.0f,  -0.0f },
+    { 12,  6,      0.6f,      0.6f,   0.1f,  -0.0f },
+    { 12,  7,      0.5f,     -0.1f,  -0.0f,  -0.0f },
+    { 12,  8,     -0.1f,      0.8f,   0.0f,   0.0f },
+    { 12,  9,     -0.4f,      0.1f,   0.0f,  -0.0f },
+    { 12, 10,     -0.2f,     -1.0f,  -0.1f,  -0.0f },
+    { 12, 11,     -1.3f,      0.1f,  -0.0f,   0.0f },
+    { 12, 12,     -0.7f,      0.2f,  -0.1f,  -0.1f },
+};
+
+/*static*/
+double MagneticModel::getEpoch() {
+    return WMM_EPOCH;
+}
+
+/** True from the epoch of the model for WMM_LIFESPAN years.
+ */
+/*static*/
+bool MagneticModel::isValidDate(double decimalYear) {
+    return decimalYear >= WMM_EPOCH && decimalYear < WMM_EPOCH + WMM_LIFESPAN;
+}
+
+/*static*/
+double MagneticModel::currentDecimalYear() {
+    time_t now = time(NULL);
+    struct tm t;
+    gmtime_r(&now, &t);
+    int year = t.tm_year + 1900;
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return year + (t.tm_yday + t.tm_hour / 24.0) / (leap ? 366.0 : 365.0);
+}
+
+/** Evaluate the main field at a geodetic position.
+ * @param latitude Geodetic latitude, degrees
+ * @param longitude Longitude, degrees
+ * @param altitude Height above the WGS84 ellipsoid, km
+ * @param decimalYear Date, e.g. 2026.5
+ * @param field Receives the field components, declination and inclination
+ * @return false, leaving field alone, if the date is outside the model
+ */
+/*static*/
+bool MagneticModel::evaluate(double latitude, double longitude, double altitude,
+        double decimalYear, MagneticField* field) {
+    if (!isValidDate(decimalYear)) {
+        return false;
+    }
+    const int N = WMM_MAX_DEGREE;
+    double dt = decimalYear - WMM_EPOCH;
+
+    // geodetic to geocentric spherical coordinates
+    double rlat = latitude * DEG_TO_RAD;
+    double rlon = longitude * DEG_TO_RAD;
+    double srlat = sin(rlat), crlat = cos(rlat);
+    double srlat2 = srlat * srlat, crlat2 = crlat * crlat;
+    double a2 = WGS84_A * WGS84_A, b2 = WGS84_B * WGS84_B;
+    double c2 = a2 - b2;
+    double a4 = a2 * a2, b4 = b2 * b2, c4 = a4 - b4;
+    double q = sqrt(a2 - c2 * srlat2);
+    double q1 = altitude * q;
+    double q2 = ((q1 + a2) / (q1 + b2)) * ((q1 + a2) / (q1 + b2));
+    double ct = srlat / sqrt(q2 * crlat2 + srlat2);
+    double st = sqrt(1.0 - ct * ct);
+    if (st < 1e-10) {
+        st = 1e-10;
+    }
+    double r = sqrt(altitude * altitude + 2.0 * q1 + (a4 - c4 * srlat2) / (q * q));
+    double d = sqrt(a2 * crlat2 + b2 * srlat2);
+    double ca = (altitude + d) / r;
+    double sa = c2 * crlat * srlat / (r * d);
+
+    // Gauss normalized associated Legendre functions and their theta
+    // derivatives; the Schmidt factors are folded into the coefficients
+    double p[N + 1][N + 1], dp[N + 1][N + 1], schmidt[N + 1][N + 1];
+    double cosml[N + 1], sinml[N + 1];
+    p[0][0] = 1;
+    dp[0][0] = 0;
+    schmidt[0][0] = 1;
+    for (int n = 1; n <= N; n++) {
+        schmidt[n][0] = schmidt[n - 1][0] * (2 * n - 1) / n;
+        for (int m = 1; m <= n; m++) {
+            schmidt[n][m] = schmidt[n][m - 1] * sqrt((double)(n - m + 1) * (m == 1 ? 2 : 1) / (n + m));
+        }
+        for (int m = 0; m <= n; m++) {
+            if (n == m) {
+                p[n][m] = st * p[n - 1][m - 1];
+                dp[n][m] = st * dp[n - 1][m - 1] + ct * p[n - 1][m - 1];
+            } else if (n == 1 || m == n - 1) {
+                p[n][m] = ct * p[n - 1][m];
+                dp[n][m] = ct * dp[n - 1][m] - st * p[n - 1][m];
+            } else {
+                double k = (double)((n - 1) * (n - 1) - m * m) / ((2 * n - 1) * (2 * n - 3));
+                p[n][m] = ct * p[n - 1][m] - k * p[n - 2][m];
+                dp[n][m] = ct * dp[n - 1][m] - st * p[n - 1][m] - k * dp[n - 2][m];
+            }
+        }
+    }
+    for (int m = 0; m <= N; m++) {
+        cosml[m] = cos(m * rlon);
+        sinml[m] = sin(m * rlon);
+    }
+
+    double br = 0, bt = 0, bp = 0;
+    double ratio = WMM_RE / r;
+    double ar = ratio * ratio;
+    int last = -1;
+    for (unsigned i = 0; i < sizeof(sWMM) / sizeof(sWMM[0]); i++) {
+        const WMMCoefficient& c = sWMM[i];
+        int n = c.n, m = c.m;
+        if (n != last) {
+            ar *= ratio;
+            last = n;
+        }
+        double g = (c.g + dt * c.gdot) * schmidt[n][m];
+        double h = (c.h + dt * c.hdot) * schmidt[n][m];
+        double t1 = g * cosml[m] + h * sinml[m];
+        double t2 = g * sinml[m] - h * cosml[m];
+        br += ar * (n + 1) * t1 * p[n][m];
+        bt -= ar * t1 * dp[n][m];
+        bp += ar * m * t2 * p[n][m] / st;
+    }
+
+    // rotate back from geocentric to geodetic
+    field->x = -bt * ca - br * sa;
+    field->y = bp;
+    field->z = bt * sa - br * ca;
+    double horizontal = sqrt(field->x * field->x + field->y * field->y);
+    field->declination = atan2(field->y, field->x) * RAD_TO_DEG;
+    field->inclination = atan2(field->z, horizontal) * RAD_TO_DEG;
+    return true;
+}
+
+DeclinationGrid::DeclinationGrid()
+    : mLatitude0(0), mLongitude0(0), mAltitude(0), mYear(WMM_EPOCH), mValid(false)
+{
+}
+
+/** Set the location and date the grid is built around.
+ * @param latitude Geodetic latitude, degrees
+ * @param longitude Longitude, degrees
+ * @param altitude Height above the WGS84 ellipsoid, km
+ * @param decimalYear Date, e.g. 2026.5
+ * @return false, keeping the previous grid, if the date is outside the model
+ */
+bool DeclinationGrid::setOrigin(double latitude, double longitude, double altitude, double decimalYear) {
+    if (!MagneticModel::isValidDate(decimalYear)) {
+        return false;
+    }
+    mAltitude = altitude;
+    mYear = decimalYear;
+    build(latitude, longitude);
+    return true;
+}
+
+bool DeclinationGrid::isValid() const {
+    return mValid;
+}
+
+void DeclinationGrid::build(double latitude, double longitude) {
+    MagneticField field;
+    double half = (DECLINATION_GRID_SIZE - 1) / 2 * DECLINATION_GRID_SPACING;
+    mLatitude0 = latitude - half;
+    mLongitude0 = longitude - half;
+    for (int i = 0; i < DECLINATION_GRID_SIZE; i++) {
+        for (int j = 0; j < DECLINATION_GRID_SIZE; j++) {
+            double lat = mLatitude0 + i * DECLINATION_GRID_SPACING;
+            if (lat > 89.99) {
+                lat = 89.99;
+            } else if (lat < -89.99) {
+                lat = -89.99;
+            }
+            MagneticModel::evaluate(lat, mLongitude0 + j * DECLINATION_GRID_SPACING,
+                    mAltitude, mYear, &field);
+            mDeclination[i][j] = (float)field.declination;
+            mInclination[i][j] = (float)field.inclination;
+        }
+    }
+    mValid = true;
+}
+
+/** Interpolate declination and inclination at a position near the origin.
+ * Positions outside the grid re-centre it on the new position first.
+ * @param latitude Geodetic latitude, degrees
+ * @param longitude Longitude, degrees
+ * @param declination Receives the declination, degrees
+ * @param inclination Receives the inclination, degrees
+ */
+void DeclinationGrid::lookup(double latitude, double longitude, float* declination, float* inclination) {
+    double fi = (latitude - mLatitude0) / DECLINATION_GRID_SPACING;
+    double fj = (longitude - mLongitude0) / DECLINATION_GRID_SPACING;
+    if (!mValid || fi < 0 || fj < 0 || fi >= DECLINATION_GRID_SIZE - 1 || fj >= DECLINATION_GRID_SIZE - 1) {
+        build(latitude, longitude);
+        fi = (latitude - mLatitude0) / DECLINATION_GRID_SPACING;
+        fj = (longitude - mLongitude0) / DECLINATION_GRID_SPACING;
+    }
+    int i = (int)fi, j = (int)fj;
+    float u = (float)(fi - i), v = (float)(fj - j);
+
+    // declination wraps at +-180 near the poles, interpolate relative to one
+    // corner so the blend does not go the long way round
+    float d00 = mDeclination[i][j];
+    float d[3] = { mDeclination[i][j + 1], mDeclination[i + 1][j], mDeclination[i + 1][j + 1] };
+    for (int k = 0; k < 3; k++) {
+        if (d[k] - d00 > 180) {
+            d[k] -= 360;
+        } else if (d[k] - d00 < -180) {
+            d[k] += 360;
+        }
+    }
+    float dec = (1 - u) * ((1 - v) * d00 + v * d[0]) + u * ((1 - v) * d[1] + v * d[2]);
+    if (dec > 180) {
+        dec -= 360;
+    } else if (dec <= -180) {
+        dec += 360;
+    }
+    *declination = dec;
+    *inclination = (1 - u) * ((1 - v) * mInclination[i][j] + v * mInclination[i][j + 1])
+            + u * ((1 - v) * mInclination[i + 1][j] + v * mInclination[i + 1][j + 1]);
+}
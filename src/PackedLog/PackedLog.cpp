@@ -0,0 +1,745 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "PackedLog.h"
+
+// column encodings, the first byte of each column
+#define COLUMN_PLAIN 0
+#define COLUMN_ZERO_RUN 1
+#define COLUMN_BITS 2
+// widest value COLUMN_BITS packs; anything wider stays a varint
+#define BITS_MAX_WIDTH 32
+
+// the largest varint of a column value: ten bytes for a 64 bit timestamp
+// change, three per int16_t and five per uint32_t field, one mode byte each
+#define SAMPLE_BOUND (10 + 10 * 3 + 3 * 5)
+
+static_assert(sizeof(PackedBlockHeader) == 32, "the block header layout is the file format");
+static_assert(sizeof(PackedIndexEntry) == 24, "the index layout is the file format");
+static_assert(sizeof(PackedLogTrailer) == 16, "the trailer layout is the file format");
+
+/**
+ * Sample fields after the timestamp, in column order.
+ */
+struct Field {
+    size_t offset;
+    bool wide; // uint32_t rather than int16_t
+};
+
+static const Field sFields[PACKED_LOG_COLUMNS - 1] = {
+    { offsetof(Sample, accel) + 0, false },
+    { offsetof(Sample, accel) + 2, false },
+    { offsetof(Sample, accel) + 4, false },
+    { offsetof(Sample, temperature), false },
+    { offsetof(Sample, gyro) + 0, false },
+    { offsetof(Sample, gyro) + 2, false },
+    { offsetof(Sample, gyro) + 4, false },
+    { offsetof(Sample, mag) + 0, false },
+    { offsetof(Sample, mag) + 2, false },
+    { offsetof(Sample, mag) + 4, false },
+    { offsetof(Sample, pressure), true },
+    { offsetof(Sample, baroTemperature), true },
+    { offsetof(Sample, flags), true },
+};
+
+static inline int64_t getField(const Sample& sample, const Field& field) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&sample) + field.offset;
+    if (field.wide) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    int16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void setField(Sample& sample, const Field& field, int64_t value) {
+    uint8_t* p = reinterpret_cast<uint8_t*>(&sample) + field.offset;
+    if (field.wide) {
+        uint32_t v = (uint32_t)value;
+        memcpy(p, &v, sizeof(v));
+    } else {
+        int16_t v = (int16_t)value;
+        memcpy(p, &v, sizeof(v));
+    }
+}
+
+static inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline uint8_t* putVarint(uint8_t* out, uint64_t v) {
+    while (v >= 0x80) {
+        *out++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *out++ = (uint8_t)v;
+    return out;
+}
+
+/** @return the byte after the varint, NULL if it runs past end */
+static inline const uint8_t* getVarint(const uint8_t* in, const uint8_t* end, uint64_t* v) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64 && in < end; shift += 7) {
+        uint8_t b = *in++;
+        value |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *v = value;
+            return in;
+        }
+    }
+    return NULL;
+}
+
+static inline uint32_t varintSize(uint64_t v) {
+    uint32_t size = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static inline uint32_t bitWidth(uint64_t v) {
+    return v ? 64 - __builtin_clzll(v) : 0;
+}
+
+/** width bits of every value, least significant first; values must fit
+ * width, at most BITS_MAX_WIDTH
+ */
+static uint8_t* putBits(uint8_t* out, const uint64_t* values, uint32_t count, uint32_t width) {
+    uint64_t pending = 0;
+    uint32_t bits = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        pending |= values[i] << bits;
+        bits += width;
+        while (bits >= 8) {
+            *out++ = (uint8_t)pending;
+            pending >>= 8;
+            bits -= 8;
+        }
+    }
+    if (bits > 0) {
+        *out++ = (uint8_t)pending;
+    }
+    return out;
+}
+
+static const uint8_t* getBits(const uint8_t* in, const uint8_t* end, uint32_t count, uint32_t width,
+        uint64_t* values) {
+    if ((size_t)(end - in) < ((uint64_t)count * width + 7) / 8) {
+        return NULL;
+    }
+    uint64_t pending = 0;
+    uint32_t bits = 0;
+    uint64_t mask = width ? ~0ULL >> (64 - width) : 0;
+    for (uint32_t i = 0; i < count; i++) {
+        while (bits < width) {
+            pending |= (uint64_t)*in++ << bits;
+            bits += 8;
+        }
+        values[i] = pending & mask;
+        pending = width < 64 ? pending >> width : 0;
+        bits -= width;
+    }
+    return in;
+}
+
+/** Zero-run coding when at least half the deltas are zero. Otherwise the
+ * smaller of zig-zag varints and bit packing at the width of the largest
+ * value, where bit packing takes the deltas or their change, whichever is
+ * narrower (vibration swings the deltas more than it changes them).
+ * Varints win when a few outliers, a gap or a shock, would widen every
+ * value.
+ */
+static uint8_t* encodeColumn(const int64_t* deltas, uint32_t count, uint8_t* out) {
+    uint32_t zeros = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        zeros += deltas[i] == 0;
+    }
+    if (zeros * 2 < count) {
+        uint64_t residuals[2][PACKED_LOG_BLOCK_SAMPLES];
+        uint64_t plain = 0;
+        uint32_t width[2] = { 0, 0 };
+        for (uint32_t i = 0; i < count; i++) {
+            residuals[0][i] = zigzag(deltas[i]);
+            residuals[1][i] = zigzag(deltas[i] - (i > 0 ? deltas[i - 1] : 0));
+            plain += varintSize(residuals[0][i]);
+            for (int order = 0; order < 2; order++) {
+                uint32_t w = bitWidth(residuals[order][i]);
+                width[order] = w > width[order] ? w : width[order];
+            }
+        }
+        int order = width[1] < width[0] ? 1 : 0;
+        if (width[order] <= BITS_MAX_WIDTH && 2 + ((uint64_t)count * width[order] + 7) / 8 < plain) {
+            *out++ = COLUMN_BITS;
+            *out++ = (uint8_t)(order + 1);
+            *out++ = (uint8_t)width[order];
+            return putBits(out, residuals[order], count, width[order]);
+        }
+        *out++ = COLUMN_PLAIN;
+        for (uint32_t i = 0; i < count; i++) {
+            out = putVarint(out, residuals[0][i]);
+        }
+        return out;
+    }
+    *out++ = COLUMN_ZERO_RUN;
+    for (uint32_t i = 0; i < count; i++) {
+        if (deltas[i] != 0) {
+            out = putVarint(out, zigzag(deltas[i]));
+            continue;
+        }
+        uint32_t run = 1;
+        while (i + run < count && deltas[i + run] == 0) {
+            run++;
+        }
+        *out++ = 0;
+        out = putVarint(out, run - 1);
+        i += run - 1;
+    }
+    return out;
+}
+
+static const uint8_t* decodeColumn(const uint8_t* in, const uint8_t* end, uint32_t count, int64_t* deltas) {
+    if (in >= end) {
+        return NULL;
+    }
+    uint8_t mode = *in++;
+    if (mode == COLUMN_BITS) {
+        if (end - in < 2 || in[0] < 1 || in[0] > 2 || in[1] > BITS_MAX_WIDTH) {
+            return NULL;
+        }
+        int order = in[0];
+        uint32_t width = in[1];
+        uint64_t values[PACKED_LOG_BLOCK_SAMPLES];
+        in = getBits(in + 2, end, count, width, values);
+        if (!in) {
+            return NULL;
+        }
+        int64_t previous = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            deltas[i] = unzigzag(values[i]) + (order == 2 ? previous : 0);
+            previous = deltas[i];
+        }
+        return in;
+    }
+    if (mode != COLUMN_PLAIN && mode != COLUMN_ZERO_RUN) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < count; ) {
+        uint64_t v;
+        in = getVarint(in, end, &v);
+        if (!in) {
+            return NULL;
+        }
+        if (v != 0 || mode == COLUMN_PLAIN) {
+            deltas[i++] = unzigzag(v);
+            continue;
+        }
+        uint64_t run;
+        in = getVarint(in, end, &run);
+        if (!in || run >= count - i) {
+            return NULL;
+        }
+        for (uint64_t r = 0; r <= run; r++) {
+            deltas[i++] = 0;
+        }
+    }
+    return in;
+}
+
+size_t packedBlockBound(uint32_t count) {
+    return (size_t)count * SAMPLE_BOUND + PACKED_LOG_COLUMNS;
+}
+
+size_t packBlock(const Sample* samples, uint32_t count, uint64_t firstTimestamp, uint8_t* out) {
+    int64_t deltas[PACKED_LOG_BLOCK_SAMPLES];
+    uint8_t* start = out;
+
+    // second difference of the timestamps: samples of one FIFO drain are
+    // exactly a period apart, so most are zero
+    uint64_t previous = firstTimestamp;
+    int64_t interval = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        int64_t d = (int64_t)(samples[i].timestamp - previous);
+        deltas[i] = d - interval;
+        interval = d;
+        previous = samples[i].timestamp;
+    }
+    out = encodeColumn(deltas, count, out);
+
+    for (int c = 0; c < PACKED_LOG_COLUMNS - 1; c++) {
+        const Field& field = sFields[c];
+        int64_t last = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            int64_t v = getField(samples[i], field);
+            deltas[i] = v - last;
+            last = v;
+        }
+        out = encodeColumn(deltas, count, out);
+    }
+    return out - start;
+}
+
+bool unpackBlock(const uint8_t* in, size_t size, uint32_t count, uint64_t firstTimestamp, Sample* out) {
+    int64_t deltas[PACKED_LOG_BLOCK_SAMPLES];
+    const uint8_t* end = in + size;
+    if (count > PACKED_LOG_BLOCK_SAMPLES) {
+        return false;
+    }
+
+    in = decodeColumn(in, end, count, deltas);
+    if (!in) {
+        return false;
+    }
+    uint64_t timestamp = firstTimestamp;
+    int64_t interval = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        interval += deltas[i];
+        timestamp += interval;
+        out[i].timestamp = timestamp;
+    }
+
+    for (int c = 0; c < PACKED_LOG_COLUMNS - 1; c++) {
+        in = decodeColumn(in, end, count, deltas);
+        if (!in) {
+            return false;
+        }
+        const Field& field = sFields[c];
+        int64_t value = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            value += deltas[i];
+            setField(out[i], field, value);
+        }
+    }
+    return in == end;
+}
+
+PackedLog::PackedLog()
+    : mCapacity(0), mFd(-1), mOffset(0), mSegment(0), mCount(0), mTotal(0), mBytes(0), mError(0),
+      mBlockCount(0) {
+    memset(&mTemplate, 0, sizeof(mTemplate));
+}
+
+PackedLog::~PackedLog() {
+    close();
+}
+
+/** Create the first segment. Existing files are replaced.
+ * @param header Settings and calibration copied into every segment; the
+ * bookkeeping fields are filled in here
+ * @param segmentRecords Samples per segment file
+ * @return false on failure, see getError()
+ */
+bool PackedLog::open(const char* path, const SampleLogHeader& header, uint32_t segmentRecords) {
+    close();
+    mPath = path;
+    mTemplate = header;
+    memcpy(mTemplate.magic, PACKED_LOG_MAGIC, sizeof(mTemplate.magic));
+    mTemplate.version = SAMPLE_LOG_VERSION;
+    mTemplate.headerSize = SAMPLE_LOG_HEADER_SIZE;
+    mTemplate.recordSize = sizeof(Sample);
+    mTemplate.capacity = segmentRecords > 0 ? segmentRecords : 1;
+    mTemplate.count = 0;
+    mCapacity = mTemplate.capacity;
+    mSegment = 0;
+    mTotal = 0;
+    mBytes = 0;
+    mError = 0;
+    mBlock.resize(PACKED_LOG_BLOCK_SAMPLES);
+    mPacked.resize(packedBlockBound(PACKED_LOG_BLOCK_SAMPLES));
+    mBlockCount = 0;
+    return openSegment();
+}
+
+bool PackedLog::openSegment() {
+    std::string file = SampleLog::segmentPath(mPath, mSegment);
+    mFd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mFd < 0) {
+        mError = errno;
+        return false;
+    }
+    uint8_t page[SAMPLE_LOG_HEADER_SIZE];
+    memset(page, 0, sizeof(page));
+    SampleLogHeader header = mTemplate;
+    header.segment = mSegment;
+    memcpy(page, &header, sizeof(header));
+    mOffset = 0;
+    mCount = 0;
+    mIndex.clear();
+    if (!writeAll(page, sizeof(page))) {
+        ::close(mFd);
+        mFd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool PackedLog::writeAll(const void* data, size_t size) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = ::write(mFd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            mError = errno;
+            return false;
+        }
+        p += n;
+        size -= n;
+        mOffset += n;
+        mBytes += n;
+    }
+    return true;
+}
+
+/** Encode and append the buffered samples, header and payload in one
+ * writev().
+ */
+bool PackedLog::writeBlock() {
+    PackedBlockHeader header;
+    header.magic = PACKED_LOG_BLOCK_MAGIC;
+    header.count = mBlockCount;
+    header.size = (uint32_t)packBlock(mBlock.data(), mBlockCount, mBlock[0].timestamp, mPacked.data());
+    header.reserved = 0;
+    header.firstIndex = mTotal;
+    header.firstTimestamp = mBlock[0].timestamp;
+
+    PackedIndexEntry entry;
+    entry.offset = mOffset;
+    entry.firstIndex = header.firstIndex;
+    entry.firstTimestamp = header.firstTimestamp;
+
+    struct iovec parts[2];
+    parts[0].iov_base = &header;
+    parts[0].iov_len = sizeof(header);
+    parts[1].iov_base = mPacked.data();
+    parts[1].iov_len = header.size;
+    size_t size = sizeof(header) + header.size;
+    ssize_t n;
+    do {
+        n = writev(mFd, parts, 2);
+    } while (n < 0 && errno == EINTR);
+    if (n >= 0 && (size_t)n < size) {
+        // short write, finish it the slow way
+        mOffset += n;
+        mBytes += n;
+        size_t done = n;
+        bool ok = done < sizeof(header)
+                ? writeAll(reinterpret_cast<uint8_t*>(&header) + done, sizeof(header) - done)
+                        && writeAll(mPacked.data(), header.size)
+                : writeAll(mPacked.data() + (done - sizeof(header)), size - done);
+        if (!ok) {
+            return false;
+        }
+    } else if (n < 0) {
+        mError = errno;
+        return false;
+    } else {
+        mOffset += n;
+        mBytes += n;
+    }
+    mIndex.push_back(entry);
+    mCount += mBlockCount;
+    mTotal += mBlockCount;
+    mBlockCount = 0;
+    return true;
+}
+
+/** Append samples; called on the acquisition thread. Encodes and writes a
+ * block whenever one fills up, and opens the next segment after
+ * segmentRecords samples.
+ * @return false once a write failed; the log stays closed
+ */
+bool PackedLog::write(const Sample* samples, uint32_t count) {
+    while (count > 0) {
+        if (mFd < 0) {
+            return false;
+        }
+        uint32_t room = PACKED_LOG_BLOCK_SAMPLES - mBlockCount;
+        uint32_t segmentRoom = mCapacity - mCount - mBlockCount;
+        uint32_t n = count < room ? count : room;
+        n = n < segmentRoom ? n : segmentRoom;
+        memcpy(&mBlock[mBlockCount], samples, n * sizeof(Sample));
+        mBlockCount += n;
+        samples += n;
+        count -= n;
+        if (mBlockCount == PACKED_LOG_BLOCK_SAMPLES || mCount + mBlockCount == mCapacity) {
+            if (!writeBlock()) {
+                ::close(mFd);
+                mFd = -1;
+                return false;
+            }
+        }
+        if (mCount == mCapacity) {
+            closeSegment();
+            mSegment++;
+            openSegment();
+        }
+    }
+    return true;
+}
+
+/** Flush the partial block, append the index and trailer and fill in the
+ * header count.
+ */
+void PackedLog::closeSegment() {
+    if (mFd < 0) {
+        return;
+    }
+    if (mBlockCount > 0) {
+        writeBlock();
+    }
+    PackedLogTrailer trailer;
+    trailer.indexOffset = mOffset;
+    trailer.blocks = (uint32_t)mIndex.size();
+    trailer.magic = PACKED_LOG_INDEX_MAGIC;
+    if (writeAll(mIndex.data(), mIndex.size() * sizeof(PackedIndexEntry))) {
+        writeAll(&trailer, sizeof(trailer));
+    }
+    SampleLogHeader header = mTemplate;
+    header.segment = mSegment;
+    header.count = mCount;
+    if (pwrite(mFd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) && !mError) {
+        mError = errno;
+    }
+    ::close(mFd);
+    mFd = -1;
+}
+
+void PackedLog::close() {
+    closeSegment();
+}
+
+/** Samples taken over all segments, including those not written yet.
+ */
+uint64_t PackedLog::getCount() const {
+    return mTotal + mBlockCount;
+}
+
+/** Bytes written over all segments.
+ */
+uint64_t PackedLog::getBytes() const {
+    return mBytes;
+}
+
+uint32_t PackedLog::getSegments() const {
+    return mTotal > 0 || mFd >= 0 ? mSegment + 1 : 0;
+}
+
+int PackedLog::getError() const {
+    return mError;
+}
+
+PackedLogReader::PackedLogReader() : mCount(0), mDecodedBlock(0), mError(0) {
+    memset(&mHeader, 0, sizeof(mHeader));
+}
+
+PackedLogReader::~PackedLogReader() {
+    close();
+}
+
+/** Map path and the segments following it and collect their blocks.
+ * @return false if path is missing or not a compressed log, see getError()
+ */
+bool PackedLogReader::open(const char* path) {
+    close();
+    mError = 0;
+    uint64_t before = 0;
+    if (!openSegment(path, true)) {
+        return false;
+    }
+    for (uint32_t segment = 1; mCount - before == mHeader.capacity; segment++) {
+        before = mCount;
+        if (!openSegment(SampleLog::segmentPath(path, segment), false)) {
+            mError = 0;
+            break;
+        }
+    }
+    mDecodedBlock = mBlocks.size();
+    mDecoded.resize(PACKED_LOG_BLOCK_SAMPLES);
+    return true;
+}
+
+bool PackedLogReader::openSegment(const std::string& file, bool first) {
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        mError = errno;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SAMPLE_LOG_HEADER_SIZE) {
+        mError = EINVAL;
+        ::close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        mError = errno;
+        return false;
+    }
+    const uint8_t* base = static_cast<const uint8_t*>(map);
+    const SampleLogHeader* header = static_cast<const SampleLogHeader*>(map);
+    if (memcmp(header->magic, PACKED_LOG_MAGIC, sizeof(header->magic)) != 0
+            || header->version != SAMPLE_LOG_VERSION || header->recordSize != sizeof(Sample)
+            || header->headerSize < sizeof(SampleLogHeader) || header->headerSize > size
+            || (!first && header->segment != mMaps.size())) {
+        mError = EINVAL;
+        munmap(map, size);
+        return false;
+    }
+    mMaps.push_back(std::make_pair(map, size));
+    if (first) {
+        mHeader = *header;
+    }
+
+    // block offsets from the index, or by walking the blocks when the
+    // segment was not closed
+    std::vector<uint64_t> offsets;
+    PackedLogTrailer trailer;
+    bool indexed = false;
+    if (size >= header->headerSize + sizeof(trailer)) {
+        memcpy(&trailer, base + size - sizeof(trailer), sizeof(trailer));
+        indexed = trailer.magic == PACKED_LOG_INDEX_MAGIC && trailer.indexOffset >= header->headerSize
+                && trailer.indexOffset + (uint64_t)trailer.blocks * sizeof(PackedIndexEntry)
+                        + sizeof(trailer) == size;
+    }
+    if (indexed) {
+        for (uint32_t i = 0; i < trailer.blocks; i++) {
+            PackedIndexEntry entry;
+            memcpy(&entry, base + trailer.indexOffset + i * sizeof(entry), sizeof(entry));
+            offsets.push_back(entry.offset);
+        }
+    } else {
+        uint64_t offset = header->headerSize;
+        PackedBlockHeader block;
+        while (offset + sizeof(block) <= size) {
+            memcpy(&block, base + offset, sizeof(block));
+            if (block.magic != PACKED_LOG_BLOCK_MAGIC || offset + sizeof(block) + block.size > size) {
+                break;
+            }
+            offsets.push_back(offset);
+            offset += sizeof(block) + block.size;
+        }
+    }
+
+    for (size_t i = 0; i < offsets.size(); i++) {
+        PackedBlockHeader header;
+        if (offsets[i] + sizeof(header) > size) {
+            break;
+        }
+        memcpy(&header, base + offsets[i], sizeof(header));
+        if (header.magic != PACKED_LOG_BLOCK_MAGIC || header.count == 0
+                || header.count > PACKED_LOG_BLOCK_SAMPLES
+                || offsets[i] + sizeof(header) + header.size > size) {
+            break;
+        }
+        Block block;
+        block.payload = base + offsets[i] + sizeof(header);
+        block.size = header.size;
+        block.count = header.count;
+        block.firstIndex = mCount;
+        block.firstTimestamp = header.firstTimestamp;
+        mBlocks.push_back(block);
+        mCount += header.count;
+    }
+    return true;
+}
+
+void PackedLogReader::close() {
+    for (size_t i = 0; i < mMaps.size(); i++) {
+        munmap(mMaps[i].first, mMaps[i].second);
+    }
+    mMaps.clear();
+    mBlocks.clear();
+    mCount = 0;
+    mDecodedBlock = 0;
+}
+
+const SampleLogHeader& PackedLogReader::getHeader() const {
+    return mHeader;
+}
+
+uint64_t PackedLogReader::getCount() const {
+    return mCount;
+}
+
+size_t PackedLogReader::blockOf(uint64_t index) const {
+    size_t low = 0, high = mBlocks.size();
+    while (high - low > 1) {
+        size_t mid = (low + high) / 2;
+        if (mBlocks[mid].firstIndex <= index) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/** Sample by index over all segments, NULL past the end or in a corrupt
+ * block. The block is decoded on first access; the pointer is valid until
+ * the next call.
+ */
+const Sample* PackedLogReader::at(uint64_t index) {
+    if (index >= mCount) {
+        return NULL;
+    }
+    size_t b = mDecodedBlock < mBlocks.size() && index >= mBlocks[mDecodedBlock].firstIndex
+            && index < mBlocks[mDecodedBlock].firstIndex + mBlocks[mDecodedBlock].count
+            ? mDecodedBlock : blockOf(index);
+    const Block& block = mBlocks[b];
+    if (b != mDecodedBlock) {
+        if (!unpackBlock(block.payload, block.size, block.count, block.firstTimestamp, mDecoded.data())) {
+            mDecodedBlock = mBlocks.size();
+            return NULL;
+        }
+        mDecodedBlock = b;
+    }
+    return &mDecoded[index - block.firstIndex];
+}
+
+/** Index of the first sample at or after timestamp, getCount() if none;
+ * only the block it falls into is decoded.
+ */
+uint64_t PackedLogReader::find(uint64_t timestamp) {
+    size_t low = 0, high = mBlocks.size();
+    while (high - low > 1) {
+        size_t mid = (low + high) / 2;
+        if (mBlocks[mid].firstTimestamp <= timestamp) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    if (mBlocks.empty()) {
+        return 0;
+    }
+    uint64_t index = mBlocks[low].firstIndex;
+    uint64_t end = index + mBlocks[low].count;
+    for (; index < end; index++) {
+        const Sample* sample = at(index);
+        if (!sample || sample->timestamp >= timestamp) {
+            break;
+        }
+    }
+    return index;
+}
+
+int PackedLogReader::getError() const {
+    return mError;
+}
@@ -1,8 +1,13 @@
+#include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
 #include <cmath>
 #include <math.h>
 
@@ -10,37 +15,226 @@
 #include "MPU6050.h"
 #include "HMC5883L.h"
 #include "MS5611.h"
+#include "MagCalibration.h"
+#include "Heading.h"
+#include "MagneticModel.h"
+#include "MPU6050Calibration.h"
+#include "Units.h"
+#include "Decimator.h"
 
 using namespace v8;
 
 #define FUNCTION_TEMPLATE_CLASS "RPiGY86"
+#define DEFAULT_BUS "/dev/i2c-1"
+#define DEFAULT_DECLINATION -4.28f
+// accel, gyro and temperature are one chip
+#define MPU6050_SENSORS (SENSOR_ACCEL | SENSOR_GYRO | SENSOR_TEMP)
+#define DEG_TO_RAD ((float)M_PI / 180.0f)
+// ms to wait for one HMC5883L sample at 75 Hz before giving up
+#define MAG_SAMPLE_TIMEOUT 100
+// samples further apart than this are treated as one period apart
+#define ATTITUDE_MAX_DT 0.1f
+// Pa, the standard atmosphere
+#define DEFAULT_SEA_LEVEL_PRESSURE 101325.0
+// Hz, .motionEvents() when nothing else runs the acquisition faster
+#define MOTION_EVENTS_DEFAULT_RATE 50
+// detector events waiting for the event loop; more are dropped
+#define MOTION_EVENTS_MAX_PENDING 64
+// .stream() filter option
+#define STREAM_FILTER_NONE 0
+#define STREAM_FILTER_FIR 1
+#define STREAM_FILTER_CIC 2
+// acquisition samples decimated per step of a filtered stream
+#define STREAM_FILTER_CHUNK 256
+// ._motionStart() callback flags of a power mode transition, with
+// SAMPLE_LOW_POWER when the MPU6050 went to sleep
+#define MOTION_EVENT_POWER 0x10000
+// .spectrum() defaults
+#define SPECTRUM_DEFAULT_RATE 1000
+#define SPECTRUM_DEFAULT_SIZE 256
+#define SPECTRUM_DEFAULT_OVERLAP 0.5
+#define SPECTRUM_DEFAULT_INTERVAL 1000 // ms
+#define SPECTRUM_DEFAULT_PEAKS 3
 
 v8::Eternal<v8::Function> RPIGY86::sFunction;
 
-//not able to directly set these offset into HMC5883L
-//therefore, keep a local offsets here.
-int32_t gMagXOffset = 0, gMagYOffset = 0, gMagZOffset = 0;
+static inline void storeValue(int16_t* target, float value)
+{
+    *target = (int16_t)lrintf(value);
+}
+
+static inline void storeValue(float* target, float value)
+{
+    *target = value;
+}
+
+/**
+ * copy a frame straight into the backing store of a caller supplied typed
+ * array; nothing is allocated on the V8 heap
+ */
+template<typename T>
+static void writeFrame(const v8::FunctionCallbackInfo<v8::Value> &args, const float* frame, uint32_t count)
+{
+    Nan::TypedArrayContents<T> target(args[0]);
+    uint32_t offset = args.Length() > 1 ? Nan::To<uint32_t>(args[1]).FromJust() : 0;
+    if ( offset > target.length() || target.length() - offset < count )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::RangeError(Nan::New("buffer too small").ToLocalChecked()));
+        return;
+    }
+    T* out = *target + offset;
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        storeValue(&out[i], frame[i]);
+    }
+}
+
+static void writeFrame(const v8::FunctionCallbackInfo<v8::Value> &args, const float* frame, uint32_t count)
+{
+    if ( args[0]->IsInt16Array() )
+    {
+        writeFrame<int16_t>(args, frame, count);
+    }
+    else
+    {
+        writeFrame<float>(args, frame, count);
+    }
+}
+
+static const char* sSensorNames[] = { "accel", "gyro", "temperature", "mag", "baro" };
 
-float gMagGainTable[] = { 0.73f, 0.92f, 1.22f, 1.52f, 2.27f, 2.56f, 3.03f, 4.35f };
+/**
+ * sensors option: a SENSOR_* mask or an array of sensor names
+ * @return false if the value is neither
+ */
+static bool parseSensors(v8::Local<v8::Value> value, uint32_t* mask)
+{
+    if ( value->IsUint32() )
+    {
+        *mask = Nan::To<uint32_t>(value).FromJust() & SENSOR_ALL;
+        return true;
+    }
+    if ( !value->IsArray() )
+    {
+        return false;
+    }
+    v8::Local<v8::Array> names = v8::Local<v8::Array>::Cast(value);
+    *mask = 0;
+    for ( uint32_t i = 0; i < names->Length(); i++ )
+    {
+        std::string name = *Nan::Utf8String(Nan::Get(names, i).ToLocalChecked());
+        uint32_t bit = 0;
+        for ( uint32_t j = 0; j < sizeof(sSensorNames) / sizeof(sSensorNames[0]); j++ )
+        {
+            if ( name == sSensorNames[j] )
+            {
+                bit = 1 << j;
+            }
+        }
+        if ( !bit )
+        {
+            return false;
+        }
+        *mask |= bit;
+    }
+    return true;
+}
 
-//GYRO_FS_250 : 0,  //  131 LSB/°/s
-//GYRO_FS_500 : 1,  //  65.5 LSB/°/s
-//GYRO_FS_1000: 2,  //  32.8 LSB/°/s
-//GYRO_FS_2000: 3 };//  16.4 LSB/°/s
-float gGryoScaleTable[] = { 131, 65.5f, 32.8f, 16.4f };
+/**
+ * units option: "raw" or "si"
+ * @return false if the value is neither
+ */
+static bool parseUnits(v8::Local<v8::Value> value, bool* si)
+{
+    if ( !value->IsString() )
+    {
+        return false;
+    }
+    std::string units = *Nan::Utf8String(value);
+    if ( units != "raw" && units != "si" )
+    {
+        return false;
+    }
+    *si = units == "si";
+    return true;
+}
 
-//FS_2   : 0,  //  16384 LSB/g
-//FS_4   : 1,  //   8192 LSB/g
-//FS_8   : 2,  //   4096 LSB/g
-//FS_16  : 3 } //   2048 LSB/g
-int gAccelScaleTable[] = { 16384, 8192, 4096, 2048 };
+/**
+ * true if options is undefined or an object with valid bus, address,
+ * magAddress, sensors, units, replay and speed properties
+ */
+static bool checkOptions(v8::Local<v8::Value> value)
+{
+    if ( value->IsUndefined() )
+    {
+        return true;
+    }
+    if ( !value->IsObject() )
+    {
+        return false;
+    }
+    v8::Local<v8::Object> options = Nan::To<v8::Object>(value).ToLocalChecked();
+    v8::Local<v8::Value> bus = Nan::Get(options, Nan::New("bus").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> address = Nan::Get(options, Nan::New("address").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> magAddress = Nan::Get(options, Nan::New("magAddress").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> sensors = Nan::Get(options, Nan::New("sensors").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> units = Nan::Get(options, Nan::New("units").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> replay = Nan::Get(options, Nan::New("replay").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> speed = Nan::Get(options, Nan::New("speed").ToLocalChecked()).ToLocalChecked();
+    uint32_t mask;
+    bool si;
+    if ( !bus->IsUndefined() && !bus->IsString() )
+    {
+        return false;
+    }
+    if ( !replay->IsUndefined() && !replay->IsString() )
+    {
+        return false;
+    }
+    if ( !speed->IsUndefined() && !(speed->IsNumber() && Nan::To<double>(speed).FromJust() >= 0) )
+    {
+        return false;
+    }
+    if ( !address->IsUndefined() && !(address->IsUint32()
+            && (Nan::To<uint32_t>(address).FromJust() == MPU6050_ADDRESS_AD0_LOW
+                || Nan::To<uint32_t>(address).FromJust() == MPU6050_ADDRESS_AD0_HIGH)) )
+    {
+        return false;
+    }
+    if ( !magAddress->IsUndefined() && !(magAddress->IsUint32()
+            && Nan::To<uint32_t>(magAddress).FromJust() >= 0x08 && Nan::To<uint32_t>(magAddress).FromJust() <= 0x77) )
+    {
+        return false;
+    }
+    if ( !units->IsUndefined() && !parseUnits(units, &si) )
+    {
+        return false;
+    }
+    return sensors->IsUndefined() || parseSensors(sensors, &mask);
+}
 
 /*static*/
 void RPIGY86::V8New(const v8::FunctionCallbackInfo<v8::Value> &args)
 {
     if (args.IsConstructCall())
     {
-        new RPIGY86(args);
+        if ( args.Length() > 0 && !checkOptions(args[0]) )
+        {
+            args.GetIsolate()->ThrowException(
+                    v8::Exception::SyntaxError(Nan::New("usage: new RPiGY86([{ bus, address: 0x68|0x69, sensors, units: 'raw'|'si', replay, speed }])").ToLocalChecked()));
+            return;
+        }
+        RPIGY86* obj = new RPIGY86(args);
+        if ( obj->mReplayError )
+        {
+            Nan::Utf8String path(Nan::Get(Nan::To<v8::Object>(args[0]).ToLocalChecked(),
+                    Nan::New("replay").ToLocalChecked()).ToLocalChecked());
+            std::string message = std::string(*path) + ": " + strerror(obj->mReplayError);
+            args.GetIsolate()->ThrowException(
+                    v8::Exception::Error(Nan::New(message.c_str()).ToLocalChecked()));
+            return;
+        }
         args.GetReturnValue().Set(args.This());
     }
     else
@@ -65,13 +259,26 @@ RPIGY86::sGetMotion6(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
     }
-    if ( args.Length()  != 0 )
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
+    }
+    if ( !sIsFrameArgs(args) )
     {
         args.GetIsolate()->ThrowException(
-                v8::Exception::SyntaxError(Nan::New("usage: getMotion6()").ToLocalChecked()));
+                v8::Exception::SyntaxError(Nan::New("usage: getMotion6([buffer[, offset]])").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() == 0 )
+    {
+        _this->getMotion6(args);
+    }
+    else
+    {
+        _this->getMotion6Into(args);
     }
-    _this->getMotion6(args);
 }
 /*static*/ void
 RPIGY86::sGetMotion9(const v8::FunctionCallbackInfo<v8::Value> &args)
@@ -81,16 +288,207 @@ RPIGY86::sGetMotion9(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL | SENSOR_MAG) )
+    {
+        return;
     }
 
-    if ( args.Length()  != 0 )
+    if ( !sIsFrameArgs(args) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: getMotion9([buffer[, offset]])").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() == 0 )
+    {
+        _this->getMotion9(args);
+    }
+    else
+    {
+        _this->getMotion9Into(args);
+    }
+}
+
+/*static*/
+bool
+RPIGY86::sIsFrameArgs(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    if ( args.Length() == 0 )
+    {
+        return true;
+    }
+    if ( args.Length() > 2 || !(args[0]->IsInt16Array() || args[0]->IsFloat32Array()) )
+    {
+        return false;
+    }
+    return args.Length() == 1 || args[1]->IsUint32();
+}
+
+/*static*/
+void
+RPIGY86::sReadLatest(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
     {
         args.GetIsolate()->ThrowException(
-                v8::Exception::SyntaxError(Nan::New("usage: getMotion9()").ToLocalChecked()));
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() < 1 || args.Length() > 2 || !args[0]->IsFloat32Array()
+            || (args.Length() > 1 && !args[1]->IsUint32()) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: readLatest(buffer[, offset])").ToLocalChecked()));
+        return;
+    }
+    float frame[9];
+    _this->readLatest(frame);
+    writeFrame<float>(args, frame, 9);
+}
+
+/*static*/
+void
+RPIGY86::sSetUnits(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    bool si;
+    if ( args.Length() != 1 || !parseUnits(args[0], &si) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: setUnits('raw'|'si')").ToLocalChecked()));
+        return;
+    }
+    _this->mSIUnits = si;
+}
+
+/*static*/
+void
+RPIGY86::sGetUnits(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    args.GetReturnValue().Set(Nan::New(_this->mSIUnits ? "si" : "raw").ToLocalChecked());
+}
+
+#ifdef RPIGY86_FAST_API
+static inline RPIGY86* fastUnwrap(v8::Local<v8::Object> receiver)
+{
+    // the signature check guarantees an RPiGY86 receiver
+    return static_cast<RPIGY86*>(
+            static_cast<Nan::ObjectWrap*>(receiver->GetAlignedPointerFromInternalField(0)));
+}
+
+/**
+ * backing store of a fast call argument, NULL (and fallback to the slow
+ * callback, which throws) if it is too short or not usable in place
+ */
+static inline float* fastFrame(const v8::FastApiTypedArray<float> &buffer, uint32_t count,
+        v8::FastApiCallbackOptions &options)
+{
+    float* out = NULL;
+    if ( buffer.length() < count || !buffer.getStorageIfAligned(&out) )
+    {
+        options.fallback = true;
+        return NULL;
+    }
+    return out;
+}
+
+/*static*/
+void
+RPIGY86::sFastGetMotion6(v8::Local<v8::Object> receiver,
+        const v8::FastApiTypedArray<float> &buffer, v8::FastApiCallbackOptions &options)
+{
+    RPIGY86* _this = fastUnwrap(receiver);
+    float* out = _this->mpu6050 ? fastFrame(buffer, 6, options) : NULL;
+    if ( !out )
+    {
+        options.fallback = true;
+        return;
+    }
+    int16_t motion[6];
+    _this->readMotion6(motion);
+    for ( int i = 0; i < 6; i++ )
+    {
+        out[i] = motion[i];
+    }
+    if ( _this->mSIUnits )
+    {
+        _this->mUnits.toUnits(out, 6);
+    }
+}
+
+/*static*/
+void
+RPIGY86::sFastGetMotion9(v8::Local<v8::Object> receiver,
+        const v8::FastApiTypedArray<float> &buffer, v8::FastApiCallbackOptions &options)
+{
+    RPIGY86* _this = fastUnwrap(receiver);
+    float* out = _this->mpu6050 && _this->hmc5883l ? fastFrame(buffer, 9, options) : NULL;
+    if ( !out )
+    {
+        options.fallback = true;
+        return;
+    }
+    int16_t motion[6];
+    _this->readMotion9(motion, &out[6]);
+    for ( int i = 0; i < 6; i++ )
+    {
+        out[i] = motion[i];
+    }
+    if ( _this->mSIUnits )
+    {
+        _this->mUnits.toUnits(out, 9);
+    }
+}
+
+/*static*/
+double
+RPIGY86::sFastGetHeading(v8::Local<v8::Object> receiver, v8::FastApiCallbackOptions &options)
+{
+    RPIGY86* _this = fastUnwrap(receiver);
+    if ( !_this->hmc5883l )
+    {
+        options.fallback = true;
+        return 0;
+    }
+    return _this->readHeading();
+}
+
+/*static*/
+void
+RPIGY86::sFastReadLatest(v8::Local<v8::Object> receiver,
+        const v8::FastApiTypedArray<float> &buffer, v8::FastApiCallbackOptions &options)
+{
+    float* out = fastFrame(buffer, 9, options);
+    if ( out )
+    {
+        fastUnwrap(receiver)->readLatest(out);
     }
-    _this->getMotion9(args);
 }
 
+#define FAST_METHOD(isolate, callback, cfunction, ftmpl) \
+    v8::FunctionTemplate::New(isolate, callback, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl), \
+            0, v8::ConstructorBehavior::kThrow, v8::SideEffectType::kHasSideEffect, &cfunction)
+#else
+#define FAST_METHOD(isolate, callback, cfunction, ftmpl) \
+    v8::FunctionTemplate::New(isolate, callback, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl))
+#endif
+
 /*static*/
 void
 RPIGY86::sSetGryoXOffset(const v8::FunctionCallbackInfo<v8::Value> &args)
@@ -100,13 +498,18 @@ RPIGY86::sSetGryoXOffset(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
     }
     if ( args.Length()  != 1 || !args[0]->IsNumber() )
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::SyntaxError(Nan::New("usage: setGryoXOffset(offset)").ToLocalChecked()));
     }
-    _this->setGryoXOffset(args[0]->ToNumber(Nan::GetCurrentContext()).ToLocalChecked()->Int32Value());
+    _this->setGryoXOffset(Nan::To<int32_t>(args[0]).FromJust());
 }
 /*static*/
 void
@@ -117,13 +520,18 @@ RPIGY86::sSetGryoYOffset(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
     }
     if ( args.Length()  != 1 || !args[0]->IsNumber() )
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::SyntaxError(Nan::New("usage: setGryoYOffset(offset)").ToLocalChecked()));
     }
-    _this->setGryoYOffset(args[0]->ToNumber(Nan::GetCurrentContext()).ToLocalChecked()->Int32Value());
+    _this->setGryoYOffset(Nan::To<int32_t>(args[0]).FromJust());
 }
 /*static*/
 void
@@ -134,13 +542,18 @@ RPIGY86::sSetGryoZOffset(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
     }
     if ( args.Length()  != 1 || !args[0]->IsNumber() )
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::SyntaxError(Nan::New("usage: setGryoZOffset(offset)").ToLocalChecked()));
     }
-    _this->setGryoZOffset(args[0]->ToNumber(Nan::GetCurrentContext()).ToLocalChecked()->Int32Value());
+    _this->setGryoZOffset(Nan::To<int32_t>(args[0]).FromJust());
 }
 
 /*static*/
@@ -152,13 +565,18 @@ RPIGY86::sSetAccelXOffset(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
     }
     if ( args.Length()  != 1 || !args[0]->IsNumber() )
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::SyntaxError(Nan::New("usage: setAccelXOffset(offset)").ToLocalChecked()));
     }
-    _this->setAccelXOffset(args[0]->ToNumber(Nan::GetCurrentContext()).ToLocalChecked()->Int32Value());
+    _this->setAccelXOffset(Nan::To<int32_t>(args[0]).FromJust());
 }
 /*static*/
 void
@@ -169,13 +587,18 @@ RPIGY86::sSetAccelYOffset(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
     }
     if ( args.Length()  != 1 || !args[0]->IsNumber() )
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::SyntaxError(Nan::New("usage: setAccelYOffset(offset)").ToLocalChecked()));
     }
-    _this->setAccelYOffset(args[0]->ToNumber(Nan::GetCurrentContext()).ToLocalChecked()->Int32Value());
+    _this->setAccelYOffset(Nan::To<int32_t>(args[0]).FromJust());
 }
 
 /*static*/
@@ -187,13 +610,18 @@ RPIGY86::sSetAccelZOffset(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
     }
     if ( args.Length()  != 1 || !args[0]->IsNumber() )
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::SyntaxError(Nan::New("usage: setAccelZOffset(offset)").ToLocalChecked()));
     }
-    _this->setAccelZOffset(args[0]->ToNumber(Nan::GetCurrentContext()).ToLocalChecked()->Int32Value());
+    _this->setAccelZOffset(Nan::To<int32_t>(args[0]).FromJust());
 }
 
 /*static*/
@@ -205,13 +633,19 @@ RPIGY86::sSetGryoRangeScale(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
     }
     if ( args.Length()  != 1 || !args[0]->IsNumber() )
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::SyntaxError(Nan::New("usage: setGryoRangeScale(scale)").ToLocalChecked()));
+        return;
     }
-    _this->setGryoRangeScale(args[0]->ToNumber(Nan::GetCurrentContext()).ToLocalChecked()->Int32Value());
+    _this->setGryoRangeScale(Nan::To<int32_t>(args[0]).FromJust());
 }
 
 /*static*/
@@ -223,6 +657,11 @@ RPIGY86::sGetGryoRangeScale(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
     }
     if ( args.Length()  != 0 )
     {
@@ -241,13 +680,19 @@ RPIGY86::sSetAccelRangeScale(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
     }
     if ( args.Length()  != 1 || !args[0]->IsNumber() )
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::SyntaxError(Nan::New("usage: setAccelRangeScale(scale)").ToLocalChecked()));
+        return;
     }
-    _this->setAccelRangeScale(args[0]->ToNumber(Nan::GetCurrentContext()).ToLocalChecked()->Int32Value());
+    _this->setAccelRangeScale(Nan::To<int32_t>(args[0]).FromJust());
 }
 
 /*static*/
@@ -259,6 +704,11 @@ RPIGY86::sGetAccelRangeScale(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
     }
     if ( args.Length()  != 0 )
     {
@@ -277,11 +727,21 @@ RPIGY86::sCalibrateMPU6050(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
     }
-    if ( args.Length()  != 0 )
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
+    }
+    if ( args.Length() > 1 || (args.Length() == 1 && !args[0]->IsObject()) )
     {
         args.GetIsolate()->ThrowException(
-                v8::Exception::SyntaxError(Nan::New("usage: calibrateMPU6050()").ToLocalChecked()));
+                v8::Exception::SyntaxError(Nan::New("usage: calibrateMPU6050([options])").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->checkCalibrationIdle(args) )
+    {
+        return;
     }
     _this->calibrateMPU6050(args);
 }
@@ -295,6 +755,11 @@ RPIGY86::sGetHeadingXYZ(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_MAG) )
+    {
+        return;
     }
     if ( args.Length()  != 0 )
     {
@@ -313,6 +778,11 @@ RPIGY86::sGetHeading(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_MAG) )
+    {
+        return;
     }
     if ( args.Length()  != 0 )
     {
@@ -337,7 +807,7 @@ RPIGY86::sSetMagXOffset(const v8::FunctionCallbackInfo<v8::Value> &args)
         args.GetIsolate()->ThrowException(
                 v8::Exception::SyntaxError(Nan::New("usage: setMagXOffset(offset)").ToLocalChecked()));
     }
-    _this->setMagXOffset(args[0]->ToNumber(Nan::GetCurrentContext()).ToLocalChecked()->Int32Value());
+    _this->setMagXOffset(Nan::To<int32_t>(args[0]).FromJust());
 }
 /*static*/
 void
@@ -354,7 +824,7 @@ RPIGY86::sSetMagYOffset(const v8::FunctionCallbackInfo<v8::Value> &args)
         args.GetIsolate()->ThrowException(
                 v8::Exception::SyntaxError(Nan::New("usage: setMagYOffset(offset)").ToLocalChecked()));
     }
-    _this->setMagYOffset(args[0]->ToNumber(Nan::GetCurrentContext()).ToLocalChecked()->Int32Value());
+    _this->setMagYOffset(Nan::To<int32_t>(args[0]).FromJust());
 }
 /*static*/
 void
@@ -371,7 +841,7 @@ RPIGY86::sSetMagZOffset(const v8::FunctionCallbackInfo<v8::Value> &args)
         args.GetIsolate()->ThrowException(
                 v8::Exception::SyntaxError(Nan::New("usage: setMagZOffset(offset)").ToLocalChecked()));
     }
-    _this->setMagZOffset(args[0]->ToNumber(Nan::GetCurrentContext()).ToLocalChecked()->Int32Value());
+    _this->setMagZOffset(Nan::To<int32_t>(args[0]).FromJust());
 }
 
 /*static*/
@@ -383,13 +853,19 @@ RPIGY86::sSetMagGain(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_MAG) )
+    {
+        return;
     }
     if ( args.Length()  != 1 || !args[0]->IsNumber() )
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::SyntaxError(Nan::New("usage: setMagGain(gain)").ToLocalChecked()));
+        return;
     }
-    _this->setMagGain(args[0]->ToNumber(Nan::GetCurrentContext()).ToLocalChecked()->Int32Value());
+    _this->setMagGain(Nan::To<int32_t>(args[0]).FromJust());
 }
 
 /*static*/
@@ -401,6 +877,11 @@ RPIGY86::sGetMagGain(const v8::FunctionCallbackInfo<v8::Value> &args)
     {
         args.GetIsolate()->ThrowException(
                 v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_MAG) )
+    {
+        return;
     }
     if ( args.Length()  != 0 )
     {
@@ -410,359 +891,4219 @@ RPIGY86::sGetMagGain(const v8::FunctionCallbackInfo<v8::Value> &args)
     _this->getMagGain(args);
 }
 /*static*/
-v8::Local<v8::Function>
-RPIGY86::sGetFunction()
+void
+RPIGY86::sStartMagCalibration(const v8::FunctionCallbackInfo<v8::Value> &args)
 {
-    Nan::EscapableHandleScope scope;
-    v8::Isolate* isolate = v8::Isolate::GetCurrent();
-
-    if ( sFunction.IsEmpty() ) {
-        v8::Local<v8::FunctionTemplate> ftmpl = v8::FunctionTemplate::New(isolate, RPIGY86::V8New);
-        ftmpl->SetClassName(Nan::New(FUNCTION_TEMPLATE_CLASS).ToLocalChecked());
-        v8::Local<v8::ObjectTemplate> otmpl = ftmpl->InstanceTemplate();
-        otmpl->SetInternalFieldCount(1);
-        otmpl->Set(Nan::New("getMotion6").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sGetMotion6, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("getMotion9").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sGetMotion9, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("setAccelXOffset").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sSetAccelXOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("setAccelYOffset").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sSetAccelYOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("setAccelZOffset").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sSetAccelZOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("setGryoXOffset").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sSetGryoXOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("setGryoYOffset").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sSetGryoYOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("setGryoZOffset").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sSetGryoZOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("setMagXOffset").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sSetMagXOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("setMagYOffset").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sSetMagYOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("setMagZOffset").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sSetMagZOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("setGryoRangeScale").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sSetGryoRangeScale, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("getGryoRangeScale").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sGetGryoRangeScale, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("setAccelRangeScale").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sSetAccelRangeScale, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("getAccelRangeScale").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sGetAccelRangeScale, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("getMagGain").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sGetMagGain, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("setMagGain").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sSetMagGain, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("calibrateMPU6050").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sCalibrateMPU6050, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("getHeadingXYZ").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sGetHeadingXYZ, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        otmpl->Set(Nan::New("getHeading").ToLocalChecked(),
-            v8::FunctionTemplate::New(isolate, sGetHeading, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
-        sFunction.Set(isolate, ftmpl->GetFunction());
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
     }
-    return scope.Escape(sFunction.Get(isolate));
-}
-
+    if ( args.Length()  != 0 )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: startMagCalibration()").ToLocalChecked()));
+        return;
+    }
+    _this->startMagCalibration();
+}
+
+/*static*/
+void
+RPIGY86::sSampleMagCalibration(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_MAG) )
+    {
+        return;
+    }
+    if ( args.Length()  != 1 || !args[0]->IsNumber() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: sampleMagCalibration(count)").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->checkCalibrationIdle(args) )
+    {
+        return;
+    }
+    _this->sampleMagCalibration(args, Nan::To<int32_t>(args[0]).FromJust());
+}
+
+/*static*/
+void
+RPIGY86::sSolveMagCalibration(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length()  != 0 )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: solveMagCalibration()").ToLocalChecked()));
+        return;
+    }
+    _this->solveMagCalibration(args);
+}
+
+/*static*/
+void
+RPIGY86::sSetMagCalibration(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length()  != 1 || !args[0]->IsArray()
+            || v8::Local<v8::Array>::Cast(args[0])->Length() != 12 )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: setMagCalibration([ox, oy, oz, m00, m01, ... m22])").ToLocalChecked()));
+        return;
+    }
+    v8::Local<v8::Array> values = v8::Local<v8::Array>::Cast(args[0]);
+    float calibration[12];
+    for ( uint32_t i = 0; i < 12; i++ )
+    {
+        calibration[i] = (float)Nan::To<double>(Nan::Get(values, i).ToLocalChecked()).FromJust();
+    }
+    _this->setMagCalibration(calibration);
+}
+
+/*static*/
+void
+RPIGY86::sSelfTestMag(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_MAG) )
+    {
+        return;
+    }
+    if ( args.Length()  != 0 )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: selfTestMag()").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->checkCalibrationIdle(args) )
+    {
+        return;
+    }
+    _this->selfTestMag(args);
+}
+
+/*static*/
+void
+RPIGY86::sSetMagScale(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length()  != 1 || !args[0]->IsArray()
+            || v8::Local<v8::Array>::Cast(args[0])->Length() != 3 )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: setMagScale([sx, sy, sz])").ToLocalChecked()));
+        return;
+    }
+    if ( _this->mCalibrating )
+    {
+        // samples being collected are in the units of the old scale
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("calibration already running").ToLocalChecked()));
+        return;
+    }
+    v8::Local<v8::Array> values = v8::Local<v8::Array>::Cast(args[0]);
+    float scale[3];
+    for ( uint32_t i = 0; i < 3; i++ )
+    {
+        scale[i] = (float)Nan::To<double>(Nan::Get(values, i).ToLocalChecked()).FromJust();
+    }
+    _this->setMagScale(scale);
+}
+
+/*static*/
+void
+RPIGY86::sGetTiltCompensatedHeading(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL | SENSOR_MAG) )
+    {
+        return;
+    }
+    if ( args.Length()  != 0 )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: getTiltCompensatedHeading()").ToLocalChecked()));
+        return;
+    }
+    _this->getTiltCompensatedHeading(args);
+}
+
+/*static*/
+void
+RPIGY86::sGetTiltCompensatedHeadings(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length()  != 2 || !args[0]->IsInt16Array() || !args[1]->IsInt16Array() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: getTiltCompensatedHeadings(accel, mag)").ToLocalChecked()));
+        return;
+    }
+    _this->getTiltCompensatedHeadings(args);
+}
+
+/*static*/
+void
+RPIGY86::sSetLocation(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() < 2 || args.Length() > 4 || !args[0]->IsNumber() || !args[1]->IsNumber()
+            || (args.Length() > 2 && !args[2]->IsNumber()) || (args.Length() > 3 && !args[3]->IsNumber()) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: setLocation(latitude, longitude[, altitude[, year]])").ToLocalChecked()));
+        return;
+    }
+    _this->setLocation(args);
+}
+
+/*static*/
+void
+RPIGY86::sUpdateLocation(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() != 2 || !args[0]->IsNumber() || !args[1]->IsNumber() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: updateLocation(latitude, longitude)").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->updateLocation(Nan::To<double>(args[0]).FromJust(), Nan::To<double>(args[1]).FromJust()) )
+    {
+        throwOutsideModel(args.GetIsolate());
+    }
+}
+
+/*static*/
+void
+RPIGY86::sGetDeclination(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length()  != 0 )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: getDeclination()").ToLocalChecked()));
+        return;
+    }
+    _this->getDeclination(args);
+}
+
+/*static*/
+void
+RPIGY86::sSetDeclination(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length()  != 1 || !args[0]->IsNumber() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: setDeclination(degrees)").ToLocalChecked()));
+        return;
+    }
+    _this->setDeclination((float)Nan::To<double>(args[0]).FromJust());
+}
+
+/**
+ * runs one bus transaction on the libuv threadpool. Calls of the same kind
+ * that arrive while it is in flight are queued on it as waiters and get the
+ * same result, so concurrent callers share one transaction.
+ */
+class RPIGY86Worker : public Nan::AsyncWorker {
+
+public:
+    RPIGY86Worker(RPIGY86* gy86, int op, Nan::Callback* callback)
+        : Nan::AsyncWorker(callback), mGY86(gy86), mOp(op), mHeading(0)
+    {
+    }
+
+    ~RPIGY86Worker()
+    {
+        for ( size_t i = 0; i < mWaiters.size(); i++ )
+        {
+            delete mWaiters[i];
+        }
+    }
+
+    void addWaiter(Nan::Callback* callback)
+    {
+        mWaiters.push_back(callback);
+    }
+
+    void Execute()
+    {
+        switch ( mOp )
+        {
+        case RPIGY86::ASYNC_MOTION6:
+            mGY86->readMotion6(mMotion6);
+            break;
+        case RPIGY86::ASYNC_MOTION9:
+            mGY86->readMotion9(mValues);
+            break;
+        case RPIGY86::ASYNC_HEADING_XYZ:
+            mGY86->readHeadingXYZ(mValues);
+            break;
+        case RPIGY86::ASYNC_HEADING:
+            mHeading = mGY86->readHeading();
+            break;
+        case RPIGY86::ASYNC_TILT_HEADING:
+            mHeading = mGY86->readTiltCompensatedHeading();
+            break;
+        }
+    }
+
+    void HandleOKCallback()
+    {
+        Nan::HandleScope scope;
+        mGY86->mInFlight[mOp] = NULL;
+
+        v8::Local<v8::Value> argv[] = { Nan::Null(), result() };
+        callback->Call(2, argv, async_resource);
+        for ( size_t i = 0; i < mWaiters.size(); i++ )
+        {
+            mWaiters[i]->Call(2, argv, async_resource);
+        }
+    }
+
+private:
+    v8::Local<v8::Value> result()
+    {
+        v8::Isolate* isolate = v8::Isolate::GetCurrent();
+        int count = 0;
+        switch ( mOp )
+        {
+        case RPIGY86::ASYNC_MOTION6:
+            for ( int i = 0; i < 6; i++ )
+            {
+                mValues[i] = mMotion6[i];
+            }
+            count = 6;
+            break;
+        case RPIGY86::ASYNC_MOTION9:
+            count = 9;
+            break;
+        case RPIGY86::ASYNC_HEADING_XYZ:
+            count = 3;
+            break;
+        default:
+            return v8::Number::New(isolate, mHeading);
+        }
+        v8::Local<v8::Array> rev = v8::Array::New(isolate, count);
+        for ( int i = 0; i < count; i++ )
+        {
+            Nan::Set(rev, i, v8::Int32::New(isolate, mValues[i]));
+        }
+        return rev;
+    }
+
+    RPIGY86* mGY86;
+    int mOp;
+    int16_t mMotion6[6];
+    int32_t mValues[9];
+    float mHeading;
+    std::vector<Nan::Callback*> mWaiters;
+};
+
+/**
+ * chips each AsyncOp reads
+ */
+static const uint32_t sAsyncSensors[RPIGY86::ASYNC_OP_COUNT] = {
+    SENSOR_ACCEL,               // ASYNC_MOTION6
+    SENSOR_ACCEL | SENSOR_MAG,  // ASYNC_MOTION9
+    SENSOR_MAG,                 // ASYNC_HEADING_XYZ
+    SENSOR_MAG,                 // ASYNC_HEADING
+    SENSOR_ACCEL | SENSOR_MAG   // ASYNC_TILT_HEADING
+};
+
+/*static*/
+void
+RPIGY86::sReadAsync(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length()  != 1 || !args[0]->IsFunction() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: <read>Async(callback)").ToLocalChecked()));
+        return;
+    }
+    int op = Nan::To<int32_t>(args.Data()).FromJust();
+    if ( !_this->requireSensors(args, sAsyncSensors[op]) )
+    {
+        return;
+    }
+    Nan::Callback* callback = new Nan::Callback(v8::Local<v8::Function>::Cast(args[0]));
+    if ( _this->mInFlight[op] )
+    {
+        _this->mInFlight[op]->addWaiter(callback);
+        return;
+    }
+    RPIGY86Worker* worker = new RPIGY86Worker(_this, op, callback);
+    // keep the JS object, and with it the devices, alive until the worker ran
+    worker->SaveToPersistent("gy86", args.Holder());
+    _this->mInFlight[op] = worker;
+    Nan::AsyncQueueWorker(worker);
+}
+
+/**
+ * budget and sample count from the calibrateMPU6050() options:
+ * { maxIterations, timeout (ms), samples }
+ */
+static void setCalibrationOptions(v8::Local<v8::Value> value, MPU6050Calibration* calibration)
+{
+    if ( !value->IsObject() )
+    {
+        return;
+    }
+    v8::Local<v8::Object> options = Nan::To<v8::Object>(value).ToLocalChecked();
+    v8::Local<v8::Value> iterations = Nan::Get(options, Nan::New("maxIterations").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> timeout = Nan::Get(options, Nan::New("timeout").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> samples = Nan::Get(options, Nan::New("samples").ToLocalChecked()).ToLocalChecked();
+    if ( iterations->IsUint32() )
+    {
+        calibration->setMaxIterations(Nan::To<uint32_t>(iterations).FromJust());
+    }
+    if ( timeout->IsUint32() )
+    {
+        calibration->setTimeBudget(Nan::To<uint32_t>(timeout).FromJust());
+    }
+    if ( samples->IsUint32() )
+    {
+        calibration->setSamples(Nan::To<uint32_t>(samples).FromJust());
+    }
+}
+
+/**
+ * runs an MPU6050Calibration on the libuv threadpool and forwards every
+ * iteration to the javascript progress function
+ */
+class RPIGY86CalibrationWorker : public Nan::AsyncProgressQueueWorker<CalibrationProgress>,
+        public CalibrationListener {
+
+public:
+    RPIGY86CalibrationWorker(RPIGY86* gy86, Nan::Callback* callback, Nan::Callback* progress)
+        : Nan::AsyncProgressQueueWorker<CalibrationProgress>(callback, "rpi-gy86:calibrate"),
+          mGY86(gy86), mProgress(progress), mExecution(NULL), mCalibration(gy86->mpu6050, &gy86->mBusLock),
+          mConverged(false)
+    {
+    }
+
+    ~RPIGY86CalibrationWorker()
+    {
+        delete mProgress;
+    }
+
+    MPU6050Calibration* calibration()
+    {
+        return &mCalibration;
+    }
+
+    void Execute(const ExecutionProgress& execution)
+    {
+        mExecution = &execution;
+        mConverged = mCalibration.run(mOffsets, this);
+        mExecution = NULL;
+    }
+
+    void onProgress(const CalibrationProgress& progress)
+    {
+        mExecution->Send(&progress, 1);
+    }
+
+    void HandleProgressCallback(const CalibrationProgress* data, size_t count)
+    {
+        Nan::HandleScope scope;
+        if ( !mProgress )
+        {
+            return;
+        }
+        v8::Isolate* isolate = v8::Isolate::GetCurrent();
+        for ( size_t i = 0; i < count; i++ )
+        {
+            const CalibrationProgress& progress = data[i];
+            v8::Local<v8::Object> rev = Nan::New<v8::Object>();
+            v8::Local<v8::Array> error = v8::Array::New(isolate, 6);
+            v8::Local<v8::Array> stddev = v8::Array::New(isolate, 6);
+            for ( int axis = 0; axis < 6; axis++ )
+            {
+                Nan::Set(error, axis, v8::Number::New(isolate, progress.error[axis]));
+                Nan::Set(stddev, axis, v8::Number::New(isolate, progress.stddev[axis]));
+            }
+            Nan::Set(rev, Nan::New("iteration").ToLocalChecked(), v8::Uint32::New(isolate, progress.iteration));
+            Nan::Set(rev, Nan::New("samples").ToLocalChecked(), v8::Uint32::New(isolate, progress.samples));
+            Nan::Set(rev, Nan::New("error").ToLocalChecked(), error);
+            Nan::Set(rev, Nan::New("stddev").ToLocalChecked(), stddev);
+            Nan::Set(rev, Nan::New("offsets").ToLocalChecked(), offsetArray(progress.offsets));
+            Nan::Set(rev, Nan::New("ready").ToLocalChecked(), v8::Uint32::New(isolate, progress.ready));
+            Nan::Set(rev, Nan::New("done").ToLocalChecked(), v8::Boolean::New(isolate, progress.done));
+            Nan::Set(rev, Nan::New("converged").ToLocalChecked(), v8::Boolean::New(isolate, progress.converged));
+            v8::Local<v8::Value> argv[] = { rev };
+            mProgress->Call(1, argv, async_resource);
+        }
+    }
+
+    void HandleOKCallback()
+    {
+        Nan::HandleScope scope;
+        mGY86->mCalibrating = false;
+        if ( mConverged )
+        {
+            v8::Local<v8::Value> argv[] = { Nan::Null(), offsetArray(mOffsets) };
+            callback->Call(2, argv, async_resource);
+            return;
+        }
+        // the offsets are still the best there is, pass them along
+        v8::Local<v8::Object> error = Nan::To<v8::Object>(
+                v8::Exception::Error(Nan::New("calibration did not converge within the budget").ToLocalChecked()))
+                .ToLocalChecked();
+        Nan::Set(error, Nan::New("offsets").ToLocalChecked(), offsetArray(mOffsets));
+        v8::Local<v8::Value> argv[] = { error };
+        callback->Call(1, argv, async_resource);
+    }
+
+private:
+    static v8::Local<v8::Array> offsetArray(const int16_t* offsets)
+    {
+        v8::Isolate* isolate = v8::Isolate::GetCurrent();
+        v8::Local<v8::Array> rev = v8::Array::New(isolate, 6);
+        for ( int i = 0; i < 6; i++ )
+        {
+            Nan::Set(rev, i, v8::Int32::New(isolate, offsets[i]));
+        }
+        return rev;
+    }
+
+    RPIGY86* mGY86;
+    Nan::Callback* mProgress;
+    const ExecutionProgress* mExecution;
+    MPU6050Calibration mCalibration;
+    int16_t mOffsets[6];
+    bool mConverged;
+};
+
+/*static*/
+void
+RPIGY86::sCalibrateAsync(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
+    }
+    if ( args.Length() != 3 || !(args[0]->IsObject() || args[0]->IsUndefined())
+            || !(args[1]->IsFunction() || args[1]->IsUndefined()) || !args[2]->IsFunction() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: _calibrateMPU6050Async(options, progress, callback)").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->checkCalibrationIdle(args) )
+    {
+        return;
+    }
+    Nan::Callback* progress = args[1]->IsFunction()
+            ? new Nan::Callback(v8::Local<v8::Function>::Cast(args[1])) : NULL;
+    RPIGY86CalibrationWorker* worker = new RPIGY86CalibrationWorker(_this,
+            new Nan::Callback(v8::Local<v8::Function>::Cast(args[2])), progress);
+    setCalibrationOptions(args[0], worker->calibration());
+    // keep the JS object, and with it the devices, alive until the worker ran
+    worker->SaveToPersistent("gy86", args.Holder());
+    _this->mCalibrating = true;
+    Nan::AsyncQueueWorker(worker);
+}
+
+/**
+ * reads samples for the magnetometer calibration on the libuv threadpool;
+ * they go into the fit back on the JS thread
+ */
+class RPIGY86MagSampleWorker : public Nan::AsyncWorker {
+
+public:
+    RPIGY86MagSampleWorker(RPIGY86* gy86, int32_t count, Nan::Callback* callback)
+        : Nan::AsyncWorker(callback), mGY86(gy86), mCount(count), mReady(false)
+    {
+        memcpy(mScale, gy86->mMagCorrection.scale, sizeof(mScale));
+    }
+
+    void Execute()
+    {
+        mReady = mGY86->readMagSamples(mCount, mScale, &mSamples);
+    }
+
+    void HandleOKCallback()
+    {
+        Nan::HandleScope scope;
+        mGY86->mCalibrating = false;
+        for ( size_t i = 0; i + 2 < mSamples.size(); i += 3 )
+        {
+            mGY86->mMagCalibration.addSample(mSamples[i], mSamples[i + 1], mSamples[i + 2]);
+        }
+        if ( !mReady )
+        {
+            v8::Local<v8::Value> argv[] = { v8::Exception::Error(Nan::New("magnetometer not ready").ToLocalChecked()) };
+            callback->Call(1, argv, async_resource);
+            return;
+        }
+        v8::Local<v8::Value> argv[] = { Nan::Null(),
+                v8::Uint32::New(v8::Isolate::GetCurrent(), mGY86->mMagCalibration.getSampleCount()) };
+        callback->Call(2, argv, async_resource);
+    }
+
+private:
+    RPIGY86* mGY86;
+    int32_t mCount;
+    float mScale[3];
+    bool mReady;
+    std::vector<float> mSamples;
+};
+
+/*static*/
+void
+RPIGY86::sSampleMagCalibrationAsync(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_MAG) )
+    {
+        return;
+    }
+    if ( args.Length() != 2 || !args[0]->IsNumber() || !args[1]->IsFunction() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: _sampleMagCalibrationAsync(count, callback)").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->checkCalibrationIdle(args) )
+    {
+        return;
+    }
+    RPIGY86MagSampleWorker* worker = new RPIGY86MagSampleWorker(_this, Nan::To<int32_t>(args[0]).FromJust(),
+            new Nan::Callback(v8::Local<v8::Function>::Cast(args[1])));
+    // keep the JS object, and with it the devices, alive until the worker ran
+    worker->SaveToPersistent("gy86", args.Holder());
+    // nothing else may start the acquisition or change the rate meanwhile
+    _this->mCalibrating = true;
+    Nan::AsyncQueueWorker(worker);
+}
+
+/**
+ * one .stream() consumer: its own reader on the acquisition ring and the
+ * javascript function to call once a batch is ready. A filtered stream has
+ * the acquisition thread decimate every sample to its rate through a
+ * Decimator into a ring of its own, which it reads instead.
+ */
+class RPIGY86Stream {
+
+public:
+    RPIGY86Stream(const SampleRing* ring, uint32_t rate, uint32_t sensors, uint32_t batch,
+            bool decimate, bool si, uint32_t filter, v8::Local<v8::Function> notify)
+        : mFiltered(filter ? new SampleRing() : NULL),
+          mReader(mFiltered ? mFiltered : ring, filter ? ACQUISITION_MAX_RATE : rate, decimate),
+          mRing(ring), mRate(rate), mSensors(sensors), mBatch(batch), mSIUnits(si), mFilter(filter),
+          mInputRate(0), mWaiting(true), mNotify(notify)
+    {
+    }
+
+    ~RPIGY86Stream()
+    {
+        delete mFiltered;
+    }
+
+    /**
+     * acquisition thread: filter and decimate the samples of a poll into
+     * mFiltered, following the acquisition to the rate it runs at
+     */
+    void decimate(const Sample* samples, uint32_t count, uint32_t inputRate)
+    {
+        if ( inputRate != mInputRate )
+        {
+            mInputRate = inputRate;
+            uint32_t factor = inputRate > mRate ? inputRate / mRate : 1;
+            mDecimator.configure(factor, mFilter == STREAM_FILTER_CIC);
+            mFiltered->setRate(inputRate / factor);
+        }
+        for ( uint32_t done = 0; done < count; done += STREAM_FILTER_CHUNK )
+        {
+            uint32_t n = std::min(count - done, (uint32_t)STREAM_FILTER_CHUNK);
+            mDecimated.resize(n / mDecimator.getFactor() + 1);
+            uint32_t out = mDecimator.write(samples + done, n, mDecimated.data());
+            if ( out > 0 )
+            {
+                mFiltered->write(mDecimated.data(), out);
+            }
+        }
+    }
+
+    /**
+     * Hz of the samples read() returns
+     */
+    uint32_t rate() const
+    {
+        return mFiltered ? mFiltered->getRate() : std::min(mRate, mRing->getRate());
+    }
+
+    uint32_t ready()
+    {
+        return mReader.ready();
+    }
+
+    uint32_t read(Sample* out, uint32_t max)
+    {
+        return mReader.read(out, max);
+    }
+
+    /**
+     * decimated samples of a filtered stream, NULL otherwise
+     */
+    SampleRing* mFiltered;
+    SampleReader mReader;
+    const SampleRing* mRing;
+    uint32_t mRate;
+    uint32_t mSensors;
+    uint32_t mBatch;
+    /**
+     * accel and gyro in g and deg/s, mag in uT and pressure in hPa
+     */
+    bool mSIUnits;
+    /**
+     * STREAM_FILTER_*, and the acquisition rate mDecimator is set up for;
+     * both used on the acquisition thread only, under mStreamLock
+     */
+    uint32_t mFilter;
+    uint32_t mInputRate;
+    Decimator mDecimator;
+    std::vector<Sample> mDecimated;
+    /**
+     * the last read came back empty, call mNotify when a batch is ready
+     */
+    bool mWaiting;
+    Nan::Callback mNotify;
+    std::vector<Sample> mSamples;
+};
+
+/*static*/
+void
+RPIGY86::sStreamOpen(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() != 8 || !args[0]->IsUint32() || !args[1]->IsUint32() || !args[2]->IsUint32()
+            || !args[3]->IsBoolean() || !args[4]->IsBoolean() || !args[5]->IsUint32() || !args[6]->IsUint32()
+            || !args[7]->IsFunction() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: _streamOpen(rate, sensors, batch, decimate, si, filter, inputRate, notify)").ToLocalChecked()));
+        return;
+    }
+    uint32_t rate = Nan::To<uint32_t>(args[0]).FromJust();
+    uint32_t batch = Nan::To<uint32_t>(args[2]).FromJust();
+    uint32_t filter = Nan::To<uint32_t>(args[5]).FromJust();
+    uint32_t inputRate = Nan::To<uint32_t>(args[6]).FromJust();
+    if ( rate == 0 || batch == 0 || batch > SAMPLE_RING_DEFAULT_CAPACITY / 2 || filter > STREAM_FILTER_CIC )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::RangeError(Nan::New("rate, batch or filter out of range").ToLocalChecked()));
+        return;
+    }
+    // the acquisition runs at 1000 Hz divided by an integer, and a filter
+    // decimates by an integer factor
+    if ( filter && (inputRate == 0 || inputRate > ACQUISITION_MAX_RATE || ACQUISITION_MAX_RATE % inputRate
+            || inputRate % rate) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::RangeError(Nan::New("a filter needs an inputRate that divides 1000 and a rate that divides inputRate").ToLocalChecked()));
+        return;
+    }
+    if ( filter && Nan::To<bool>(args[3]).FromJust() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::TypeError(Nan::New("overflow 'decimate' does not apply to a filtered stream").ToLocalChecked()));
+        return;
+    }
+    uint32_t sensors = Nan::To<uint32_t>(args[1]).FromJust() & SENSOR_ALL;
+    if ( !_this->requireSensors(args, sensors | SENSOR_ACCEL) )
+    {
+        return;
+    }
+    if ( _this->mCalibrating )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("calibration running").ToLocalChecked()));
+        return;
+    }
+    int32_t id = _this->streamOpen(rate, sensors, batch, Nan::To<bool>(args[3]).FromJust(),
+            Nan::To<bool>(args[4]).FromJust(), filter, inputRate, v8::Local<v8::Function>::Cast(args[7]));
+    args.GetReturnValue().Set(v8::Int32::New(args.GetIsolate(), id));
+}
+
+/*static*/
+void
+RPIGY86::sStreamRead(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() != 2 || !args[0]->IsInt32() || !args[1]->IsBoolean() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: _streamRead(id, binary)").ToLocalChecked()));
+        return;
+    }
+    std::map<int32_t, RPIGY86Stream*>::iterator it = _this->mStreams.find(Nan::To<int32_t>(args[0]).FromJust());
+    if ( it == _this->mStreams.end() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("stream is closed").ToLocalChecked()));
+        return;
+    }
+    _this->streamRead(args, it->second, it->second->mBatch, Nan::To<bool>(args[1]).FromJust());
+}
+
+/*static*/
+void
+RPIGY86::sStreamStats(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() != 1 || !args[0]->IsInt32() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: _streamStats(id)").ToLocalChecked()));
+        return;
+    }
+    std::map<int32_t, RPIGY86Stream*>::iterator it = _this->mStreams.find(Nan::To<int32_t>(args[0]).FromJust());
+    if ( it == _this->mStreams.end() )
+    {
+        return;
+    }
+    v8::Isolate* isolate = args.GetIsolate();
+    const SampleReader& reader = it->second->mReader;
+    v8::Local<v8::Array> rev = v8::Array::New(isolate, 4);
+    Nan::Set(rev, 0, v8::Number::New(isolate, (double)reader.getDropped()));
+    Nan::Set(rev, 1, v8::Number::New(isolate, (double)reader.getDecimated()));
+    Nan::Set(rev, 2, v8::Number::New(isolate, (double)_this->mAcquisition->getOverflows()));
+    Nan::Set(rev, 3, v8::Number::New(isolate, (double)it->second->rate()));
+    args.GetReturnValue().Set(rev);
+}
+
+/*static*/
+void
+RPIGY86::sStreamClose(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() != 1 || !args[0]->IsInt32() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: _streamClose(id)").ToLocalChecked()));
+        return;
+    }
+    _this->streamClose(Nan::To<int32_t>(args[0]).FromJust());
+}
+
+/*static*/
+void
+RPIGY86::sRingBuffer(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    _this->ringBuffer(args);
+}
+
+/*static*/
+void
+RPIGY86::sRingStart(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() != 3 || !args[0]->IsUint32() || !args[1]->IsUint32() || !args[2]->IsFunction() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: _ringStart(rate, sensors, notify)").ToLocalChecked()));
+        return;
+    }
+    uint32_t rate = Nan::To<uint32_t>(args[0]).FromJust();
+    if ( rate == 0 )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::RangeError(Nan::New("rate out of range").ToLocalChecked()));
+        return;
+    }
+    uint32_t sensors = Nan::To<uint32_t>(args[1]).FromJust() & SENSOR_ALL;
+    if ( !_this->requireSensors(args, sensors | SENSOR_ACCEL) )
+    {
+        return;
+    }
+    if ( _this->mCalibrating )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("calibration running").ToLocalChecked()));
+        return;
+    }
+    _this->startAcquisition(rate, sensors);
+    delete _this->mRingNotify;
+    _this->mRingNotify = new Nan::Callback(v8::Local<v8::Function>::Cast(args[2]));
+}
+
+/*static*/
+void
+RPIGY86::sRingStop(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    delete _this->mRingNotify;
+    _this->mRingNotify = NULL;
+    _this->releaseAcquisition();
+}
+
+/**
+ * attitude options: filter ('madgwick' or 'mahony'), rate, beta, kp, ki, mag
+ * @return false if filter is not a known name
+ */
+static bool setAttitudeOptions(v8::Local<v8::Value> value, AHRS* ahrs, uint32_t* rate, bool* mag)
+{
+    if ( !value->IsObject() )
+    {
+        return true;
+    }
+    v8::Local<v8::Object> options = Nan::To<v8::Object>(value).ToLocalChecked();
+    v8::Local<v8::Value> filter = Nan::Get(options, Nan::New("filter").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> rateValue = Nan::Get(options, Nan::New("rate").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> beta = Nan::Get(options, Nan::New("beta").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> kp = Nan::Get(options, Nan::New("kp").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> ki = Nan::Get(options, Nan::New("ki").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> magValue = Nan::Get(options, Nan::New("mag").ToLocalChecked()).ToLocalChecked();
+    if ( !filter->IsUndefined() )
+    {
+        std::string name = *Nan::Utf8String(filter);
+        if ( name == "madgwick" )
+        {
+            ahrs->setFilter(AHRS_MADGWICK);
+        }
+        else if ( name == "mahony" )
+        {
+            ahrs->setFilter(AHRS_MAHONY);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    if ( rateValue->IsUint32() && Nan::To<uint32_t>(rateValue).FromJust() > 0 )
+    {
+        *rate = Nan::To<uint32_t>(rateValue).FromJust();
+    }
+    if ( beta->IsNumber() )
+    {
+        ahrs->setBeta(Nan::To<double>(beta).FromJust());
+    }
+    if ( kp->IsNumber() || ki->IsNumber() )
+    {
+        ahrs->setGains(kp->IsNumber() ? Nan::To<double>(kp).FromJust() : ahrs->getKp(),
+                ki->IsNumber() ? Nan::To<double>(ki).FromJust() : ahrs->getKi());
+    }
+    if ( magValue->IsBoolean() )
+    {
+        *mag = *mag && Nan::To<bool>(magValue).FromJust();
+    }
+    return true;
+}
+
+/*static*/
+void
+RPIGY86::sStartAttitude(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL | SENSOR_GYRO) )
+    {
+        return;
+    }
+    if ( args.Length() > 1 || (args.Length() == 1 && !(args[0]->IsObject() || args[0]->IsUndefined())) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: startAttitude([{ filter: 'madgwick'|'mahony', rate, beta, kp, ki, mag }])").ToLocalChecked()));
+        return;
+    }
+    if ( _this->mCalibrating )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("calibration running").ToLocalChecked()));
+        return;
+    }
+    uint32_t rate = 100;
+    bool mag = _this->hmc5883l != NULL;
+    bool valid;
+    {
+        std::lock_guard<std::mutex> lock(_this->mAttitudeLock);
+        valid = setAttitudeOptions(args[0], &_this->mAHRS, &rate, &mag);
+    }
+    if ( !valid )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::RangeError(Nan::New("filter must be 'madgwick' or 'mahony'").ToLocalChecked()));
+        return;
+    }
+    _this->startAttitude(rate, mag);
+}
+
+/*static*/
+void
+RPIGY86::sGetAttitude(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() > 2 || (args.Length() > 0 && !args[0]->IsFloat32Array())
+            || (args.Length() > 1 && !args[1]->IsUint32()) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: getAttitude([buffer[, offset]])").ToLocalChecked()));
+        return;
+    }
+    _this->getAttitude(args);
+}
+
+/*static*/
+void
+RPIGY86::sStopAttitude(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    _this->stopAttitude();
+}
+
+/**
+ * EKF options: rate, mag, baro, seaLevelPressure (Pa) and the noise
+ * settings gyroNoise, gyroBiasNoise, accelNoise, verticalAccelNoise,
+ * accelBiasNoise, magNoise and baroNoise
+ */
+static void setEKFOptions(v8::Local<v8::Value> value, EKF* ekf, uint32_t* rate, bool* mag, bool* baro,
+        double* seaLevel)
+{
+    if ( !value->IsObject() )
+    {
+        return;
+    }
+    v8::Local<v8::Object> options = Nan::To<v8::Object>(value).ToLocalChecked();
+    v8::Local<v8::Value> rateValue = Nan::Get(options, Nan::New("rate").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> magValue = Nan::Get(options, Nan::New("mag").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> baroValue = Nan::Get(options, Nan::New("baro").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> seaLevelValue =
+            Nan::Get(options, Nan::New("seaLevelPressure").ToLocalChecked()).ToLocalChecked();
+    if ( rateValue->IsUint32() && Nan::To<uint32_t>(rateValue).FromJust() > 0 )
+    {
+        *rate = Nan::To<uint32_t>(rateValue).FromJust();
+    }
+    if ( magValue->IsBoolean() )
+    {
+        *mag = *mag && Nan::To<bool>(magValue).FromJust();
+    }
+    if ( baroValue->IsBoolean() )
+    {
+        *baro = *baro && Nan::To<bool>(baroValue).FromJust();
+    }
+    if ( seaLevelValue->IsNumber() && Nan::To<double>(seaLevelValue).FromJust() > 0 )
+    {
+        *seaLevel = Nan::To<double>(seaLevelValue).FromJust();
+    }
+
+    EKFNoise noise = ekf->getNoise();
+    static const char* names[] = { "gyroNoise", "gyroBiasNoise", "accelNoise", "verticalAccelNoise",
+                                   "accelBiasNoise", "magNoise", "baroNoise" };
+    float* fields[] = { &noise.gyro, &noise.gyroBias, &noise.accel, &noise.verticalAccel,
+                        &noise.accelBias, &noise.mag, &noise.baro };
+    for ( int i = 0; i < 7; i++ )
+    {
+        v8::Local<v8::Value> field = Nan::Get(options, Nan::New(names[i]).ToLocalChecked()).ToLocalChecked();
+        if ( field->IsNumber() && Nan::To<double>(field).FromJust() > 0 )
+        {
+            *fields[i] = Nan::To<double>(field).FromJust();
+        }
+    }
+    ekf->setNoise(noise);
+}
+
+/*static*/
+void
+RPIGY86::sStartEKF(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL | SENSOR_GYRO) )
+    {
+        return;
+    }
+    if ( args.Length() > 1 || (args.Length() == 1 && !(args[0]->IsObject() || args[0]->IsUndefined())) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: startEKF([{ rate, mag, baro, seaLevelPressure, <sensor>Noise }])").ToLocalChecked()));
+        return;
+    }
+    if ( _this->mCalibrating )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("calibration running").ToLocalChecked()));
+        return;
+    }
+    uint32_t rate = 100;
+    bool mag = _this->hmc5883l != NULL;
+    bool baro = _this->ms5611 != NULL;
+    {
+        std::lock_guard<std::mutex> lock(_this->mAttitudeLock);
+        setEKFOptions(args[0], &_this->mEKF, &rate, &mag, &baro, &_this->mEKFSeaLevel);
+    }
+    _this->startEKF(rate, mag, baro);
+}
+
+/*static*/
+void
+RPIGY86::sGetEKF(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() > 2 || (args.Length() > 0 && !args[0]->IsFloat32Array())
+            || (args.Length() > 1 && !args[1]->IsUint32()) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: getEKF([buffer[, offset]])").ToLocalChecked()));
+        return;
+    }
+    _this->getEKF(args);
+}
+
+/*static*/
+void
+RPIGY86::sStopEKF(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    _this->stopEKF();
+}
+
+/*static*/
+void
+RPIGY86::sStartRecording(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() < 1 || args.Length() > 2 || !args[0]->IsString()
+            || (args.Length() == 2 && !(args[1]->IsObject() || args[1]->IsUndefined())) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: startRecording(path[, { rate, sensors, segmentSeconds, compress }])").ToLocalChecked()));
+        return;
+    }
+    uint32_t rate = ACQUISITION_MAX_RATE;
+    uint32_t sensors = _this->mSensors;
+    uint32_t segmentSeconds = SAMPLE_LOG_DEFAULT_SEGMENT_SECONDS;
+    bool compress = false;
+    if ( args.Length() == 2 && args[1]->IsObject() )
+    {
+        v8::Local<v8::Object> options = Nan::To<v8::Object>(args[1]).ToLocalChecked();
+        v8::Local<v8::Value> rateValue = Nan::Get(options, Nan::New("rate").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> sensorsValue = Nan::Get(options, Nan::New("sensors").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> segmentValue =
+                Nan::Get(options, Nan::New("segmentSeconds").ToLocalChecked()).ToLocalChecked();
+        if ( rateValue->IsUint32() && Nan::To<uint32_t>(rateValue).FromJust() > 0 )
+        {
+            rate = Nan::To<uint32_t>(rateValue).FromJust();
+        }
+        if ( !sensorsValue->IsUndefined() && !parseSensors(sensorsValue, &sensors) )
+        {
+            args.GetIsolate()->ThrowException(
+                    v8::Exception::TypeError(Nan::New("sensors must be a mask or an array of sensor names").ToLocalChecked()));
+            return;
+        }
+        if ( segmentValue->IsUint32() && Nan::To<uint32_t>(segmentValue).FromJust() > 0 )
+        {
+            segmentSeconds = Nan::To<uint32_t>(segmentValue).FromJust();
+        }
+        v8::Local<v8::Value> compressValue = Nan::Get(options, Nan::New("compress").ToLocalChecked()).ToLocalChecked();
+        compress = Nan::To<bool>(compressValue).FromJust();
+    }
+    sensors |= SENSOR_ACCEL;
+    if ( !_this->requireSensors(args, sensors) )
+    {
+        return;
+    }
+    if ( _this->mCalibrating )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("calibration running").ToLocalChecked()));
+        return;
+    }
+    if ( _this->mRecorder )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("already recording").ToLocalChecked()));
+        return;
+    }
+    Nan::Utf8String path(args[0]);
+    int error = _this->startRecording(*path, rate, sensors, segmentSeconds, compress);
+    if ( error )
+    {
+        std::string message = std::string(*path) + ": " + strerror(error);
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New(message.c_str()).ToLocalChecked()));
+    }
+}
+
+/*static*/
+void
+RPIGY86::sStartFlightRecorder(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() < 1 || args.Length() > 2 || !args[0]->IsString()
+            || (args.Length() == 2 && !(args[1]->IsObject() || args[1]->IsUndefined())) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: startFlightRecorder(path[, { seconds, rate, sensors }])").ToLocalChecked()));
+        return;
+    }
+    uint32_t rate = ACQUISITION_MAX_RATE;
+    uint32_t sensors = _this->mSensors;
+    uint32_t seconds = FLIGHT_RECORDER_DEFAULT_SECONDS;
+    if ( args.Length() == 2 && args[1]->IsObject() )
+    {
+        v8::Local<v8::Object> options = Nan::To<v8::Object>(args[1]).ToLocalChecked();
+        v8::Local<v8::Value> rateValue = Nan::Get(options, Nan::New("rate").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> sensorsValue = Nan::Get(options, Nan::New("sensors").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> secondsValue = Nan::Get(options, Nan::New("seconds").ToLocalChecked()).ToLocalChecked();
+        if ( rateValue->IsUint32() && Nan::To<uint32_t>(rateValue).FromJust() > 0 )
+        {
+            rate = Nan::To<uint32_t>(rateValue).FromJust();
+        }
+        if ( !sensorsValue->IsUndefined() && !parseSensors(sensorsValue, &sensors) )
+        {
+            args.GetIsolate()->ThrowException(
+                    v8::Exception::TypeError(Nan::New("sensors must be a mask or an array of sensor names").ToLocalChecked()));
+            return;
+        }
+        if ( secondsValue->IsUint32() && Nan::To<uint32_t>(secondsValue).FromJust() > 0 )
+        {
+            seconds = Nan::To<uint32_t>(secondsValue).FromJust();
+        }
+    }
+    sensors |= SENSOR_ACCEL;
+    if ( !_this->requireSensors(args, sensors) )
+    {
+        return;
+    }
+    if ( _this->mCalibrating )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("calibration running").ToLocalChecked()));
+        return;
+    }
+    if ( _this->mFlightRecorder )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("flight recorder already running").ToLocalChecked()));
+        return;
+    }
+    Nan::Utf8String path(args[0]);
+    int error = _this->startFlightRecorder(*path, rate, sensors, seconds);
+    if ( error )
+    {
+        std::string message = std::string(*path) + ": " + strerror(error);
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New(message.c_str()).ToLocalChecked()));
+    }
+}
+
+/*static*/
+void
+RPIGY86::sStopFlightRecorder(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    _this->stopFlightRecorder();
+}
+
+/**
+ * register value for a detector setting in units of step, within 1..255
+ */
+static uint8_t detectorRegister(v8::Local<v8::Object> options, const char* name, double step, uint8_t fallback)
+{
+    v8::Local<v8::Value> value = Nan::Get(options, Nan::New(name).ToLocalChecked()).ToLocalChecked();
+    if ( !value->IsNumber() )
+    {
+        return fallback;
+    }
+    double units = Nan::To<double>(value).FromJust() / step;
+    return units < 1 ? 1 : units > 255 ? 255 : (uint8_t)(units + 0.5);
+}
+
+/**
+ * capture options: pre, post (s), shock, freefall (g), freefallTime (ms),
+ * detector { motion, freefall (mg), motionTime, freefallTime (ms) },
+ * compress, and rate and sensors as for a recording
+ * @return false if sensors is not valid
+ */
+static bool parseCaptureOptions(v8::Local<v8::Object> options, CaptureOptions* capture,
+        uint32_t* rate, uint32_t* sensors)
+{
+    v8::Local<v8::Value> rateValue = Nan::Get(options, Nan::New("rate").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> sensorsValue = Nan::Get(options, Nan::New("sensors").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> pre = Nan::Get(options, Nan::New("pre").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> post = Nan::Get(options, Nan::New("post").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> shock = Nan::Get(options, Nan::New("shock").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> freefall = Nan::Get(options, Nan::New("freefall").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> freefallTime =
+            Nan::Get(options, Nan::New("freefallTime").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> detector = Nan::Get(options, Nan::New("detector").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> compress = Nan::Get(options, Nan::New("compress").ToLocalChecked()).ToLocalChecked();
+    if ( rateValue->IsUint32() && Nan::To<uint32_t>(rateValue).FromJust() > 0 )
+    {
+        *rate = Nan::To<uint32_t>(rateValue).FromJust();
+    }
+    if ( !sensorsValue->IsUndefined() && !parseSensors(sensorsValue, sensors) )
+    {
+        return false;
+    }
+    if ( pre->IsNumber() && Nan::To<double>(pre).FromJust() >= 0 )
+    {
+        capture->pre = Nan::To<double>(pre).FromJust();
+    }
+    if ( post->IsNumber() && Nan::To<double>(post).FromJust() >= 0 )
+    {
+        capture->post = Nan::To<double>(post).FromJust();
+    }
+    if ( shock->IsNumber() && Nan::To<double>(shock).FromJust() > 0 )
+    {
+        capture->shock = Nan::To<double>(shock).FromJust();
+    }
+    if ( freefall->IsNumber() && Nan::To<double>(freefall).FromJust() > 0 )
+    {
+        capture->freefall = Nan::To<double>(freefall).FromJust();
+    }
+    if ( freefallTime->IsNumber() && Nan::To<double>(freefallTime).FromJust() > 0 )
+    {
+        capture->freefallTime = Nan::To<double>(freefallTime).FromJust();
+    }
+    if ( detector->IsObject() )
+    {
+        // thresholds are 2 mg per LSB, durations 1 ms
+        v8::Local<v8::Object> hw = Nan::To<v8::Object>(detector).ToLocalChecked();
+        capture->detector.motionThreshold = detectorRegister(hw, "motion", 2, 0);
+        capture->detector.motionDuration = detectorRegister(hw, "motionTime", 1, 1);
+        capture->detector.freefallThreshold = detectorRegister(hw, "freefall", 2, 0);
+        capture->detector.freefallDuration = detectorRegister(hw, "freefallTime", 1, 20);
+    }
+    capture->compress = Nan::To<bool>(compress).FromJust();
+    return true;
+}
+
+/*static*/
+void
+RPIGY86::sStartCapture(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    int last = args.Length() - 1;
+    if ( args.Length() < 2 || args.Length() > 3 || !args[0]->IsString() || !args[last]->IsFunction()
+            || (args.Length() == 3 && !(args[1]->IsObject() || args[1]->IsUndefined())) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: startCapture(path[, { pre, post, shock, freefall, freefallTime, detector, rate, sensors, compress }], callback)").ToLocalChecked()));
+        return;
+    }
+    uint32_t rate = ACQUISITION_MAX_RATE;
+    uint32_t sensors = _this->mSensors;
+    CaptureOptions options;
+    memset(&options, 0, sizeof(options));
+    options.pre = 1;
+    options.post = 2;
+    options.freefallTime = 20;
+    if ( args.Length() == 3 && args[1]->IsObject()
+            && !parseCaptureOptions(Nan::To<v8::Object>(args[1]).ToLocalChecked(), &options, &rate, &sensors) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::TypeError(Nan::New("sensors must be a mask or an array of sensor names").ToLocalChecked()));
+        return;
+    }
+    sensors |= SENSOR_ACCEL;
+    if ( !_this->requireSensors(args, sensors) )
+    {
+        return;
+    }
+    if ( _this->mCalibrating )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("calibration running").ToLocalChecked()));
+        return;
+    }
+    if ( _this->mCapture )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("capture already running").ToLocalChecked()));
+        return;
+    }
+    _this->startCapture(*Nan::Utf8String(args[0]), rate, sensors, options,
+            v8::Local<v8::Function>::Cast(args[last]));
+}
+
+/*static*/
+void
+RPIGY86::sTriggerCapture(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_this->mRecordLock);
+    if ( _this->mCapture )
+    {
+        _this->mCapture->trigger();
+    }
+}
+
+/*static*/
+void
+RPIGY86::sStopCapture(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    _this->stopCapture(args);
+}
+
+/**
+ * low-power options: wakeRate (Hz, default 5), wake (mg, default 20), and
+ * either stillTime (ms) with stillNoise (mg rms, default 4) for the software
+ * variance window, or the zero-motion detector, which is enabled at 8 mg
+ * unless detection has it already. stillSamples is filled in in ms, to be
+ * converted once the rate is known.
+ * @return false if wakeRate is not one of the MPU6050 wake frequencies
+ */
+static bool parseLowPowerPolicy(v8::Local<v8::Object> options, float accelScale, LowPowerPolicy* policy,
+        MotionDetection* detection)
+{
+    static const double rates[] = { 1.25, 2.5, 5, 10 };
+    static const uint8_t frequencies[] = { MPU6050_WAKE_FREQ_1P25, MPU6050_WAKE_FREQ_2P5,
+                                           MPU6050_WAKE_FREQ_5, MPU6050_WAKE_FREQ_10 };
+    v8::Local<v8::Value> wakeRate = Nan::Get(options, Nan::New("wakeRate").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> stillTime = Nan::Get(options, Nan::New("stillTime").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> stillNoise = Nan::Get(options, Nan::New("stillNoise").ToLocalChecked()).ToLocalChecked();
+    policy->enabled = true;
+    policy->wakeFrequency = MPU6050_WAKE_FREQ_5;
+    if ( !wakeRate->IsUndefined() )
+    {
+        double hz = Nan::To<double>(wakeRate).FromJust();
+        unsigned i = 0;
+        while ( i < sizeof(rates) / sizeof(rates[0]) && rates[i] != hz )
+        {
+            i++;
+        }
+        if ( i == sizeof(rates) / sizeof(rates[0]) )
+        {
+            return false;
+        }
+        policy->wakeFrequency = frequencies[i];
+    }
+    policy->wakeThreshold = detectorRegister(options, "wake", 2, 10);
+    if ( stillTime->IsNumber() && Nan::To<double>(stillTime).FromJust() > 0 )
+    {
+        double noise = stillNoise->IsNumber() && Nan::To<double>(stillNoise).FromJust() > 0
+                ? Nan::To<double>(stillNoise).FromJust() : 4;
+        double counts = noise / 1000 / accelScale;
+        policy->stillSamples = (uint32_t)Nan::To<double>(stillTime).FromJust();
+        policy->stillVariance = (uint32_t)(counts * counts + 0.5);
+    }
+    else if ( !detection->zeroMotionThreshold )
+    {
+        detection->zeroMotionThreshold = 4;
+        detection->zeroMotionDuration = 1;
+    }
+    return true;
+}
+
+/*static*/
+void
+RPIGY86::sMotionStart(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() != 2 || !args[0]->IsObject() || !args[1]->IsFunction() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: _motionStart({ motion, motionTime, freefall, freefallTime, zeroMotion, zeroMotionTime, rate }, callback)").ToLocalChecked()));
+        return;
+    }
+    v8::Local<v8::Object> options = Nan::To<v8::Object>(args[0]).ToLocalChecked();
+    v8::Local<v8::Value> rateValue = Nan::Get(options, Nan::New("rate").ToLocalChecked()).ToLocalChecked();
+    uint32_t rate = rateValue->IsUint32() && Nan::To<uint32_t>(rateValue).FromJust() > 0
+            ? Nan::To<uint32_t>(rateValue).FromJust() : MOTION_EVENTS_DEFAULT_RATE;
+    // thresholds are 2 mg per LSB, durations 1 ms, zero motion 64 ms
+    MotionDetection detection;
+    detection.motionThreshold = detectorRegister(options, "motion", 2, 0);
+    detection.motionDuration = detectorRegister(options, "motionTime", 1, 1);
+    detection.freefallThreshold = detectorRegister(options, "freefall", 2, 0);
+    detection.freefallDuration = detectorRegister(options, "freefallTime", 1, 20);
+    detection.zeroMotionThreshold = detectorRegister(options, "zeroMotion", 2, 0);
+    detection.zeroMotionDuration = detectorRegister(options, "zeroMotionTime", 64, 1);
+    LowPowerPolicy policy;
+    memset(&policy, 0, sizeof(policy));
+    v8::Local<v8::Value> lowPower = Nan::Get(options, Nan::New("lowPower").ToLocalChecked()).ToLocalChecked();
+    if ( lowPower->IsObject() )
+    {
+        if ( _this->mReplay )
+        {
+            args.GetIsolate()->ThrowException(
+                    v8::Exception::Error(Nan::New("lowPower is not available on a replay").ToLocalChecked()));
+            return;
+        }
+        if ( !parseLowPowerPolicy(Nan::To<v8::Object>(lowPower).ToLocalChecked(), _this->mUnits.getAccelScale(),
+                &policy, &detection) )
+        {
+            args.GetIsolate()->ThrowException(
+                    v8::Exception::RangeError(Nan::New("lowPower.wakeRate must be 1.25, 2.5, 5 or 10").ToLocalChecked()));
+            return;
+        }
+    }
+    if ( !detection.motionThreshold && !detection.freefallThreshold && !detection.zeroMotionThreshold )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::TypeError(Nan::New("no detector enabled").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL) )
+    {
+        return;
+    }
+    if ( _this->mCalibrating )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("calibration running").ToLocalChecked()));
+        return;
+    }
+    if ( _this->mEventCallback )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("motion events already open").ToLocalChecked()));
+        return;
+    }
+    _this->startMotionEvents(rate, detection, policy, v8::Local<v8::Function>::Cast(args[1]));
+}
+
+/*static*/
+void
+RPIGY86::sMotionStop(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    _this->stopMotionEvents();
+}
+
+/**
+ * .spectrum() options: rate (Hz), size (samples per FFT, a power of 2),
+ * overlap (fraction of a frame shared with the next one), interval (ms
+ * between results), peaks (per axis) and bands ([low, high] pairs in Hz)
+ * @return false if one is out of range
+ */
+static bool parseSpectrumOptions(v8::Local<v8::Object> options, uint32_t* rate, SpectrumSettings* settings)
+{
+    v8::Local<v8::Value> rateValue = Nan::Get(options, Nan::New("rate").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> size = Nan::Get(options, Nan::New("size").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> overlap = Nan::Get(options, Nan::New("overlap").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> interval = Nan::Get(options, Nan::New("interval").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> peaks = Nan::Get(options, Nan::New("peaks").ToLocalChecked()).ToLocalChecked();
+    v8::Local<v8::Value> bands = Nan::Get(options, Nan::New("bands").ToLocalChecked()).ToLocalChecked();
+    *rate = rateValue->IsUint32() && Nan::To<uint32_t>(rateValue).FromJust() > 0
+            ? Nan::To<uint32_t>(rateValue).FromJust() : SPECTRUM_DEFAULT_RATE;
+    settings->size = size->IsUndefined() ? SPECTRUM_DEFAULT_SIZE
+            : size->IsUint32() ? Nan::To<uint32_t>(size).FromJust() : 0;
+    if ( settings->size < SPECTRUM_MIN_SIZE || settings->size > SPECTRUM_MAX_SIZE
+            || (settings->size & (settings->size - 1)) )
+    {
+        return false;
+    }
+    double fraction = overlap->IsNumber() ? Nan::To<double>(overlap).FromJust() : SPECTRUM_DEFAULT_OVERLAP;
+    if ( !(fraction >= 0 && fraction < 1) )
+    {
+        return false;
+    }
+    settings->hop = (uint32_t)lround(settings->size * (1 - fraction));
+    if ( settings->hop == 0 )
+    {
+        settings->hop = 1;
+    }
+    double ms = interval->IsNumber() ? Nan::To<double>(interval).FromJust() : SPECTRUM_DEFAULT_INTERVAL;
+    if ( !(ms >= 0) )
+    {
+        return false;
+    }
+    settings->interval = (uint64_t)(ms * 1e6);
+    settings->peaks = peaks->IsUndefined() ? SPECTRUM_DEFAULT_PEAKS
+            : peaks->IsUint32() ? Nan::To<uint32_t>(peaks).FromJust() : SPECTRUM_MAX_PEAKS + 1;
+    if ( settings->peaks > SPECTRUM_MAX_PEAKS )
+    {
+        return false;
+    }
+    settings->bands.clear();
+    if ( bands->IsUndefined() )
+    {
+        return true;
+    }
+    if ( !bands->IsArray() || v8::Local<v8::Array>::Cast(bands)->Length() > SPECTRUM_MAX_BANDS )
+    {
+        return false;
+    }
+    v8::Local<v8::Array> list = v8::Local<v8::Array>::Cast(bands);
+    for ( uint32_t i = 0; i < list->Length(); i++ )
+    {
+        v8::Local<v8::Value> band = Nan::Get(list, i).ToLocalChecked();
+        if ( !band->IsArray() || v8::Local<v8::Array>::Cast(band)->Length() != 2 )
+        {
+            return false;
+        }
+        v8::Local<v8::Value> low = Nan::Get(v8::Local<v8::Array>::Cast(band), 0).ToLocalChecked();
+        v8::Local<v8::Value> high = Nan::Get(v8::Local<v8::Array>::Cast(band), 1).ToLocalChecked();
+        if ( !low->IsNumber() || !high->IsNumber()
+                || !(Nan::To<double>(low).FromJust() >= 0
+                    && Nan::To<double>(low).FromJust() <= Nan::To<double>(high).FromJust()) )
+        {
+            return false;
+        }
+        settings->bands.push_back(Nan::To<double>(low).FromJust());
+        settings->bands.push_back(Nan::To<double>(high).FromJust());
+    }
+    return true;
+}
+
+/*static*/
+void
+RPIGY86::sSpectrumStart(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() != 2 || !args[0]->IsObject() || !args[1]->IsFunction() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: _spectrumStart({ rate, size, overlap, interval, peaks, bands }, callback)").ToLocalChecked()));
+        return;
+    }
+    uint32_t rate;
+    SpectrumSettings settings;
+    if ( !parseSpectrumOptions(Nan::To<v8::Object>(args[0]).ToLocalChecked(), &rate, &settings) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::RangeError(Nan::New("size must be a power of 2 from 16 to 4096, overlap below 1, at most 8 peaks and 16 [low, high] bands").ToLocalChecked()));
+        return;
+    }
+    if ( !_this->requireSensors(args, SENSOR_ACCEL | SENSOR_GYRO) )
+    {
+        return;
+    }
+    if ( _this->mCalibrating )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("calibration running").ToLocalChecked()));
+        return;
+    }
+    if ( _this->mSpectrum )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("spectrum already open").ToLocalChecked()));
+        return;
+    }
+    _this->startSpectrum(rate, settings, v8::Local<v8::Function>::Cast(args[1]));
+}
+
+/*static*/
+void
+RPIGY86::sSpectrumStop(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    _this->stopSpectrum();
+}
+
+/*static*/
+void
+RPIGY86::sSetFilters(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() != 1 || !args[0]->IsArray() )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: _setFilters([{ type, sensors, frequency, q }])").ToLocalChecked()));
+        return;
+    }
+    v8::Local<v8::Array> filters = v8::Local<v8::Array>::Cast(args[0]);
+    BiquadSpec specs[BIQUAD_MAX_SECTIONS];
+    uint32_t count = filters->Length();
+    bool valid = count <= BIQUAD_MAX_SECTIONS;
+    for ( uint32_t i = 0; valid && i < count; i++ )
+    {
+        v8::Local<v8::Value> filter = Nan::Get(filters, i).ToLocalChecked();
+        if ( !filter->IsObject() )
+        {
+            valid = false;
+            break;
+        }
+        v8::Local<v8::Object> options = Nan::To<v8::Object>(filter).ToLocalChecked();
+        v8::Local<v8::Value> type = Nan::Get(options, Nan::New("type").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> sensors = Nan::Get(options, Nan::New("sensors").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> frequency = Nan::Get(options, Nan::New("frequency").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> q = Nan::Get(options, Nan::New("q").ToLocalChecked()).ToLocalChecked();
+        specs[i].type = type->IsUint32() ? Nan::To<uint32_t>(type).FromJust() : 0;
+        specs[i].sensors = sensors->IsUint32() ? Nan::To<uint32_t>(sensors).FromJust() & BIQUAD_SENSORS : BIQUAD_SENSORS;
+        specs[i].frequency = frequency->IsNumber() ? Nan::To<double>(frequency).FromJust() : 0;
+        specs[i].q = q->IsNumber() ? Nan::To<double>(q).FromJust()
+                : specs[i].type == BIQUAD_NOTCH ? BIQUAD_DEFAULT_NOTCH_Q : BIQUAD_DEFAULT_LOWPASS_Q;
+    }
+    if ( !valid || !_this->mBiquads.setSections(specs, count) )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::RangeError(Nan::New("at most 8 filters, each a notch or lowpass with a positive frequency and q").ToLocalChecked()));
+        return;
+    }
+}
+
+/*static*/
+void
+RPIGY86::sStopRecording(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    _this->stopRecording(args);
+}
+
+/*static*/
+void
+RPIGY86::sGetReplay(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    RPIGY86* _this = RPIGY86::Unwrap<RPIGY86>(args.Holder());
+    if ( !_this )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::ReferenceError(Nan::New("not a valid RPiGY86 object").ToLocalChecked()));
+        return;
+    }
+    if ( args.Length() != 0 )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::SyntaxError(Nan::New("usage: getReplay()").ToLocalChecked()));
+        return;
+    }
+    _this->getReplay(args);
+}
+
+/*static*/
+void
+RPIGY86::sOnSamplesAsync(uv_async_t* handle)
+{
+    RPIGY86* _this = static_cast<RPIGY86*>(handle->data);
+    if ( _this )
+    {
+        _this->notifyStreams();
+        _this->notifyCapture();
+        _this->notifyMotionEvents();
+        _this->notifySpectrum();
+    }
+}
+
+static void closeSamplesAsync(uv_handle_t* handle)
+{
+    delete reinterpret_cast<uv_async_t*>(handle);
+}
+
+/*static*/
+v8::Local<v8::Function>
+RPIGY86::sGetFunction()
+{
+    Nan::EscapableHandleScope scope;
+    v8::Isolate* isolate = v8::Isolate::GetCurrent();
+
+    if ( sFunction.IsEmpty() ) {
+#ifdef RPIGY86_FAST_API
+        static const v8::CFunction fastGetMotion6 = v8::CFunction::Make(sFastGetMotion6);
+        static const v8::CFunction fastGetMotion9 = v8::CFunction::Make(sFastGetMotion9);
+        static const v8::CFunction fastGetHeading = v8::CFunction::Make(sFastGetHeading);
+        static const v8::CFunction fastReadLatest = v8::CFunction::Make(sFastReadLatest);
+#endif
+        v8::Local<v8::FunctionTemplate> ftmpl = v8::FunctionTemplate::New(isolate, RPIGY86::V8New);
+        ftmpl->SetClassName(Nan::New(FUNCTION_TEMPLATE_CLASS).ToLocalChecked());
+        v8::Local<v8::ObjectTemplate> otmpl = ftmpl->InstanceTemplate();
+        otmpl->SetInternalFieldCount(1);
+        // wrapped by index.js, which returns the caller's buffer: a fast
+        // call cannot return it
+        otmpl->Set(Nan::New("_getMotion6").ToLocalChecked(),
+            FAST_METHOD(isolate, sGetMotion6, fastGetMotion6, ftmpl));
+        otmpl->Set(Nan::New("_getMotion9").ToLocalChecked(),
+            FAST_METHOD(isolate, sGetMotion9, fastGetMotion9, ftmpl));
+        otmpl->Set(Nan::New("_readLatest").ToLocalChecked(),
+            FAST_METHOD(isolate, sReadLatest, fastReadLatest, ftmpl));
+        otmpl->Set(Nan::New("setUnits").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetUnits, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("getUnits").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sGetUnits, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setAccelXOffset").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetAccelXOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setAccelYOffset").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetAccelYOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setAccelZOffset").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetAccelZOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setGryoXOffset").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetGryoXOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setGryoYOffset").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetGryoYOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setGryoZOffset").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetGryoZOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setMagXOffset").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetMagXOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setMagYOffset").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetMagYOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setMagZOffset").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetMagZOffset, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setGryoRangeScale").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetGryoRangeScale, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("getGryoRangeScale").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sGetGryoRangeScale, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setAccelRangeScale").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetAccelRangeScale, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("getAccelRangeScale").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sGetAccelRangeScale, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("getMagGain").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sGetMagGain, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setMagGain").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetMagGain, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("calibrateMPU6050").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sCalibrateMPU6050, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("getHeadingXYZ").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sGetHeadingXYZ, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("getHeading").ToLocalChecked(),
+            FAST_METHOD(isolate, sGetHeading, fastGetHeading, ftmpl));
+        otmpl->Set(Nan::New("startMagCalibration").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStartMagCalibration, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("sampleMagCalibration").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSampleMagCalibration, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("solveMagCalibration").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSolveMagCalibration, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setMagCalibration").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetMagCalibration, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("selfTestMag").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSelfTestMag, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setMagScale").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetMagScale, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("getTiltCompensatedHeading").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sGetTiltCompensatedHeading, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("getTiltCompensatedHeadings").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sGetTiltCompensatedHeadings, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setLocation").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetLocation, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("updateLocation").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sUpdateLocation, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("getDeclination").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sGetDeclination, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("setDeclination").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetDeclination, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_getMotion6Async").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sReadAsync, v8::Int32::New(isolate, ASYNC_MOTION6), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_getMotion9Async").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sReadAsync, v8::Int32::New(isolate, ASYNC_MOTION9), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_getHeadingXYZAsync").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sReadAsync, v8::Int32::New(isolate, ASYNC_HEADING_XYZ), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_getHeadingAsync").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sReadAsync, v8::Int32::New(isolate, ASYNC_HEADING), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_getTiltCompensatedHeadingAsync").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sReadAsync, v8::Int32::New(isolate, ASYNC_TILT_HEADING), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_calibrateMPU6050Async").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sCalibrateAsync, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_sampleMagCalibrationAsync").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSampleMagCalibrationAsync, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_streamOpen").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStreamOpen, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_streamRead").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStreamRead, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_streamStats").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStreamStats, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_streamClose").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStreamClose, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_ringBuffer").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sRingBuffer, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_ringStart").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sRingStart, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_ringStop").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sRingStop, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("startAttitude").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStartAttitude, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("getAttitude").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sGetAttitude, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("stopAttitude").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStopAttitude, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("startEKF").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStartEKF, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("getEKF").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sGetEKF, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("stopEKF").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStopEKF, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("startRecording").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStartRecording, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("stopRecording").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStopRecording, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("startFlightRecorder").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStartFlightRecorder, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("stopFlightRecorder").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStopFlightRecorder, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("startCapture").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStartCapture, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("triggerCapture").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sTriggerCapture, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("stopCapture").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sStopCapture, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_motionStart").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sMotionStart, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_motionStop").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sMotionStop, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_spectrumStart").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSpectrumStart, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_spectrumStop").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSpectrumStop, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("_setFilters").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sSetFilters, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        otmpl->Set(Nan::New("getReplay").ToLocalChecked(),
+            v8::FunctionTemplate::New(isolate, sGetReplay, v8::Local<v8::Value>(), v8::Signature::New(isolate, ftmpl)));
+        sFunction.Set(isolate, ftmpl->GetFunction(isolate->GetCurrentContext()).ToLocalChecked());
+    }
+    return scope.Escape(sFunction.Get(isolate));
+}
+
 RPIGY86::RPIGY86(const v8::FunctionCallbackInfo<v8::Value> &args)
-    : mpu6050(nullptr), hmc5883l(nullptr), ms5611(nullptr)
+    : mpu6050(nullptr), hmc5883l(nullptr), ms5611(nullptr), mBus(DEFAULT_BUS),
+      mAddress(MPU6050_DEFAULT_ADDRESS), mMagAddress(HMC5883L_DEFAULT_ADDRESS), mSensors(SENSOR_ALL),
+      mSIUnits(false), mDeclination(DEFAULT_DECLINATION), mInclination(0),
+      mCalibrating(false), mAcquisition(nullptr), mNextStreamId(1), mRingNotify(nullptr),
+      mAttitudeRunning(false), mAttitudeMag(false), mAttitudeGyroScale(0), mAttitudeAccelScale(0),
+      mAttitudeTimestamp(0), mEKFRunning(false), mEKFMag(false), mEKFBaro(false),
+      mEKFSeaLevel(DEFAULT_SEA_LEVEL_PRESSURE), mEKFTimestamp(0), mRecorder(nullptr),
+      mFlightRecorder(nullptr), mCapture(nullptr), mCaptureCallback(nullptr), mCaptureCompress(false),
+      mEventCallback(nullptr), mSpectrum(nullptr), mSpectrumCallback(nullptr), mReplay(nullptr),
+      mReplayError(0)
+{
+    memset(&mEventDetector, 0, sizeof(mEventDetector));
+    memset(&mCaptureDetector, 0, sizeof(mCaptureDetector));
+    memset(&mLowPowerPolicy, 0, sizeof(mLowPowerPolicy));
+    for ( int i = 0; i < ASYNC_OP_COUNT; i++ )
+    {
+        mInFlight[i] = NULL;
+    }
+    memset(mLatest, 0, sizeof(mLatest));
+    if ( args.Length() > 0 && args[0]->IsObject() )
+    {
+        v8::Local<v8::Object> options = Nan::To<v8::Object>(args[0]).ToLocalChecked();
+        v8::Local<v8::Value> bus = Nan::Get(options, Nan::New("bus").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> address = Nan::Get(options, Nan::New("address").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> magAddress = Nan::Get(options, Nan::New("magAddress").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> sensors = Nan::Get(options, Nan::New("sensors").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> units = Nan::Get(options, Nan::New("units").ToLocalChecked()).ToLocalChecked();
+        if ( bus->IsString() )
+        {
+            mBus = *Nan::Utf8String(bus);
+        }
+        if ( address->IsUint32() )
+        {
+            mAddress = Nan::To<uint32_t>(address).FromJust();
+        }
+        if ( magAddress->IsUint32() )
+        {
+            mMagAddress = Nan::To<uint32_t>(magAddress).FromJust();
+        }
+        if ( !sensors->IsUndefined() )
+        {
+            parseSensors(sensors, &mSensors);
+        }
+        if ( !units->IsUndefined() )
+        {
+            parseUnits(units, &mSIUnits);
+        }
+        v8::Local<v8::Value> replay = Nan::Get(options, Nan::New("replay").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> speed = Nan::Get(options, Nan::New("speed").ToLocalChecked()).ToLocalChecked();
+        if ( replay->IsString() && !openReplay(*Nan::Utf8String(replay),
+                speed->IsNumber() ? Nan::To<double>(speed).FromJust() : 1.0) )
+        {
+            // V8New throws; leave every chip out
+            mSensors = 0;
+        }
+    }
+    this->Wrap(args.This());
+    initialize();
+    if ( mReplay )
+    {
+        const SampleLogHeader& header = mReplay->getHeader();
+        memcpy(mMagCorrection.scale, header.magCorrectionScale, sizeof(mMagCorrection.scale));
+        memcpy(mMagCorrection.offset, header.magCorrectionOffset, sizeof(mMagCorrection.offset));
+        memcpy(mMagCorrection.matrix, header.magCorrectionMatrix, sizeof(mMagCorrection.matrix));
+    }
+    mAttitudeGyroScale = mUnits.getGyroScale() * DEG_TO_RAD;
+    mAttitudeAccelScale = mUnits.getAccelScale();
+
+    // only keeps the loop alive while streams are open
+    mSamplesAsync = new uv_async_t;
+    uv_async_init(Nan::GetCurrentEventLoop(), mSamplesAsync, sOnSamplesAsync);
+    mSamplesAsync->data = this;
+    uv_unref(reinterpret_cast<uv_handle_t*>(mSamplesAsync));
+    mStreamResource = new Nan::AsyncResource("rpi-gy86:stream");
+}
+
+/**
+ * put the chips on a ReplayTransport of the recording at path: the bus,
+ * address and available sensors become the recorded ones
+ * @return false with mReplayError set if the recording cannot be read
+ */
+bool RPIGY86::openReplay(const char* path, double speed)
+{
+    static uint32_t sReplayCount = 0;
+    ReplayTransport* replay = new ReplayTransport();
+    if ( !replay->open(path, speed) )
+    {
+        mReplayError = replay->getError() ? replay->getError() : EINVAL;
+        delete replay;
+        return false;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "replay-%u", ++sReplayCount);
+    if ( !I2CTransport::registerBus(name, replay) )
+    {
+        mReplayError = ENOSPC;
+        delete replay;
+        return false;
+    }
+    mReplay = replay;
+    mBus = name;
+    const SampleLogHeader& header = replay->getHeader();
+    if ( header.mpuAddress == MPU6050_ADDRESS_AD0_LOW || header.mpuAddress == MPU6050_ADDRESS_AD0_HIGH )
+    {
+        mAddress = header.mpuAddress;
+    }
+    mSensors &= header.sensors | MPU6050_SENSORS;
+    return true;
+}
+
+void RPIGY86::initialize()
+{
+    if ( mSensors & MPU6050_SENSORS )
+    {
+        mpu6050 = new MPU6050(mBus.c_str(), mAddress);
+        mpu6050->initialize();
+        mpu6050->setI2CBypassEnabled(true);
+        mUnits.setAccelRange(mpu6050->getFullScaleAccelRange());
+        mUnits.setGyroRange(mpu6050->getFullScaleGyroRange());
+    }
+    else if ( mSensors & SENSOR_MAG )
+    {
+        // the HMC5883L is reached through the MPU6050 auxiliary bus bypass;
+        // open the bypass and leave the MPU6050 otherwise untouched
+        MPU6050 bypass(mBus.c_str(), mAddress);
+        bypass.setI2CBypassEnabled(true);
+    }
+    if ( mSensors & SENSOR_MAG )
+    {
+        hmc5883l = new HMC5883L(mBus.c_str(), mMagAddress);
+        hmc5883l->initialize();
+        mUnits.setMagGain(hmc5883l->getGain());
+    }
+    if ( mSensors & SENSOR_BARO )
+    {
+        ms5611 = new MS5611(mBus.c_str(), MS5611_ADDRESS);
+        ms5611->begin();
+    }
+}
+
+/**
+ * throw unless the chips behind the SENSOR_* mask were enabled in the
+ * constructor options
+ */
+bool RPIGY86::requireSensors(const v8::FunctionCallbackInfo<v8::Value> &args, uint32_t sensors)
+{
+    const char* missing = NULL;
+    if ( (sensors & MPU6050_SENSORS) && !(mSensors & MPU6050_SENSORS) )
+    {
+        missing = "MPU6050 is not enabled";
+    }
+    else if ( (sensors & SENSOR_MAG) && !(mSensors & SENSOR_MAG) )
+    {
+        missing = "HMC5883L is not enabled";
+    }
+    else if ( (sensors & SENSOR_BARO) && !(mSensors & SENSOR_BARO) )
+    {
+        missing = "MS5611 is not enabled";
+    }
+    if ( missing )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New(missing).ToLocalChecked()));
+        return false;
+    }
+    return true;
+}
+
+RPIGY86::~RPIGY86()
+{
+    // the acquisition thread uses the devices, the recorders and the async
+    // handle
+    delete mAcquisition;
+    delete mRecorder;
+    delete mFlightRecorder;
+    delete mCapture;
+    delete mCaptureCallback;
+    delete mEventCallback;
+    delete mSpectrum;
+    delete mSpectrumCallback;
+    for ( std::map<int32_t, RPIGY86Stream*>::iterator it = mStreams.begin(); it != mStreams.end(); ++it )
+    {
+        delete it->second;
+    }
+    delete mRingNotify;
+    mSamplesAsync->data = NULL;
+    uv_close(reinterpret_cast<uv_handle_t*>(mSamplesAsync), closeSamplesAsync);
+    delete mStreamResource;
+    delete mpu6050;
+    delete hmc5883l;
+    delete ms5611;
+    if ( mReplay )
+    {
+        I2CTransport::unregisterBus(mBus.c_str());
+        delete mReplay;
+    }
+}
+
+void RPIGY86::getMotion6(const FunctionCallbackInfo<v8::Value> &args)
+{
+    int16_t motion[6];
+    v8::Isolate* isolate = args.GetIsolate();
+    readMotion6(motion);
+    v8::Local<v8::Array> rev = v8::Array::New(isolate, 6);
+    for ( int i = 0; i < 6; i++ )
+    {
+        Nan::Set(rev, i, v8::Int32::New(isolate, motion[i]));
+    }
+    args.GetReturnValue().Set(rev);
+}
+
+void RPIGY86::getMotion9(const FunctionCallbackInfo<v8::Value> &args)
+{
+    int32_t motion[9];
+    v8::Isolate* isolate = args.GetIsolate();
+    readMotion9(motion);
+    v8::Local<v8::Array> rev = v8::Array::New(isolate, 9);
+    for ( int i = 0; i < 9; i++ )
+    {
+        Nan::Set(rev, i, v8::Int32::New(isolate, motion[i]));
+    }
+    args.GetReturnValue().Set(rev);
+}
+
+void RPIGY86::getMotion6Into(const FunctionCallbackInfo<v8::Value> &args)
+{
+    int16_t motion[6];
+    float frame[6];
+    readMotion6(motion);
+    for ( int i = 0; i < 6; i++ )
+    {
+        frame[i] = motion[i];
+    }
+    if ( mSIUnits && args[0]->IsFloat32Array() )
+    {
+        mUnits.toUnits(frame, 6);
+    }
+    writeFrame(args, frame, 6);
+}
+
+void RPIGY86::getMotion9Into(const FunctionCallbackInfo<v8::Value> &args)
+{
+    int16_t motion[6];
+    float frame[9];
+    readMotion9(motion, &frame[6]);
+    for ( int i = 0; i < 6; i++ )
+    {
+        frame[i] = motion[i];
+    }
+    if ( mSIUnits && args[0]->IsFloat32Array() )
+    {
+        mUnits.toUnits(frame, 9);
+    }
+    writeFrame(args, frame, 9);
+}
+
+void RPIGY86::readMotion6(int16_t* motion)
+{
+    {
+        std::lock_guard<std::mutex> lock(mBusLock);
+        mpu6050->getMotion6(&motion[0], &motion[1], &motion[2], &motion[3], &motion[4], &motion[5]);
+    }
+    storeLatest(motion, NULL);
+}
+
+void RPIGY86::readMotion9(int32_t* motion)
+{
+    int16_t raw[6];
+    float m[3];
+    readMotion9(raw, m);
+    for ( int i = 0; i < 6; i++ )
+    {
+        motion[i] = raw[i];
+    }
+    motion[6] = lrintf(m[0]);
+    motion[7] = lrintf(m[1]);
+    motion[8] = lrintf(m[2]);
+}
+
+void RPIGY86::readMotion9(int16_t* motion, float* mag)
+{
+    int16_t mx, my, mz;
+    {
+        std::lock_guard<std::mutex> lock(mBusLock);
+        mpu6050->getMotion6(&motion[0], &motion[1], &motion[2], &motion[3], &motion[4], &motion[5]);
+        hmc5883l->getHeading(&mx, &my, &mz);
+    }
+    magCorrection().apply(mx, my, mz, mag);
+    storeLatest(motion, mag);
+}
+
+/**
+ * copy of the most recent frame, no bus access; in physical units if the
+ * object was created with units: 'si'
+ */
+void RPIGY86::readLatest(float* frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(mLatestLock);
+        memcpy(frame, mLatest, sizeof(mLatest));
+    }
+    if ( mSIUnits )
+    {
+        mUnits.toUnits(frame, 9);
+    }
+}
+
+/**
+ * record a freshly read frame; mag may be NULL for a 6 axis read
+ */
+void RPIGY86::storeLatest(const int16_t* motion, const float* mag)
+{
+    std::lock_guard<std::mutex> lock(mLatestLock);
+    for ( int i = 0; i < 6; i++ )
+    {
+        mLatest[i] = motion[i];
+    }
+    if ( mag )
+    {
+        memcpy(&mLatest[6], mag, 3 * sizeof(float));
+    }
+}
+
+void
+RPIGY86::setGryoXOffset(int32_t offset)
+{
+    std::lock_guard<std::mutex> lock(mBusLock);
+    mpu6050->setXGyroOffset(offset);
+}
+
+void
+RPIGY86::setGryoYOffset(int32_t offset)
+{
+    std::lock_guard<std::mutex> lock(mBusLock);
+    mpu6050->setYGyroOffset(offset);
+}
+
+void
+RPIGY86::setGryoZOffset(int32_t offset)
+{
+    std::lock_guard<std::mutex> lock(mBusLock);
+    mpu6050->setZGyroOffset(offset);
+}
+
+void
+RPIGY86::setAccelXOffset(int32_t offset)
+{
+    std::lock_guard<std::mutex> lock(mBusLock);
+    mpu6050->setXAccelOffset(offset);
+}
+
+void
+RPIGY86::setAccelYOffset(int32_t offset)
+{
+    std::lock_guard<std::mutex> lock(mBusLock);
+    mpu6050->setYAccelOffset(offset);
+}
+
+void
+RPIGY86::setAccelZOffset(int32_t offset)
+{
+    std::lock_guard<std::mutex> lock(mBusLock);
+    mpu6050->setZAccelOffset(offset);
+}
+
+void
+RPIGY86::setGryoRangeScale(int32_t scale)
+{
+    std::lock_guard<std::mutex> lock(mBusLock);
+    mpu6050->setFullScaleGyroRange(scale);
+    mUnits.setGyroRange(scale);
+    std::lock_guard<std::mutex> attitudeLock(mAttitudeLock);
+    mAttitudeGyroScale = mUnits.getGyroScale() * DEG_TO_RAD;
+}
+
+void
+RPIGY86::getGryoRangeScale(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    args.GetReturnValue().Set(v8::Uint32::New(args.GetIsolate(), mUnits.getGyroRange()));
+}
+
+void
+RPIGY86::setAccelRangeScale(int32_t scale)
+{
+    std::lock_guard<std::mutex> lock(mBusLock);
+    mpu6050->setFullScaleAccelRange(scale);
+    mUnits.setAccelRange(scale);
+    std::lock_guard<std::mutex> attitudeLock(mAttitudeLock);
+    mAttitudeAccelScale = mUnits.getAccelScale();
+}
+
+void
+RPIGY86::getAccelRangeScale(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    args.GetReturnValue().Set(v8::Uint32::New(args.GetIsolate(), mUnits.getAccelRange()));
+}
+
+void
+RPIGY86::setMagXOffset(int32_t offset)
+{
+    std::lock_guard<std::mutex> lock(mMagCorrectionLock);
+    mMagCorrection.offset[0] = offset;
+}
+
+void
+RPIGY86::setMagYOffset(int32_t offset)
+{
+    std::lock_guard<std::mutex> lock(mMagCorrectionLock);
+    mMagCorrection.offset[1] = offset;
+}
+
+void
+RPIGY86::setMagZOffset(int32_t offset)
+{
+    std::lock_guard<std::mutex> lock(mMagCorrectionLock);
+    mMagCorrection.offset[2] = offset;
+}
+
+void
+RPIGY86::setMagGain(int32_t gain)
+{
+    std::lock_guard<std::mutex> lock(mBusLock);
+    hmc5883l->setGain(gain);
+    mUnits.setMagGain(gain);
+}
+
+void
+RPIGY86::getMagGain(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    args.GetReturnValue().Set(v8::Uint32::New(args.GetIsolate(), mUnits.getMagGain()));
+}
+
+/**
+ * the calibration owns the FIFO and the sample rate while it runs
+ */
+bool
+RPIGY86::checkCalibrationIdle(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    const char* busy = NULL;
+    if ( mCalibrating )
+    {
+        busy = "calibration already running";
+    }
+    else if ( mAcquisition && mAcquisition->isRunning() )
+    {
+        busy = "close streams before calibrating";
+    }
+    if ( busy )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New(busy).ToLocalChecked()));
+        return false;
+    }
+    return true;
+}
+
+void
+RPIGY86::calibrateMPU6050(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    MPU6050Calibration calibration(mpu6050, &mBusLock);
+    int16_t offsets[6];
+    setCalibrationOptions(args[0], &calibration);
+    mCalibrating = true;
+    calibration.run(offsets, NULL);
+    mCalibrating = false;
+
+    v8::Isolate* isolate = args.GetIsolate();
+    v8::Local<v8::Array> rev = v8::Array::New(isolate, 6);
+    for ( int i = 0; i < 6; i++ )
+    {
+        Nan::Set(rev, i, v8::Int32::New(isolate, offsets[i]));
+    }
+    args.GetReturnValue().Set(rev);
+}
+
+void
+RPIGY86::getHeadingXYZ(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    int32_t mag[3];
+    v8::Isolate* isolate = args.GetIsolate();
+    readHeadingXYZ(mag);
+    v8::Local<v8::Array> rev = v8::Array::New(isolate, 3);
+    for ( int i = 0; i < 3; i++ )
+    {
+        Nan::Set(rev, i, v8::Int32::New(isolate, mag[i]));
+    }
+    args.GetReturnValue().Set(rev);
+}
+
+void
+RPIGY86::getHeading(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    args.GetReturnValue().Set(v8::Number::New(args.GetIsolate(), readHeading()));
+}
+
+void
+RPIGY86::getTiltCompensatedHeading(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    args.GetReturnValue().Set(v8::Number::New(args.GetIsolate(), readTiltCompensatedHeading()));
+}
+
+void
+RPIGY86::readHeadingXYZ(int32_t* mag)
+{
+    int16_t mx, my, mz;
+    float m[3];
+    {
+        std::lock_guard<std::mutex> lock(mBusLock);
+        hmc5883l->getHeading(&mx, &my, &mz);
+    }
+    magCorrection().apply(mx, my, mz, m);
+    mag[0] = lrintf(m[0]);
+    mag[1] = lrintf(m[1]);
+    mag[2] = lrintf(m[2]);
+}
+
+float
+RPIGY86::readHeading()
+{
+    int16_t mx, my, mz;
+    float m[3];
+    {
+        std::lock_guard<std::mutex> lock(mBusLock);
+        hmc5883l->getHeading(&mx, &my, &mz);
+    }
+    magCorrection().apply(mx, my, mz, m);
+    return applyDeclination(levelHeading(m[0], m[1]));
+}
+
+float
+RPIGY86::readTiltCompensatedHeading()
+{
+    int16_t ax, ay, az;
+    int16_t mx, my, mz;
+    float a[3], m[3];
+    {
+        std::lock_guard<std::mutex> lock(mBusLock);
+        mpu6050->getAcceleration(&ax, &ay, &az);
+        hmc5883l->getHeading(&mx, &my, &mz);
+    }
+    a[0] = ax;
+    a[1] = ay;
+    a[2] = az;
+    magCorrection().apply(mx, my, mz, m);
+    return applyDeclination(tiltCompensatedHeading(a, m));
+}
+
+void
+RPIGY86::getTiltCompensatedHeadings(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    Nan::TypedArrayContents<int16_t> accel(args[0]);
+    Nan::TypedArrayContents<int16_t> mag(args[1]);
+    uint32_t count = accel.length() / 3;
+    if ( mag.length() / 3 < count )
+    {
+        count = mag.length() / 3;
+    }
+
+    std::vector<float> corrected(count * 3);
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        mMagCorrection.apply((*mag)[i * 3], (*mag)[i * 3 + 1], (*mag)[i * 3 + 2], &corrected[i * 3]);
+    }
+
+    v8::Isolate* isolate = args.GetIsolate();
+    v8::Local<v8::Float32Array> rev = v8::Float32Array::New(
+            v8::ArrayBuffer::New(isolate, count * sizeof(float)), 0, count);
+    Nan::TypedArrayContents<float> heading(rev);
+    tiltCompensatedHeadings(*accel, corrected.data(), count, *heading);
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        (*heading)[i] = applyDeclination((*heading)[i]);
+    }
+    args.GetReturnValue().Set(rev);
+}
+
+void
+RPIGY86::setLocation(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    double latitude = Nan::To<double>(args[0]).FromJust();
+    double longitude = Nan::To<double>(args[1]).FromJust();
+    // altitude is given in meters, the model works in km
+    double altitude = args.Length() > 2 ? Nan::To<double>(args[2]).FromJust() / 1000 : 0;
+    double year = args.Length() > 3 ? Nan::To<double>(args[3]).FromJust()
+                                    : MagneticModel::currentDecimalYear();
+    if ( !mDeclinationGrid.setOrigin(latitude, longitude, altitude, year) )
+    {
+        throwOutsideModel(args.GetIsolate());
+        return;
+    }
+    updateLocation(latitude, longitude);
+    getDeclination(args);
+}
+
+/**
+ * @return false if no location was set and today is outside the model
+ */
+bool
+RPIGY86::updateLocation(double latitude, double longitude)
+{
+    if ( !mDeclinationGrid.isValid()
+            && !mDeclinationGrid.setOrigin(latitude, longitude, 0, MagneticModel::currentDecimalYear()) )
+    {
+        return false;
+    }
+    mDeclinationGrid.lookup(latitude, longitude, &mDeclination, &mInclination);
+    return true;
+}
+
+/**
+ * the magnetic model is not extrapolated past its validity
+ */
+/*static*/
+void
+RPIGY86::throwOutsideModel(v8::Isolate* isolate)
+{
+    char message[80];
+    snprintf(message, sizeof(message), "date outside the magnetic model, valid %.1f to %.1f",
+            MagneticModel::getEpoch(), MagneticModel::getEpoch() + WMM_LIFESPAN);
+    isolate->ThrowException(v8::Exception::RangeError(Nan::New(message).ToLocalChecked()));
+}
+
+void
+RPIGY86::getDeclination(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    v8::Isolate* isolate = args.GetIsolate();
+    v8::Local<v8::Array> rev = v8::Array::New(isolate, 2);
+    Nan::Set(rev, 0, v8::Number::New(isolate, mDeclination));
+    Nan::Set(rev, 1, v8::Number::New(isolate, mInclination));
+    args.GetReturnValue().Set(rev);
+}
+
+void
+RPIGY86::setDeclination(float declination)
+{
+    mDeclination = declination;
+}
+
+float
+RPIGY86::applyDeclination(float heading)
+{
+    heading += mDeclination;
+    if ( heading < 0 )
+    {
+        heading += 360;
+    }
+    else if ( heading >= 360 )
+    {
+        heading -= 360;
+    }
+    return heading;
+}
+
+void
+RPIGY86::startMagCalibration()
+{
+    mMagCalibration.reset();
+}
+
+void
+RPIGY86::sampleMagCalibration(const v8::FunctionCallbackInfo<v8::Value> &args, int32_t count)
+{
+    std::vector<float> samples;
+    bool ready = readMagSamples(count, mMagCorrection.scale, &samples);
+    for ( size_t i = 0; i + 2 < samples.size(); i += 3 )
+    {
+        mMagCalibration.addSample(samples[i], samples[i + 1], samples[i + 2]);
+    }
+    if ( !ready )
+    {
+        args.GetIsolate()->ThrowException(
+                v8::Exception::Error(Nan::New("magnetometer not ready").ToLocalChecked()));
+        return;
+    }
+    args.GetReturnValue().Set(v8::Uint32::New(args.GetIsolate(), mMagCalibration.getSampleCount()));
+}
+
+/**
+ * reads count HMC5883L samples for the ellipsoid fit into samples, x, y, z
+ * each, multiplied by scale. Only touches the bus, so it can run on the
+ * threadpool; the bus is taken per sample to let other reads through.
+ * @return false if a sample was not ready within MAG_SAMPLE_TIMEOUT ms;
+ * samples then holds the ones read before
+ */
+bool
+RPIGY86::readMagSamples(int32_t count, const float* scale, std::vector<float>* samples)
+{
+    // run at the fastest continuous rate while collecting, the fit only
+    // needs directions so the rotation can be done in a few seconds
+    uint8_t rate;
+    {
+        std::lock_guard<std::mutex> lock(mBusLock);
+        rate = hmc5883l->getDataRate();
+        hmc5883l->setDataRate(HMC5883L_RATE_75);
+    }
+    bool ready = true;
+    for ( int32_t i = 0; i < count; i++ )
+    {
+        std::lock_guard<std::mutex> lock(mBusLock);
+        int waited = 0;
+        while ( !(ready = hmc5883l->getReadyStatus()) && waited++ < MAG_SAMPLE_TIMEOUT )
+        {
+            usleep(1000);
+        }
+        if ( !ready )
+        {
+            break;
+        }
+        int16_t mx, my, mz;
+        hmc5883l->getHeading(&mx, &my, &mz);
+        if ( mx == -4096 || my == -4096 || mz == -4096 )
+        {
+            continue;
+        }
+        samples->push_back(mx * scale[0]);
+        samples->push_back(my * scale[1]);
+        samples->push_back(mz * scale[2]);
+    }
+    std::lock_guard<std::mutex> lock(mBusLock);
+    hmc5883l->setDataRate(rate);
+    return ready;
+}
+
+void
+RPIGY86::solveMagCalibration(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    MagCorrection correction = mMagCorrection;
+    if ( !mMagCalibration.solve(&correction) )
+    {
+        args.GetReturnValue().SetNull();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMagCorrectionLock);
+        mMagCorrection = correction;
+    }
+
+    v8::Isolate* isolate = args.GetIsolate();
+    v8::Local<v8::Array> rev = v8::Array::New(isolate, 12);
+    for ( int i = 0; i < 3; i++ )
+    {
+        Nan::Set(rev, i, v8::Number::New(isolate, correction.offset[i]));
+    }
+    for ( int i = 0; i < 9; i++ )
+    {
+        Nan::Set(rev, i + 3, v8::Number::New(isolate, correction.matrix[i]));
+    }
+    args.GetReturnValue().Set(rev);
+}
+
+void
+RPIGY86::setMagCalibration(const float* calibration)
+{
+    std::lock_guard<std::mutex> lock(mMagCorrectionLock);
+    memcpy(mMagCorrection.offset, calibration, sizeof(mMagCorrection.offset));
+    memcpy(mMagCorrection.matrix, calibration + 3, sizeof(mMagCorrection.matrix));
+}
+
+/**
+ * no acquisition may run; the bus is only taken per step of the test, so
+ * async reads get through
+ */
+void
+RPIGY86::selfTestMag(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    float scale[3];
+    mCalibrating = true;
+    bool passed = MagCalibration::selfTest(hmc5883l, &mBusLock, scale);
+    mCalibrating = false;
+    if ( !passed )
+    {
+        args.GetReturnValue().SetNull();
+        return;
+    }
+    setMagScale(scale);
+
+    v8::Isolate* isolate = args.GetIsolate();
+    v8::Local<v8::Array> rev = v8::Array::New(isolate, 3);
+    for ( int i = 0; i < 3; i++ )
+    {
+        Nan::Set(rev, i, v8::Number::New(isolate, scale[i]));
+    }
+    args.GetReturnValue().Set(rev);
+}
+
+/**
+ * a new scale changes the units the offset and matrix were fitted in, so
+ * they are reset along with the samples collected for a fit
+ */
+void
+RPIGY86::setMagScale(const float* scale)
+{
+    std::lock_guard<std::mutex> lock(mMagCorrectionLock);
+    if ( memcmp(mMagCorrection.scale, scale, sizeof(mMagCorrection.scale)) == 0 )
+    {
+        return;
+    }
+    mMagCorrection.reset();
+    memcpy(mMagCorrection.scale, scale, sizeof(mMagCorrection.scale));
+    mMagCalibration.reset();
+}
+
+/**
+ * copy of the magnetometer correction for use off the JS thread, where a
+ * setter may change it at any time
+ */
+MagCorrection
+RPIGY86::magCorrection() const
+{
+    std::lock_guard<std::mutex> lock(mMagCorrectionLock);
+    return mMagCorrection;
+}
+
+/**
+ * the acquisition, created on first use; its ring lives as long as this
+ * object so that a shared ring stays valid
+ */
+Acquisition*
+RPIGY86::acquisition()
+{
+    if ( !mAcquisition )
+    {
+        mAcquisition = new Acquisition(&mBusLock, mpu6050, hmc5883l, ms5611);
+        mAcquisition->setListener(this);
+        mAcquisition->setClock(mReplay);
+    }
+    return mAcquisition;
+}
+
+/**
+ * start the acquisition or raise its rate, for a new stream or the shared ring
+ */
+void
+RPIGY86::startAcquisition(uint32_t rate, uint32_t sensors)
+{
+    if ( !acquisition()->isRunning() )
+    {
+        uv_ref(reinterpret_cast<uv_handle_t*>(mSamplesAsync));
+        // the filter state is from before the pause
+        mBiquads.reset();
+    }
+    mAcquisition->start(rate, sensors);
+    if ( mLowPowerPolicy.enabled )
+    {
+        // the new consumer needs full rate; releaseAcquisition() lets the
+        // policy back in once motion events are alone again
+        LowPowerPolicy off;
+        memset(&off, 0, sizeof(off));
+        mAcquisition->setLowPowerPolicy(off);
+    }
+}
+
+/**
+ * stop the acquisition once no stream, shared ring, attitude filter, EKF,
+ * recording or flight recorder needs it
+ */
+void
+RPIGY86::releaseAcquisition()
+{
+    if ( mStreams.empty() && !mRingNotify && !mAttitudeRunning && !mEKFRunning && !mRecorder && !mFlightRecorder && !mCapture && !mEventCallback && !mSpectrum && mAcquisition && mAcquisition->isRunning() )
+    {
+        mAcquisition->stop();
+        uv_unref(reinterpret_cast<uv_handle_t*>(mSamplesAsync));
+    }
+    else
+    {
+        applyLowPowerPolicy();
+    }
+}
+
+/**
+ * hand the low-power policy of .motionEvents() to the acquisition while
+ * nothing else reads it; gyro and full-rate consumers, and the ones that
+ * need evenly spaced samples, keep it suspended
+ */
+void
+RPIGY86::applyLowPowerPolicy()
+{
+    if ( !mAcquisition || !mAcquisition->isRunning() )
+    {
+        return;
+    }
+    LowPowerPolicy policy;
+    memset(&policy, 0, sizeof(policy));
+    if ( mLowPowerPolicy.enabled && mEventCallback && mStreams.empty() && !mRingNotify && !mAttitudeRunning
+            && !mEKFRunning && !mRecorder && !mFlightRecorder && !mCapture && !mSpectrum )
+    {
+        // the variance window came in ms
+        policy = mLowPowerPolicy;
+        policy.stillSamples = (uint32_t)((uint64_t)mLowPowerPolicy.stillSamples * mAcquisition->getRate() / 1000);
+        if ( mLowPowerPolicy.stillSamples && !policy.stillSamples )
+        {
+            policy.stillSamples = 1;
+        }
+    }
+    mAcquisition->setLowPowerPolicy(policy);
+}
+
+static void releaseRingMemory(void* data, size_t length, void* deleterData)
+{
+    delete static_cast<std::shared_ptr<void>*>(deleterData);
+}
+
+/**
+ * a SharedArrayBuffer over the acquisition ring; the ring memory stays
+ * alive while any thread holds the buffer
+ */
+void
+RPIGY86::ringBuffer(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    v8::Isolate* isolate = args.GetIsolate();
+#if V8_MAJOR_VERSION >= 8
+    SampleRing* ring = acquisition()->getRing();
+    std::unique_ptr<v8::BackingStore> store = v8::SharedArrayBuffer::NewBackingStore(
+            ring->getMemory(), SampleRing::bytesFor(ring->getCapacity()),
+            releaseRingMemory, new std::shared_ptr<void>(ring->share()));
+    args.GetReturnValue().Set(v8::SharedArrayBuffer::New(isolate, std::move(store)));
+#else
+    isolate->ThrowException(
+            v8::Exception::Error(Nan::New("a shared ring needs node 14 or newer").ToLocalChecked()));
+#endif
+}
+
+/**
+ * open a consumer on the acquisition ring, starting the acquisition or
+ * raising its rate as needed; a filtered stream runs it at inputRate
+ * @return id for the other _stream functions
+ */
+int32_t
+RPIGY86::streamOpen(uint32_t rate, uint32_t sensors, uint32_t batch, bool decimate, bool si,
+        uint32_t filter, uint32_t inputRate, v8::Local<v8::Function> notify)
+{
+    startAcquisition(filter ? inputRate : rate, sensors);
+    int32_t id = mNextStreamId++;
+    RPIGY86Stream* stream = new RPIGY86Stream(mAcquisition->getRing(), rate, sensors, batch, decimate, si, filter,
+            notify);
+    std::lock_guard<std::mutex> lock(mStreamLock);
+    mStreams[id] = stream;
+    return id;
+}
+
+/**
+ * append a typed array view to a stream batch
+ * @return backing store of the view
+ */
+template<typename T, typename A>
+static T* addField(v8::Local<v8::Object> batch, const char* name, v8::Local<v8::ArrayBuffer> buffer,
+        size_t* offset, uint32_t length)
+{
+    v8::Local<A> view = A::New(buffer, *offset, length);
+    Nan::Set(batch, Nan::New(name).ToLocalChecked(), view);
+    *offset += length * sizeof(T);
+    return *Nan::TypedArrayContents<T>(view);
+}
+
+/**
+ * return the next batch of a stream, or null (and notify later) if there
+ * is not a whole batch yet. A binary batch is a Buffer of raw Sample
+ * records, otherwise an object of typed arrays that share one ArrayBuffer.
+ */
+void
+RPIGY86::streamRead(const v8::FunctionCallbackInfo<v8::Value> &args, RPIGY86Stream* stream,
+        uint32_t max, bool binary)
+{
+    uint32_t count = 0;
+    if ( stream->ready() >= max )
+    {
+        if ( stream->mSamples.size() < max )
+        {
+            stream->mSamples.resize(max);
+        }
+        count = stream->read(stream->mSamples.data(), max);
+    }
+    if ( count == 0 )
+    {
+        stream->mWaiting = true;
+        args.GetReturnValue().SetNull();
+        return;
+    }
+    const Sample* samples = stream->mSamples.data();
+    if ( binary )
+    {
+        args.GetReturnValue().Set(
+                Nan::CopyBuffer(reinterpret_cast<const char*>(samples), count * sizeof(Sample)).ToLocalChecked());
+        return;
+    }
+
+    // 8 byte fields first, then 4 and 2 byte ones, so every view is aligned
+    uint32_t sensors = stream->mSensors;
+    bool si = stream->mSIUnits;
+    size_t motionSize = si ? sizeof(float) : sizeof(int16_t);
+    size_t bytes = count * sizeof(double);
+    bytes += (sensors & SENSOR_TEMP) ? count * sizeof(float) : 0;
+    bytes += (sensors & SENSOR_MAG) ? 3 * count * sizeof(float) : 0;
+    bytes += (sensors & SENSOR_BARO) ? count * sizeof(float) : 0;
+    bytes += (sensors & SENSOR_ACCEL) ? 3 * count * motionSize : 0;
+    bytes += (sensors & SENSOR_GYRO) ? 3 * count * motionSize : 0;
+
+    v8::Isolate* isolate = args.GetIsolate();
+    v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, bytes);
+    v8::Local<v8::Object> rev = Nan::New<v8::Object>();
+    size_t offset = 0;
+    Nan::Set(rev, Nan::New("count").ToLocalChecked(), v8::Uint32::New(isolate, count));
+    Nan::Set(rev, Nan::New("dropped").ToLocalChecked(),
+            v8::Number::New(isolate, (double)stream->mReader.getDropped()));
+    Nan::Set(rev, Nan::New("decimated").ToLocalChecked(),
+            v8::Number::New(isolate, (double)stream->mReader.getDecimated()));
+
+    double* timestamp = addField<double, v8::Float64Array>(rev, "timestamp", buffer, &offset, count);
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        timestamp[i] = samples[i].timestamp / 1e6;
+    }
+    if ( sensors & SENSOR_TEMP )
+    {
+        float* temperature = addField<float, v8::Float32Array>(rev, "temperature", buffer, &offset, count);
+        UnitScales::temperature(samples, count, temperature);
+    }
+    if ( sensors & SENSOR_MAG )
+    {
+        float* mag = addField<float, v8::Float32Array>(rev, "mag", buffer, &offset, 3 * count);
+        if ( si )
+        {
+            mUnits.mag(samples, count, mMagCorrection, mag);
+        }
+        else
+        {
+            for ( uint32_t i = 0; i < count; i++ )
+            {
+                mMagCorrection.apply(samples[i].mag[0], samples[i].mag[1], samples[i].mag[2], &mag[3 * i]);
+            }
+        }
+    }
+    if ( sensors & SENSOR_BARO )
+    {
+        float* pressure = addField<float, v8::Float32Array>(rev, "pressure", buffer, &offset, count);
+        float scale = si ? 0.01f : 1.0f;
+        // a conversion repeats for about ten samples, compensate it once
+        uint32_t d1 = 0, d2 = 0;
+        float value = NAN;
+        for ( uint32_t i = 0; i < count; i++ )
+        {
+            // NaN until both conversions were read once
+            if ( samples[i].baroTemperature && (samples[i].pressure != d1 || samples[i].baroTemperature != d2) )
+            {
+                d1 = samples[i].pressure;
+                d2 = samples[i].baroTemperature;
+                value = ms5611->calculatePressure(d1, d2, true) * scale;
+            }
+            pressure[i] = value;
+        }
+    }
+    if ( si )
+    {
+        if ( sensors & SENSOR_ACCEL )
+        {
+            float* accel = addField<float, v8::Float32Array>(rev, "accel", buffer, &offset, 3 * count);
+            mUnits.accel(samples, count, accel);
+        }
+        if ( sensors & SENSOR_GYRO )
+        {
+            float* gyro = addField<float, v8::Float32Array>(rev, "gyro", buffer, &offset, 3 * count);
+            mUnits.gyro(samples, count, gyro);
+        }
+        args.GetReturnValue().Set(rev);
+        return;
+    }
+    if ( sensors & SENSOR_ACCEL )
+    {
+        int16_t* accel = addField<int16_t, v8::Int16Array>(rev, "accel", buffer, &offset, 3 * count);
+        for ( uint32_t i = 0; i < count; i++ )
+        {
+            memcpy(&accel[3 * i], samples[i].accel, sizeof(samples[i].accel));
+        }
+    }
+    if ( sensors & SENSOR_GYRO )
+    {
+        int16_t* gyro = addField<int16_t, v8::Int16Array>(rev, "gyro", buffer, &offset, 3 * count);
+        for ( uint32_t i = 0; i < count; i++ )
+        {
+            memcpy(&gyro[3 * i], samples[i].gyro, sizeof(samples[i].gyro));
+        }
+    }
+    args.GetReturnValue().Set(rev);
+}
+
+/**
+ * the acquisition stops with the last stream
+ */
+void
+RPIGY86::streamClose(int32_t id)
+{
+    std::map<int32_t, RPIGY86Stream*>::iterator it = mStreams.find(id);
+    if ( it == mStreams.end() )
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mStreamLock);
+        delete it->second;
+        mStreams.erase(it);
+    }
+    releaseAcquisition();
+}
+
+/**
+ * call the notify function of every waiting stream that has a batch ready
+ */
+void
+RPIGY86::notifyStreams()
+{
+    Nan::HandleScope scope;
+    // notify may open or close streams
+    std::vector<int32_t> ready;
+    for ( std::map<int32_t, RPIGY86Stream*>::iterator it = mStreams.begin(); it != mStreams.end(); ++it )
+    {
+        if ( it->second->mWaiting && it->second->ready() >= it->second->mBatch )
+        {
+            ready.push_back(it->first);
+        }
+    }
+    for ( size_t i = 0; i < ready.size(); i++ )
+    {
+        std::map<int32_t, RPIGY86Stream*>::iterator it = mStreams.find(ready[i]);
+        if ( it != mStreams.end() )
+        {
+            it->second->mWaiting = false;
+            it->second->mNotify.Call(0, NULL, mStreamResource);
+        }
+    }
+    if ( mRingNotify )
+    {
+        mRingNotify->Call(0, NULL, mStreamResource);
+    }
+}
+
+/**
+ * start feeding the attitude filter, from level and north; a running
+ * filter keeps its state and only picks up the new options
+ */
+void
+RPIGY86::startAttitude(uint32_t rate, bool mag)
+{
+    {
+        std::lock_guard<std::mutex> lock(mAttitudeLock);
+        if ( !mAttitudeRunning )
+        {
+            mAHRS.reset();
+            mAttitudeTimestamp = 0;
+        }
+        mAttitudeRunning = true;
+        mAttitudeMag = mag;
+    }
+    startAcquisition(rate, SENSOR_ACCEL | SENSOR_GYRO | (mag ? SENSOR_MAG : 0));
+}
+
+/**
+ * quaternion w, x, y, z and roll, pitch, yaw in degrees; written into a
+ * Float32Array, or returned as an object
+ */
+void
+RPIGY86::getAttitude(const v8::FunctionCallbackInfo<v8::Value> &args)
+{
+    float frame[7];
+    uint64_t timestamp;
+    {
+        std::lock_guard<std::mutex> lock(mAttitudeLock);
+        mAHRS.getQuaternion(frame);
+        timestamp = mAttitudeTimestamp;
+    }
+    AHRS::eulerFromQuaternion(frame, &frame[4]);
+    if ( args.Length() > 0 )
+    {
+        writeFrame<float>(args, frame, 7);
+        return;
+    }
+    v8::Isolate* isolate = args.GetIsolate();
+    v8::Local<v8::Object> rev = Nan::New<v8::Object>();
+    v8::Local<v8::Array> quaternion = v8::Array::New(isolate, 4);
+    for ( int i = 0; i < 4; i++ )
+    {
+        Nan::Set(quaternion, i, v8::Number::New(isolate, frame[i]));
+    }
+    Nan::Set(rev, Nan::New("quaternion").ToLocalChecked(), quaternion);
+    Nan::Set(rev, Nan::New("roll").ToLocalChecked(), v8::Number::New(isolate, frame[4]));
+    Nan::Set(rev, Nan::New("pitch").ToLocalChecked(), v8::Number::New(isolate, frame[5]));
+    Nan::Set(rev, Nan::New("yaw").ToLocalChecked(), v8::Number::New(isolate, frame[6]));
+    Nan::Set(rev, Nan::New("timestamp").ToLocalChecked(), v8::Number::New(isolate, timestamp / 1e6));
+    args.GetReturnValue().Set(rev);
+}
+
+void
+RPIGY86::stopAttitude()
+{
+    {
+        std::lock_guard<std::mutex> lock(mAttitudeLock);
+        mAttitudeRunning = false;
+    }
+    releaseAcquisition();
+}
+
+/**
+ * acquisition thread: run the filter once per sample
+ */
+void
+RPIGY86::updateAttitude(const Sample* samples, uint32_t count, bool mag, const MagCorrection& correction)
+{
+    std::lock_guard<std::mutex> lock(mAttitudeLock);
+    if ( !mAttitudeRunning )
+    {
+        return;
+    }
+    mag = mag && mAttitudeMag;
+    float period = 1.0f / mAcquisition->getRate();
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        const Sample& sample = samples[i];
+        if ( sample.flags & SAMPLE_LOW_POWER )
+        {
+            // no gyro data; pick up again from the first full rate sample
+            mAttitudeTimestamp = 0;
+            continue;
+        }
+        float dt = mAttitudeTimestamp ? (sample.timestamp - mAttitudeTimestamp) * 1e-9f : period;
+        if ( dt > ATTITUDE_MAX_DT || (sample.flags & SAMPLE_GAP) )
+        {
+            dt = period;
+        }
+        mAttitudeTimestamp = sample.timestamp;
+        float gyro[3], accel[3], field[3];
+        for ( int axis = 0; axis < 3; axis++ )
+        {
+            gyro[axis] = sample.gyro[axis] * mAttitudeGyroScale;
+            accel[axis] = sample.accel[axis];
+        }
+        if ( mag )
+        {
+            correction.apply(sample.mag[0], sample.mag[1], sample.mag[2], field);
+        }
+        mAHRS.update(gyro, accel, mag ? field : NULL, dt);
+    }
+}
+
+/**
+ * start feeding the EKF; the first readings align it. A running filter
+ * keeps its state and only picks up the new options
+ */
+void
+RPIGY86::startEKF(uint32_t rate, bool mag, bool baro)
 {
-    this->Wrap(args.This());
-    initialize();
+    {
+        std::lock_guard<std::mutex> lock(mAttitudeLock);
+        if ( !mEKFRunning )
+        {
+            mEKF.reset();
+            mEKFTimestamp = 0;
+        }
+        mEKFRunning = true;
+        mEKFMag = mag;
+        mEKFBaro = baro;
+    }
+    startAcquisition(rate, SENSOR_ACCEL | SENSOR_GYRO | (mag ? SENSOR_MAG : 0) | (baro ? SENSOR_BARO : 0));
 }
 
-void RPIGY86::initialize()
+/**
+ * state and covariance as EKF_EXPORT_SIZE floats, written into a
+ * Float32Array or returned in a new one
+ */
+void
+RPIGY86::getEKF(const v8::FunctionCallbackInfo<v8::Value> &args)
 {
-    mpu6050 = new MPU6050();
-    hmc5883l = new HMC5883L();
-    ms5611 = new MS5611();
-    mpu6050->initialize();
-    mpu6050->setI2CBypassEnabled(true);
-    hmc5883l->initialize();
-    ms5611->begin();
+    float state[EKF_EXPORT_SIZE];
+    {
+        std::lock_guard<std::mutex> lock(mAttitudeLock);
+        mEKF.exportState(state);
+    }
+    if ( args.Length() > 0 )
+    {
+        writeFrame<float>(args, state, EKF_EXPORT_SIZE);
+        return;
+    }
+    v8::Local<v8::Float32Array> rev = v8::Float32Array::New(
+            v8::ArrayBuffer::New(args.GetIsolate(), sizeof(state)), 0, EKF_EXPORT_SIZE);
+    Nan::TypedArrayContents<float> out(rev);
+    memcpy(*out, state, sizeof(state));
+    args.GetReturnValue().Set(rev);
 }
 
-RPIGY86::~RPIGY86()
+void
+RPIGY86::stopEKF()
 {
-    delete mpu6050;
-    delete hmc5883l;
-    delete ms5611;
+    {
+        std::lock_guard<std::mutex> lock(mAttitudeLock);
+        mEKFRunning = false;
+    }
+    releaseAcquisition();
 }
 
-void RPIGY86::getMotion6(const FunctionCallbackInfo<v8::Value> &args)
+/**
+ * acquisition thread: propagate with every gyro sample and correct with
+ * the accelerometer, and with mag and baro whenever the sample carries a
+ * new reading of them
+ */
+void
+RPIGY86::updateEKF(const Sample* samples, uint32_t count, bool mag, bool baro,
+        const MagCorrection& correction)
 {
-    int16_t ax, ay, az;
-    int16_t gx, gy, gz;
-    v8::Isolate* isolate = args.GetIsolate();
-    mpu6050->getMotion6(&ax, &ay, &az, &gx, &gy, &gz);
-    v8::Local<v8::Array> rev = v8::Array::New(isolate, 6);
-    rev->Set(0, v8::Int32::New(isolate, ax));
-    rev->Set(1, v8::Int32::New(isolate, ay));
-    rev->Set(2, v8::Int32::New(isolate, az));
-    rev->Set(3, v8::Int32::New(isolate, gx));
-    rev->Set(4, v8::Int32::New(isolate, gy));
-    rev->Set(5, v8::Int32::New(isolate, gz));
-    args.GetReturnValue().Set(rev);
+    std::lock_guard<std::mutex> lock(mAttitudeLock);
+    if ( !mEKFRunning )
+    {
+        return;
+    }
+    mag = mag && mEKFMag;
+    baro = baro && mEKFBaro;
+    float period = 1.0f / mAcquisition->getRate();
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        const Sample& sample = samples[i];
+        if ( sample.flags & SAMPLE_LOW_POWER )
+        {
+            // no gyro data; pick up again from the first full rate sample
+            mEKFTimestamp = 0;
+            continue;
+        }
+        float dt = mEKFTimestamp ? (sample.timestamp - mEKFTimestamp) * 1e-9f : period;
+        if ( dt > ATTITUDE_MAX_DT || (sample.flags & SAMPLE_GAP) )
+        {
+            dt = period;
+        }
+        mEKFTimestamp = sample.timestamp;
+        float gyro[3], accel[3];
+        for ( int axis = 0; axis < 3; axis++ )
+        {
+            gyro[axis] = sample.gyro[axis] * mAttitudeGyroScale;
+            accel[axis] = sample.accel[axis] * mAttitudeAccelScale;
+        }
+        mEKF.updateGyro(gyro, dt);
+        mEKF.updateAccel(accel);
+        if ( mag && (sample.flags & SAMPLE_MAG) )
+        {
+            float field[3];
+            correction.apply(sample.mag[0], sample.mag[1], sample.mag[2], field);
+            mEKF.updateMag(field);
+        }
+        if ( baro && (sample.flags & SAMPLE_BARO) && sample.pressure && sample.baroTemperature )
+        {
+            int32_t pressure = ms5611->calculatePressure(sample.pressure, sample.baroTemperature, true);
+            mEKF.updateBaro(ms5611->getAltitude(pressure, mEKFSeaLevel));
+        }
+    }
 }
 
-void RPIGY86::getMotion9(const FunctionCallbackInfo<v8::Value> &args)
+/**
+ * settings and calibration a recording needs to be decoded later, with the
+ * acquisition running
+ */
+void
+RPIGY86::fillLogHeader(SampleLogHeader* header)
 {
-    int16_t ax, ay, az;
-    int16_t gx, gy, gz;
-    int16_t mx, my, mz;
+    memset(header, 0, sizeof(*header));
+    header->rate = mAcquisition->getRate();
+    header->sensors = mAcquisition->getSensors();
+    struct timespec monotonic, realtime;
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    header->startMonotonic = monotonic.tv_sec * 1000000000ULL + monotonic.tv_nsec;
+    header->startRealtime = realtime.tv_sec * 1000000000ULL + realtime.tv_nsec;
+    header->accelRange = mUnits.getAccelRange();
+    header->gyroRange = mUnits.getGyroRange();
+    header->magGain = mUnits.getMagGain();
+    header->accelScale = mUnits.getAccelScale();
+    header->gyroScale = mUnits.getGyroScale();
+    header->magScale = mUnits.getMagScale();
+    header->mpuAddress = mAddress;
+    {
+        std::lock_guard<std::mutex> lock(mBusLock);
+        header->accelOffset[0] = mpu6050->getXAccelOffset();
+        header->accelOffset[1] = mpu6050->getYAccelOffset();
+        header->accelOffset[2] = mpu6050->getZAccelOffset();
+        header->gyroOffset[0] = mpu6050->getXGyroOffset();
+        header->gyroOffset[1] = mpu6050->getYGyroOffset();
+        header->gyroOffset[2] = mpu6050->getZGyroOffset();
+    }
+    if ( ms5611 )
+    {
+        ms5611->getCoefficients(header->baroCoefficients);
+        header->baroOversampling = ms5611->getOversampling();
+    }
+    memcpy(header->magCorrectionScale, mMagCorrection.scale, sizeof(header->magCorrectionScale));
+    memcpy(header->magCorrectionOffset, mMagCorrection.offset, sizeof(header->magCorrectionOffset));
+    memcpy(header->magCorrectionMatrix, mMagCorrection.matrix, sizeof(header->magCorrectionMatrix));
+}
 
-    v8::Isolate* isolate = args.GetIsolate();
-    mpu6050->getMotion6(&ax, &ay, &az, &gx, &gy, &gz);
-    v8::Local<v8::Array> rev = v8::Array::New(isolate, 9);
-    rev->Set(0, v8::Int32::New(isolate, ax));
-    rev->Set(1, v8::Int32::New(isolate, ay));
-    rev->Set(2, v8::Int32::New(isolate, az));
-    rev->Set(3, v8::Int32::New(isolate, gx));
-    rev->Set(4, v8::Int32::New(isolate, gy));
-    rev->Set(5, v8::Int32::New(isolate, gz));
-
-    hmc5883l->getHeading(&mx, &my, &mz);
-    rev->Set(6, v8::Int32::New(isolate, mx - gMagXOffset));
-    rev->Set(7, v8::Int32::New(isolate, my - gMagYOffset));
-    rev->Set(8, v8::Int32::New(isolate, mz));
+/**
+ * start the acquisition and log every sample it produces from now on
+ * @return 0, or the errno of creating the first segment
+ */
+int
+RPIGY86::startRecording(const char* path, uint32_t rate, uint32_t sensors, uint32_t segmentSeconds,
+        bool compress)
+{
+    startAcquisition(rate, sensors);
 
-    args.GetReturnValue().Set(rev);
+    SampleLogHeader header;
+    fillLogHeader(&header);
+
+    SampleRecorder* recorder;
+    bool opened;
+    if ( compress )
+    {
+        PackedLog* log = new PackedLog();
+        opened = log->open(path, header, header.rate * segmentSeconds);
+        recorder = log;
+    }
+    else
+    {
+        SampleLog* log = new SampleLog();
+        opened = log->open(path, header, header.rate * segmentSeconds);
+        recorder = log;
+    }
+    if ( !opened )
+    {
+        int error = recorder->getError();
+        delete recorder;
+        releaseAcquisition();
+        return error;
+    }
+    std::lock_guard<std::mutex> lock(mRecordLock);
+    mRecorder = recorder;
+    return 0;
 }
 
+/**
+ * close the log; returns { records, segments }
+ */
 void
-RPIGY86::setGryoXOffset(int32_t offset)
+RPIGY86::stopRecording(const v8::FunctionCallbackInfo<v8::Value> &args)
 {
-    mpu6050->setXGyroOffset(offset);
+    SampleRecorder* recorder;
+    {
+        std::lock_guard<std::mutex> lock(mRecordLock);
+        recorder = mRecorder;
+        mRecorder = NULL;
+    }
+    if ( !recorder )
+    {
+        return;
+    }
+    recorder->close();
+    v8::Isolate* isolate = args.GetIsolate();
+    v8::Local<v8::Object> rev = Nan::New<v8::Object>();
+    Nan::Set(rev, Nan::New("records").ToLocalChecked(), v8::Number::New(isolate, recorder->getCount()));
+    Nan::Set(rev, Nan::New("segments").ToLocalChecked(), v8::Number::New(isolate, recorder->getSegments()));
+    args.GetReturnValue().Set(rev);
+    delete recorder;
+    releaseAcquisition();
 }
 
+/**
+ * progress of the replay: { records, position, finished, timestamp }, or
+ * null when not replaying
+ */
 void
-RPIGY86::setGryoYOffset(int32_t offset)
+RPIGY86::getReplay(const v8::FunctionCallbackInfo<v8::Value> &args)
 {
-    mpu6050->setYGyroOffset(offset);
+    v8::Isolate* isolate = args.GetIsolate();
+    if ( !mReplay )
+    {
+        args.GetReturnValue().SetNull();
+        return;
+    }
+    v8::Local<v8::Object> rev = Nan::New<v8::Object>();
+    Nan::Set(rev, Nan::New("records").ToLocalChecked(), v8::Number::New(isolate, mReplay->getCount()));
+    Nan::Set(rev, Nan::New("position").ToLocalChecked(), v8::Number::New(isolate, mReplay->getPosition()));
+    Nan::Set(rev, Nan::New("finished").ToLocalChecked(), v8::Boolean::New(isolate, mReplay->isFinished()));
+    Nan::Set(rev, Nan::New("timestamp").ToLocalChecked(), v8::Number::New(isolate, mReplay->now()));
+    args.GetReturnValue().Set(rev);
 }
 
-void
-RPIGY86::setGryoZOffset(int32_t offset)
+/**
+ * start the acquisition and keep its last seconds in a ring file
+ * @return 0, or the errno of creating the file
+ */
+int
+RPIGY86::startFlightRecorder(const char* path, uint32_t rate, uint32_t sensors, uint32_t seconds)
 {
-    mpu6050->setZGyroOffset(offset);
+    startAcquisition(rate, sensors);
+    SampleLogHeader header;
+    fillLogHeader(&header);
+    FlightRecorder* recorder = new FlightRecorder();
+    if ( !recorder->open(path, header, header.rate * seconds) )
+    {
+        int error = recorder->getError();
+        delete recorder;
+        releaseAcquisition();
+        return error;
+    }
+    std::lock_guard<std::mutex> lock(mRecordLock);
+    mFlightRecorder = recorder;
+    return 0;
 }
 
 void
-RPIGY86::setAccelXOffset(int32_t offset)
+RPIGY86::stopFlightRecorder()
 {
-    mpu6050->setXAccelOffset(offset);
+    FlightRecorder* recorder;
+    {
+        std::lock_guard<std::mutex> lock(mRecordLock);
+        recorder = mFlightRecorder;
+        mFlightRecorder = NULL;
+    }
+    if ( !recorder )
+    {
+        return;
+    }
+    delete recorder;
+    releaseAcquisition();
 }
 
+/**
+ * start the acquisition and capture events into path-1, path-2, ...
+ */
 void
-RPIGY86::setAccelYOffset(int32_t offset)
+RPIGY86::startCapture(const char* path, uint32_t rate, uint32_t sensors, const CaptureOptions& options,
+        v8::Local<v8::Function> callback)
 {
-    mpu6050->setYAccelOffset(offset);
+    startAcquisition(rate, sensors);
+    fillLogHeader(&mCaptureHeader);
+
+    // sample counts at the acquisition rate and thresholds in counts as of now
+    uint32_t actual = mAcquisition->getRate();
+    float scale = mUnits.getAccelScale();
+    CaptureSettings settings;
+    settings.preSamples = (uint32_t)(options.pre * actual + 0.5);
+    settings.postSamples = (uint32_t)(options.post * actual + 0.5);
+    settings.triggers = CAPTURE_MANUAL;
+    settings.shockThreshold = 0;
+    settings.freefallThreshold = 0;
+    settings.freefallSamples = (uint32_t)(options.freefallTime * actual / 1000 + 0.5);
+    if ( options.shock > 0 )
+    {
+        settings.triggers |= CAPTURE_SHOCK;
+        settings.shockThreshold = (uint32_t)(options.shock / scale);
+    }
+    if ( options.freefall > 0 )
+    {
+        settings.triggers |= CAPTURE_FREEFALL;
+        settings.freefallThreshold = (uint32_t)(options.freefall / scale);
+    }
+    if ( options.detector.motionThreshold )
+    {
+        settings.triggers |= CAPTURE_HW_MOTION;
+    }
+    if ( options.detector.freefallThreshold )
+    {
+        settings.triggers |= CAPTURE_HW_FREEFALL;
+    }
+    mCaptureDetector = options.detector;
+    applyDetection();
+    mCapturePath = path;
+    mCaptureCompress = options.compress;
+    mCaptureCallback = new Nan::Callback(callback);
+    std::lock_guard<std::mutex> lock(mRecordLock);
+    mCapture = new TriggeredCapture(settings);
 }
 
+/**
+ * stop capturing; events already complete are still written and reported,
+ * one still collecting its post-trigger samples is dropped. Returns
+ * { events, missed }.
+ */
 void
-RPIGY86::setAccelZOffset(int32_t offset)
+RPIGY86::stopCapture(const v8::FunctionCallbackInfo<v8::Value> &args)
 {
-    mpu6050->setZAccelOffset(offset);
+    TriggeredCapture* capture;
+    {
+        std::lock_guard<std::mutex> lock(mRecordLock);
+        capture = mCapture;
+        mCapture = NULL;
+    }
+    if ( !capture )
+    {
+        return;
+    }
+    Nan::Callback* callback = mCaptureCallback;
+    mCaptureCallback = NULL;
+    memset(&mCaptureDetector, 0, sizeof(mCaptureDetector));
+    applyDetection();
+    RPIGY86CaptureWorker* worker = takeCaptures(capture, callback);
+    if ( worker )
+    {
+        writeCaptures(worker);
+    }
+    v8::Isolate* isolate = args.GetIsolate();
+    v8::Local<v8::Object> rev = Nan::New<v8::Object>();
+    Nan::Set(rev, Nan::New("events").ToLocalChecked(), v8::Number::New(isolate, capture->getEvents()));
+    Nan::Set(rev, Nan::New("missed").ToLocalChecked(), v8::Number::New(isolate, capture->getMissed()));
+    args.GetReturnValue().Set(rev);
+    delete capture;
+    delete callback;
+    releaseAcquisition();
 }
 
+/**
+ * writes capture events on the libuv threadpool, each as a recording of
+ * its own, and reports them back on the event loop with (err, { path,
+ * reason, timestamp, trigger, samples }) in the order they completed
+ */
+class RPIGY86CaptureWorker : public Nan::AsyncWorker {
+
+public:
+    RPIGY86CaptureWorker(RPIGY86* gy86, Nan::Callback* callback)
+        : Nan::AsyncWorker(callback), mGY86(gy86), mPath(gy86->mCapturePath),
+          mCompress(gy86->mCaptureCompress), mHeader(gy86->mCaptureHeader)
+    {
+        // keep the JS object alive until every event is reported
+        SaveToPersistent("gy86", gy86->handle());
+    }
+
+    /**
+     * move the next completed event of capture in
+     * @return false if there was none
+     */
+    bool take(TriggeredCapture* capture)
+    {
+        mEvents.push_back(CaptureEvent());
+        if ( !capture->take(&mEvents.back()) )
+        {
+            mEvents.pop_back();
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() const
+    {
+        return mEvents.size();
+    }
+
+    void Execute()
+    {
+        mFiles.resize(mEvents.size());
+        mErrors.resize(mEvents.size());
+        for ( size_t i = 0; i < mEvents.size(); i++ )
+        {
+            mErrors[i] = RPIGY86::persistCapture(mEvents[i], mPath, mCompress, mHeader, &mFiles[i]);
+            mSamples.push_back(mEvents[i].samples.size());
+            // written, no need to hold on to them until the callback
+            std::vector<Sample>().swap(mEvents[i].samples);
+        }
+    }
+
+    void HandleOKCallback()
+    {
+        static const char* const reasons[] = { "shock", "freefall", "freefallInterrupt", "motionInterrupt", "manual" };
+        Nan::HandleScope scope;
+        v8::Isolate* isolate = v8::Isolate::GetCurrent();
+        for ( size_t i = 0; i < mEvents.size(); i++ )
+        {
+            const CaptureEvent& event = mEvents[i];
+            v8::Local<v8::Value> argv[2];
+            if ( mErrors[i] )
+            {
+                std::string message = mFiles[i] + ": " + strerror(mErrors[i]);
+                argv[0] = v8::Exception::Error(Nan::New(message.c_str()).ToLocalChecked());
+                argv[1] = Nan::Undefined();
+            }
+            else
+            {
+                v8::Local<v8::Array> reason = v8::Array::New(isolate);
+                for ( uint32_t bit = 0, n = 0; bit < sizeof(reasons) / sizeof(reasons[0]); bit++ )
+                {
+                    if ( event.reason & (1 << bit) )
+                    {
+                        Nan::Set(reason, n++, Nan::New(reasons[bit]).ToLocalChecked());
+                    }
+                }
+                v8::Local<v8::Object> info = Nan::New<v8::Object>();
+                Nan::Set(info, Nan::New("path").ToLocalChecked(), Nan::New(mFiles[i].c_str()).ToLocalChecked());
+                Nan::Set(info, Nan::New("reason").ToLocalChecked(), reason);
+                Nan::Set(info, Nan::New("timestamp").ToLocalChecked(), v8::Number::New(isolate, event.timestamp / 1e6));
+                Nan::Set(info, Nan::New("trigger").ToLocalChecked(), v8::Number::New(isolate, event.trigger));
+                Nan::Set(info, Nan::New("samples").ToLocalChecked(), v8::Number::New(isolate, mSamples[i]));
+                argv[0] = Nan::Null();
+                argv[1] = info;
+            }
+            callback->Call(2, argv, async_resource);
+        }
+        mGY86->onCapturesWritten();
+    }
+
+private:
+    RPIGY86* mGY86;
+    std::string mPath;
+    bool mCompress;
+    SampleLogHeader mHeader;
+    std::vector<CaptureEvent> mEvents;
+    std::vector<std::string> mFiles;
+    std::vector<int> mErrors;
+    std::vector<size_t> mSamples;
+};
+
+/**
+ * event loop: hand the capture events completed since the last wakeup to
+ * a worker; while one is writing they wait in the capture
+ */
 void
-RPIGY86::setGryoRangeScale(int32_t scale)
+RPIGY86::notifyCapture()
 {
-    mpu6050->setFullScaleGyroRange(scale);
+    if ( !mCapture || !mCaptureWriters.empty() )
+    {
+        return;
+    }
+    RPIGY86CaptureWorker* worker = takeCaptures(mCapture, mCaptureCallback);
+    if ( worker )
+    {
+        writeCaptures(worker);
+    }
 }
 
-void
-RPIGY86::getGryoRangeScale(const v8::FunctionCallbackInfo<v8::Value> &args)
+/**
+ * a worker for the events capture has completed, reporting to callback
+ * @return NULL if there are none
+ */
+RPIGY86CaptureWorker*
+RPIGY86::takeCaptures(TriggeredCapture* capture, Nan::Callback* callback)
 {
-    uint8_t scale = mpu6050->getFullScaleGyroRange();
-    args.GetReturnValue().Set(v8::Uint32::New(args.GetIsolate(), scale));
+    Nan::HandleScope scope;
+    RPIGY86CaptureWorker* worker = new RPIGY86CaptureWorker(this, new Nan::Callback(callback->GetFunction()));
+    while ( worker->take(capture) )
+    {
+    }
+    if ( worker->size() == 0 )
+    {
+        delete worker;
+        return NULL;
+    }
+    return worker;
 }
 
+/**
+ * queue a worker behind the ones still writing
+ */
 void
-RPIGY86::setAccelRangeScale(int32_t scale)
+RPIGY86::writeCaptures(RPIGY86CaptureWorker* worker)
 {
-    mpu6050->setFullScaleAccelRange(scale);
+    mCaptureWriters.push_back(worker);
+    if ( mCaptureWriters.size() == 1 )
+    {
+        Nan::AsyncQueueWorker(worker);
+    }
 }
 
+/**
+ * event loop: the front worker has reported its events, the next one may
+ * write; libuv deletes the worker
+ */
 void
-RPIGY86::getAccelRangeScale(const v8::FunctionCallbackInfo<v8::Value> &args)
+RPIGY86::onCapturesWritten()
 {
-    uint8_t scale = mpu6050->getFullScaleAccelRange();
-    args.GetReturnValue().Set(v8::Uint32::New(args.GetIsolate(), scale));
+    mCaptureWriters.pop_front();
+    if ( !mCaptureWriters.empty() )
+    {
+        Nan::AsyncQueueWorker(mCaptureWriters.front());
+        return;
+    }
+    // events that completed while the worker was writing
+    notifyCapture();
 }
 
-void
-RPIGY86::setMagXOffset(int32_t offset)
+/**
+ * write one event as a recording of its own, path-<sequence>; any thread
+ * @return 0, or the errno of creating the file
+ */
+/*static*/
+int
+RPIGY86::persistCapture(const CaptureEvent& event, const std::string& path, bool compress,
+        const SampleLogHeader& header, std::string* file)
 {
-    gMagXOffset = offset;
+    char suffix[24];
+    snprintf(suffix, sizeof(suffix), "-%llu", (unsigned long long)event.sequence);
+    *file = path + suffix;
+    // one spare record, so that the event does not start a second segment
+    uint32_t records = (uint32_t)event.samples.size() + 1;
+    SampleRecorder* recorder;
+    bool opened;
+    if ( compress )
+    {
+        PackedLog* log = new PackedLog();
+        opened = log->open(file->c_str(), header, records);
+        recorder = log;
+    }
+    else
+    {
+        SampleLog* log = new SampleLog();
+        opened = log->open(file->c_str(), header, records);
+        recorder = log;
+    }
+    if ( opened )
+    {
+        recorder->write(event.samples.data(), (uint32_t)event.samples.size());
+        recorder->close();
+    }
+    int error = recorder->getError();
+    delete recorder;
+    return error;
 }
 
+/**
+ * program the detectors with the more sensitive setting of each that
+ * .motionEvents() and the capture ask for
+ */
 void
-RPIGY86::setMagYOffset(int32_t offset)
+RPIGY86::applyDetection()
 {
-    gMagYOffset = offset;
+    const MotionDetection& a = mEventDetector;
+    const MotionDetection& b = mCaptureDetector;
+    MotionDetection merged;
+    // free fall and zero motion fire below their threshold, motion above it
+    merged.freefallThreshold = a.freefallThreshold > b.freefallThreshold ? a.freefallThreshold : b.freefallThreshold;
+    merged.motionThreshold = !a.motionThreshold ? b.motionThreshold : !b.motionThreshold ? a.motionThreshold
+            : a.motionThreshold < b.motionThreshold ? a.motionThreshold : b.motionThreshold;
+    merged.zeroMotionThreshold = a.zeroMotionThreshold > b.zeroMotionThreshold
+            ? a.zeroMotionThreshold : b.zeroMotionThreshold;
+    merged.freefallDuration = !a.freefallThreshold ? b.freefallDuration : !b.freefallThreshold ? a.freefallDuration
+            : a.freefallDuration < b.freefallDuration ? a.freefallDuration : b.freefallDuration;
+    merged.motionDuration = !a.motionThreshold ? b.motionDuration : !b.motionThreshold ? a.motionDuration
+            : a.motionDuration < b.motionDuration ? a.motionDuration : b.motionDuration;
+    merged.zeroMotionDuration = !a.zeroMotionThreshold ? b.zeroMotionDuration
+            : !b.zeroMotionThreshold ? a.zeroMotionDuration
+            : a.zeroMotionDuration < b.zeroMotionDuration ? a.zeroMotionDuration : b.zeroMotionDuration;
+    acquisition()->setMotionDetection(merged);
 }
 
+/**
+ * start the acquisition, at a low rate unless something else needs more,
+ * with the detectors programmed
+ */
 void
-RPIGY86::setMagZOffset(int32_t offset)
+RPIGY86::startMotionEvents(uint32_t rate, const MotionDetection& detection, const LowPowerPolicy& policy,
+        v8::Local<v8::Function> callback)
 {
-    gMagZOffset = offset;
+    mEventDetector = detection;
+    applyDetection();
+    {
+        std::lock_guard<std::mutex> lock(mEventLock);
+        mEventQueue.clear();
+        mEventCallback = new Nan::Callback(callback);
+    }
+    startAcquisition(rate, SENSOR_ACCEL);
+    mLowPowerPolicy = policy;
+    applyLowPowerPolicy();
 }
 
 void
-RPIGY86::setMagGain(int32_t gain)
+RPIGY86::stopMotionEvents()
 {
-    hmc5883l->setGain(gain);
+    if ( !mEventCallback )
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mEventLock);
+        delete mEventCallback;
+        mEventCallback = NULL;
+        mEventQueue.clear();
+    }
+    memset(&mLowPowerPolicy, 0, sizeof(mLowPowerPolicy));
+    acquisition()->setLowPowerPolicy(mLowPowerPolicy);
+    memset(&mEventDetector, 0, sizeof(mEventDetector));
+    applyDetection();
+    releaseAcquisition();
 }
 
+/**
+ * acquisition thread: remember the samples that carry detector events
+ * while .motionEvents() is open
+ */
 void
-RPIGY86::getMagGain(const v8::FunctionCallbackInfo<v8::Value> &args)
+RPIGY86::queueMotionEvents(const Sample* samples, uint32_t count)
 {
-    uint8_t gain = hmc5883l->getGain();
-    args.GetReturnValue().Set(v8::Uint32::New(args.GetIsolate(), gain));
+    std::lock_guard<std::mutex> lock(mEventLock);
+    if ( !mEventCallback )
+    {
+        return;
+    }
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        if ( (samples[i].flags & (SAMPLE_FREEFALL | SAMPLE_MOTION | SAMPLE_ZERO_MOTION))
+                && mEventQueue.size() < MOTION_EVENTS_MAX_PENDING )
+        {
+            mEventQueue.push_back(std::make_pair(samples[i].timestamp, samples[i].flags));
+        }
+    }
 }
 
-void RPIGY86::measure(int* m_ax, int* m_ay, int* m_az, int* m_gx, int* m_gy,
-        int* m_gz)
+/**
+ * acquisition thread: queue a transition of the low-power policy
+ */
+void
+RPIGY86::onPowerMode(uint64_t timestamp, bool lowPower)
 {
-    int i = 0, buff_ax = 0, buff_ay = 0, buff_az = 0, buff_gx = 0, buff_gy = 0,
-            buff_gz = 0;
-    int16_t ax=0, ay=0, az=0, gx=0, gy=0,gz=0;
-    static int buffersize = 1000;
-
-    while (i < (buffersize + 101)) {
-        // read raw accel/gyro measurements from device
-        mpu6050->getMotion6(&ax, &ay, &az, &gx, &gy, &gz);
+    std::lock_guard<std::mutex> lock(mEventLock);
+    if ( mEventCallback && mEventQueue.size() < MOTION_EVENTS_MAX_PENDING )
+    {
+        mEventQueue.push_back(std::make_pair(timestamp,
+                (uint32_t)(MOTION_EVENT_POWER | (lowPower ? SAMPLE_LOW_POWER : 0))));
+    }
+}
 
-        if (i > 100 && i <= (buffersize + 100)) { //First 100 measures are discarded
-            buff_ax += ax;
-            buff_ay += ay;
-            buff_az += az;
-            buff_gx += gx;
-            buff_gy += gy;
-            buff_gz += gz;
+/**
+ * event loop: call back with (timestamp in ms, Sample.flags) for every
+ * queued event, or MOTION_EVENT_POWER for a power mode transition;
+ * index.js turns them into typed events
+ */
+void
+RPIGY86::notifyMotionEvents()
+{
+    std::vector<std::pair<uint64_t, uint32_t> > events;
+    {
+        std::lock_guard<std::mutex> lock(mEventLock);
+        if ( !mEventCallback || mEventQueue.empty() )
+        {
+            return;
         }
-        i++;
-        usleep(2); //Needed so we don't get repeated measures
+        events.swap(mEventQueue);
+    }
+    Nan::HandleScope scope;
+    v8::Isolate* isolate = v8::Isolate::GetCurrent();
+    // the callback may close the events and delete mEventCallback
+    Nan::Callback callback(mEventCallback->GetFunction());
+    for ( size_t i = 0; i < events.size() && mEventCallback; i++ )
+    {
+        v8::Local<v8::Value> argv[2] = {
+            v8::Number::New(isolate, events[i].first / 1e6),
+            v8::Number::New(isolate, events[i].second)
+        };
+        callback.Call(2, argv, mStreamResource);
     }
+}
 
-    *m_ax = buff_ax / buffersize;
-    *m_ay = buff_ay / buffersize;
-    *m_az = buff_az / buffersize;
-    *m_gx = buff_gx / buffersize;
-    *m_gy = buff_gy / buffersize;
-    *m_gz = buff_gz / buffersize;
-    printf("mean:%d, %d, %d, %d, %d, %d\n", *m_ax, *m_ay, *m_az, *m_gx,
-            *m_gy, *m_gz);
+void
+RPIGY86::startSpectrum(uint32_t rate, const SpectrumSettings& settings, v8::Local<v8::Function> callback)
+{
+    mSpectrumCallback = new Nan::Callback(callback);
+    {
+        std::lock_guard<std::mutex> lock(mSpectrumLock);
+        mSpectrum = new SpectrumAnalyzer(settings);
+    }
+    startAcquisition(rate, SENSOR_ACCEL | SENSOR_GYRO);
 }
 
+/**
+ * stop the analysis; results not reported yet are dropped
+ */
 void
-RPIGY86::calibrateMPU6050(const v8::FunctionCallbackInfo<v8::Value> &args)
+RPIGY86::stopSpectrum()
 {
-    static int acel_deadzone=8;
-    static int giro_deadzone=1;
-    int ax_offset=0, ay_offset=0, az_offset=0,
-         gx_offset=0, gy_offset=0, gz_offset=0;
-    int mean_ax=0, mean_ay=0, mean_az=0, mean_gx=0, mean_gy=0, mean_gz=0;
-    mpu6050->setXAccelOffset(ax_offset);
-    mpu6050->setYAccelOffset(ay_offset);
-    mpu6050->setZAccelOffset(az_offset);
-    mpu6050->setXGyroOffset(gx_offset);
-    mpu6050->setYGyroOffset(gy_offset);
-    mpu6050->setZGyroOffset(gz_offset);
-    usleep(1000);
-
-    measure(&mean_ax, &mean_ay, &mean_az, &mean_gx, &mean_gy, &mean_gz);
-    usleep(1000);
-    ax_offset=-mean_ax/8;
-    ay_offset=-mean_ay/8;
-    az_offset=(16384-mean_az)/8;
-    gx_offset=-mean_gx/4;
-    gy_offset=-mean_gy/4;
-    gz_offset=-mean_gz/4;
-
-    while (1){
-        int ready=0;
-        mpu6050->setXAccelOffset(ax_offset);
-        mpu6050->setYAccelOffset(ay_offset);
-        mpu6050->setZAccelOffset(az_offset);
-        mpu6050->setXGyroOffset(gx_offset);
-        mpu6050->setYGyroOffset(gy_offset);
-        mpu6050->setZGyroOffset(gz_offset);
-
-        measure(&mean_ax, &mean_ay, &mean_az, &mean_gx, &mean_gy, &mean_gz);
-
-        if (std::abs(mean_ax)<=acel_deadzone) ready++;
-        else ax_offset=ax_offset-mean_ax/acel_deadzone;
-
-        if (std::abs(mean_ay)<=acel_deadzone) ready++;
-        else ay_offset=ay_offset-mean_ay/acel_deadzone;
-
-        if (std::abs(16384-mean_az)<=acel_deadzone) ready++;
-        else az_offset=az_offset+(16384-mean_az)/acel_deadzone;
-
-        if (std::abs(mean_gx)<=giro_deadzone) ready++;
-        else gx_offset=gx_offset-mean_gx/(giro_deadzone+1);
-
-        if (std::abs(mean_gy)<=giro_deadzone) ready++;
-        else gy_offset=gy_offset-mean_gy/(giro_deadzone+1);
-
-        if (std::abs(mean_gz)<=giro_deadzone) ready++;
-        else gz_offset=gz_offset-mean_gz/(giro_deadzone+1);
-
-        if (ready==6) break;
-        printf("ready:%d, %d, %d, %d, %d, %d, %d\n", ready, ax_offset, ay_offset,
-           az_offset, gx_offset, gy_offset, gz_offset);
+    SpectrumAnalyzer* spectrum;
+    {
+        std::lock_guard<std::mutex> lock(mSpectrumLock);
+        spectrum = mSpectrum;
+        mSpectrum = NULL;
     }
-    v8::Isolate* isolate = args.GetIsolate();
-    v8::Local<v8::Array> rev = v8::Array::New(isolate, 6);
-    rev->Set(0, v8::Int32::New(isolate, ax_offset));
-    rev->Set(1, v8::Int32::New(isolate, ay_offset));
-    rev->Set(2, v8::Int32::New(isolate, az_offset));
-    rev->Set(3, v8::Int32::New(isolate, gx_offset));
-    rev->Set(4, v8::Int32::New(isolate, gy_offset));
-    rev->Set(5, v8::Int32::New(isolate, gz_offset));
-    args.GetReturnValue().Set(rev);
+    if ( !spectrum )
+    {
+        return;
+    }
+    delete spectrum;
+    delete mSpectrumCallback;
+    mSpectrumCallback = NULL;
+    releaseAcquisition();
 }
 
+/**
+ * acquisition thread: decimate the raw samples for the filtered streams
+ */
 void
-RPIGY86::getHeadingXYZ(const v8::FunctionCallbackInfo<v8::Value> &args)
+RPIGY86::decimateStreams(const Sample* samples, uint32_t count)
 {
-    int16_t mx, my, mz;
+    std::lock_guard<std::mutex> lock(mStreamLock);
+    for ( std::map<int32_t, RPIGY86Stream*>::iterator it = mStreams.begin(); it != mStreams.end(); ++it )
+    {
+        if ( it->second->mFilter )
+        {
+            it->second->decimate(samples, count, mAcquisition->getRate());
+        }
+    }
+}
 
-    v8::Isolate* isolate = args.GetIsolate();
-    v8::Local<v8::Array> rev = v8::Array::New(isolate, 3);
-    hmc5883l->getHeading(&mx, &my, &mz);
-    rev->Set(0, v8::Int32::New(isolate, mx - gMagXOffset));
-    rev->Set(1, v8::Int32::New(isolate, my - gMagYOffset));
-    rev->Set(2, v8::Int32::New(isolate, mz));
+/**
+ * acquisition thread: feed the spectrum analyzer with the raw samples
+ */
+void
+RPIGY86::analyzeSamples(const Sample* samples, uint32_t count)
+{
+    std::lock_guard<std::mutex> lock(mSpectrumLock);
+    if ( mSpectrum )
+    {
+        mSpectrum->write(samples, count, mAcquisition->getRate());
+    }
+}
 
-    args.GetReturnValue().Set(rev);
+/**
+ * Float32Array of SpectrumResult rows, the three accel rows times
+ * accelScale and the three gyro rows times gyroScale; from first on, every
+ * step-th value is scaled, so that peak frequencies stay in Hz
+ */
+static v8::Local<v8::Float32Array> spectrumArray(v8::Isolate* isolate, const std::vector<float>& values,
+        float accelScale, float gyroScale, size_t first, size_t step)
+{
+    v8::Local<v8::Float32Array> array = v8::Float32Array::New(
+            v8::ArrayBuffer::New(isolate, values.size() * sizeof(float)), 0, values.size());
+    Nan::TypedArrayContents<float> out(array);
+    memcpy(*out, values.data(), values.size() * sizeof(float));
+    size_t accel = values.size() / 2;
+    for ( size_t i = first; i < values.size(); i += step )
+    {
+        (*out)[i] *= i < accel ? accelScale : gyroScale;
+    }
+    return array;
 }
 
+/**
+ * event loop: call back with { timestamp, rate, frames, resolution,
+ * amplitude, peaks, bands } for every result since the last wakeup. The
+ * arrays hold one row per axis, accel x, y, z in g and then gyro x, y, z
+ * in deg/s: the amplitude of every bin, (frequency, amplitude) of the
+ * peaks and the RMS of the bands; index.js splits them per axis.
+ */
 void
-RPIGY86::getHeading(const v8::FunctionCallbackInfo<v8::Value> &args)
+RPIGY86::notifySpectrum()
 {
-    int16_t mx, my, mz;
-    //todo: get this value from somewhere
-    static float declination = -4.28;
-    uint8_t gain = hmc5883l->getGain();
-    float scale = gMagGainTable[gain];
-    hmc5883l->getHeading(&mx, &my, &mz);
-
-    float myf = (my - gMagYOffset) * scale;
-    float mxf = (mx - gMagXOffset) * scale;
-    float heading = atan2(myf, mxf);
-    if(heading < 0)
-      heading += 2 * M_PI;
-    heading = heading * 180/M_PI + declination;
-    if ( heading < 0 ) {
-        heading += 360;
+    if ( !mSpectrum )
+    {
+        return;
+    }
+    Nan::HandleScope scope;
+    v8::Isolate* isolate = v8::Isolate::GetCurrent();
+    // the callback may close the spectrum and delete mSpectrumCallback
+    Nan::Callback callback(mSpectrumCallback->GetFunction());
+    float accelScale = mUnits.getAccelScale();
+    float gyroScale = mUnits.getGyroScale();
+    SpectrumResult result;
+    while ( mSpectrum && mSpectrum->take(&result) )
+    {
+        v8::Local<v8::Object> info = Nan::New<v8::Object>();
+        Nan::Set(info, Nan::New("timestamp").ToLocalChecked(), v8::Number::New(isolate, result.timestamp / 1e6));
+        Nan::Set(info, Nan::New("rate").ToLocalChecked(), v8::Number::New(isolate, result.rate));
+        Nan::Set(info, Nan::New("frames").ToLocalChecked(), v8::Number::New(isolate, result.frames));
+        Nan::Set(info, Nan::New("resolution").ToLocalChecked(),
+                v8::Number::New(isolate, (double)result.rate / ((result.bins - 1) * 2)));
+        Nan::Set(info, Nan::New("amplitude").ToLocalChecked(),
+                spectrumArray(isolate, result.amplitude, accelScale, gyroScale, 0, 1));
+        Nan::Set(info, Nan::New("peaks").ToLocalChecked(),
+                spectrumArray(isolate, result.peaks, accelScale, gyroScale, 1, 2));
+        Nan::Set(info, Nan::New("bands").ToLocalChecked(),
+                spectrumArray(isolate, result.bands, accelScale, gyroScale, 0, 1));
+        v8::Local<v8::Value> argv[1] = { info };
+        callback.Call(1, argv, mStreamResource);
+    }
+}
+
+/**
+ * acquisition thread: append to the log while recording, to the flight
+ * recorder ring and to the triggered capture
+ */
+void
+RPIGY86::recordSamples(const Sample* samples, uint32_t count)
+{
+    std::lock_guard<std::mutex> lock(mRecordLock);
+    if ( mRecorder )
+    {
+        mRecorder->write(samples, count);
+    }
+    if ( mFlightRecorder )
+    {
+        mFlightRecorder->write(samples, count);
     }
+    if ( mCapture )
+    {
+        mCapture->write(samples, count);
+    }
+}
 
-    args.GetReturnValue().Set(v8::Number::New(args.GetIsolate(), heading));
+/**
+ * acquisition thread: run the vibration filters, keep readLatest() current,
+ * update the attitude and the EKF with the filtered samples, record,
+ * queue detector events and decimate filtered streams with the raw ones,
+ * and wake up the event loop
+ */
+void
+RPIGY86::onSamples(const Sample* samples, uint32_t count)
+{
+    const Sample* fused = samples;
+    if ( mBiquads.isActive() )
+    {
+        mFiltered.assign(samples, samples + count);
+        mBiquads.filter(mFiltered.data(), count, mAcquisition->getRate());
+        fused = mFiltered.data();
+    }
+    const Sample& last = fused[count - 1];
+    int16_t motion[6] = { last.accel[0], last.accel[1], last.accel[2],
+                          last.gyro[0], last.gyro[1], last.gyro[2] };
+    bool mag = (mAcquisition->getSensors() & SENSOR_MAG) != 0;
+    MagCorrection correction = magCorrection();
+    if ( mag )
+    {
+        float field[3];
+        correction.apply(last.mag[0], last.mag[1], last.mag[2], field);
+        storeLatest(motion, field);
+    }
+    else
+    {
+        storeLatest(motion, NULL);
+    }
+    updateAttitude(fused, count, mag, correction);
+    updateEKF(fused, count, mag, (mAcquisition->getSensors() & SENSOR_BARO) != 0, correction);
+    recordSamples(samples, count);
+    queueMotionEvents(samples, count);
+    analyzeSamples(samples, count);
+    decimateStreams(samples, count);
+    uv_async_send(mSamplesAsync);
 }
 
 NAN_MODULE_INIT(initialize) {
@@ -2,12 +2,62 @@
 #define RPIGY86_H_
 
 #include <nan.h>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "AHRS.h"
+#include "Acquisition.h"
+#include "BiquadBank.h"
+#include "EKF.h"
+#include "FlightRecorder.h"
+#include "PackedLog.h"
+#include "ReplayTransport.h"
+#include "SampleLog.h"
+#include "Spectrum.h"
+#include "TriggeredCapture.h"
+#include "MagCalibration.h"
+#include "MagneticModel.h"
+#include "Units.h"
+
+/**
+ * V8 fast API calls for the hot getters. The header is not shipped with
+ * every node release, and the options.fallback protocol used here exists
+ * from V8 10 until it was replaced in V8 12; elsewhere only the regular
+ * callbacks are registered.
+ */
+#if defined(__has_include)
+#if __has_include(<v8-fast-api-calls.h>)
+#include <v8-fast-api-calls.h>
+#if V8_MAJOR_VERSION >= 10 && V8_MAJOR_VERSION < 12
+#define RPIGY86_FAST_API 1
+#endif
+#endif
+#endif
+
+/**
+ * .startCapture() options, in the units of the JavaScript API
+ */
+struct CaptureOptions {
+    double pre;              // s before the trigger
+    double post;             // s after it
+    double shock;            // g, 0 for no shock trigger
+    double freefall;         // g, 0 for no free-fall trigger
+    double freefallTime;     // ms below freefall
+    MotionDetection detector; // MPU6050 interrupts, register units
+    bool compress;
+};
 
 class MPU6050;
 class HMC5883L;
 class MS5611;
+class RPIGY86Worker;
+class RPIGY86Stream;
+class RPIGY86CaptureWorker;
 
-class RPIGY86 : public Nan::ObjectWrap {
+class RPIGY86 : public Nan::ObjectWrap, public AcquisitionListener {
 
 public:
     RPIGY86(const v8::FunctionCallbackInfo<v8::Value> &args);
@@ -15,7 +65,24 @@ public:
 
     static v8::Local<v8::Function> sGetFunction();
 
+    /**
+     * reads that have an asynchronous variant
+     */
+    enum AsyncOp {
+        ASYNC_MOTION6,
+        ASYNC_MOTION9,
+        ASYNC_HEADING_XYZ,
+        ASYNC_HEADING,
+        ASYNC_TILT_HEADING,
+        ASYNC_OP_COUNT
+    };
+
 private:
+    friend class RPIGY86Worker;
+    friend class RPIGY86CalibrationWorker;
+    friend class RPIGY86MagSampleWorker;
+    friend class RPIGY86CaptureWorker;
+
     /**
      * used by javascript ctro function
      */
@@ -28,6 +95,33 @@ private:
      * callback function for javascript function .getMotion9()
      */
     static void sGetMotion9(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * true for () or (Int16Array|Float32Array[, offset])
+     */
+    static bool sIsFrameArgs(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback function for javascript function .readLatest()
+     */
+    static void sReadLatest(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback functions for javascript functions .setUnits() and .getUnits()
+     */
+    static void sSetUnits(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sGetUnits(const v8::FunctionCallbackInfo<v8::Value> &args);
+#ifdef RPIGY86_FAST_API
+    /**
+     * fast API variants, called from optimized code for a single
+     * Float32Array argument; they set options.fallback for anything the
+     * slow callback has to handle
+     */
+    static void sFastGetMotion6(v8::Local<v8::Object> receiver,
+            const v8::FastApiTypedArray<float> &buffer, v8::FastApiCallbackOptions &options);
+    static void sFastGetMotion9(v8::Local<v8::Object> receiver,
+            const v8::FastApiTypedArray<float> &buffer, v8::FastApiCallbackOptions &options);
+    static double sFastGetHeading(v8::Local<v8::Object> receiver, v8::FastApiCallbackOptions &options);
+    static void sFastReadLatest(v8::Local<v8::Object> receiver,
+            const v8::FastApiTypedArray<float> &buffer, v8::FastApiCallbackOptions &options);
+#endif
     static void sSetGryoXOffset(const v8::FunctionCallbackInfo<v8::Value> &args);
     static void sSetGryoYOffset(const v8::FunctionCallbackInfo<v8::Value> &args);
     static void sSetGryoZOffset(const v8::FunctionCallbackInfo<v8::Value> &args);
@@ -46,15 +140,120 @@ private:
     static void sGetHeading(const v8::FunctionCallbackInfo<v8::Value> &args);
     static void sSetMagGain(const v8::FunctionCallbackInfo<v8::Value> &args);
     static void sGetMagGain(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sStartMagCalibration(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sSampleMagCalibration(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sSolveMagCalibration(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sSetMagCalibration(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sSelfTestMag(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sSetMagScale(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sGetTiltCompensatedHeading(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sGetTiltCompensatedHeadings(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sSetLocation(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sUpdateLocation(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sGetDeclination(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sSetDeclination(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback function for the javascript ._<read>Async(callback) functions,
+     * the AsyncOp is bound as function data
+     */
+    static void sReadAsync(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback function for javascript function ._calibrateMPU6050Async()
+     */
+    static void sCalibrateAsync(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback function for javascript function ._sampleMagCalibrationAsync()
+     */
+    static void sSampleMagCalibrationAsync(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback functions for the javascript ._stream<Op>() functions behind
+     * .stream()
+     */
+    static void sStreamOpen(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sStreamRead(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sStreamStats(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sStreamClose(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback functions for the javascript ._ring<Op>() functions behind
+     * .sharedRing()
+     */
+    static void sRingBuffer(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sRingStart(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sRingStop(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback functions for javascript functions .startAttitude(),
+     * .getAttitude() and .stopAttitude()
+     */
+    static void sStartAttitude(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sGetAttitude(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sStopAttitude(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback functions for javascript functions .startEKF(), .getEKF()
+     * and .stopEKF()
+     */
+    static void sStartEKF(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sGetEKF(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sStopEKF(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback functions for javascript functions .startRecording() and
+     * .stopRecording()
+     */
+    static void sStartRecording(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sStopRecording(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback functions for javascript functions .startFlightRecorder() and
+     * .stopFlightRecorder()
+     */
+    static void sStartFlightRecorder(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sStopFlightRecorder(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback functions for javascript functions .startCapture(),
+     * .triggerCapture() and .stopCapture()
+     */
+    static void sStartCapture(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sTriggerCapture(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sStopCapture(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback functions for the javascript ._motion<Op>() functions behind
+     * .motionEvents()
+     */
+    static void sMotionStart(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sMotionStop(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback functions for javascript functions ._spectrumStart() and
+     * ._spectrumStop()
+     */
+    static void sSpectrumStart(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void sSpectrumStop(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback function for javascript function ._setFilters()
+     */
+    static void sSetFilters(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * callback function for javascript function .getReplay()
+     */
+    static void sGetReplay(const v8::FunctionCallbackInfo<v8::Value> &args);
+    /**
+     * runs on the event loop after the acquisition thread wrote samples
+     */
+    static void sOnSamplesAsync(uv_async_t* handle);
     static v8::Eternal<v8::Function> sFunction;
 
     /**
      * initialize MPU6050, HMC5883L and MS6511
      */
     void initialize();
+    bool requireSensors(const v8::FunctionCallbackInfo<v8::Value> &args, uint32_t sensors);
 
     void getMotion6(const v8::FunctionCallbackInfo<v8::Value> &args);
     void getMotion9(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void getMotion6Into(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void getMotion9Into(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void readMotion6(int16_t* motion);
+    void readMotion9(int32_t* motion);
+    void readMotion9(int16_t* motion, float* mag);
+    void readLatest(float* frame);
+    void storeLatest(const int16_t* motion, const float* mag);
     void setAccelXOffset(int32_t offset);
     void setAccelYOffset(int32_t offset);
     void setAccelZOffset(int32_t offset);
@@ -69,17 +268,270 @@ private:
     void setAccelRangeScale(int32_t scale);
     void getAccelRangeScale(const v8::FunctionCallbackInfo<v8::Value> &args);
     void calibrateMPU6050(const v8::FunctionCallbackInfo<v8::Value> &args);
-    void measure(int* m_ax, int* m_ay, int* m_az, int* m_gx, int* m_gy, int* m_gz);
+    bool checkCalibrationIdle(const v8::FunctionCallbackInfo<v8::Value> &args);
     void getHeadingXYZ(const v8::FunctionCallbackInfo<v8::Value> &args);
     void getHeading(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void readHeadingXYZ(int32_t* mag);
+    float readHeading();
     void setMagGain(int32_t gain);
     void getMagGain(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void startMagCalibration();
+    void sampleMagCalibration(const v8::FunctionCallbackInfo<v8::Value> &args, int32_t count);
+    bool readMagSamples(int32_t count, const float* scale, std::vector<float>* samples);
+    void solveMagCalibration(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void setMagCalibration(const float* calibration);
+    void selfTestMag(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void setMagScale(const float* scale);
+    MagCorrection magCorrection() const;
+    void getTiltCompensatedHeading(const v8::FunctionCallbackInfo<v8::Value> &args);
+    float readTiltCompensatedHeading();
+    void getTiltCompensatedHeadings(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void setLocation(const v8::FunctionCallbackInfo<v8::Value> &args);
+    bool updateLocation(double latitude, double longitude);
+    static void throwOutsideModel(v8::Isolate* isolate);
+    void getDeclination(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void setDeclination(float declination);
+    float applyDeclination(float heading);
+    Acquisition* acquisition();
+    void startAcquisition(uint32_t rate, uint32_t sensors);
+    void releaseAcquisition();
+    void applyLowPowerPolicy();
+    void ringBuffer(const v8::FunctionCallbackInfo<v8::Value> &args);
+    int32_t streamOpen(uint32_t rate, uint32_t sensors, uint32_t batch, bool decimate, bool si,
+            uint32_t filter, uint32_t inputRate, v8::Local<v8::Function> notify);
+    void streamRead(const v8::FunctionCallbackInfo<v8::Value> &args, RPIGY86Stream* stream,
+            uint32_t max, bool binary);
+    void streamClose(int32_t id);
+    void notifyStreams();
+    void decimateStreams(const Sample* samples, uint32_t count);
+    void startAttitude(uint32_t rate, bool mag);
+    void getAttitude(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void stopAttitude();
+    void updateAttitude(const Sample* samples, uint32_t count, bool mag, const MagCorrection& correction);
+    void startEKF(uint32_t rate, bool mag, bool baro);
+    void getEKF(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void stopEKF();
+    void updateEKF(const Sample* samples, uint32_t count, bool mag, bool baro,
+            const MagCorrection& correction);
+    int startRecording(const char* path, uint32_t rate, uint32_t sensors, uint32_t segmentSeconds, bool compress);
+    void stopRecording(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void recordSamples(const Sample* samples, uint32_t count);
+    void fillLogHeader(SampleLogHeader* header);
+    int startFlightRecorder(const char* path, uint32_t rate, uint32_t sensors, uint32_t seconds);
+    void stopFlightRecorder();
+    void startCapture(const char* path, uint32_t rate, uint32_t sensors, const CaptureOptions& options,
+            v8::Local<v8::Function> callback);
+    void stopCapture(const v8::FunctionCallbackInfo<v8::Value> &args);
+    void notifyCapture();
+    RPIGY86CaptureWorker* takeCaptures(TriggeredCapture* capture, Nan::Callback* callback);
+    void writeCaptures(RPIGY86CaptureWorker* worker);
+    void onCapturesWritten();
+    static int persistCapture(const CaptureEvent& event, const std::string& path, bool compress,
+            const SampleLogHeader& header, std::string* file);
+    void applyDetection();
+    void startMotionEvents(uint32_t rate, const MotionDetection& detection, const LowPowerPolicy& policy,
+            v8::Local<v8::Function> callback);
+    void stopMotionEvents();
+    void queueMotionEvents(const Sample* samples, uint32_t count);
+    void notifyMotionEvents();
+    void startSpectrum(uint32_t rate, const SpectrumSettings& settings, v8::Local<v8::Function> callback);
+    void stopSpectrum();
+    void analyzeSamples(const Sample* samples, uint32_t count);
+    void notifySpectrum();
+    void getReplay(const v8::FunctionCallbackInfo<v8::Value> &args);
+    bool openReplay(const char* path, double speed);
+    void onSamples(const Sample* samples, uint32_t count);
+    void onPowerMode(uint64_t timestamp, bool lowPower);
 
 
 
     MPU6050* mpu6050;
     HMC5883L* hmc5883l;
     MS5611* ms5611;
+
+    /**
+     * i2c-dev device or registered transport the sensors are on
+     */
+    std::string mBus;
+    /**
+     * MPU6050 address, 0x68 or 0x69 depending on AD0
+     */
+    uint8_t mAddress;
+    /**
+     * HMC5883L address, 0x1E unless the magAddress option says otherwise
+     */
+    uint8_t mMagAddress;
+    /**
+     * SENSOR_* mask of the chips to use; the others stay NULL
+     */
+    uint32_t mSensors;
+
+    /**
+     * range and gain settings as last written, and the scales they imply;
+     * read from the chips once in initialize() and kept in step by the
+     * setters, so getting a range or converting a sample needs no bus access
+     */
+    UnitScales mUnits;
+    /**
+     * Float32Array frames in g, deg/s and uT instead of raw counts
+     */
+    bool mSIUnits;
+
+    /**
+     * not able to directly set these offset into HMC5883L
+     * therefore, keep a local hard/soft-iron correction here. It is set
+     * on the JS thread and read on the acquisition thread and the
+     * threadpool, which take a copy through magCorrection().
+     */
+    mutable std::mutex mMagCorrectionLock;
+    MagCorrection mMagCorrection;
+    MagCalibration mMagCalibration;
+
+    /**
+     * declination used by the heading APIs, taken from the magnetic model
+     * once setLocation() is called. The default is the historical value of
+     * the original deployment.
+     */
+    float mDeclination;
+    float mInclination;
+    DeclinationGrid mDeclinationGrid;
+
+    /**
+     * accel, gyro and corrected mag of the most recent read, for readLatest()
+     */
+    std::mutex mLatestLock;
+    float mLatest[9];
+
+    /**
+     * serializes bus access between the JS thread and async workers
+     */
+    std::mutex mBusLock;
+    RPIGY86Worker* mInFlight[ASYNC_OP_COUNT];
+    bool mCalibrating;
+
+    /**
+     * FIFO acquisition thread, running while streams are open
+     */
+    Acquisition* mAcquisition;
+    /**
+     * changed on the event loop under mStreamLock, which the acquisition
+     * thread holds while it decimates the filtered streams
+     */
+    std::mutex mStreamLock;
+    std::map<int32_t, RPIGY86Stream*> mStreams;
+    int32_t mNextStreamId;
+    /**
+     * set while the ring is shared; calls Atomics.notify() on the ring head
+     */
+    Nan::Callback* mRingNotify;
+    uv_async_t* mSamplesAsync;
+    Nan::AsyncResource* mStreamResource;
+
+    /**
+     * orientation filter, fed with every sample by the acquisition thread
+     * while mAttitudeRunning; everything below is guarded by mAttitudeLock
+     */
+    std::mutex mAttitudeLock;
+    AHRS mAHRS;
+    bool mAttitudeRunning;
+    bool mAttitudeMag;
+    /**
+     * rad/s per LSB, kept in step with the gyro range
+     */
+    float mAttitudeGyroScale;
+    /**
+     * g per LSB, kept in step with the accel range
+     */
+    float mAttitudeAccelScale;
+    /**
+     * CLOCK_MONOTONIC ns of the last sample fed, 0 before the first one
+     */
+    uint64_t mAttitudeTimestamp;
+
+    /**
+     * Kalman filter for attitude, gyro bias and altitude, fed like the
+     * attitude filter while mEKFRunning; also guarded by mAttitudeLock
+     */
+    EKF mEKF;
+    bool mEKFRunning;
+    bool mEKFMag;
+    bool mEKFBaro;
+    /**
+     * Pa, reference for the barometric altitude
+     */
+    double mEKFSeaLevel;
+    uint64_t mEKFTimestamp;
+
+    /**
+     * notch and low-pass sections on accel and gyro, run by the acquisition
+     * thread on the samples for readLatest(), the attitude filter and the
+     * EKF, into mFiltered; streams and recordings keep the raw samples
+     */
+    BiquadBank mBiquads;
+    std::vector<Sample> mFiltered;
+
+    /**
+     * SampleLog or PackedLog the acquisition thread writes every sample to
+     * while recording; guarded by mRecordLock
+     */
+    std::mutex mRecordLock;
+    SampleRecorder* mRecorder;
+    FlightRecorder* mFlightRecorder;
+
+    /**
+     * triggered capture the acquisition thread feeds, also guarded by
+     * mRecordLock; the event loop hands its events to workers that write
+     * them to mCapturePath-<n> on the threadpool and report them to
+     * mCaptureCallback
+     */
+    TriggeredCapture* mCapture;
+    Nan::Callback* mCaptureCallback;
+    std::string mCapturePath;
+    bool mCaptureCompress;
+    SampleLogHeader mCaptureHeader;
+    /**
+     * one worker runs at a time, the front one, so that events are written
+     * and reported in order
+     */
+    std::deque<RPIGY86CaptureWorker*> mCaptureWriters;
+
+    /**
+     * MPU6050 detector settings wanted by .motionEvents() and by the
+     * capture; the chip gets the more sensitive of each, see
+     * applyDetection()
+     */
+    MotionDetection mEventDetector;
+    MotionDetection mCaptureDetector;
+    /**
+     * low-power policy wanted by .motionEvents(), stillSamples in ms; see
+     * applyLowPowerPolicy()
+     */
+    LowPowerPolicy mLowPowerPolicy;
+    /**
+     * set while .motionEvents() is open. The acquisition thread queues the
+     * timestamp and flags of samples that carry detector events, and the
+     * power mode transitions of its low-power policy; the event loop hands
+     * them to the callback.
+     */
+    Nan::Callback* mEventCallback;
+    std::mutex mEventLock;
+    std::vector<std::pair<uint64_t, uint32_t> > mEventQueue;
+
+    /**
+     * vibration spectra of the raw samples while .spectrum() is open; the
+     * acquisition thread feeds mSpectrum under mSpectrumLock, the event
+     * loop takes its results and hands them to mSpectrumCallback
+     */
+    std::mutex mSpectrumLock;
+    SpectrumAnalyzer* mSpectrum;
+    Nan::Callback* mSpectrumCallback;
+
+    /**
+     * recording the sensors are replayed from instead of a bus, NULL
+     * normally; mReplayError is the errno of opening it
+     */
+    ReplayTransport* mReplay;
+    int mReplayError;
 };
 
 #endif /* RPIGY86_H_ */
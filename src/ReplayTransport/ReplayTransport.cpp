@@ -0,0 +1,383 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "ReplayTransport.h"
+#include "MPU6050.h"
+#include "HMC5883L.h"
+#include "MS5611.h"
+
+#define NS_PER_SEC 1000000000ULL
+
+#define ACCEL_FS_MASK 0x18
+#define GYRO_FS_MASK 0x18
+#define MAG_GAIN_MASK 0xE0
+
+static uint64_t monotonicNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+ReplayTransport::ReplayTransport()
+    : mSpeed(1), mStarted(false), mOrigin(0), mWallOrigin(0), mVirtual(0), mNext(0), mNextDue(0),
+      mFifoHead(0), mFifoCount(0), mBaroCommand(0) {
+    memset(&mCurrent, 0, sizeof(mCurrent));
+    memset(mRegs, 0, sizeof(mRegs));
+    memset(mMagRegs, 0, sizeof(mMagRegs));
+    memset(mMagLatched, 0, sizeof(mMagLatched));
+}
+
+/** Map a recording and reset the registers to its settings. Call before
+ * any device is opened on the bus.
+ * @param speed Multiple of real time, 0 for as fast as possible
+ * @return false if the log cannot be read, see getError()
+ */
+bool ReplayTransport::open(const char* path, double speed) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!mLog.open(path)) {
+        return false;
+    }
+    const SampleLogHeader& header = mLog.getHeader();
+    mSpeed = speed > 0 ? speed : 0;
+    mStarted = false;
+    mNext = 0;
+    mNextDue = 0;
+    memset(&mCurrent, 0, sizeof(mCurrent));
+    if (mLog.getCount() > 0) {
+        mCurrent = *mLog.at(0);
+    }
+    mOrigin = header.startMonotonic ? header.startMonotonic : mCurrent.timestamp;
+
+    memset(mRegs, 0, sizeof(mRegs));
+    mRegs[MPU6050_RA_PWR_MGMT_1] = 0x40;
+    mRegs[MPU6050_RA_WHO_AM_I] = 0x68;
+    mRegs[MPU6050_RA_ACCEL_CONFIG] = (header.accelRange << 3) & ACCEL_FS_MASK;
+    mRegs[MPU6050_RA_GYRO_CONFIG] = (header.gyroRange << 3) & GYRO_FS_MASK;
+    mFifoHead = 0;
+    mFifoCount = 0;
+
+    memset(mMagRegs, 0, sizeof(mMagRegs));
+    mMagRegs[HMC5883L_RA_CONFIG_A] = 0x10;
+    mMagRegs[HMC5883L_RA_CONFIG_B] = (header.magGain << 5) & MAG_GAIN_MASK;
+    mMagRegs[HMC5883L_RA_MODE] = 0x01;
+    mMagRegs[HMC5883L_RA_ID_A] = 'H';
+    mMagRegs[HMC5883L_RA_ID_B] = '4';
+    mMagRegs[HMC5883L_RA_ID_C] = '3';
+    memset(mMagLatched, 0, sizeof(mMagLatched));
+    mBaroCommand = 0;
+    return true;
+}
+
+/** Settings and calibration the log was recorded with.
+ */
+const SampleLogHeader& ReplayTransport::getHeader() const {
+    return mLog.getHeader();
+}
+
+int ReplayTransport::getError() const {
+    return mLog.getError();
+}
+
+uint64_t ReplayTransport::getCount() const {
+    return mLog.getCount();
+}
+
+/** Records the replay clock has passed.
+ */
+uint64_t ReplayTransport::getPosition() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mNext;
+}
+
+/** True once every record was passed and the FIFO is drained.
+ */
+bool ReplayTransport::isFinished() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mNext >= mLog.getCount() && mFifoCount == 0;
+}
+
+/** Log time now. Called with mLock held.
+ */
+uint64_t ReplayTransport::clock() {
+    if (!mStarted) {
+        return mOrigin;
+    }
+    if (mSpeed == 0) {
+        return mVirtual;
+    }
+    return mOrigin + (uint64_t)((monotonicNow() - mWallOrigin) * mSpeed);
+}
+
+uint64_t ReplayTransport::now() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return clock();
+}
+
+/** With speed 0 the clock jumps to t at once while records are left;
+ * otherwise, and after the end of the log, the caller really sleeps.
+ */
+void ReplayTransport::sleepUntil(uint64_t t) {
+    uint64_t wait;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        uint64_t c = clock();
+        if (t <= c) {
+            return;
+        }
+        if (mStarted && mSpeed == 0 && mNext < mLog.getCount()) {
+            mVirtual = t;
+            return;
+        }
+        wait = mSpeed > 0 ? (uint64_t)((t - c) / mSpeed) : t - c;
+    }
+    struct timespec ts;
+    ts.tv_sec = wait / NS_PER_SEC;
+    ts.tv_nsec = wait % NS_PER_SEC;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mStarted && mSpeed == 0 && t > mVirtual) {
+        mVirtual = t;
+    }
+}
+
+/** Pass the records up to log time t: the latest becomes current and those
+ * due at the programmed sample rate go into the FIFO. Called with mLock
+ * held.
+ */
+void ReplayTransport::advance(uint64_t t) {
+    uint8_t enabled = mRegs[MPU6050_RA_FIFO_EN];
+    bool fifo = (mRegs[MPU6050_RA_USER_CTRL] & (1 << MPU6050_USERCTRL_FIFO_EN_BIT)) && enabled;
+    uint8_t dlpf = mRegs[MPU6050_RA_CONFIG] & 7;
+    uint64_t period = (uint64_t)((1 + mRegs[MPU6050_RA_SMPLRT_DIV]) * NS_PER_SEC
+            / (dlpf == 0 || dlpf == 7 ? 8000.0 : 1000.0));
+    // every record at the recorded rate or faster; when decimating, half a
+    // recorded period of slack absorbs timestamp jitter
+    uint32_t rate = mLog.getHeader().rate;
+    bool every = rate == 0 || period <= NS_PER_SEC / rate;
+    uint64_t slack = rate ? NS_PER_SEC / rate / 2 : 0;
+    while (mNext < mLog.getCount()) {
+        const Sample* sample = mLog.at(mNext);
+        if (sample->timestamp > t) {
+            break;
+        }
+        mCurrent = *sample;
+        mNext++;
+        if (sample->flags & (SAMPLE_FREEFALL | SAMPLE_MOTION | SAMPLE_ZERO_MOTION)) {
+            replayDetection(*sample);
+        }
+        if (fifo && (every || sample->timestamp + slack >= mNextDue)) {
+            pushFrame(*sample);
+            mNextDue = sample->timestamp > mNextDue + period ? sample->timestamp + period : mNextDue + period;
+        }
+    }
+}
+
+/** Raise the detector interrupts a recorded sample reports, where the
+ * driver enabled them, and restore the motion status that went with them.
+ * Called with mLock held.
+ */
+void ReplayTransport::replayDetection(const Sample& sample) {
+    uint8_t enabled = mRegs[MPU6050_RA_INT_ENABLE];
+    uint8_t status = 0;
+    if (sample.flags & SAMPLE_FREEFALL) {
+        status |= 1 << MPU6050_INTERRUPT_FF_BIT;
+    }
+    if (sample.flags & SAMPLE_MOTION) {
+        status |= 1 << MPU6050_INTERRUPT_MOT_BIT;
+    }
+    if (sample.flags & SAMPLE_ZERO_MOTION) {
+        status |= 1 << MPU6050_INTERRUPT_ZMOT_BIT;
+    }
+    mRegs[MPU6050_RA_INT_STATUS] |= status & enabled;
+    if (sample.flags & (SAMPLE_MOTION | SAMPLE_ZERO_MOTION)) {
+        mRegs[MPU6050_RA_MOT_DETECT_STATUS] = SAMPLE_MOTION_STATUS(sample.flags);
+    }
+}
+
+/** Append one frame in the FIFO_EN layout; the oldest data is overwritten
+ * when the FIFO is full, as on the real part.
+ */
+void ReplayTransport::pushFrame(const Sample& sample) {
+    uint8_t enabled = mRegs[MPU6050_RA_FIFO_EN];
+    int16_t v[7] = { sample.accel[0], sample.accel[1], sample.accel[2], sample.temperature,
+                     sample.gyro[0], sample.gyro[1], sample.gyro[2] };
+    for (int i = 0; i < 7; i++) {
+        bool on = i < 3 ? (enabled & (1 << MPU6050_ACCEL_FIFO_EN_BIT))
+                : i == 3 ? (enabled & (1 << MPU6050_TEMP_FIFO_EN_BIT))
+                : (enabled & (1 << (MPU6050_XG_FIFO_EN_BIT - (i - 4))));
+        if (!on) {
+            continue;
+        }
+        uint8_t bytes[2] = { (uint8_t)(v[i] >> 8), (uint8_t)(v[i] & 0xff) };
+        for (int b = 0; b < 2; b++) {
+            if (mFifoCount == REPLAY_FIFO_SIZE) {
+                mFifoHead = (mFifoHead + 1) % REPLAY_FIFO_SIZE;
+                mFifoCount--;
+                mRegs[MPU6050_RA_INT_STATUS] |= 1 << MPU6050_INTERRUPT_FIFO_OFLOW_BIT;
+            }
+            mFifo[(mFifoHead + mFifoCount) % REPLAY_FIFO_SIZE] = bytes[b];
+            mFifoCount++;
+        }
+    }
+}
+
+uint8_t ReplayTransport::readMPU(uint8_t regAddr) {
+    if (regAddr == MPU6050_RA_FIFO_R_W) {
+        if (mFifoCount == 0) {
+            return 0;
+        }
+        uint8_t b = mFifo[mFifoHead];
+        mFifoHead = (mFifoHead + 1) % REPLAY_FIFO_SIZE;
+        mFifoCount--;
+        return b;
+    }
+    if (regAddr == MPU6050_RA_FIFO_COUNTH) {
+        return mFifoCount >> 8;
+    }
+    if (regAddr == MPU6050_RA_FIFO_COUNTL) {
+        return mFifoCount & 0xff;
+    }
+    if (regAddr == MPU6050_RA_INT_STATUS) {
+        uint8_t status = mRegs[MPU6050_RA_INT_STATUS] | (1 << MPU6050_INTERRUPT_DATA_RDY_BIT);
+        mRegs[MPU6050_RA_INT_STATUS] = 0;
+        return status;
+    }
+    if (regAddr >= MPU6050_RA_ACCEL_XOUT_H && regAddr <= MPU6050_RA_GYRO_ZOUT_L) {
+        int16_t v[7] = { mCurrent.accel[0], mCurrent.accel[1], mCurrent.accel[2], mCurrent.temperature,
+                         mCurrent.gyro[0], mCurrent.gyro[1], mCurrent.gyro[2] };
+        int16_t w = v[(regAddr - MPU6050_RA_ACCEL_XOUT_H) / 2];
+        return (regAddr - MPU6050_RA_ACCEL_XOUT_H) & 1 ? w & 0xff : w >> 8;
+    }
+    return regAddr < sizeof(mRegs) ? mRegs[regAddr] : 0;
+}
+
+void ReplayTransport::writeMPU(uint8_t regAddr, uint8_t value) {
+    if (regAddr >= sizeof(mRegs) || regAddr == MPU6050_RA_WHO_AM_I) {
+        return;
+    }
+    // the recording has one range; keep reporting it
+    if (regAddr == MPU6050_RA_ACCEL_CONFIG) {
+        value = (value & ~ACCEL_FS_MASK) | (mRegs[regAddr] & ACCEL_FS_MASK);
+    } else if (regAddr == MPU6050_RA_GYRO_CONFIG) {
+        value = (value & ~GYRO_FS_MASK) | (mRegs[regAddr] & GYRO_FS_MASK);
+    } else if (regAddr == MPU6050_RA_PWR_MGMT_1 && (value & (1 << MPU6050_PWR1_DEVICE_RESET_BIT))) {
+        uint8_t accel = mRegs[MPU6050_RA_ACCEL_CONFIG] & ACCEL_FS_MASK;
+        uint8_t gyro = mRegs[MPU6050_RA_GYRO_CONFIG] & GYRO_FS_MASK;
+        memset(mRegs, 0, sizeof(mRegs));
+        mRegs[MPU6050_RA_PWR_MGMT_1] = 0x40;
+        mRegs[MPU6050_RA_WHO_AM_I] = 0x68;
+        mRegs[MPU6050_RA_ACCEL_CONFIG] = accel;
+        mRegs[MPU6050_RA_GYRO_CONFIG] = gyro;
+        mFifoHead = 0;
+        mFifoCount = 0;
+        return;
+    } else if (regAddr == MPU6050_RA_USER_CTRL) {
+        if (value & (1 << MPU6050_USERCTRL_FIFO_RESET_BIT)) {
+            mFifoHead = 0;
+            mFifoCount = 0;
+            value &= ~(1 << MPU6050_USERCTRL_FIFO_RESET_BIT);
+        }
+        if ((value & (1 << MPU6050_USERCTRL_FIFO_EN_BIT)) && !mStarted) {
+            // the replay clock starts with the first acquisition
+            mStarted = true;
+            mWallOrigin = monotonicNow();
+            mVirtual = mOrigin;
+        }
+    }
+    mRegs[regAddr] = value;
+}
+
+uint8_t ReplayTransport::readMag(uint8_t regAddr) {
+    if (regAddr == HMC5883L_RA_DATAX_H) {
+        memcpy(mMagLatched, mCurrent.mag, sizeof(mMagLatched));
+    }
+    if (regAddr >= HMC5883L_RA_DATAX_H && regAddr <= HMC5883L_RA_DATAY_L) {
+        // registers are in X, Z, Y order
+        static const int axis[3] = { 0, 2, 1 };
+        int16_t w = mMagLatched[axis[(regAddr - HMC5883L_RA_DATAX_H) / 2]];
+        return (regAddr - HMC5883L_RA_DATAX_H) & 1 ? w & 0xff : w >> 8;
+    }
+    if (regAddr == HMC5883L_RA_STATUS) {
+        return 0x01;
+    }
+    return regAddr < sizeof(mMagRegs) ? mMagRegs[regAddr] : 0;
+}
+
+int8_t ReplayTransport::readBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data) {
+    std::lock_guard<std::mutex> lock(mLock);
+    advance(clock());
+    uint8_t mpuAddress = mLog.getHeader().mpuAddress;
+    if (devAddr == mpuAddress || (!mpuAddress && (devAddr == MPU6050_ADDRESS_AD0_LOW
+            || devAddr == MPU6050_ADDRESS_AD0_HIGH))) {
+        for (uint8_t i = 0; i < length; i++) {
+            // the FIFO port does not auto-increment
+            data[i] = readMPU(regAddr == MPU6050_RA_FIFO_R_W ? regAddr : regAddr + i);
+        }
+        return length;
+    }
+    if (devAddr == HMC5883L_ADDRESS) {
+        for (uint8_t i = 0; i < length; i++) {
+            data[i] = readMag(regAddr + i);
+        }
+        return length;
+    }
+    if (devAddr == MS5611_ADDRESS) {
+        uint32_t value = 0;
+        if (regAddr == MS5611_CMD_ADC_READ) {
+            // the conversion returns what was recorded when it is read
+            if (mBaroCommand == MS5611_CMD_CONV_D1) {
+                value = mCurrent.pressure;
+            } else if (mBaroCommand == MS5611_CMD_CONV_D2) {
+                value = mCurrent.baroTemperature;
+            }
+            mBaroCommand = 0;
+        } else if (regAddr >= MS5611_CMD_READ_PROM && regAddr < MS5611_CMD_READ_PROM + 12) {
+            value = mLog.getHeader().baroCoefficients[(regAddr - MS5611_CMD_READ_PROM) / 2];
+        }
+        for (uint8_t i = 0; i < length; i++) {
+            data[i] = value >> (8 * (length - 1 - i));
+        }
+        return length;
+    }
+    return -1;
+}
+
+bool ReplayTransport::writeBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data) {
+    std::lock_guard<std::mutex> lock(mLock);
+    advance(clock());
+    uint8_t mpuAddress = mLog.getHeader().mpuAddress;
+    if (devAddr == mpuAddress || (!mpuAddress && (devAddr == MPU6050_ADDRESS_AD0_LOW
+            || devAddr == MPU6050_ADDRESS_AD0_HIGH))) {
+        for (uint8_t i = 0; i < length; i++) {
+            writeMPU(regAddr + i, data[i]);
+        }
+        return true;
+    }
+    if (devAddr == HMC5883L_ADDRESS) {
+        for (uint8_t i = 0; i < length; i++) {
+            uint8_t reg = regAddr + i;
+            if (reg == HMC5883L_RA_CONFIG_B) {
+                mMagRegs[reg] = (data[i] & ~MAG_GAIN_MASK) | (mMagRegs[reg] & MAG_GAIN_MASK);
+            } else if (reg <= HMC5883L_RA_MODE) {
+                mMagRegs[reg] = data[i];
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+bool ReplayTransport::writeCommand(uint8_t devAddr, uint8_t command) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (devAddr != MS5611_ADDRESS) {
+        return false;
+    }
+    advance(clock());
+    if ((command & 0xF0) == MS5611_CMD_CONV_D1 || (command & 0xF0) == MS5611_CMD_CONV_D2) {
+        mBaroCommand = command & 0xF0;
+    }
+    return true;
+}
@@ -0,0 +1,341 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "PackedLog.h"
+#include "SampleLog.h"
+
+#define NS_PER_SEC 1000000000ULL
+// how often the header count is brought up to date and writeback started
+#define SAMPLE_LOG_FLUSH_NS NS_PER_SEC
+
+static_assert(sizeof(SampleLogHeader) <= SAMPLE_LOG_HEADER_SIZE, "header must fit its page");
+static_assert(sizeof(Sample) == 40, "the record layout is the file format");
+
+SampleLog::SampleLog()
+    : mCapacity(0), mFd(-1), mMap(NULL), mMapSize(0), mHeader(NULL), mRecords(NULL), mSegment(0),
+      mCount(0), mFlushed(0), mFlushTimestamp(0), mTotal(0), mError(0) {
+    memset(&mTemplate, 0, sizeof(mTemplate));
+}
+
+SampleLog::~SampleLog() {
+    close();
+}
+
+/** File name of one segment: the first is path itself, later ones get
+ * .1, .2, ... appended.
+ */
+std::string SampleLog::segmentPath(const std::string& path, uint32_t segment) {
+    if (segment == 0) {
+        return path;
+    }
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%u", segment);
+    return path + suffix;
+}
+
+/** Create the first segment. Existing files are replaced.
+ * @param header Settings and calibration copied into every segment; the
+ * bookkeeping fields are filled in here
+ * @param segmentRecords Records per segment file
+ * @return false on failure, see getError()
+ */
+bool SampleLog::open(const char* path, const SampleLogHeader& header, uint32_t segmentRecords) {
+    close();
+    mPath = path;
+    mTemplate = header;
+    memcpy(mTemplate.magic, SAMPLE_LOG_MAGIC, sizeof(mTemplate.magic));
+    mTemplate.version = SAMPLE_LOG_VERSION;
+    mTemplate.headerSize = SAMPLE_LOG_HEADER_SIZE;
+    mTemplate.recordSize = sizeof(Sample);
+    mTemplate.capacity = segmentRecords > 0 ? segmentRecords : 1;
+    mTemplate.count = 0;
+    mCapacity = mTemplate.capacity;
+    mSegment = 0;
+    mTotal = 0;
+    mError = 0;
+    return openSegment();
+}
+
+bool SampleLog::openSegment() {
+    std::string file = segmentPath(mPath, mSegment);
+    mFd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mFd < 0) {
+        mError = errno;
+        return false;
+    }
+    mMapSize = SAMPLE_LOG_HEADER_SIZE + (size_t)mCapacity * sizeof(Sample);
+    // allocate the blocks now rather than on the first touch of each page
+    // (not every file system can; a sparse file still works)
+    if (posix_fallocate(mFd, 0, mMapSize) != 0 && ftruncate(mFd, mMapSize) != 0) {
+        mError = errno;
+        ::close(mFd);
+        mFd = -1;
+        return false;
+    }
+    void* map = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (map == MAP_FAILED) {
+        mError = errno;
+        ::close(mFd);
+        mFd = -1;
+        return false;
+    }
+    madvise(map, mMapSize, MADV_SEQUENTIAL);
+    mMap = static_cast<uint8_t*>(map);
+    mHeader = reinterpret_cast<SampleLogHeader*>(mMap);
+    mRecords = reinterpret_cast<Sample*>(mMap + SAMPLE_LOG_HEADER_SIZE);
+    *mHeader = mTemplate;
+    mHeader->segment = mSegment;
+    mCount = 0;
+    mFlushed = 0;
+    mFlushTimestamp = 0;
+    return true;
+}
+
+/** Final count, writeback of the tail and unmap. The file keeps its
+ * preallocated size so that readers can rely on capacity.
+ */
+void SampleLog::closeSegment() {
+    if (!mMap) {
+        return;
+    }
+    flush();
+    munmap(mMap, mMapSize);
+    ::close(mFd);
+    mMap = NULL;
+    mHeader = NULL;
+    mRecords = NULL;
+    mFd = -1;
+}
+
+/** Append samples; called on the acquisition thread. Copies into the
+ * mapping, opens the next segment when one fills up and flushes about
+ * once a second of sample time.
+ * @return false once a segment could not be created; the log stays closed
+ */
+bool SampleLog::write(const Sample* samples, uint32_t count) {
+    while (count > 0) {
+        if (!mMap) {
+            return false;
+        }
+        uint32_t n = mCapacity - mCount < count ? mCapacity - mCount : count;
+        memcpy(&mRecords[mCount], samples, n * sizeof(Sample));
+        mCount += n;
+        mTotal += n;
+        samples += n;
+        count -= n;
+        if (mCount == mCapacity) {
+            closeSegment();
+            mSegment++;
+            openSegment();
+        }
+    }
+    if (mMap && mCount > 0 && mRecords[mCount - 1].timestamp >= mFlushTimestamp + SAMPLE_LOG_FLUSH_NS) {
+        flush();
+    }
+    return true;
+}
+
+/** Publish the count and start writeback of the pages written since the
+ * previous flush, without waiting for the device.
+ */
+void SampleLog::flush() {
+    if (!mMap || mCount == mFlushed) {
+        return;
+    }
+    __atomic_store_n(&mHeader->count, mCount, __ATOMIC_RELEASE);
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t from = (SAMPLE_LOG_HEADER_SIZE + (size_t)mFlushed * sizeof(Sample)) / page * page;
+    size_t to = SAMPLE_LOG_HEADER_SIZE + (size_t)mCount * sizeof(Sample);
+    sync_file_range(mFd, 0, SAMPLE_LOG_HEADER_SIZE, SYNC_FILE_RANGE_WRITE);
+    sync_file_range(mFd, from, to - from, SYNC_FILE_RANGE_WRITE);
+    mFlushed = mCount;
+    mFlushTimestamp = mRecords[mCount - 1].timestamp;
+}
+
+void SampleLog::close() {
+    closeSegment();
+}
+
+bool SampleLog::isOpen() const {
+    return mMap != NULL;
+}
+
+/** Records written over all segments.
+ */
+uint64_t SampleLog::getCount() const {
+    return mTotal;
+}
+
+uint32_t SampleLog::getSegments() const {
+    return mTotal > 0 || mMap ? mSegment + 1 : 0;
+}
+
+int SampleLog::getError() const {
+    return mError;
+}
+
+SampleLogReader::SampleLogReader() : mPacked(NULL), mCount(0), mCurrent(0), mError(0) {
+    memset(&mHeader, 0, sizeof(mHeader));
+}
+
+SampleLogReader::~SampleLogReader() {
+    close();
+}
+
+/** Map path and the segments following it. A segment that ends early (the
+ * recording stopped or crashed there) is the last one.
+ * @return false if path is missing or not a log, see getError()
+ */
+bool SampleLogReader::open(const char* path) {
+    close();
+    mError = 0;
+    char magic[8] = { 0 };
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (read(fd, magic, sizeof(magic)) != (ssize_t)sizeof(magic)) {
+            magic[0] = 0;
+        }
+        ::close(fd);
+    }
+    if (memcmp(magic, PACKED_LOG_MAGIC, sizeof(magic)) == 0) {
+        mPacked = new PackedLogReader();
+        if (!mPacked->open(path)) {
+            mError = mPacked->getError();
+            delete mPacked;
+            mPacked = NULL;
+            return false;
+        }
+        mHeader = mPacked->getHeader();
+        mCount = mPacked->getCount();
+        return true;
+    }
+    if (!openSegment(path, true)) {
+        return false;
+    }
+    for (uint32_t segment = 1; mSegments.back().count == mHeader.capacity; segment++) {
+        if (!openSegment(SampleLog::segmentPath(path, segment), false)) {
+            mError = 0;
+            break;
+        }
+    }
+    return true;
+}
+
+bool SampleLogReader::openSegment(const std::string& file, bool first) {
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        mError = errno;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SAMPLE_LOG_HEADER_SIZE) {
+        mError = EINVAL;
+        ::close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        mError = errno;
+        return false;
+    }
+    const SampleLogHeader* header = static_cast<const SampleLogHeader*>(map);
+    if (memcmp(header->magic, SAMPLE_LOG_MAGIC, sizeof(header->magic)) != 0
+            || header->version != SAMPLE_LOG_VERSION || header->recordSize != sizeof(Sample)
+            || header->headerSize < sizeof(SampleLogHeader)
+            || (!first && header->segment != mSegments.size())) {
+        mError = EINVAL;
+        munmap(map, st.st_size);
+        return false;
+    }
+    Segment segment;
+    segment.map = map;
+    segment.size = st.st_size;
+    segment.records = reinterpret_cast<const Sample*>(static_cast<const uint8_t*>(map) + header->headerSize);
+    segment.first = mCount;
+    // the count lags up to a second behind a crash; the records after it
+    // are valid up to the zero fill
+    uint32_t room = (uint32_t)((st.st_size - header->headerSize) / sizeof(Sample));
+    uint32_t count = header->count < room ? header->count : room;
+    while (count < room && segment.records[count].timestamp != 0) {
+        count++;
+    }
+    segment.count = count;
+    if (first) {
+        mHeader = *header;
+    }
+    mSegments.push_back(segment);
+    mCount += count;
+    return true;
+}
+
+void SampleLogReader::close() {
+    for (size_t i = 0; i < mSegments.size(); i++) {
+        munmap(mSegments[i].map, mSegments[i].size);
+    }
+    mSegments.clear();
+    delete mPacked;
+    mPacked = NULL;
+    mCount = 0;
+    mCurrent = 0;
+}
+
+/** Settings and calibration of the recording, from its first segment.
+ */
+const SampleLogHeader& SampleLogReader::getHeader() const {
+    return mHeader;
+}
+
+uint64_t SampleLogReader::getCount() const {
+    return mCount;
+}
+
+/** Record by index over all segments, NULL past the end. The pointer is
+ * valid until close(), or for a compressed log until the next call.
+ */
+const Sample* SampleLogReader::at(uint64_t index) {
+    if (index >= mCount) {
+        return NULL;
+    }
+    if (mPacked) {
+        return mPacked->at(index);
+    }
+    if (mCurrent >= mSegments.size() || index < mSegments[mCurrent].first) {
+        mCurrent = 0;
+    }
+    while (index >= mSegments[mCurrent].first + mSegments[mCurrent].count) {
+        mCurrent++;
+    }
+    return &mSegments[mCurrent].records[index - mSegments[mCurrent].first];
+}
+
+/** Index of the first record at or after timestamp, getCount() if none.
+ */
+uint64_t SampleLogReader::find(uint64_t timestamp) {
+    if (mPacked) {
+        return mPacked->find(timestamp);
+    }
+    uint64_t low = 0, high = mCount;
+    while (low < high) {
+        uint64_t mid = (low + high) / 2;
+        if (at(mid)->timestamp < timestamp) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+bool SampleLogReader::isPacked() const {
+    return mPacked != NULL;
+}
+
+int SampleLogReader::getError() const {
+    return mError;
+}
@@ -0,0 +1,445 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "SimTransport.h"
+#include "MPU6050.h"
+#include "HMC5883L.h"
+#include "MS5611.h"
+
+// the board rests for SIM_REST seconds, then rocks around X once over
+// SIM_ROCK seconds, starting and ending at rest
+#define SIM_REST 4.0
+#define SIM_ROCK 4.0
+#define SIM_ROLL_AMPLITUDE 0.6 // rad
+
+#define SIM_GRAVITY_LSB 16384.0 // at +/-2g
+#define SIM_GYRO_LSB 131.0      // at +/-250 deg/s
+
+// sensor errors the calibration routines are expected to find
+static const double sAccelBias[3] = { 0.012, -0.007, 0.021 }; // g
+static const double sGyroBias[3] = { 0.42, -0.23, 0.15 };     // deg/s
+static const double sHardIron[3] = { -0.20, 0.07, 0.03 };     // gauss
+
+// earth field at the simulated site, heading 30 degrees
+#define SIM_FIELD_HORIZONTAL 0.35 // gauss
+#define SIM_FIELD_DOWN 0.25       // gauss
+#define SIM_YAW (30.0 * M_PI / 180.0)
+
+// LP_WAKE_CTRL, Hz
+static const double sWakeRates[4] = { 1.25, 2.5, 5, 10 };
+
+static const uint16_t sMagGain[8] = { 1370, 1090, 820, 660, 440, 390, 330, 230 };
+
+// datasheet example values: 20.07 C, 1000.09 mbar
+static const uint16_t sBaroProm[8] = { 0, 40127, 36924, 23317, 23282, 33464, 28312, 0 };
+#define SIM_BARO_D1 9085466
+#define SIM_BARO_D2 8569150
+
+/*static*/
+SimTransport* SimTransport::shared() {
+    static SimTransport sShared;
+    return &sShared;
+}
+
+SimTransport::SimTransport() : mStart(0), mBaroValue(0), mNoise(2463534242u) {
+    mStart = now();
+    for (int i = 0; i < SIM_MPU_COUNT; i++) {
+        resetMPU(&mMPU[i]);
+    }
+    memset(mMagRegs, 0, sizeof(mMagRegs));
+    mMagRegs[HMC5883L_RA_CONFIG_A] = 0x10;
+    mMagRegs[HMC5883L_RA_CONFIG_B] = 0x20;
+    mMagRegs[HMC5883L_RA_MODE] = 0x01;
+    mMagRegs[HMC5883L_RA_ID_A] = 'H';
+    mMagRegs[HMC5883L_RA_ID_B] = '4';
+    mMagRegs[HMC5883L_RA_ID_C] = '3';
+    memset(mMagLatched, 0, sizeof(mMagLatched));
+}
+
+double SimTransport::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9 - mStart;
+}
+
+/** Roll angle and rate of the simulated board.
+ */
+static void boardRoll(double t, double* roll, double* rate) {
+    double phase = fmod(t, SIM_REST + SIM_ROCK) - SIM_REST;
+    if (phase < 0) {
+        *roll = 0;
+        *rate = 0;
+        return;
+    }
+    double w = 2 * M_PI / SIM_ROCK;
+    *roll = SIM_ROLL_AMPLITUDE * (1 - cos(w * phase)) / 2;
+    *rate = SIM_ROLL_AMPLITUDE * w * sin(w * phase) / 2;
+}
+
+static inline int16_t clamp16(double v) {
+    if (v > 32767) return 32767;
+    if (v < -32768) return -32768;
+    return (int16_t)lrint(v);
+}
+
+void SimTransport::resetMPU(MPU* mpu) {
+    memset(mpu, 0, sizeof(*mpu));
+    mpu->regs[MPU6050_RA_PWR_MGMT_1] = 0x40;
+    mpu->regs[MPU6050_RA_WHO_AM_I] = 0x68;
+}
+
+/** Accel X/Y/Z, temperature and gyro X/Y/Z as the data registers show them.
+ */
+void SimTransport::sampleMPU(const MPU* mpu, double t, int16_t* out) {
+    double roll, rate;
+    boardRoll(t, &roll, &rate);
+    int afs = (mpu->regs[MPU6050_RA_ACCEL_CONFIG] >> 3) & 3;
+    int gfs = (mpu->regs[MPU6050_RA_GYRO_CONFIG] >> 3) & 3;
+    double accelLsb = SIM_GRAVITY_LSB / (1 << afs);
+    double gyroLsb = SIM_GYRO_LSB / (1 << gfs);
+
+    double accel[3] = { 0, sin(roll), cos(roll) };
+    double gyro[3] = { rate * 180 / M_PI, 0, 0 };
+    for (int i = 0; i < 3; i++) {
+        // offset registers: accel in +/-16g units, gyro in +/-1000 deg/s units
+        int16_t accelOffset = (mpu->regs[MPU6050_RA_XA_OFFS_H + i * 2] << 8)
+                | mpu->regs[MPU6050_RA_XA_OFFS_L_TC + i * 2];
+        int16_t gyroOffset = (mpu->regs[MPU6050_RA_XG_OFFS_USRH + i * 2] << 8)
+                | mpu->regs[MPU6050_RA_XG_OFFS_USRL + i * 2];
+        mNoise ^= mNoise << 13;
+        mNoise ^= mNoise >> 17;
+        mNoise ^= mNoise << 5;
+        double noise = (int)(mNoise & 7) - 3.5;
+        out[i] = clamp16((accel[i] + sAccelBias[i]) * accelLsb + accelOffset * accelLsb / 2048 + noise);
+        out[i + 4] = clamp16((gyro[i] + sGyroBias[i]) * gyroLsb + gyroOffset * gyroLsb / 32.8 + noise / 2);
+        if (mpu->regs[MPU6050_RA_PWR_MGMT_2] & (1 << (MPU6050_PWR2_STBY_XG_BIT - i))) {
+            out[i + 4] = 0;
+        }
+    }
+    // 25 C
+    out[3] = (int16_t)((25 - 36.53) * 340);
+}
+
+/** Free-fall, motion and zero-motion detectors, run on every sample that
+ * goes into the FIFO: free fall while all axes are below FF_THR, motion
+ * while an axis of the high-passed (5 Hz) acceleration is above MOT_THR,
+ * each for its duration in ms, latched into INT_STATUS when the interrupt
+ * is enabled. Zero motion, all high-passed axes below ZRMOT_THR for
+ * ZRMOT_DUR * 64 ms, raises its interrupt when it begins and when it ends.
+ * MOT_DETECT_STATUS has the axes of the last motion and the zero-motion
+ * state.
+ */
+void SimTransport::detectMotion(MPU* mpu, const int16_t* v, double period) {
+    uint8_t enabled = mpu->regs[MPU6050_RA_INT_ENABLE];
+    if (!(enabled & ((1 << MPU6050_INTERRUPT_FF_BIT) | (1 << MPU6050_INTERRUPT_MOT_BIT)
+            | (1 << MPU6050_INTERRUPT_ZMOT_BIT)))) {
+        mpu->primed = false;
+        return;
+    }
+    int afs = (mpu->regs[MPU6050_RA_ACCEL_CONFIG] >> 3) & 3;
+    double accelLsb = SIM_GRAVITY_LSB / (1 << afs);
+    double accel[3];
+    for (int i = 0; i < 3; i++) {
+        accel[i] = v[i] / accelLsb;
+    }
+    if (!mpu->primed) {
+        memcpy(mpu->lowPass, accel, sizeof(accel));
+        mpu->motionTime = 0;
+        mpu->freefallTime = 0;
+        mpu->stillTime = 0;
+        mpu->still = false;
+        mpu->primed = true;
+    }
+    // DHPF_HOLD freezes the filter, motion is then measured against the
+    // acceleration at that moment
+    double k = (mpu->regs[MPU6050_RA_ACCEL_CONFIG] & 7) == MPU6050_DHPF_HOLD ? 0
+            : 1 - exp(-2 * M_PI * 5 * period);
+    double freefall = mpu->regs[MPU6050_RA_FF_THR] * 0.002;
+    double motion = mpu->regs[MPU6050_RA_MOT_THR] * 0.002;
+    double zeroMotion = mpu->regs[MPU6050_RA_ZRMOT_THR] * 0.002;
+    bool falling = true, moving = false, quiet = true;
+    uint8_t axes = 0;
+    for (int i = 0; i < 3; i++) {
+        mpu->lowPass[i] += (accel[i] - mpu->lowPass[i]) * k;
+        double high = accel[i] - mpu->lowPass[i];
+        falling = falling && fabs(accel[i]) < freefall;
+        if (fabs(high) > motion) {
+            moving = true;
+            // XNEG is bit 7, XPOS 6, YNEG 5, ...
+            axes |= 1 << (MPU6050_MOTION_MOT_XNEG_BIT - i * 2 - (high > 0 ? 1 : 0));
+        }
+        quiet = quiet && fabs(high) < zeroMotion;
+    }
+    double ms = period * 1000;
+    mpu->freefallTime = falling ? mpu->freefallTime + ms : 0;
+    mpu->motionTime = moving ? mpu->motionTime + ms : 0;
+    mpu->stillTime = quiet ? mpu->stillTime + ms : 0;
+    uint8_t* status = &mpu->regs[MPU6050_RA_MOT_DETECT_STATUS];
+    if ((enabled & (1 << MPU6050_INTERRUPT_FF_BIT)) && falling
+            && mpu->freefallTime >= mpu->regs[MPU6050_RA_FF_DUR]) {
+        mpu->regs[MPU6050_RA_INT_STATUS] |= 1 << MPU6050_INTERRUPT_FF_BIT;
+    }
+    if ((enabled & (1 << MPU6050_INTERRUPT_MOT_BIT)) && moving
+            && mpu->motionTime >= mpu->regs[MPU6050_RA_MOT_DUR]) {
+        mpu->regs[MPU6050_RA_INT_STATUS] |= 1 << MPU6050_INTERRUPT_MOT_BIT;
+        *status = (*status & (1 << MPU6050_MOTION_MOT_ZRMOT_BIT)) | axes;
+    }
+    if (enabled & (1 << MPU6050_INTERRUPT_ZMOT_BIT)) {
+        // ends with the first sample above the threshold
+        bool still = mpu->still ? quiet : mpu->stillTime >= mpu->regs[MPU6050_RA_ZRMOT_DUR] * 64.0;
+        if (still != mpu->still) {
+            mpu->still = still;
+            mpu->regs[MPU6050_RA_INT_STATUS] |= 1 << MPU6050_INTERRUPT_ZMOT_BIT;
+            *status = (*status & ~(1 << MPU6050_MOTION_MOT_ZRMOT_BIT))
+                    | (still ? 1 << MPU6050_MOTION_MOT_ZRMOT_BIT : 0);
+        }
+    }
+}
+
+/** Push the samples taken since the last access into the FIFO.
+ * The oldest data is overwritten when it is full, as on the real part.
+ * In cycle mode the chip only wakes for an accelerometer conversion at the
+ * LP_WAKE_CTRL rate, which feeds the detectors and not the FIFO.
+ */
+void SimTransport::updateFIFO(MPU* mpu, double t) {
+    uint8_t enabled = mpu->regs[MPU6050_RA_FIFO_EN];
+    uint8_t dlpf = mpu->regs[MPU6050_RA_CONFIG] & 7;
+    bool cycle = mpu->regs[MPU6050_RA_PWR_MGMT_1] & (1 << MPU6050_PWR1_CYCLE_BIT);
+    double rate = cycle ? sWakeRates[mpu->regs[MPU6050_RA_PWR_MGMT_2] >> 6]
+            : (dlpf == 0 || dlpf == 7 ? 8000.0 : 1000.0) / (1 + mpu->regs[MPU6050_RA_SMPLRT_DIV]);
+    uint64_t index = (uint64_t)(t * rate);
+    if (cycle != mpu->cycle) {
+        // sample indexes count at the new rate from here
+        mpu->cycle = cycle;
+        mpu->lastSample = index;
+        return;
+    }
+    if (cycle) {
+        for (uint64_t s = mpu->lastSample + 1; s <= index; s++) {
+            int16_t v[7];
+            sampleMPU(mpu, s / rate, v);
+            detectMotion(mpu, v, 1 / rate);
+        }
+        mpu->lastSample = index;
+        return;
+    }
+    if (!(mpu->regs[MPU6050_RA_USER_CTRL] & (1 << MPU6050_USERCTRL_FIFO_EN_BIT)) || !enabled) {
+        mpu->lastSample = index;
+        return;
+    }
+
+    uint16_t frame = 0;
+    if (enabled & (1 << MPU6050_ACCEL_FIFO_EN_BIT)) frame += 6;
+    if (enabled & (1 << MPU6050_TEMP_FIFO_EN_BIT)) frame += 2;
+    if (enabled & (1 << MPU6050_XG_FIFO_EN_BIT)) frame += 2;
+    if (enabled & (1 << MPU6050_YG_FIFO_EN_BIT)) frame += 2;
+    if (enabled & (1 << MPU6050_ZG_FIFO_EN_BIT)) frame += 2;
+
+    uint64_t first = mpu->lastSample + 1;
+    if (index >= first + SIM_FIFO_SIZE / frame + 1) {
+        // only the newest samples can survive anyway
+        first = index - SIM_FIFO_SIZE / frame;
+        mpu->regs[MPU6050_RA_INT_STATUS] |= 1 << MPU6050_INTERRUPT_FIFO_OFLOW_BIT;
+    }
+    for (uint64_t s = first; s <= index; s++) {
+        int16_t v[7];
+        uint8_t bytes[14];
+        uint16_t n = 0;
+        sampleMPU(mpu, s / rate, v);
+        detectMotion(mpu, v, 1 / rate);
+        for (int i = 0; i < 7; i++) {
+            bool on = i < 3 ? (enabled & (1 << MPU6050_ACCEL_FIFO_EN_BIT))
+                    : i == 3 ? (enabled & (1 << MPU6050_TEMP_FIFO_EN_BIT))
+                    : (enabled & (1 << (MPU6050_XG_FIFO_EN_BIT - (i - 4))));
+            if (on) {
+                bytes[n++] = v[i] >> 8;
+                bytes[n++] = v[i] & 0xff;
+            }
+        }
+        for (uint16_t i = 0; i < n; i++) {
+            if (mpu->fifoCount == SIM_FIFO_SIZE) {
+                mpu->fifoHead = (mpu->fifoHead + 1) % SIM_FIFO_SIZE;
+                mpu->fifoCount--;
+                mpu->regs[MPU6050_RA_INT_STATUS] |= 1 << MPU6050_INTERRUPT_FIFO_OFLOW_BIT;
+            }
+            mpu->fifo[(mpu->fifoHead + mpu->fifoCount) % SIM_FIFO_SIZE] = bytes[i];
+            mpu->fifoCount++;
+        }
+    }
+    mpu->lastSample = index;
+}
+
+uint8_t SimTransport::readMPU(MPU* mpu, uint8_t regAddr, double t) {
+    if (regAddr == MPU6050_RA_FIFO_R_W) {
+        if (mpu->fifoCount == 0) {
+            return 0;
+        }
+        uint8_t b = mpu->fifo[mpu->fifoHead];
+        mpu->fifoHead = (mpu->fifoHead + 1) % SIM_FIFO_SIZE;
+        mpu->fifoCount--;
+        return b;
+    }
+    if (regAddr == MPU6050_RA_FIFO_COUNTH) {
+        return mpu->fifoCount >> 8;
+    }
+    if (regAddr == MPU6050_RA_FIFO_COUNTL) {
+        return mpu->fifoCount & 0xff;
+    }
+    if (regAddr == MPU6050_RA_INT_STATUS) {
+        uint8_t status = mpu->regs[MPU6050_RA_INT_STATUS] | (1 << MPU6050_INTERRUPT_DATA_RDY_BIT);
+        mpu->regs[MPU6050_RA_INT_STATUS] = 0;
+        return status;
+    }
+    if (regAddr >= MPU6050_RA_ACCEL_XOUT_H && regAddr <= MPU6050_RA_GYRO_ZOUT_L) {
+        int16_t v[7];
+        sampleMPU(mpu, t, v);
+        int16_t w = v[(regAddr - MPU6050_RA_ACCEL_XOUT_H) / 2];
+        return (regAddr - MPU6050_RA_ACCEL_XOUT_H) & 1 ? w & 0xff : w >> 8;
+    }
+    return regAddr < sizeof(mpu->regs) ? mpu->regs[regAddr] : 0;
+}
+
+void SimTransport::writeMPU(MPU* mpu, uint8_t regAddr, uint8_t value) {
+    if (regAddr >= sizeof(mpu->regs) || regAddr == MPU6050_RA_WHO_AM_I) {
+        return;
+    }
+    if (regAddr == MPU6050_RA_PWR_MGMT_1 && (value & (1 << MPU6050_PWR1_DEVICE_RESET_BIT))) {
+        resetMPU(mpu);
+        return;
+    }
+    if (regAddr == MPU6050_RA_USER_CTRL && (value & (1 << MPU6050_USERCTRL_FIFO_RESET_BIT))) {
+        mpu->fifoHead = 0;
+        mpu->fifoCount = 0;
+        value &= ~(1 << MPU6050_USERCTRL_FIFO_RESET_BIT);
+    }
+    mpu->regs[regAddr] = value;
+}
+
+/** Magnetometer X/Y/Z counts for the current gain and bias configuration.
+ */
+void SimTransport::sampleMag(double t, int16_t* out) {
+    double roll, rate;
+    boardRoll(t, &roll, &rate);
+    double level[3] = { SIM_FIELD_HORIZONTAL * cos(SIM_YAW), -SIM_FIELD_HORIZONTAL * sin(SIM_YAW), SIM_FIELD_DOWN };
+    double field[3] = {
+        level[0],
+        level[1] * cos(roll) + level[2] * sin(roll),
+        -level[1] * sin(roll) + level[2] * cos(roll)
+    };
+    uint8_t bias = mMagRegs[HMC5883L_RA_CONFIG_A] & 3;
+    double gain = sMagGain[mMagRegs[HMC5883L_RA_CONFIG_B] >> 5];
+    for (int i = 0; i < 3; i++) {
+        double gauss = field[i] + sHardIron[i];
+        if (bias == HMC5883L_BIAS_POSITIVE) {
+            gauss += i == 2 ? 1.08 : 1.16;
+        } else if (bias == HMC5883L_BIAS_NEGATIVE) {
+            gauss -= i == 2 ? 1.08 : 1.16;
+        }
+        double counts = gauss * gain;
+        out[i] = counts < -2048 || counts > 2047 ? -4096 : (int16_t)lrint(counts);
+    }
+}
+
+uint8_t SimTransport::readMag(uint8_t regAddr, double t) {
+    if (regAddr == HMC5883L_RA_DATAX_H) {
+        // a read from the first data register latches a new measurement
+        sampleMag(t, mMagLatched);
+    }
+    if (regAddr >= HMC5883L_RA_DATAX_H && regAddr <= HMC5883L_RA_DATAY_L) {
+        // registers are in X, Z, Y order
+        static const int axis[3] = { 0, 2, 1 };
+        int16_t w = mMagLatched[axis[(regAddr - HMC5883L_RA_DATAX_H) / 2]];
+        return (regAddr - HMC5883L_RA_DATAX_H) & 1 ? w & 0xff : w >> 8;
+    }
+    if (regAddr == HMC5883L_RA_STATUS) {
+        return 0x01;
+    }
+    return regAddr < sizeof(mMagRegs) ? mMagRegs[regAddr] : 0;
+}
+
+int8_t SimTransport::readBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data) {
+    std::lock_guard<std::mutex> lock(mLock);
+    double t = now();
+    if (devAddr == MPU6050_ADDRESS_AD0_LOW || devAddr == MPU6050_ADDRESS_AD0_HIGH) {
+        MPU* mpu = &mMPU[devAddr - MPU6050_ADDRESS_AD0_LOW];
+        updateFIFO(mpu, t);
+        if (regAddr >= MPU6050_RA_ACCEL_XOUT_H && regAddr <= MPU6050_RA_GYRO_ZOUT_L) {
+            // one conversion for the whole burst, like the shadow registers
+            int16_t v[7];
+            sampleMPU(mpu, t, v);
+            for (uint8_t i = 0; i < length; i++) {
+                uint8_t reg = regAddr + i;
+                if (reg > MPU6050_RA_GYRO_ZOUT_L) {
+                    data[i] = readMPU(mpu, reg, t);
+                } else {
+                    int16_t w = v[(reg - MPU6050_RA_ACCEL_XOUT_H) / 2];
+                    data[i] = (reg - MPU6050_RA_ACCEL_XOUT_H) & 1 ? w & 0xff : w >> 8;
+                }
+            }
+            return length;
+        }
+        for (uint8_t i = 0; i < length; i++) {
+            // the FIFO port does not auto-increment
+            data[i] = readMPU(mpu, regAddr == MPU6050_RA_FIFO_R_W ? regAddr : regAddr + i, t);
+        }
+        return length;
+    }
+    if (devAddr == HMC5883L_ADDRESS) {
+        for (uint8_t i = 0; i < length; i++) {
+            data[i] = readMag(regAddr + i, t);
+        }
+        return length;
+    }
+    if (devAddr == MS5611_ADDRESS) {
+        uint32_t value = 0;
+        if (regAddr == MS5611_CMD_ADC_READ) {
+            value = mBaroValue;
+            mBaroValue = 0;
+        } else if (regAddr >= 0xA0 && regAddr <= 0xAE) {
+            value = sBaroProm[(regAddr - 0xA0) / 2];
+        }
+        for (uint8_t i = 0; i < length; i++) {
+            data[i] = value >> (8 * (length - 1 - i));
+        }
+        return length;
+    }
+    return -1;
+}
+
+bool SimTransport::writeBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data) {
+    std::lock_guard<std::mutex> lock(mLock);
+    double t = now();
+    if (devAddr == MPU6050_ADDRESS_AD0_LOW || devAddr == MPU6050_ADDRESS_AD0_HIGH) {
+        MPU* mpu = &mMPU[devAddr - MPU6050_ADDRESS_AD0_LOW];
+        updateFIFO(mpu, t);
+        for (uint8_t i = 0; i < length; i++) {
+            writeMPU(mpu, regAddr + i, data[i]);
+        }
+        return true;
+    }
+    if (devAddr == HMC5883L_ADDRESS) {
+        for (uint8_t i = 0; i < length; i++) {
+            uint8_t reg = regAddr + i;
+            if (reg <= HMC5883L_RA_MODE) {
+                mMagRegs[reg] = data[i];
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+bool SimTransport::writeCommand(uint8_t devAddr, uint8_t command) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (devAddr != MS5611_ADDRESS) {
+        return false;
+    }
+    if ((command & 0xF0) == MS5611_CMD_CONV_D1) {
+        mBaroValue = SIM_BARO_D1 + (int)(mNoise & 0x1f) - 16;
+    } else if ((command & 0xF0) == MS5611_CMD_CONV_D2) {
+        mBaroValue = SIM_BARO_D2;
+    }
+    return true;
+}
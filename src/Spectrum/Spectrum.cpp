@@ -0,0 +1,283 @@
+#include <math.h>
+#include <string.h>
+
+#include "Spectrum.h"
+
+// half width of the Hann main lobe, in bins
+#define SPECTRUM_LOBE 2
+
+SpectrumAnalyzer::SpectrumAnalyzer(const SpectrumSettings& settings)
+    : mSettings(settings), mWindowSum(0), mWindowPower(0), mFill(0), mFrames(0), mRate(0),
+      mTimestamp(0), mStart(0), mMissed(0) {
+    uint32_t size = mSettings.size;
+    if (mSettings.hop == 0 || mSettings.hop > size) {
+        mSettings.hop = size;
+    }
+    if (mSettings.peaks > SPECTRUM_MAX_PEAKS) {
+        mSettings.peaks = SPECTRUM_MAX_PEAKS;
+    }
+
+    // periodic Hann window
+    mWindow.resize(size);
+    for (uint32_t n = 0; n < size; n++) {
+        mWindow[n] = 0.5 - 0.5 * cos(2 * M_PI * n / size);
+        mWindowSum += mWindow[n];
+        mWindowPower += mWindow[n] * mWindow[n];
+    }
+    uint32_t bits = 0;
+    while ((1u << bits) < size) {
+        bits++;
+    }
+    mReverse.resize(size);
+    for (uint32_t n = 0; n < size; n++) {
+        uint32_t reversed = 0;
+        for (uint32_t b = 0; b < bits; b++) {
+            reversed |= ((n >> b) & 1) << (bits - 1 - b);
+        }
+        mReverse[n] = reversed;
+    }
+    mCos.resize(size / 2);
+    mSin.resize(size / 2);
+    for (uint32_t k = 0; k < size / 2; k++) {
+        mCos[k] = cos(2 * M_PI * k / size);
+        mSin[k] = sin(2 * M_PI * k / size);
+    }
+
+    mInput.assign(size * SPECTRUM_STRIDE, 0);
+    mRe.assign(size * SPECTRUM_STRIDE, 0);
+    mIm.assign(size * SPECTRUM_STRIDE, 0);
+    mPower.assign((size / 2 + 1) * SPECTRUM_STRIDE, 0);
+}
+
+/** Drop the samples and the frames since the last result, e.g. when the
+ * rate changes or samples were lost.
+ */
+void SpectrumAnalyzer::restart() {
+    mFill = 0;
+    mFrames = 0;
+    mStart = 0;
+    memset(mPower.data(), 0, mPower.size() * sizeof(float));
+}
+
+/** FFT of the frame in mInput into mRe and mIm, and its power added to
+ * mPower.
+ */
+void SpectrumAnalyzer::transform() {
+    uint32_t size = mSettings.size;
+    float mean[SPECTRUM_STRIDE] = { 0 };
+    for (uint32_t n = 0; n < size; n++) {
+        const float* in = &mInput[n * SPECTRUM_STRIDE];
+        for (uint32_t c = 0; c < SPECTRUM_STRIDE; c++) {
+            mean[c] += in[c];
+        }
+    }
+    for (uint32_t c = 0; c < SPECTRUM_STRIDE; c++) {
+        mean[c] /= size;
+    }
+    for (uint32_t n = 0; n < size; n++) {
+        const float* in = &mInput[n * SPECTRUM_STRIDE];
+        float* re = &mRe[mReverse[n] * SPECTRUM_STRIDE];
+        float* im = &mIm[mReverse[n] * SPECTRUM_STRIDE];
+        float w = mWindow[n];
+        for (uint32_t c = 0; c < SPECTRUM_STRIDE; c++) {
+            re[c] = (in[c] - mean[c]) * w;
+            im[c] = 0;
+        }
+    }
+
+    // iterative decimation in time, all axes per butterfly
+    for (uint32_t length = 2; length <= size; length <<= 1) {
+        uint32_t half = length / 2;
+        uint32_t step = size / length;
+        for (uint32_t i = 0; i < size; i += length) {
+            for (uint32_t j = 0; j < half; j++) {
+                float wr = mCos[j * step];
+                float wi = -mSin[j * step];
+                float* ar = &mRe[(i + j) * SPECTRUM_STRIDE];
+                float* ai = &mIm[(i + j) * SPECTRUM_STRIDE];
+                float* br = &mRe[(i + j + half) * SPECTRUM_STRIDE];
+                float* bi = &mIm[(i + j + half) * SPECTRUM_STRIDE];
+                for (uint32_t c = 0; c < SPECTRUM_STRIDE; c++) {
+                    float tr = wr * br[c] - wi * bi[c];
+                    float ti = wr * bi[c] + wi * br[c];
+                    br[c] = ar[c] - tr;
+                    bi[c] = ai[c] - ti;
+                    ar[c] += tr;
+                    ai[c] += ti;
+                }
+            }
+        }
+    }
+
+    for (uint32_t k = 0; k <= size / 2; k++) {
+        const float* re = &mRe[k * SPECTRUM_STRIDE];
+        const float* im = &mIm[k * SPECTRUM_STRIDE];
+        float* power = &mPower[k * SPECTRUM_STRIDE];
+        for (uint32_t c = 0; c < SPECTRUM_STRIDE; c++) {
+            power[c] += re[c] * re[c] + im[c] * im[c];
+        }
+    }
+    mFrames++;
+}
+
+/** Turn the averaged power into a result for take(), and start the next
+ * interval.
+ */
+void SpectrumAnalyzer::publish() {
+    uint32_t size = mSettings.size;
+    uint32_t bins = size / 2 + 1;
+    uint32_t peaks = mSettings.peaks;
+    uint32_t bands = mSettings.bands.size() / 2;
+    float resolution = (float)mRate / size;
+
+    SpectrumResult result;
+    result.timestamp = mTimestamp;
+    result.rate = mRate;
+    result.frames = mFrames;
+    result.bins = bins;
+    result.amplitude.resize(SPECTRUM_CHANNELS * bins);
+    result.peaks.assign(SPECTRUM_CHANNELS * peaks * 2, 0);
+    result.bands.assign(SPECTRUM_CHANNELS * bands, 0);
+
+    for (uint32_t c = 0; c < SPECTRUM_CHANNELS; c++) {
+        float* amplitude = &result.amplitude[c * bins];
+        for (uint32_t k = 0; k < bins; k++) {
+            // one-sided: the other half of the energy is in the mirror bin
+            float sides = k == 0 || k == bins - 1 ? 1 : 2;
+            float power = mPower[k * SPECTRUM_STRIDE + c] / mFrames;
+            amplitude[k] = sides * sqrtf(power) / mWindowSum;
+        }
+
+        // local maxima, strongest first, at the vertex of the parabola
+        // through the bin and its neighbours; the amplitude is taken from
+        // the power of the whole main lobe of the window, which does not
+        // drop for a frequency between bins like the peak bin does
+        float* peak = &result.peaks[c * peaks * 2];
+        for (uint32_t k = 1; peaks > 0 && k + 1 < bins; k++) {
+            float left = amplitude[k - 1], centre = amplitude[k], right = amplitude[k + 1];
+            if (!(centre > left && centre >= right)) {
+                continue;
+            }
+            double lobe = 0;
+            for (uint32_t l = k > SPECTRUM_LOBE ? k - SPECTRUM_LOBE : 0; l <= k + SPECTRUM_LOBE && l < bins; l++) {
+                float sides = l == 0 || l == bins - 1 ? 1 : 2;
+                lobe += sides * mPower[l * SPECTRUM_STRIDE + c];
+            }
+            float strength = sqrt(2 * lobe / mFrames / ((double)size * mWindowPower));
+            if (strength <= peak[(peaks - 1) * 2 + 1]) {
+                continue;
+            }
+            float curvature = left - 2 * centre + right;
+            float offset = curvature < 0 ? 0.5f * (left - right) / curvature : 0;
+            uint32_t slot = peaks - 1;
+            while (slot > 0 && peak[(slot - 1) * 2 + 1] < strength) {
+                peak[slot * 2] = peak[(slot - 1) * 2];
+                peak[slot * 2 + 1] = peak[(slot - 1) * 2 + 1];
+                slot--;
+            }
+            peak[slot * 2] = (k + offset) * resolution;
+            peak[slot * 2 + 1] = strength;
+        }
+
+        // Parseval, corrected for the power of the window
+        for (uint32_t b = 0; b < bands; b++) {
+            float low = mSettings.bands[b * 2], high = mSettings.bands[b * 2 + 1];
+            double sum = 0;
+            for (uint32_t k = 0; k < bins; k++) {
+                float frequency = k * resolution;
+                if (frequency >= low && frequency <= high) {
+                    float sides = k == 0 || k == bins - 1 ? 1 : 2;
+                    sum += sides * mPower[k * SPECTRUM_STRIDE + c];
+                }
+            }
+            result.bands[c * bands + b] = sqrt(sum / mFrames / ((double)size * mWindowPower));
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (mDone.size() < SPECTRUM_MAX_PENDING) {
+            mDone.push_back(SpectrumResult());
+            mDone.back().timestamp = result.timestamp;
+            mDone.back().rate = result.rate;
+            mDone.back().frames = result.frames;
+            mDone.back().bins = result.bins;
+            mDone.back().amplitude.swap(result.amplitude);
+            mDone.back().peaks.swap(result.peaks);
+            mDone.back().bands.swap(result.bands);
+        } else {
+            mMissed++;
+        }
+    }
+    mFrames = 0;
+    mStart = mTimestamp;
+    memset(mPower.data(), 0, mPower.size() * sizeof(float));
+}
+
+/** Feed samples; called on the acquisition thread.
+ * @param rate Hz the samples were taken at; a change starts over
+ */
+void SpectrumAnalyzer::write(const Sample* samples, uint32_t count, uint32_t rate) {
+    if (rate != mRate) {
+        restart();
+        mRate = rate;
+    }
+    uint32_t size = mSettings.size;
+    for (uint32_t i = 0; i < count; i++) {
+        const Sample& sample = samples[i];
+        if (sample.flags & (SAMPLE_GAP | SAMPLE_LOW_POWER)) {
+            // frames need evenly spaced samples of every axis
+            restart();
+            if (sample.flags & SAMPLE_LOW_POWER) {
+                continue;
+            }
+        }
+        if (mStart == 0) {
+            mStart = sample.timestamp;
+        }
+        mTimestamp = sample.timestamp;
+        float* in = &mInput[mFill * SPECTRUM_STRIDE];
+        for (int axis = 0; axis < 3; axis++) {
+            in[axis] = sample.accel[axis];
+            in[axis + 3] = sample.gyro[axis];
+        }
+        in[6] = in[7] = 0;
+        if (++mFill < size) {
+            continue;
+        }
+
+        transform();
+        uint32_t keep = size - mSettings.hop;
+        memmove(mInput.data(), &mInput[mSettings.hop * SPECTRUM_STRIDE], keep * SPECTRUM_STRIDE * sizeof(float));
+        mFill = keep;
+        if (mTimestamp - mStart >= mSettings.interval) {
+            publish();
+        }
+    }
+}
+
+/** Oldest result, moved into result.
+ * @return false if none is waiting
+ */
+bool SpectrumAnalyzer::take(SpectrumResult* result) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mDone.empty()) {
+        return false;
+    }
+    result->timestamp = mDone.front().timestamp;
+    result->rate = mDone.front().rate;
+    result->frames = mDone.front().frames;
+    result->bins = mDone.front().bins;
+    result->amplitude.swap(mDone.front().amplitude);
+    result->peaks.swap(mDone.front().peaks);
+    result->bands.swap(mDone.front().bands);
+    mDone.pop_front();
+    return true;
+}
+
+/** Results dropped because SPECTRUM_MAX_PENDING were waiting to be taken.
+ */
+uint64_t SpectrumAnalyzer::getMissed() const {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mMissed;
+}
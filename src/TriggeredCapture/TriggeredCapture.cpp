@@ -0,0 +1,148 @@
+#include <string.h>
+
+#include "TriggeredCapture.h"
+
+TriggeredCapture::TriggeredCapture(const CaptureSettings& settings)
+    : mSettings(settings), mRing(settings.preSamples), mRingHead(0), mRingCount(0), mBelow(0),
+      mCapturing(false), mRemaining(0), mSequence(0), mManual(false), mEvents(0), mMissed(0) {
+    mShock = (uint64_t)settings.shockThreshold * settings.shockThreshold;
+    mFreefall = (uint64_t)settings.freefallThreshold * settings.freefallThreshold;
+    if (mSettings.freefallSamples == 0) {
+        mSettings.freefallSamples = 1;
+    }
+}
+
+/** CAPTURE_* sources the sample fires, updating the free-fall run.
+ */
+uint32_t TriggeredCapture::check(const Sample& sample) {
+    uint32_t reason = 0;
+    if (sample.flags & SAMPLE_FREEFALL) {
+        reason |= CAPTURE_HW_FREEFALL;
+    }
+    if (sample.flags & SAMPLE_MOTION) {
+        reason |= CAPTURE_HW_MOTION;
+    }
+    if (mSettings.triggers & (CAPTURE_SHOCK | CAPTURE_FREEFALL)) {
+        int32_t x = sample.accel[0], y = sample.accel[1], z = sample.accel[2];
+        uint64_t magnitude = (uint64_t)(x * x) + (uint64_t)(y * y) + (uint64_t)(z * z);
+        if (magnitude > mShock) {
+            reason |= CAPTURE_SHOCK;
+        }
+        if (magnitude < mFreefall) {
+            // fire once per run, when it has lasted long enough
+            if (++mBelow == mSettings.freefallSamples) {
+                reason |= CAPTURE_FREEFALL;
+            }
+        } else {
+            mBelow = 0;
+        }
+    }
+    if (mManual.exchange(false)) {
+        reason |= CAPTURE_MANUAL;
+    }
+    return reason & mSettings.triggers;
+}
+
+/** Start an event at sample: the pre-trigger ring, oldest first, then the
+ * trigger sample itself.
+ */
+void TriggeredCapture::begin(const Sample& sample, uint32_t reason) {
+    mCurrent.sequence = ++mSequence;
+    mCurrent.reason = reason;
+    mCurrent.trigger = mRingCount;
+    mCurrent.timestamp = sample.timestamp;
+    mCurrent.samples.clear();
+    mCurrent.samples.reserve(mRingCount + 1 + mSettings.postSamples);
+    uint32_t first = mRingCount < mRing.size() ? 0 : mRingHead;
+    for (uint32_t i = 0; i < mRingCount; i++) {
+        mCurrent.samples.push_back(mRing[(first + i) % mRing.size()]);
+    }
+    mCurrent.samples.push_back(sample);
+    mRemaining = mSettings.postSamples;
+    mCapturing = true;
+}
+
+/** Feed samples; called on the acquisition thread.
+ */
+void TriggeredCapture::write(const Sample* samples, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        const Sample& sample = samples[i];
+        uint32_t reason = check(sample);
+        if (mCapturing) {
+            mCurrent.reason |= reason;
+            mCurrent.samples.push_back(sample);
+            mRemaining--;
+        } else if (reason) {
+            begin(sample, reason);
+        }
+        if (mCapturing && mRemaining == 0) {
+            std::lock_guard<std::mutex> lock(mLock);
+            if (mDone.size() < CAPTURE_MAX_PENDING) {
+                mDone.push_back(CaptureEvent());
+                mDone.back().sequence = mCurrent.sequence;
+                mDone.back().reason = mCurrent.reason;
+                mDone.back().trigger = mCurrent.trigger;
+                mDone.back().timestamp = mCurrent.timestamp;
+                mDone.back().samples.swap(mCurrent.samples);
+                mEvents++;
+            } else {
+                mMissed++;
+            }
+            mCapturing = false;
+        }
+
+        // the ring keeps running during an event, so one that follows
+        // closely still gets its pre-trigger samples
+        if (!mRing.empty()) {
+            mRing[mRingHead] = sample;
+            mRingHead = (mRingHead + 1) % mRing.size();
+            if (mRingCount < mRing.size()) {
+                mRingCount++;
+            }
+        }
+    }
+}
+
+/** Fire CAPTURE_MANUAL with the next sample written, if enabled.
+ */
+void TriggeredCapture::trigger() {
+    mManual = true;
+}
+
+/** Oldest completed event, moved into event.
+ * @return false if none is waiting
+ */
+bool TriggeredCapture::take(CaptureEvent* event) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mDone.empty()) {
+        return false;
+    }
+    event->sequence = mDone.front().sequence;
+    event->reason = mDone.front().reason;
+    event->trigger = mDone.front().trigger;
+    event->timestamp = mDone.front().timestamp;
+    event->samples.swap(mDone.front().samples);
+    mDone.pop_front();
+    return true;
+}
+
+/** An event is collecting its post-trigger samples; acquisition thread
+ * only.
+ */
+bool TriggeredCapture::isCapturing() const {
+    return mCapturing;
+}
+
+/** Events completed, taken or not.
+ */
+uint64_t TriggeredCapture::getEvents() const {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mEvents;
+}
+
+/** Events dropped because CAPTURE_MAX_PENDING were waiting to be taken.
+ */
+uint64_t TriggeredCapture::getMissed() const {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mMissed;
+}
@@ -0,0 +1,171 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Units.h"
+#include "Acquisition.h"
+#include "MagCalibration.h"
+
+#define UNITS_BLOCK 64
+
+// LSB per g for AFS_SEL 0-3
+static const float sAccelLSB[] = { 16384, 8192, 4096, 2048 };
+// LSB per deg/s for FS_SEL 0-3
+static const float sGyroLSB[] = { 131, 65.5f, 32.8f, 16.4f };
+// mGauss per LSB for the HMC5883L gain settings 0-7
+static const float sMagResolution[] = { 0.73f, 0.92f, 1.22f, 1.52f, 2.27f, 2.56f, 3.03f, 4.35f };
+
+/** Starts with the power-on settings the drivers' initialize() leave behind:
+ * +-2g, +-250 deg/s and 1.3 Gauss.
+ */
+UnitScales::UnitScales() {
+    setAccelRange(0);
+    setGyroRange(0);
+    setMagGain(1);
+}
+
+void UnitScales::setAccelRange(uint8_t range) {
+    mAccelRange = range & 3;
+    mAccelScale = 1.0f / sAccelLSB[mAccelRange];
+}
+
+void UnitScales::setGyroRange(uint8_t range) {
+    mGyroRange = range & 3;
+    mGyroScale = 1.0f / sGyroLSB[mGyroRange];
+}
+
+void UnitScales::setMagGain(uint8_t gain) {
+    mMagGain = gain & 7;
+    // 1 mGauss is 0.1 uT
+    mMagScale = sMagResolution[mMagGain] * 0.1f;
+}
+
+uint8_t UnitScales::getAccelRange() const {
+    return mAccelRange;
+}
+
+uint8_t UnitScales::getGyroRange() const {
+    return mGyroRange;
+}
+
+uint8_t UnitScales::getMagGain() const {
+    return mMagGain;
+}
+
+float UnitScales::getAccelScale() const {
+    return mAccelScale;
+}
+
+float UnitScales::getGyroScale() const {
+    return mGyroScale;
+}
+
+float UnitScales::getMagScale() const {
+    return mMagScale;
+}
+
+/** Convert a frame in place.
+ * @param frame Raw accel X/Y/Z, gyro X/Y/Z and, with 9 axes, corrected mag X/Y/Z
+ * @param axes 6 or 9
+ */
+void UnitScales::toUnits(float* frame, uint32_t axes) const {
+    for (int i = 0; i < 3; i++) {
+        frame[i] *= mAccelScale;
+        frame[i + 3] *= mGyroScale;
+    }
+    if (axes > 6) {
+        for (int i = 6; i < 9; i++) {
+            frame[i] *= mMagScale;
+        }
+    }
+}
+
+/** Multiply a contiguous block of raw values, widening them to float or to
+ * Q16.16 (where the product of an int16_t count and the scale's raw value
+ * fits 32 bits for every range).
+ */
+template<typename T>
+static inline void scaleBlock(const int16_t* in, uint32_t n, T scale, T* out) {
+    for (uint32_t i = 0; i < n; i++) {
+        out[i] = in[i] * scale;
+    }
+}
+
+/** Gather one 3 axis field of count samples, UNITS_BLOCK at a time, and
+ * scale it. The gather is a strided copy of 16 bit values; the multiply
+ * runs over contiguous memory.
+ * @param field Byte offset of the int16_t[3] field in Sample
+ */
+template<typename T>
+static void scaleField(const Sample* samples, uint32_t count, size_t field, T scale, T* out) {
+    int16_t block[UNITS_BLOCK * 3];
+    for (uint32_t start = 0; start < count; start += UNITS_BLOCK) {
+        uint32_t n = count - start < UNITS_BLOCK ? count - start : UNITS_BLOCK;
+        for (uint32_t i = 0; i < n; i++) {
+            memcpy(&block[i * 3], reinterpret_cast<const char*>(&samples[start + i]) + field,
+                    3 * sizeof(int16_t));
+        }
+        scaleBlock(block, n * 3, scale, out + start * 3);
+    }
+}
+
+/** Accelerometer in g.
+ * @param out Receives interleaved X/Y/Z, 3 * count values
+ */
+void UnitScales::accel(const Sample* samples, uint32_t count, float* out) const {
+    scaleField(samples, count, offsetof(Sample, accel), mAccelScale, out);
+}
+
+/** Gyro in deg/s.
+ * @param out Receives interleaved X/Y/Z, 3 * count values
+ */
+void UnitScales::gyro(const Sample* samples, uint32_t count, float* out) const {
+    scaleField(samples, count, offsetof(Sample, gyro), mGyroScale, out);
+}
+
+/** Accelerometer in g, Q16.16.
+ * @param out Receives interleaved X/Y/Z, 3 * count values
+ */
+void UnitScales::accel(const Sample* samples, uint32_t count, q16_t* out) const {
+    scaleField(samples, count, offsetof(Sample, accel), q16_t(mAccelScale), out);
+}
+
+/** Gyro in deg/s, Q16.16. The scale is rounded to 16 fractional bits,
+ * within 0.1% at every range.
+ * @param out Receives interleaved X/Y/Z, 3 * count values
+ */
+void UnitScales::gyro(const Sample* samples, uint32_t count, q16_t* out) const {
+    scaleField(samples, count, offsetof(Sample, gyro), q16_t(mGyroScale), out);
+}
+
+/** Magnetometer in uT, after hard and soft iron correction.
+ * @param out Receives interleaved X/Y/Z, 3 * count values
+ */
+void UnitScales::mag(const Sample* samples, uint32_t count, const MagCorrection& correction,
+        float* out) const {
+    for (uint32_t i = 0; i < count; i++) {
+        correction.apply(samples[i].mag[0], samples[i].mag[1], samples[i].mag[2], &out[i * 3]);
+    }
+    for (uint32_t i = 0; i < count * 3; i++) {
+        out[i] *= mMagScale;
+    }
+}
+
+/** MPU6050 die temperature in deg C.
+ */
+void UnitScales::temperature(const Sample* samples, uint32_t count, float* out) {
+    int16_t block[UNITS_BLOCK];
+    for (uint32_t start = 0; start < count; start += UNITS_BLOCK) {
+        uint32_t n = count - start < UNITS_BLOCK ? count - start : UNITS_BLOCK;
+        for (uint32_t i = 0; i < n; i++) {
+            block[i] = samples[start + i].temperature;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            out[start + i] = temperature(block[i]);
+        }
+    }
+}
+
+float UnitScales::temperature(int16_t raw) {
+    return raw / 340.0f + 36.53f;
+}
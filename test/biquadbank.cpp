@@ -0,0 +1,70 @@
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "BiquadBank.h"
+
+#include "test.h"
+
+#define RATE 1000
+#define SAMPLES 2000
+#define SETTLE 500
+
+/**
+ * amplitude of gyro x (or accel x) from SETTLE on, around offset
+ */
+static double amplitude(const std::vector<Sample>& samples, bool gyro, double offset) {
+    double peak = 0;
+    for (size_t i = SETTLE; i < samples.size(); i++) {
+        double v = (gyro ? samples[i].gyro[0] : samples[i].accel[0]) - offset;
+        peak = fmax(peak, fabs(v));
+    }
+    return peak;
+}
+
+/**
+ * a sine of 1000 counts at frequency on gyro x and accel x, with a
+ * constant offset, through bank; frequencies that divide RATE / 4 sample
+ * the crest
+ */
+static double run(BiquadBank* bank, double frequency, bool gyro) {
+    std::vector<Sample> samples(SAMPLES);
+    for (int i = 0; i < SAMPLES; i++) {
+        memset(&samples[i], 0, sizeof(Sample));
+        samples[i].timestamp = (uint64_t)(i + 1) * 1000000000ULL / RATE;
+        int16_t v = (int16_t)lrint(200 + 1000 * sin(2 * M_PI * frequency * i / RATE));
+        samples[i].gyro[0] = v;
+        samples[i].accel[0] = v;
+    }
+    bank->reset();
+    for (int i = 0; i < SAMPLES; i += 10) {
+        bank->filter(&samples[i], 10, RATE);
+    }
+    return amplitude(samples, gyro, 200);
+}
+
+void testBiquadBank() {
+    BiquadSpec notch = { BIQUAD_NOTCH, SENSOR_GYRO, 125, BIQUAD_DEFAULT_NOTCH_Q };
+    BiquadBank bank;
+    CHECK(!bank.isActive());
+    CHECK(bank.setSections(&notch, 1));
+    CHECK(bank.getSections() == 1);
+
+    // the notch takes out its frequency on the gyro, keeps the offset and
+    // leaves the accelerometer and other frequencies alone
+    CHECK(run(&bank, 125, true) < 20);
+    CHECK_NEAR(run(&bank, 125, false), 1000, 2);
+    CHECK_NEAR(run(&bank, 20, true), 1000, 30);
+
+    // second order low-pass, -40 dB per decade
+    BiquadSpec lowpass = { BIQUAD_LOWPASS, BIQUAD_SENSORS, 50, BIQUAD_DEFAULT_LOWPASS_Q };
+    CHECK(bank.setSections(&lowpass, 1));
+    CHECK(run(&bank, 200, true) < 1000 / 16.0 * 1.2);
+    CHECK(run(&bank, 200, false) < 1000 / 16.0 * 1.2);
+    CHECK_NEAR(run(&bank, 5, true), 1000, 30);
+
+    // invalid sections change nothing
+    BiquadSpec invalid = { BIQUAD_NOTCH, SENSOR_GYRO, -1, 1 };
+    CHECK(!bank.setSections(&invalid, 1));
+    CHECK(bank.getSections() == 1);
+}
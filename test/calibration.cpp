@@ -0,0 +1,77 @@
+#include <math.h>
+#include <mutex>
+#include <stdint.h>
+#include <time.h>
+
+#include "MPU6050.h"
+#include "MPU6050Calibration.h"
+#include "SimTransport.h"
+
+#include "test.h"
+
+// the simulated bias, in offset register steps: accel 1/2048 g, gyro
+// 1/32.8 deg/s; the registers move the reading the other way
+static const double sAccelSteps[3] = { -0.012 * 2048, 0.007 * 2048, -0.021 * 2048 };
+static const double sGyroSteps[3] = { -0.42 * 32.8, 0.23 * 32.8, -0.15 * 32.8 };
+
+class Progress : public CalibrationListener {
+    public:
+        Progress() : calls(0), iterations(0), lastDone(false), lastConverged(false) {}
+        void onProgress(const CalibrationProgress& progress) {
+            calls++;
+            iterations = progress.iteration;
+            lastDone = progress.done;
+            lastConverged = progress.converged;
+        }
+        uint32_t calls;
+        uint32_t iterations;
+        bool lastDone;
+        bool lastConverged;
+};
+
+static double elapsedMs(const struct timespec& start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+void testMPU6050Calibration() {
+    std::mutex bus;
+    // a fresh board rests for its first four seconds
+    SimTransport sim;
+    I2CTransport::registerBus("calibration", &sim);
+    {
+        MPU6050 mpu("calibration", 0x68);
+        mpu.initialize();
+
+        // at rest it converges on the offsets that cancel the bias
+        MPU6050Calibration calibration(&mpu, &bus);
+        calibration.setTimeBudget(3000);
+        Progress progress;
+        int16_t offsets[6];
+        CHECK(calibration.run(offsets, &progress));
+        CHECK(progress.lastDone && progress.lastConverged);
+        CHECK(progress.iterations < CALIBRATION_DEFAULT_ITERATIONS);
+        for (int axis = 0; axis < 3; axis++) {
+            CHECK_NEAR(offsets[axis], sAccelSteps[axis], 2);
+            CHECK_NEAR(offsets[axis + 3], sGyroSteps[axis], 1);
+        }
+        // and leaves the chip as it found it, but for the offsets
+        CHECK(!mpu.getFIFOEnabled());
+        CHECK(mpu.getXGyroOffset() == offsets[3]);
+
+        // a budget too short for one iteration ends the run on time and
+        // still reports once, done but not converged
+        MPU6050Calibration hurried(&mpu, &bus);
+        hurried.setSamples(1000);
+        hurried.setTimeBudget(100);
+        Progress cut;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        CHECK(!hurried.run(offsets, &cut));
+        CHECK(elapsedMs(start) < 100 + 50);
+        CHECK(cut.calls == 1);
+        CHECK(cut.lastDone && !cut.lastConverged);
+    }
+    I2CTransport::unregisterBus("calibration");
+}
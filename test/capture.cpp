@@ -0,0 +1,137 @@
+#include <string.h>
+#include <vector>
+
+#include "TriggeredCapture.h"
+
+#include "test.h"
+
+#define PRE 100
+#define POST 200
+#define ONE_G 16384
+
+/**
+ * a board at rest, the timestamp numbering the samples; shocks, free falls
+ * and motion interrupts are set by the caller
+ */
+static std::vector<Sample> still(uint32_t count) {
+    std::vector<Sample> samples(count);
+    memset(samples.data(), 0, count * sizeof(Sample));
+    for (uint32_t i = 0; i < count; i++) {
+        samples[i].timestamp = i;
+        samples[i].accel[2] = ONE_G;
+    }
+    return samples;
+}
+
+/**
+ * in uneven batches, as FIFO drains come
+ */
+static void feed(TriggeredCapture* capture, const std::vector<Sample>& samples) {
+    for (uint32_t i = 0; i < samples.size(); i += 7) {
+        capture->write(&samples[i], samples.size() - i < 7 ? samples.size() - i : 7);
+    }
+}
+
+/**
+ * the event holds samples first to last in order, around trigger
+ */
+static bool window(const CaptureEvent& event, uint64_t first, uint64_t trigger, uint64_t last) {
+    if (event.samples.size() != last - first + 1 || event.trigger != trigger - first
+            || event.timestamp != trigger) {
+        return false;
+    }
+    for (size_t i = 0; i < event.samples.size(); i++) {
+        if (event.samples[i].timestamp != first + i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void testTriggeredCapture() {
+    CaptureSettings settings;
+    settings.preSamples = PRE;
+    settings.postSamples = POST;
+    settings.triggers = CAPTURE_SHOCK | CAPTURE_FREEFALL | CAPTURE_HW_MOTION;
+    settings.shockThreshold = 3 * ONE_G / 2;
+    settings.freefallThreshold = ONE_G / 4;
+    settings.freefallSamples = 20;
+    CaptureEvent event;
+
+    // a shock gets PRE samples before it and POST after; a motion interrupt
+    // inside the post window joins the same event
+    {
+        TriggeredCapture capture(settings);
+        std::vector<Sample> samples = still(1000);
+        samples[500].accel[0] = 30000;
+        samples[550].flags = SAMPLE_MOTION;
+        feed(&capture, samples);
+        CHECK(capture.take(&event));
+        CHECK(window(event, 500 - PRE, 500, 500 + POST));
+        CHECK(event.sequence == 1);
+        CHECK(event.reason == (CAPTURE_SHOCK | CAPTURE_HW_MOTION));
+        CHECK(!capture.take(&event));
+        CHECK(capture.getEvents() == 1 && capture.getMissed() == 0);
+    }
+
+    // before the ring has filled the pre window is what there is; a
+    // trigger right after an event still gets its full pre window, and the
+    // software free fall fires once its run is long enough, not before
+    {
+        TriggeredCapture capture(settings);
+        std::vector<Sample> samples = still(1200);
+        samples[30].accel[0] = 30000;
+        for (uint32_t i = 240; i < 300; i++) {
+            samples[i].accel[2] = 0;
+        }
+        feed(&capture, samples);
+        CHECK(capture.take(&event));
+        CHECK(window(event, 0, 30, 30 + POST));
+        CHECK(capture.take(&event));
+        CHECK(window(event, 259 - PRE, 259, 259 + POST));
+        CHECK(event.sequence == 2 && event.reason == CAPTURE_FREEFALL);
+        CHECK(!capture.take(&event));
+    }
+
+    // triggers that are not enabled do nothing; manual fires on the next
+    // sample when enabled
+    {
+        TriggeredCapture capture(settings);
+        std::vector<Sample> samples = still(400);
+        samples[100].flags = SAMPLE_FREEFALL;
+        capture.trigger();
+        feed(&capture, samples);
+        CHECK(!capture.take(&event));
+
+        settings.triggers |= CAPTURE_MANUAL;
+        TriggeredCapture manual(settings);
+        feed(&manual, samples);
+        manual.trigger();
+        std::vector<Sample> more = still(POST + 10);
+        for (uint32_t i = 0; i < more.size(); i++) {
+            more[i].timestamp = 400 + i;
+        }
+        feed(&manual, more);
+        CHECK(manual.take(&event));
+        CHECK(window(event, 400 - PRE, 400, 400 + POST));
+        CHECK(event.reason == CAPTURE_MANUAL);
+    }
+
+    // events nobody takes are kept up to CAPTURE_MAX_PENDING, the rest are
+    // counted as missed
+    {
+        TriggeredCapture capture(settings);
+        std::vector<Sample> samples = still((CAPTURE_MAX_PENDING + 2) * 300 + 300);
+        for (uint32_t n = 0; n < CAPTURE_MAX_PENDING + 2; n++) {
+            samples[150 + n * 300].accel[0] = 30000;
+        }
+        feed(&capture, samples);
+        CHECK(capture.getEvents() == CAPTURE_MAX_PENDING);
+        CHECK(capture.getMissed() == 2);
+        uint32_t taken = 0;
+        while (capture.take(&event)) {
+            taken++;
+        }
+        CHECK(taken == CAPTURE_MAX_PENDING);
+    }
+}
@@ -0,0 +1,105 @@
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "Decimator.h"
+
+#include "test.h"
+
+#define INPUT_RATE 1000
+#define OUTPUT_RATE 50
+#define FACTOR (INPUT_RATE / OUTPUT_RATE)
+#define SAMPLES 8000
+#define AMPLITUDE 10000
+
+/**
+ * a tone of frequency Hz on accel X, gyro Y and mag Z, the timestamp
+ * counting ms and a flag on every 97th sample
+ */
+static std::vector<Sample> tone(double frequency) {
+    std::vector<Sample> samples(SAMPLES);
+    memset(samples.data(), 0, SAMPLES * sizeof(Sample));
+    for (uint32_t i = 0; i < SAMPLES; i++) {
+        int16_t v = (int16_t)lrint(AMPLITUDE * sin(2 * M_PI * frequency * i / INPUT_RATE));
+        samples[i].timestamp = (uint64_t)i * 1000000;
+        samples[i].accel[0] = v;
+        samples[i].gyro[1] = v;
+        samples[i].mag[2] = v;
+        samples[i].temperature = (int16_t)i;
+        samples[i].flags = i % 97 == 0 ? SAMPLE_MAG : 0;
+    }
+    return samples;
+}
+
+/**
+ * through the decimator in uneven batches
+ */
+static std::vector<Sample> decimate(Decimator* decimator, const std::vector<Sample>& in) {
+    std::vector<Sample> out(in.size() / decimator->getFactor() + 1);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < in.size(); i += 37) {
+        uint32_t count = in.size() - i < 37 ? in.size() - i : 37;
+        n += decimator->write(&in[i], count, &out[n]);
+    }
+    out.resize(n);
+    return out;
+}
+
+/**
+ * amplitude of accel X after the filters settled, from its RMS over whole
+ * periods of a tone at an eighth of the output rate (or its alias)
+ */
+static double amplitude(const std::vector<Sample>& out) {
+    double sum = 0;
+    size_t first = out.size() / 4, n = (out.size() - first) / 8 * 8;
+    for (size_t i = first; i < first + n; i++) {
+        sum += (double)out[i].accel[0] * out[i].accel[0];
+    }
+    return sqrt(2 * sum / n);
+}
+
+static void checkFilter(bool cic, double aliasLimit) {
+    Decimator decimator;
+    CHECK(decimator.configure(FACTOR, cic));
+    CHECK(decimator.getFactor() == FACTOR);
+    CHECK(decimator.getStages() >= 2);
+
+    // one output per factor inputs; a tone in the passband comes through
+    // whole on every channel, lined up with the timestamps, and the slow
+    // channels are those of the input at the centre of the delay
+    double frequency = OUTPUT_RATE / 8.0;
+    std::vector<Sample> out = decimate(&decimator, tone(frequency));
+    CHECK(out.size() == SAMPLES / FACTOR);
+    CHECK_NEAR(amplitude(out), AMPLITUDE, AMPLITUDE * 0.01);
+    uint32_t misaligned = 0, flagged = 0;
+    for (size_t i = 0; i < out.size(); i++) {
+        double t = out[i].timestamp / 1e9;
+        double expected = AMPLITUDE * sin(2 * M_PI * frequency * t);
+        if (i >= out.size() / 4 && (fabs(out[i].accel[0] - expected) > AMPLITUDE * 0.02
+                || fabs(out[i].temperature - t * 1000) > 1
+                || out[i].gyro[1] != out[i].accel[0] || out[i].mag[2] != out[i].accel[0])) {
+            misaligned++;
+        }
+        flagged += (out[i].flags & SAMPLE_MAG) != 0;
+    }
+    CHECK(misaligned == 0);
+    // every input flag lands on the next output, and they are further
+    // apart than the factor
+    CHECK(flagged == (SAMPLES - 1) / 97 + 1);
+
+    // a tone that would fold into the passband is suppressed
+    decimator.reset();
+    CHECK(amplitude(decimate(&decimator, tone(OUTPUT_RATE - frequency))) < AMPLITUDE * aliasLimit);
+}
+
+void testDecimator() {
+    // 60 dB, plus rounding to counts
+    checkFilter(false, 0.0015);
+    checkFilter(true, 0.0015);
+
+    Decimator decimator;
+    CHECK(!decimator.configure(0, false));
+    CHECK(decimator.configure(1, false));
+    std::vector<Sample> in = tone(10);
+    CHECK(decimate(&decimator, in).size() == SAMPLES);
+}
@@ -0,0 +1,106 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "AHRSCore.h"
+
+#include "test.h"
+
+#define RATE 1000
+#define SECONDS 10
+#define DEG_TO_RAD (M_PI / 180.0)
+
+typedef Fixed<24> q24_t;
+
+static uint32_t sSeed = 1;
+
+static float noise(float amplitude) {
+    sSeed = sSeed * 1103515245 + 12345;
+    return ((sSeed >> 8) / 16777216.0f - 0.5f) * 2 * amplitude;
+}
+
+/**
+ * sensor readings of a board swaying in roll, pitch and yaw at time t
+ */
+static void sway(double t, float* gyro, float* accel, float* mag) {
+    double roll = 30 * DEG_TO_RAD * sin(0.7 * t), pitch = 15 * DEG_TO_RAD * sin(0.45 * t + 1);
+    double yaw = 90 * DEG_TO_RAD * sin(0.1 * t);
+    double rollRate = 30 * DEG_TO_RAD * 0.7 * cos(0.7 * t);
+    double pitchRate = 15 * DEG_TO_RAD * 0.45 * cos(0.45 * t + 1);
+    double yawRate = 90 * DEG_TO_RAD * 0.1 * cos(0.1 * t);
+    double cr = cos(roll), sr = sin(roll), cp = cos(pitch), sp = sin(pitch), cy = cos(yaw), sy = sin(yaw);
+    gyro[0] = (float)(rollRate - sp * yawRate) + noise(0.003f);
+    gyro[1] = (float)(cr * pitchRate + sr * cp * yawRate) + noise(0.003f);
+    gyro[2] = (float)(-sr * pitchRate + cr * cp * yawRate) + noise(0.003f);
+    // R^T e with R = Rz Ry Rx, gravity up and 48uT at 60 degrees inclination
+    double r[9] = { cy * cp, cy * sp * sr - sy * cr, cy * sp * cr + sy * sr,
+                    sy * cp, sy * sp * sr + cy * cr, sy * sp * cr - cy * sr,
+                    -sp, cp * sr, cp * cr };
+    const double field[3] = { 24.0, 0, -41.6 };
+    for (int i = 0; i < 3; i++) {
+        accel[i] = (float)r[6 + i] + noise(0.01f);
+        mag[i] = (float)(r[i] * field[0] + r[3 + i] * field[1] + r[6 + i] * field[2]) + noise(0.5f);
+    }
+}
+
+/**
+ * angle between two attitudes, degrees; from the vector part of
+ * conj(a) * b, which unlike acos of the dot product resolves tiny angles
+ */
+static double angleBetween(const float* a, const float* b) {
+    double w = (double)a[0] * b[0] + (double)a[1] * b[1] + (double)a[2] * b[2] + (double)a[3] * b[3];
+    double x = (double)a[0] * b[1] - (double)a[1] * b[0] - (double)a[2] * b[3] + (double)a[3] * b[2];
+    double y = (double)a[0] * b[2] + (double)a[1] * b[3] - (double)a[2] * b[0] - (double)a[3] * b[1];
+    double z = (double)a[0] * b[3] - (double)a[1] * b[2] + (double)a[2] * b[1] - (double)a[3] * b[0];
+    return 2 * atan2(sqrt(x * x + y * y + z * z), fabs(w)) / DEG_TO_RAD;
+}
+
+/**
+ * the float and the Q8.24 instantiations side by side on the same input,
+ * the way AHRS::update() feeds them
+ */
+static double compare(bool mahony) {
+    float qf[4] = { 1, 0, 0, 0 }, integralf[3] = { 0, 0, 0 };
+    q24_t qx[4] = { q24_t(1), q24_t(0), q24_t(0), q24_t(0) };
+    q24_t integralx[3];
+    float dt = 1.0f / RATE;
+    double worst = 0;
+    sSeed = 1;
+    for (int i = 0; i < RATE * SECONDS; i++) {
+        float gyro[3], accel[3], mag[3];
+        sway(i * (double)dt, gyro, accel, mag);
+        q24_t gyrox[3] = { q24_t(gyro[0]), q24_t(gyro[1]), q24_t(gyro[2]) };
+        q24_t accelx[3], magx[3];
+        toDirection(accel, accelx);
+        toDirection(mag, magx);
+        if (mahony) {
+            mahonyUpdate<float>(qf, integralf, gyro[0], gyro[1], gyro[2], accel, mag, 0.5f, 0.0f, dt);
+            mahonyUpdate<q24_t>(qx, integralx, gyrox[0], gyrox[1], gyrox[2], accelx, magx,
+                    q24_t(0.5f), q24_t(0.0f), q24_t(dt));
+        } else {
+            madgwickUpdate<float>(qf, gyro[0], gyro[1], gyro[2], accel, mag, 0.1f, dt);
+            madgwickUpdate<q24_t>(qx, gyrox[0], gyrox[1], gyrox[2], accelx, magx, q24_t(0.1f), q24_t(dt));
+        }
+        float q[4] = { qx[0].toFloat(), qx[1].toFloat(), qx[2].toFloat(), qx[3].toFloat() };
+        double apart = angleBetween(qf, q);
+        worst = apart > worst ? apart : worst;
+    }
+    // the fixed point quaternion stays normalized
+    double norm = 0;
+    for (int k = 0; k < 4; k++) {
+        norm += (double)qx[k].toFloat() * qx[k].toFloat();
+    }
+    CHECK_NEAR(norm, 1, 1e-5);
+    return worst;
+}
+
+void testFixedPoint() {
+    // the integer invSqrt over the range the filters feed it
+    for (float x = 1.0f / 64; x < 100; x *= 1.37f) {
+        CHECK_NEAR(invSqrt(q24_t(x)).toFloat() * sqrtf(x), 1, 1e-5);
+    }
+    CHECK(invSqrt(q24_t(0)).raw() == 0x7FFFFFFF);
+
+    // Q8.24 follows float within a fraction of the filters' own error
+    CHECK(compare(false) < 0.05);
+    CHECK(compare(true) < 0.05);
+}
@@ -0,0 +1,76 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "FlightRecorder.h"
+
+#include "test.h"
+
+#define CAPACITY 2000
+#define SAMPLES 3000
+
+/**
+ * overwrite the commit of the slot of sequence, as a write torn by a crash
+ * leaves it
+ */
+static void tear(const std::string& path, uint64_t sequence) {
+    int fd = open(path.c_str(), O_RDWR);
+    CHECK(fd >= 0);
+    uint64_t torn = sequence + 12345;
+    off_t offset = SAMPLE_LOG_HEADER_SIZE + (sequence % CAPACITY) * sizeof(FlightRecord)
+            + offsetof(FlightRecord, commit);
+    CHECK(pwrite(fd, &torn, sizeof(torn), offset) == sizeof(torn));
+    close(fd);
+}
+
+void testFlightRecorder() {
+    std::string path = scratchPath("box");
+    SampleLogHeader header;
+    memset(&header, 0, sizeof(header));
+    header.rate = 1000;
+
+    // wraps around the ring once and a half; the flags number the samples,
+    // sequence numbers start at 1
+    FlightRecorder recorder;
+    CHECK(recorder.open(path.c_str(), header, CAPACITY));
+    Sample batch[4];
+    memset(batch, 0, sizeof(batch));
+    for (uint32_t n = 0; n < SAMPLES; n += 4) {
+        for (uint32_t i = 0; i < 4; i++) {
+            batch[i].timestamp = 1000000000ULL + (uint64_t)(n + i) * 1000000;
+            batch[i].accel[0] = (int16_t)(n + i);
+            batch[i].flags = n + i;
+        }
+        CHECK(recorder.write(batch, 4));
+    }
+    recorder.close();
+
+    SampleLogHeader recovered;
+    std::vector<Sample> samples;
+    int error = 0;
+    CHECK(FlightRecorder::recover(path.c_str(), 0, &recovered, &samples, &error));
+    CHECK(recovered.capacity == CAPACITY);
+    CHECK(samples.size() == CAPACITY);
+    CHECK(samples.size() > 0 && samples.front().flags == SAMPLES - CAPACITY && samples.back().flags == SAMPLES - 1);
+
+    // the last second only
+    CHECK(FlightRecorder::recover(path.c_str(), 1.0, &recovered, &samples, &error));
+    CHECK(samples.size() == 1001);
+
+    // a torn newest slot is skipped and recovery ends at the one before;
+    // the oldest sample went with the slot it was overwriting
+    tear(path, SAMPLES);
+    CHECK(FlightRecorder::recover(path.c_str(), 0, &recovered, &samples, &error));
+    CHECK(samples.size() == CAPACITY - 1);
+    CHECK(samples.size() > 0 && samples.front().flags == SAMPLES - CAPACITY && samples.back().flags == SAMPLES - 2);
+
+    // a torn slot in the middle ends the walk back
+    tear(path, 2500);
+    CHECK(FlightRecorder::recover(path.c_str(), 0, &recovered, &samples, &error));
+    CHECK(samples.size() == SAMPLES - 1 - 2500);
+    CHECK(samples.size() > 0 && samples.front().flags == 2500);
+
+    CHECK(!FlightRecorder::recover(scratchPath("missing").c_str(), 0, &recovered, &samples, &error));
+}
@@ -0,0 +1,65 @@
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+#include "Heading.h"
+
+#include "test.h"
+
+#define SAMPLES 1000 // not a multiple of the batch block
+
+/**
+ * difference of two headings in degrees, across north
+ */
+static double headingError(double a, double b) {
+    double d = fmod(a - b + 540, 360) - 180;
+    return fabs(d);
+}
+
+void testHeading() {
+    // the board at roll, pitch and heading; the field has a horizontal
+    // part of 250 towards the heading and 400 down
+    std::vector<int16_t> accel(SAMPLES * 3);
+    std::vector<float> mag(SAMPLES * 3);
+    std::vector<double> expected(SAMPLES);
+    for (int i = 0; i < SAMPLES; i++) {
+        double roll = (i % 13 - 6) * 10 * M_PI / 180;
+        double pitch = (i % 11 - 5) * 12 * M_PI / 180;
+        double heading = fmod(i * 7.3, 360);
+        double sr = sin(roll), cr = cos(roll), sp = sin(pitch), cp = cos(pitch);
+        double level[3] = { 250 * cos(heading * M_PI / 180), 250 * sin(heading * M_PI / 180), 400 };
+        // board frame: the transpose of pitch after roll
+        double m[3][3] = { { cp, sp * sr, sp * cr },
+                           { 0, cr, -sr },
+                           { -sp, cp * sr, cp * cr } };
+        for (int axis = 0; axis < 3; axis++) {
+            accel[i * 3 + axis] = (int16_t)lrint(m[2][axis] * 16384);
+            mag[i * 3 + axis] = (float)(m[0][axis] * level[0] + m[1][axis] * level[1] + m[2][axis] * level[2]);
+        }
+        expected[i] = heading;
+    }
+
+    // the batch matches the scalar function, and both the heading the
+    // board was turned to
+    std::vector<float> batch(SAMPLES);
+    tiltCompensatedHeadings(accel.data(), mag.data(), SAMPLES, batch.data());
+    double worstScalar = 0, worstBatch = 0;
+    bool range = true;
+    for (int i = 0; i < SAMPLES; i++) {
+        float a[3] = { (float)accel[i * 3], (float)accel[i * 3 + 1], (float)accel[i * 3 + 2] };
+        float scalar = tiltCompensatedHeading(a, &mag[i * 3]);
+        worstScalar = fmax(worstScalar, headingError(scalar, expected[i]));
+        worstBatch = fmax(worstBatch, headingError(batch[i], scalar));
+        range = range && batch[i] >= 0 && batch[i] < 360 && scalar >= 0 && scalar < 360;
+    }
+    CHECK(worstScalar < 0.05);
+    CHECK(worstBatch < 0.01);
+    CHECK(range);
+
+    // a level board needs no compensation
+    float level[3] = { 0, 0, 16384 };
+    float field[3] = { 120, -300, 400 };
+    CHECK_NEAR(tiltCompensatedHeading(level, field), levelHeading(field[0], field[1]), 1e-3);
+    CHECK_NEAR(fastAtan2(1, -1), atan2(1, -1), 2e-5);
+    CHECK_NEAR(fastAtan2(-3, 0.5f), atan2(-3, 0.5), 2e-5);
+}
@@ -0,0 +1,110 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "HMC5883L.h"
+#include "MagCalibration.h"
+
+#include "test.h"
+
+#define SAMPLES 500
+#define RADIUS 400
+
+// hard iron offset and a soft iron distortion with some cross coupling
+static const float sOffset[3] = { 120, -80, 45 };
+static const float sSoft[9] = { 1.20f, 0.05f, 0.00f,
+                                0.05f, 0.90f, 0.03f,
+                                0.00f, 0.03f, 1.00f };
+
+/**
+ * reading i of SAMPLES, at directions spread evenly over the sphere as a
+ * full rotation of the board would give
+ */
+static void distorted(int i, int16_t* raw) {
+    float z = 1 - 2 * (i + 0.5f) / SAMPLES;
+    float r = sqrtf(1 - z * z);
+    float phi = i * (float)M_PI * (3 - sqrtf(5));
+    float field[3] = { r * cosf(phi) * RADIUS, r * sinf(phi) * RADIUS, z * RADIUS };
+    for (int axis = 0; axis < 3; axis++) {
+        const float* row = &sSoft[axis * 3];
+        raw[axis] = (int16_t)lrintf(row[0] * field[0] + row[1] * field[1] + row[2] * field[2] + sOffset[axis]);
+    }
+}
+
+void testMagCalibration() {
+    MagCalibration calibration;
+    MagCorrection correction;
+    calibration.addSample((int16_t)1, (int16_t)2, (int16_t)3);
+    CHECK(!calibration.solve(&correction));
+
+    calibration.reset();
+    for (int i = 0; i < SAMPLES; i++) {
+        int16_t raw[3];
+        distorted(i, raw);
+        calibration.addSample(raw[0], raw[1], raw[2]);
+    }
+    CHECK(calibration.getSampleCount() == SAMPLES);
+    CHECK(calibration.solve(&correction));
+    for (int axis = 0; axis < 3; axis++) {
+        CHECK_NEAR(correction.offset[axis], sOffset[axis], 1);
+    }
+
+    // the corrected readings lie on a sphere again
+    double sum = 0, sumSquares = 0;
+    for (int i = 0; i < SAMPLES; i++) {
+        int16_t raw[3];
+        float corrected[3];
+        distorted(i, raw);
+        correction.apply(raw[0], raw[1], raw[2], corrected);
+        double length = sqrt(corrected[0] * corrected[0] + corrected[1] * corrected[1]
+                + corrected[2] * corrected[2]);
+        sum += length;
+        sumSquares += length * length;
+    }
+    double mean = sum / SAMPLES;
+    double deviation = sqrt(sumSquares / SAMPLES - mean * mean);
+    CHECK(mean > 0);
+    CHECK(deviation < 0.01 * mean);
+}
+
+void testMagSelfTest() {
+    // at the default gain the bias coil induces 1.16, 1.16 and 1.08 Gauss,
+    // 1090 LSB/Gauss; the ambient field cancels out
+    const int16_t ambient[3] = { 200, -150, 400 };
+    const float induced[3] = { 1.16f * 1090, 1.16f * 1090 * 0.9f, 1.08f * 1090 * 1.2f };
+    int16_t pos[3], neg[3];
+    for (int axis = 0; axis < 3; axis++) {
+        pos[axis] = (int16_t)lrintf(ambient[axis] + induced[axis]);
+        neg[axis] = (int16_t)lrintf(ambient[axis] - induced[axis]);
+    }
+    float scale[3] = { 0, 0, 0 };
+    CHECK(MagCalibration::checkSelfTest(HMC5883L_GAIN_1090, pos, neg, scale) == MAG_SELF_TEST_PASSED);
+    CHECK_NEAR(scale[0], 1, 0.002);
+    CHECK_NEAR(scale[1], 1 / 0.9, 0.002);
+    CHECK_NEAR(scale[2], 1 / 1.2, 0.002);
+
+    // an overflowing axis asks for a lower gain, where the same field reads
+    // smaller and passes
+    int16_t saturated[3] = { pos[0], -4096, pos[2] };
+    float untouched[3] = { 5, 5, 5 };
+    CHECK(MagCalibration::checkSelfTest(HMC5883L_GAIN_1090, saturated, neg, untouched) == MAG_SELF_TEST_SATURATED);
+    CHECK(untouched[0] == 5 && untouched[1] == 5 && untouched[2] == 5);
+
+    // outside the limits fails outright rather than trying another gain,
+    // and leaves scale alone
+    int16_t weak[3] = { pos[0], (int16_t)(ambient[1] + 0.3f * 1.16f * 1090), pos[2] };
+    int16_t weakNeg[3] = { neg[0], (int16_t)(ambient[1] - 0.3f * 1.16f * 1090), neg[2] };
+    CHECK(MagCalibration::checkSelfTest(HMC5883L_GAIN_1090, weak, weakNeg, untouched) == MAG_SELF_TEST_FAILED);
+    CHECK(untouched[0] == 5 && untouched[1] == 5 && untouched[2] == 5);
+    int16_t strong[3] = { (int16_t)(ambient[0] + 1.6f * 1.16f * 1090), pos[1], pos[2] };
+    int16_t strongNeg[3] = { (int16_t)(ambient[0] - 1.6f * 1.16f * 1090), neg[1], neg[2] };
+    CHECK(MagCalibration::checkSelfTest(HMC5883L_GAIN_1090, strong, strongNeg, untouched) == MAG_SELF_TEST_FAILED);
+
+    // the limits follow the gain
+    for (int axis = 0; axis < 3; axis++) {
+        pos[axis] = (int16_t)lrintf(ambient[axis] + induced[axis] * 390 / 1090);
+        neg[axis] = (int16_t)lrintf(ambient[axis] - induced[axis] * 390 / 1090);
+    }
+    CHECK(MagCalibration::checkSelfTest(HMC5883L_GAIN_1090, pos, neg, scale) == MAG_SELF_TEST_FAILED);
+    CHECK(MagCalibration::checkSelfTest(HMC5883L_GAIN_390, pos, neg, scale) == MAG_SELF_TEST_PASSED);
+    CHECK_NEAR(scale[1], 1 / 0.9, 0.005);
+}
@@ -0,0 +1,63 @@
+#include <string.h>
+
+#include "MagneticModel.h"
+
+#include "test.h"
+
+// WMM2025 at the points and dates of the report's test values: sea level at
+// the epoch and 100 km half way through; computed from the coefficients as
+// compiled in, which agree with WMM2020 carried forward to 2025.0 within
+// 0.2 degree
+static const struct {
+    double latitude, longitude, altitude, year;
+    double x, y, z;     // nT
+    double declination, inclination;
+} sTestValues[] = {
+    {  80,   0,   0, 2025.0,  6521.6,   145.9,  54791.5,  1.28,  83.21 },
+    {   0, 120,   0, 2025.0, 39677.8,  -109.6, -10580.2, -0.16, -14.93 },
+    { -80, 240,   0, 2025.0,  6117.5, 15751.9, -52022.5, 68.78, -72.00 },
+    {  80,   0, 100, 2027.5,  6196.7,   233.8,  52670.5,  2.16,  83.29 },
+    {   0, 120, 100, 2027.5, 37711.5,  -148.7,  -9969.8, -0.23, -14.81 },
+    { -80, 240, 100, 2027.5,  5984.0, 14760.1, -49317.7, 67.93, -72.10 },
+};
+
+void testMagneticModel() {
+    CHECK(MagneticModel::getEpoch() == 2025.0);
+    for (size_t i = 0; i < sizeof(sTestValues) / sizeof(sTestValues[0]); i++) {
+        MagneticField field;
+        CHECK(MagneticModel::evaluate(sTestValues[i].latitude, sTestValues[i].longitude,
+                sTestValues[i].altitude, sTestValues[i].year, &field));
+        CHECK_NEAR(field.x, sTestValues[i].x, 0.1);
+        CHECK_NEAR(field.y, sTestValues[i].y, 0.1);
+        CHECK_NEAR(field.z, sTestValues[i].z, 0.1);
+        CHECK_NEAR(field.declination, sTestValues[i].declination, 0.01);
+        CHECK_NEAR(field.inclination, sTestValues[i].inclination, 0.01);
+    }
+
+    // dates outside the model are refused, not extrapolated
+    CHECK(!MagneticModel::isValidDate(2024.99));
+    CHECK(MagneticModel::isValidDate(2025.0));
+    CHECK(MagneticModel::isValidDate(2029.99));
+    CHECK(!MagneticModel::isValidDate(2030.0));
+    MagneticField untouched;
+    memset(&untouched, 0, sizeof(untouched));
+    CHECK(!MagneticModel::evaluate(80, 0, 0, 2031.0, &untouched));
+    CHECK(untouched.x == 0 && untouched.declination == 0);
+
+    // the grid interpolates the model closely near its origin
+    DeclinationGrid grid;
+    CHECK(!grid.setOrigin(25, 121.5, 0, 2020));
+    CHECK(!grid.isValid());
+    CHECK(grid.setOrigin(25, 121.5, 0, 2026.5));
+    float declination, inclination;
+    grid.lookup(25.1, 121.6, &declination, &inclination);
+    MagneticField field;
+    MagneticModel::evaluate(25.1, 121.6, 0, 2026.5, &field);
+    CHECK_NEAR(declination, field.declination, 0.01);
+    CHECK_NEAR(inclination, field.inclination, 0.01);
+
+    // and keeps its origin when a new one is refused
+    CHECK(!grid.setOrigin(-33, 151, 0, 2035));
+    grid.lookup(25.1, 121.6, &declination, &inclination);
+    CHECK_NEAR(declination, field.declination, 0.01);
+}
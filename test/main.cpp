@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "test.h"
+
+int gFailures = 0;
+
+static char sScratch[] = "/tmp/gy86test-XXXXXX";
+
+std::string scratchPath(const char* name) {
+    return std::string(sScratch) + "/" + name;
+}
+
+static void removeScratch() {
+    DIR* dir = opendir(sScratch);
+    if (!dir) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+            unlink(scratchPath(entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+    rmdir(sScratch);
+}
+
+static void run(const char* name, void (*test)()) {
+    int before = gFailures;
+    test();
+    printf("%-20s %s\n", name, gFailures == before ? "ok" : "FAILED");
+}
+
+int main(int argc, char** argv) {
+    if (!mkdtemp(sScratch)) {
+        perror(sScratch);
+        return 1;
+    }
+    run("replay fusion", testReplayFusion);
+    run("mag calibration", testMagCalibration);
+    run("mag self-test", testMagSelfTest);
+    run("heading", testHeading);
+    run("magnetic model", testMagneticModel);
+    run("mpu calibration", testMPU6050Calibration);
+    run("units", testUnits);
+    run("fixed point", testFixedPoint);
+    run("packed log", testPackedLog);
+    run("flight recorder", testFlightRecorder);
+    run("triggered capture", testTriggeredCapture);
+    run("decimator", testDecimator);
+    run("biquad bank", testBiquadBank);
+    run("spectrum", testSpectrum);
+    removeScratch();
+    if (gFailures) {
+        printf("%d checks failed\n", gFailures);
+        return 1;
+    }
+    return 0;
+}
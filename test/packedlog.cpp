@@ -0,0 +1,152 @@
+#include <math.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "PackedLog.h"
+#include "SampleLog.h"
+
+#include "test.h"
+
+#define SAMPLES 3000
+
+/**
+ * a second of 1 kHz vibration with noise, a dropped sample, slowly moving
+ * mag and baro and the odd detector flag
+ */
+static void synthesize(std::vector<Sample>* samples) {
+    uint32_t seed = 1;
+    samples->resize(SAMPLES);
+    uint64_t timestamp = 1000000000ULL;
+    for (uint32_t i = 0; i < SAMPLES; i++) {
+        Sample& s = (*samples)[i];
+        memset(&s, 0, sizeof(s));
+        timestamp += i == 1500 ? 2000000 : 1000000 + (i % 7) * 1000;
+        s.timestamp = timestamp;
+        for (int axis = 0; axis < 3; axis++) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (int)((seed >> 16) % 41) - 20;
+            s.accel[axis] = (int16_t)(300 * sin(i * 0.7 + axis) + noise + (axis == 2 ? 16384 : 0));
+            s.gyro[axis] = (int16_t)(150 * sin(i * 0.3 + axis) - noise);
+            s.mag[axis] = (int16_t)(200 + axis * 50 + i / 100);
+        }
+        s.temperature = (int16_t)(-2000 + i / 300);
+        s.pressure = 8500000 + i / 10;
+        s.baroTemperature = 8300000 + i / 50;
+        s.flags = (i % 10 == 0 ? SAMPLE_MAG : 0) | (i % 25 == 0 ? SAMPLE_BARO : 0) | (i == 1500 ? SAMPLE_GAP : 0);
+    }
+}
+
+/**
+ * a second of a motor-mounted board: 1000 to 2000 counts of vibration at
+ * two frequencies on every accel and gyro axis, plus noise
+ */
+static void vibrate(std::vector<Sample>* samples) {
+    uint32_t seed = 3;
+    samples->resize(PACKED_LOG_BLOCK_SAMPLES);
+    for (uint32_t i = 0; i < PACKED_LOG_BLOCK_SAMPLES; i++) {
+        Sample& s = (*samples)[i];
+        memset(&s, 0, sizeof(s));
+        s.timestamp = 1000000000ULL + (i + 1) * 1000000ULL;
+        for (int axis = 0; axis < 3; axis++) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (int)((seed >> 16) % 81) - 40;
+            double amplitude = 1000 + 500 * axis;
+            double vibration = amplitude * sin(i * 2 * M_PI * 0.19 + axis)
+                    + amplitude / 3 * sin(i * 2 * M_PI * 0.047 + 2 * axis);
+            s.accel[axis] = (int16_t)(vibration + noise + (axis == 2 ? 16384 : 0));
+            s.gyro[axis] = (int16_t)(vibration * 0.8 - noise);
+            s.mag[axis] = (int16_t)(200 + axis * 50);
+        }
+        s.temperature = -2000;
+        s.pressure = 8500000;
+        s.baroTemperature = 8300000;
+        s.flags = i % 10 == 0 ? SAMPLE_MAG : 0;
+    }
+}
+
+/**
+ * size of a packed block of samples, or 0 if it does not decode back to them
+ */
+static size_t packed(const std::vector<Sample>& samples) {
+    std::vector<uint8_t> block(packedBlockBound(PACKED_LOG_BLOCK_SAMPLES));
+    size_t size = packBlock(samples.data(), PACKED_LOG_BLOCK_SAMPLES, samples[0].timestamp, block.data());
+    std::vector<Sample> decoded(PACKED_LOG_BLOCK_SAMPLES);
+    if (!unpackBlock(block.data(), size, PACKED_LOG_BLOCK_SAMPLES, samples[0].timestamp, decoded.data())
+            || memcmp(decoded.data(), samples.data(), PACKED_LOG_BLOCK_SAMPLES * sizeof(Sample))) {
+        return 0;
+    }
+    return size;
+}
+
+void testPackedLog() {
+    std::vector<Sample> samples;
+    synthesize(&samples);
+
+    // a block decodes back to the same samples
+    std::vector<uint8_t> block(packedBlockBound(PACKED_LOG_BLOCK_SAMPLES));
+    size_t size = packBlock(samples.data(), PACKED_LOG_BLOCK_SAMPLES, samples[0].timestamp, block.data());
+    std::vector<Sample> decoded(PACKED_LOG_BLOCK_SAMPLES);
+    CHECK(unpackBlock(block.data(), size, PACKED_LOG_BLOCK_SAMPLES, samples[0].timestamp, decoded.data()));
+    CHECK(memcmp(decoded.data(), samples.data(), PACKED_LOG_BLOCK_SAMPLES * sizeof(Sample)) == 0);
+    CHECK(!unpackBlock(block.data(), size / 2, PACKED_LOG_BLOCK_SAMPLES, samples[0].timestamp, decoded.data()));
+
+    // at least three times smaller, on this and on heavy vibration
+    CHECK(size > 0 && size * 3 <= PACKED_LOG_BLOCK_SAMPLES * sizeof(Sample));
+    std::vector<Sample> vibration;
+    vibrate(&vibration);
+    size_t vibrationSize = packed(vibration);
+    CHECK(vibrationSize > 0 && vibrationSize * 3 <= PACKED_LOG_BLOCK_SAMPLES * sizeof(Sample));
+
+    // a whole recording reads back through the index
+    std::string path = scratchPath("packed.log");
+    SampleLogHeader header;
+    memset(&header, 0, sizeof(header));
+    header.rate = 1000;
+    header.sensors = SENSOR_ALL;
+    PackedLog log;
+    CHECK(log.open(path.c_str(), header, 1 << 20));
+    for (uint32_t i = 0; i < SAMPLES; i += 10) {
+        CHECK(log.write(&samples[i], 10));
+    }
+    log.close();
+    CHECK(log.getError() == 0);
+    {
+        SampleLogReader reader;
+        CHECK(reader.open(path.c_str()));
+        CHECK(reader.isPacked());
+        CHECK(reader.getCount() == SAMPLES);
+        uint32_t mismatches = 0;
+        for (uint64_t i = 0; i < reader.getCount() && i < SAMPLES; i++) {
+            const Sample* s = reader.at(i);
+            if (!s || memcmp(s, &samples[i], sizeof(Sample))) {
+                mismatches++;
+            }
+        }
+        CHECK(mismatches == 0);
+        CHECK(reader.find(samples[2000].timestamp) == 2000);
+    }
+
+    // cut short by a crash: no index, the last block torn; the complete
+    // blocks are found by walking their headers
+    uint32_t blocks = (SAMPLES + PACKED_LOG_BLOCK_SAMPLES - 1) / PACKED_LOG_BLOCK_SAMPLES;
+    struct stat st;
+    CHECK(stat(path.c_str(), &st) == 0);
+    off_t cut = st.st_size - blocks * sizeof(PackedIndexEntry) - sizeof(PackedLogTrailer) - 100;
+    CHECK(truncate(path.c_str(), cut) == 0);
+    {
+        SampleLogReader reader;
+        CHECK(reader.open(path.c_str()));
+        uint64_t complete = (uint64_t)(blocks - 1) * PACKED_LOG_BLOCK_SAMPLES;
+        CHECK(reader.getCount() == complete);
+        uint32_t mismatches = 0;
+        for (uint64_t i = 0; i < reader.getCount() && i < SAMPLES; i++) {
+            const Sample* s = reader.at(i);
+            if (!s || memcmp(s, &samples[i], sizeof(Sample))) {
+                mismatches++;
+            }
+        }
+        CHECK(mismatches == 0);
+    }
+}
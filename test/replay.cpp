@@ -0,0 +1,136 @@
+#include <math.h>
+#include <mutex>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "AHRS.h"
+#include "Acquisition.h"
+#include "EKF.h"
+#include "HMC5883L.h"
+#include "MPU6050.h"
+#include "MS5611.h"
+#include "ReplayTransport.h"
+#include "SampleLog.h"
+
+#include "test.h"
+
+#define RATE 1000
+#define SECONDS 10
+#define ROLL 20.0
+#define PITCH -10.0
+#define GYRO_SCALE (1 / 131.0f * (float)M_PI / 180)
+#define ACCEL_SCALE (1 / 16384.0f)
+
+// bias of the gyro at rest, counts
+static const int16_t sBias[3] = { 66, -40, 0 };
+
+/**
+ * runs the replayed samples through AHRS and EKF the way the addon does
+ */
+class Fusion : public AcquisitionListener {
+    public:
+        Fusion() : count(0) {}
+        void onSamples(const Sample* samples, uint32_t n) {
+            float period = 1.0f / RATE;
+            for (uint32_t i = 0; i < n; i++) {
+                float gyro[3], accel[3], g[3];
+                for (int axis = 0; axis < 3; axis++) {
+                    gyro[axis] = samples[i].gyro[axis] * GYRO_SCALE;
+                    accel[axis] = samples[i].accel[axis];
+                    g[axis] = samples[i].accel[axis] * ACCEL_SCALE;
+                }
+                ahrs.update(gyro, accel, NULL, period);
+                ekf.updateGyro(gyro, period);
+                ekf.updateAccel(g);
+            }
+            count += n;
+        }
+        AHRS ahrs;
+        EKF ekf;
+        uint64_t count;
+};
+
+/**
+ * a board held still at ROLL and PITCH, with a gyro bias and noise
+ */
+static void record(const std::string& path) {
+    MS5611 ms("sim", 0x77);
+    ms.begin();
+    SampleLogHeader header;
+    memset(&header, 0, sizeof(header));
+    header.rate = RATE;
+    header.sensors = SENSOR_ACCEL | SENSOR_GYRO;
+    header.mpuAddress = 0x68;
+    header.startMonotonic = 1000000000ULL;
+    ms.getCoefficients(header.baroCoefficients);
+
+    double roll = ROLL * M_PI / 180, pitch = PITCH * M_PI / 180;
+    double gravity[3] = { -sin(pitch), sin(roll) * cos(pitch), cos(roll) * cos(pitch) };
+    SampleLog log;
+    CHECK(log.open(path.c_str(), header, 4096));
+    uint32_t seed = 7;
+    for (uint32_t i = 0; i < RATE * SECONDS; i++) {
+        Sample s;
+        memset(&s, 0, sizeof(s));
+        // the first sample arrives a period after the acquisition started
+        s.timestamp = header.startMonotonic + (uint64_t)(i + 1) * 1000000000ULL / RATE;
+        for (int axis = 0; axis < 3; axis++) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (int)((seed >> 16) % 81) - 40;
+            s.accel[axis] = (int16_t)lrint(gravity[axis] * 16384 + noise);
+            s.gyro[axis] = (int16_t)(sBias[axis] + noise / 8);
+        }
+        CHECK(log.write(&s, 1));
+    }
+    log.close();
+}
+
+void testReplayFusion() {
+    std::mutex bus;
+    std::string path = scratchPath("still.log");
+    record(path);
+
+    ReplayTransport replay;
+    CHECK(replay.open(path.c_str(), 0));
+    I2CTransport::registerBus("replay", &replay);
+    Fusion fusion;
+    {
+        MPU6050 mpu("replay", 0x68);
+        mpu.initialize();
+        mpu.setI2CBypassEnabled(true);
+        HMC5883L hmc("replay", 0x1E);
+        hmc.initialize();
+        MS5611 ms("replay", 0x77);
+        ms.begin();
+        Acquisition acquisition(&bus, &mpu, &hmc, &ms);
+        acquisition.setListener(&fusion);
+        acquisition.setClock(&replay);
+        acquisition.start(RATE, SENSOR_ACCEL | SENSOR_GYRO);
+        while (!replay.isFinished()) {
+            usleep(1000);
+        }
+        acquisition.stop();
+    }
+    I2CTransport::unregisterBus("replay");
+
+    // every recorded sample comes through
+    CHECK(fusion.count == (uint64_t)RATE * SECONDS);
+
+    // both filters find the tilt despite the gyro bias
+    float euler[3];
+    fusion.ahrs.getEuler(euler);
+    CHECK_NEAR(euler[0], ROLL, 1);
+    CHECK_NEAR(euler[1], PITCH, 1);
+    float q[4];
+    fusion.ekf.getQuaternion(q);
+    AHRS::eulerFromQuaternion(q, euler);
+    CHECK_NEAR(euler[0], ROLL, 1);
+    CHECK_NEAR(euler[1], PITCH, 1);
+
+    // and the EKF learns the bias of the axes gravity makes observable
+    float bias[3];
+    fusion.ekf.getGyroBias(bias);
+    CHECK_NEAR(bias[0], sBias[0] * GYRO_SCALE, 0.2 * fabs(sBias[0] * GYRO_SCALE));
+    CHECK_NEAR(bias[1], sBias[1] * GYRO_SCALE, 0.2 * fabs(sBias[1] * GYRO_SCALE));
+}
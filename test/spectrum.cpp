@@ -0,0 +1,65 @@
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "Spectrum.h"
+
+#include "test.h"
+
+#define RATE 1000
+#define SAMPLES 5000
+
+void testSpectrum() {
+    SpectrumSettings settings;
+    settings.size = 256;
+    settings.hop = 128;
+    settings.interval = 1000000000ULL;
+    settings.peaks = 2;
+    settings.bands.push_back(70);
+    settings.bands.push_back(90);
+    settings.bands.push_back(150);
+    settings.bands.push_back(250);
+    SpectrumAnalyzer analyzer(settings);
+
+    // accel x: 500 counts at 80.3 Hz, between bins, and 100 at 211 Hz;
+    // gyro y: 50 at 33 Hz; accel z: gravity only
+    std::vector<Sample> samples(SAMPLES);
+    for (int i = 0; i < SAMPLES; i++) {
+        double t = (double)i / RATE;
+        memset(&samples[i], 0, sizeof(Sample));
+        samples[i].timestamp = (uint64_t)(i + 1) * 1000000;
+        samples[i].accel[0] = (int16_t)lrint(500 * sin(2 * M_PI * 80.3 * t) + 100 * sin(2 * M_PI * 211 * t));
+        samples[i].accel[2] = 16384;
+        samples[i].gyro[1] = (int16_t)lrint(50 * sin(2 * M_PI * 33 * t));
+    }
+    for (int i = 0; i < SAMPLES; i += 10) {
+        analyzer.write(&samples[i], 10, RATE);
+    }
+
+    SpectrumResult result;
+    int results = 0;
+    while (analyzer.take(&result)) {
+        results++;
+        CHECK(result.rate == RATE);
+        CHECK(result.bins == 129);
+        CHECK(result.frames > 0);
+
+        // accel x: peaks strongest first
+        const float* peaks = &result.peaks[0];
+        CHECK_NEAR(peaks[0], 80.3, 0.5);
+        CHECK_NEAR(peaks[1], 500, 10);
+        CHECK_NEAR(peaks[2], 211, 0.5);
+        CHECK_NEAR(peaks[3], 100, 5);
+
+        // RMS of a sine is its amplitude over sqrt(2)
+        CHECK_NEAR(result.bands[0], 500 / sqrt(2), 10);
+        CHECK_NEAR(result.bands[1], 100 / sqrt(2), 5);
+
+        // accel z holds no vibration, gyro y its 33 Hz
+        CHECK(result.bands[2 * 2] < 1 && result.bands[2 * 2 + 1] < 1);
+        CHECK_NEAR(result.peaks[4 * 4], 33, 0.5);
+        CHECK_NEAR(result.peaks[4 * 4 + 1], 50, 2);
+    }
+    CHECK(results == 4);
+    CHECK(analyzer.getMissed() == 0);
+}
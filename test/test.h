@@ -0,0 +1,56 @@
+// Behavior tests
+//
+// Checks of the library against known answers, without a board. Each
+// test*() function is one module; CHECK and CHECK_NEAR report a failure
+// with its location and carry on, and main() fails if any did.
+//
+//     build/Release/gy86test
+
+#ifndef _GY86_TEST_H_
+#define _GY86_TEST_H_
+
+#include <math.h>
+#include <stdio.h>
+#include <string>
+
+extern int gFailures;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            gFailures++; \
+        } \
+    } while (0)
+
+#define CHECK_NEAR(actual, expected, tolerance) \
+    do { \
+        double a_ = (actual), e_ = (expected); \
+        if (!(fabs(a_ - e_) <= (tolerance))) { \
+            fprintf(stderr, "%s:%d: %s is %g, expected %g within %g\n", __FILE__, __LINE__, \
+                    #actual, a_, e_, (double)(tolerance)); \
+            gFailures++; \
+        } \
+    } while (0)
+
+/**
+ * path of a file in the scratch directory of this run
+ */
+std::string scratchPath(const char* name);
+
+void testReplayFusion();
+void testMagCalibration();
+void testMagSelfTest();
+void testHeading();
+void testMagneticModel();
+void testMPU6050Calibration();
+void testUnits();
+void testFixedPoint();
+void testPackedLog();
+void testFlightRecorder();
+void testTriggeredCapture();
+void testDecimator();
+void testBiquadBank();
+void testSpectrum();
+
+#endif /* _GY86_TEST_H_ */
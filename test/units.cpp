@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "Acquisition.h"
+#include "MagCalibration.h"
+#include "Units.h"
+
+#include "test.h"
+
+// not a multiple of the conversion block
+#define COUNT 100
+
+static const float sAccelLSB[] = { 16384, 8192, 4096, 2048 };
+static const float sGyroLSB[] = { 131, 65.5f, 32.8f, 16.4f };
+
+void testUnits() {
+    Sample samples[COUNT];
+    memset(samples, 0, sizeof(samples));
+    for (int i = 0; i < COUNT; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            // full scale sweep, both signs
+            samples[i].accel[axis] = (int16_t)((i * 331 + axis * 1013) % 65536 - 32768);
+            samples[i].gyro[axis] = (int16_t)(32767 - (i * 659 + axis * 97) % 65536);
+            samples[i].mag[axis] = (int16_t)(i * 20 - 1000 + axis);
+        }
+        samples[i].temperature = (int16_t)(-3920 + i);
+    }
+
+    UnitScales units;
+    // power-on settings
+    CHECK_NEAR(units.getAccelScale(), 1 / 16384.0, 1e-12);
+    CHECK_NEAR(units.getGyroScale(), 1 / 131.0, 1e-9);
+    CHECK_NEAR(units.getMagScale(), 0.092, 1e-7);
+
+    float frame[9] = { 16384, -8192, 0, 131, -262, 0, 1000, -1000, 0 };
+    units.toUnits(frame, 9);
+    CHECK_NEAR(frame[0], 1, 1e-6);
+    CHECK_NEAR(frame[1], -0.5, 1e-6);
+    CHECK_NEAR(frame[3], 1, 1e-6);
+    CHECK_NEAR(frame[4], -2, 1e-6);
+    CHECK_NEAR(frame[6], 92, 1e-4);
+    CHECK_NEAR(frame[7], -92, 1e-4);
+
+    static float accel[COUNT * 3], gyro[COUNT * 3], mag[COUNT * 3], temperature[COUNT];
+    static q16_t accelQ[COUNT * 3], gyroQ[COUNT * 3];
+    for (uint8_t range = 0; range < 4; range++) {
+        units.setAccelRange(range);
+        units.setGyroRange(range);
+        CHECK(units.getAccelRange() == range && units.getGyroRange() == range);
+        units.accel(samples, COUNT, accel);
+        units.gyro(samples, COUNT, gyro);
+        units.accel(samples, COUNT, accelQ);
+        units.gyro(samples, COUNT, gyroQ);
+        int failures = gFailures;
+        for (int i = 0; i < COUNT && gFailures == failures; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                double a = samples[i].accel[axis] / sAccelLSB[range];
+                double g = samples[i].gyro[axis] / sGyroLSB[range];
+                CHECK_NEAR(accel[i * 3 + axis], a, 1e-6 * fabs(a) + 1e-9);
+                CHECK_NEAR(gyro[i * 3 + axis], g, 1e-6 * fabs(g) + 1e-9);
+                // the accel scales are powers of two and exact in Q16.16
+                CHECK(accelQ[i * 3 + axis].raw() == (int32_t)lrint(a * 65536));
+                // the gyro scales round to 16 fractional bits, within 0.1%
+                CHECK_NEAR(gyroQ[i * 3 + axis].toFloat(), g, 1e-3 * fabs(g) + 1e-9);
+            }
+        }
+    }
+
+    units.setMagGain(5);
+    CHECK(units.getMagGain() == 5);
+    MagCorrection correction;
+    correction.offset[0] = 100;
+    units.mag(samples, COUNT, correction, mag);
+    for (int i = 0; i < COUNT; i += 33) {
+        CHECK_NEAR(mag[i * 3], (samples[i].mag[0] - 100) * 0.256, 1e-3);
+        CHECK_NEAR(mag[i * 3 + 1], samples[i].mag[1] * 0.256, 1e-3);
+    }
+
+    UnitScales::temperature(samples, COUNT, temperature);
+    CHECK_NEAR(temperature[0], -3920 / 340.0 + 36.53, 1e-4);
+    CHECK_NEAR(temperature[COUNT - 1], UnitScales::temperature(samples[COUNT - 1].temperature), 1e-6);
+    CHECK_NEAR(UnitScales::temperature((int16_t)((25 - 36.53) * 340)), 25, 0.01);
+}
@@ -0,0 +1,62 @@
+// Flight recorder decoder: prints the last seconds of a ring file written
+// by .startFlightRecorder() as CSV, or converts them to a sample log that
+// new RPiGY86({ replay }) can replay. Works on the file as the crash left
+// it, also on the path.prev copy kept by the next start.
+//
+//     build/Release/blackbox ring [seconds [out.log]]
+//
+// seconds defaults to everything still in the ring.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "FlightRecorder.h"
+#include "SampleLog.h"
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "usage: %s ring [seconds [out.log]]\n", argv[0]);
+        return 2;
+    }
+    double seconds = argc > 2 ? atof(argv[2]) : 0;
+    SampleLogHeader header;
+    std::vector<Sample> samples;
+    int error = 0;
+    if (!FlightRecorder::recover(argv[1], seconds, &header, &samples, &error)) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(error));
+        return 1;
+    }
+    if (samples.empty()) {
+        fprintf(stderr, "%s: no samples\n", argv[1]);
+        return 1;
+    }
+
+    if (argc == 4) {
+        SampleLog log;
+        uint32_t count = (uint32_t)samples.size();
+        header.startMonotonic = samples[0].timestamp;
+        if (!log.open(argv[3], header, count) || !log.write(samples.data(), count)) {
+            fprintf(stderr, "%s: %s\n", argv[3], strerror(log.getError()));
+            return 1;
+        }
+        log.close();
+        fprintf(stderr, "%u samples, %.3f s\n", count,
+                (samples.back().timestamp - samples[0].timestamp) * 1e-9);
+        return 0;
+    }
+
+    // raw counts; the header line has what it takes to convert them
+    printf("# rate %u, accel %g g/LSB, gyro %g deg/s/LSB, mag %g uT/LSB, sensors 0x%x\n",
+            header.rate, header.accelScale, header.gyroScale, header.magScale, header.sensors);
+    printf("time,ax,ay,az,temperature,gx,gy,gz,mx,my,mz,pressure,baroTemperature,flags\n");
+    uint64_t end = samples.back().timestamp;
+    for (size_t i = 0; i < samples.size(); i++) {
+        const Sample& s = samples[i];
+        printf("%.6f,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%u,%u,%u\n", -(double)(end - s.timestamp) * 1e-9,
+                s.accel[0], s.accel[1], s.accel[2], s.temperature, s.gyro[0], s.gyro[1], s.gyro[2],
+                s.mag[0], s.mag[1], s.mag[2], s.pressure, s.baroTemperature, s.flags);
+    }
+    return 0;
+}